@@ -7,6 +7,10 @@
 #pragma once
 
 #include <vector>
+#include <unordered_map>
+#include <set>
+#include <deque>
+#include <list>
 
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
@@ -20,29 +24,302 @@
 #define NOMINMAX
 #include "wn_common.h"
 #include "wn_gltf.h"
+#include "wn_geometry.h"
+#include "wn_job.h"
+
+/// @note(ame): TILED NAVMESH
+/// The level is cut into square tiles of `tile_size` cells. Every tile is rasterized, partitioned and turned into a Detour tile
+/// on its own, so they all build in parallel on the job system. The tiles of a level are cached as a single .wnn keyed by the
+/// level's content hash and the build settings: header | entries | tile blobs, 16 byte aligned. Loading it is one map.
+#define WNN_MAGIC 0x314E4E57 /// @note(ame): "WNN1"
+#define WNN_VERSION 2
+#define WNN_ALIGNMENT 16
+
+enum navmesh_poly_flags
+{
+    NavmeshPoly_Walk = 1 << 0
+};
+
+struct navmesh_settings
+{
+    f32 cell_size;
+    f32 cell_height;
+    f32 agent_height;
+    f32 agent_radius;
+    f32 agent_max_climb;
+    f32 agent_max_slope; /// @note(ame): degrees
+    u32 tile_size; /// @note(ame): in cells, border not included
+};
+
+/// @note(ame): DYNAMIC OBSTACLES
+/// Every tile keeps its compact heightfield from the bake, as it was right before erosion, LZ4 compressed. An obstacle that
+/// moves dirties the tiles it overlaps, and a background job rebuilds them from their heightfield with every obstacle carved
+/// out -- no rasterization -- until it runs out of navmesh_rebuild_budget_ms. The main thread swaps the new tiles in.
+struct navmesh_heightfield
+{
+    u64 size = 0; /// @note(ame): uncompressed
+    bool compressed = false;
+    std::vector<u8> bytes; /// @note(ame): empty for tiles without polygons, obstacles can't add any
+};
+
+struct navmesh_obstacle
+{
+    glm::vec3 min;
+    glm::vec3 max;
+};
+
+struct navmesh_tile_data
+{
+    i32 x;
+    i32 z;
+    u8 *data = nullptr; /// @note(ame): dtAlloc'd, the navmesh takes ownership once the tile is added
+    i32 size = 0;
+    navmesh_heightfield heightfield;
+};
+
+/// @note(ame): one round of rebuilds. The job only reads the navmesh settings and heightfields, and its own copy of the obstacles.
+struct navmesh_rebuild
+{
+    job_counter counter;
+    std::vector<u32> tiles;
+    std::vector<navmesh_obstacle> obstacles;
+
+    std::vector<navmesh_tile_data> built;
+    std::vector<u32> leftover; /// @note(ame): out of budget, back in the dirty set for the next round
+    f32 ms;
+};
+
+struct navmesh_rebuild_stats
+{
+    u64 rounds;
+    u64 tiles;
+    f32 last_ms;
+    f32 worst_ms;
+};
+
+struct navmesh_crowd_stats
+{
+    u64 updates;
+    f32 last_ms; /// @note(ame): for every step of the last crowd_update_async
+    f32 worst_ms;
+};
+
+struct pathfinder;
 
 struct navmesh
 {
-    rcConfig config;
-    rcHeightfield* height_field;
-    rcCompactHeightfield* compact_height_field;
-    rcContourSet* contour_set;
-    rcPolyMesh* poly_mesh;
-    rcPolyMeshDetail* poly_mesh_detail;
+    navmesh_settings settings;
+    rcConfig config; /// @note(ame): the config of a single tile, border included
+    dtNavMeshParams params;
 
-    dtNavMesh* mesh;
-    dtNavMeshQuery* query;
-    dtCrowd* agent_manager;
+    dtNavMesh* mesh = nullptr;
+    dtNavMeshQuery* query = nullptr;
+    dtCrowd* agent_manager = nullptr;
+
+    u32 tiles_x;
+    u32 tiles_z;
+    u32 tile_count; /// @note(ame): tiles with polygons in them, empty ones are never added
+    u32 poly_count;
+
+    /// @note(ame): dynamic obstacles, main thread only
+    std::vector<navmesh_heightfield> heightfields; /// @note(ame): x + z * tiles_x
+    std::unordered_map<u32, navmesh_obstacle> obstacles;
+    u32 next_obstacle = 1;
+    std::set<u32> dirty_tiles;
+    navmesh_rebuild *rebuild = nullptr;
+    navmesh_rebuild_stats rebuild_stats = {};
+    u64 revision = 0; /// @note(ame): bumped every time tiles get swapped
+
+    /// @note(ame): crowd, see below
+    job_counter *crowd_job = nullptr;
+    navmesh_crowd_stats crowd_stats = {};
+
+    /// @note(ame): pathfinding, see below
+    pathfinder *paths = nullptr;
 };
 
 struct navmesh_build_info
 {
-    std::vector<gltf_vertex> vertices;
-    std::vector<u32> indices;
+    geometry_view geometry; /// @note(ame): only read during the bake, ie. the level's gltf_model::geometry
 
     glm::vec3 min = glm::vec3(0.0f);
-    glm::vec3 max = glm::vec3(0.0f);
+    glm::vec3 max = glm::vec3(0.0f); /// @note(ame): min == max uses the bounds of the geometry
+    u64 content_hash = 0; /// @note(ame): ie. the level's gltf_model::source_hash. 0 hashes the geometry instead.
+};
+
+struct wnn_header
+{
+    u32 magic;
+    u32 version;
+    u32 tile_count;
+    u32 pad;
+    dtNavMeshParams params;
+};
+
+struct wnn_entry
+{
+    i32 x;
+    i32 z;
+    u64 offset;
+    u64 size;
+
+    u64 heightfield_offset;
+    u64 heightfield_size;
+    u64 heightfield_raw_size;
+    u32 heightfield_compressed;
+    u32 pad;
 };
 
-void navmesh_init(navmesh *mesh, const navmesh_build_info& info);
+/// @note(ame): registers the navmesh, crowd and pathfinding cvars. Main thread, before any navmesh gets built -- bakes and
+/// level preloads read them from workers.
+void navmesh_system_init();
+navmesh_settings navmesh_get_settings();
+u64 navmesh_settings_hash(const navmesh_settings& settings);
+
+/// @note(ame): builds every tile from scratch, max_threads = 0 means every worker + the calling thread
+bool navmesh_bake(navmesh *mesh, const navmesh_build_info& info, const navmesh_settings& settings, u32 max_threads = 0);
+/// @note(ame): loads the baked tiles of the level if they are in the cache, bakes (and caches) them otherwise
+void navmesh_init(navmesh *mesh, const navmesh_build_info& info, bool cache = true, u32 max_threads = 0);
 void navmesh_free(navmesh *mesh);
+
+/// @note(ame): obstacles are world space boxes, ids are never 0
+u32 navmesh_obstacle_add(navmesh *mesh, glm::vec3 min, glm::vec3 max);
+void navmesh_obstacle_move(navmesh *mesh, u32 id, glm::vec3 min, glm::vec3 max);
+void navmesh_obstacle_remove(navmesh *mesh, u32 id);
+/// @note(ame): queues every tile overlapping the box for a rebuild, for obstacles that changed behind the navmesh's back
+void navmesh_dirty_bounds(navmesh *mesh, glm::vec3 min, glm::vec3 max);
+/// @note(ame): main thread, once per frame. Swaps in the tiles of the last round if it's done, then kicks the next one.
+void navmesh_update(navmesh *mesh);
+/// @note(ame): waits for the round in flight and swaps its tiles in
+void navmesh_wait(navmesh *mesh);
+/// @note(ame): rebuilds every dirty tile right away, no budget. For level loads.
+void navmesh_flush(navmesh *mesh);
+
+/// @note(ame): CROWD
+/// navmesh::agent_manager steers the agents along their corridors and around each other, the physics characters stay in
+/// charge of the actual movement. Every frame the agents are put where their character ended up, their velocities go to the
+/// characters, and the crowd runs for the fixed steps that went by on a job, while the frame renders. Nothing touches the
+/// crowd or the navmesh tiles until crowd_wait -- every crowd_* call and tile swap below waits on its own.
+#define CROWD_MAX_AGENT_RADIUS 1.0f
+
+void crowd_init(navmesh *mesh, u32 max_agents);
+void crowd_free(navmesh *mesh);
+/// @note(ame): `position` is at the agent's feet, returns -1 if the crowd is full or there's no navmesh there
+i32 crowd_agent_add(navmesh *mesh, glm::vec3 position, f32 radius, f32 height, f32 max_speed);
+void crowd_agent_remove(navmesh *mesh, i32 agent);
+/// @note(ame): false if there's no navmesh near the target
+bool crowd_agent_set_target(navmesh *mesh, i32 agent, glm::vec3 target);
+void crowd_agent_set_position(navmesh *mesh, i32 agent, glm::vec3 position);
+glm::vec3 crowd_agent_get_position(navmesh *mesh, i32 agent);
+glm::vec3 crowd_agent_get_velocity(navmesh *mesh, i32 agent);
+/// @note(ame): `steps` dtCrowd::update of `dt` each, on a job
+void crowd_update_async(navmesh *mesh, u32 steps, f32 dt);
+void crowd_wait(navmesh *mesh);
+
+/// @note(ame): PATHFINDING
+/// A* on request. pathfind_request hands out a ticket, pathfind_update deals the queue out to the workers, each with its own
+/// dtNavMeshQuery, and runs them on jobs through the frame. The queries are sliced, a worker stops once it went over
+/// `pathfind_budget_ms` and picks up where it left off next frame. Corridors are cached by start/goal polygon, the cache is
+/// dropped whenever tiles get swapped. Poll the ticket until it's done -- polling a finished ticket hands the path over and
+/// releases it.
+#define PATHFIND_MAX_POLYS 256
+#define PATHFIND_QUERY_NODES 2048
+#define PATHFIND_SLICE_ITERATIONS 64
+#define PATHFIND_MAX_BATCH 32
+
+typedef u32 path_ticket; /// @note(ame): never 0
+
+enum path_status
+{
+    PathStatus_Invalid, /// @note(ame): unknown ticket, or already handed over
+    PathStatus_Pending,
+    PathStatus_Done,
+    PathStatus_Partial, /// @note(ame): the goal can't be reached, the path goes as close as it gets
+    PathStatus_Failed
+};
+
+struct path_result
+{
+    path_status status;
+    std::vector<dtPolyRef> corridor;
+    std::vector<glm::vec3> points; /// @note(ame): straight path, start and end included
+};
+
+struct path_request
+{
+    path_ticket ticket;
+    glm::vec3 start;
+    glm::vec3 goal;
+    dtPolyRef start_ref;
+    dtPolyRef goal_ref;
+    u64 revision; /// @note(ame): navmesh::revision the refs were looked up at
+
+    /// @note(ame): the worker owns these between dispatch and the next pathfind_update
+    bool dispatched = false;
+    bool orphaned = false; /// @note(ame): cancelled while dispatched, deleted once it comes back
+    path_result result = {};
+};
+
+struct path_cache_entry
+{
+    u64 key;
+    std::vector<dtPolyRef> corridor;
+    std::vector<u32> tiles; /// @note(ame): x + z * tiles_x of every tile the corridor crosses, sorted
+    bool partial;
+};
+
+struct pathfinder_worker
+{
+    dtNavMeshQuery *query;
+    path_request *current = nullptr; /// @note(ame): sliced query in flight, carries over to the next frame
+    std::vector<path_request*> batch;
+    u32 next = 0;
+    std::vector<path_request*> done;
+    u64 iterations;
+    f32 ms;
+};
+
+struct pathfinder_stats
+{
+    u64 requests;
+    u64 cache_hits;
+    u64 completed;
+    u64 failed;
+    u64 restarted; /// @note(ame): queries in flight when their tiles got swapped
+    u64 evicted; /// @note(ame): cached corridors that went through a swapped tile
+    u64 iterations;
+    f32 last_ms;
+    f32 worst_ms;
+};
+
+struct pathfinder
+{
+    job_counter counter;
+    dtQueryFilter filter; /// @note(ame): sliced queries keep a pointer to it
+    dtNavMeshQuery *query; /// @note(ame): main thread, poly lookups and straightening cached corridors
+
+    std::vector<pathfinder_worker> workers;
+    std::deque<path_request*> queue;
+    std::unordered_map<path_ticket, path_request*> requests;
+    path_ticket next_ticket = 1;
+
+    /// @note(ame): LRU, most recent in front
+    std::list<path_cache_entry> cache;
+    std::unordered_map<u64, std::list<path_cache_entry>::iterator> cache_lookup;
+    u32 cache_size;
+    std::vector<u32> swapped_tiles; /// @note(ame): filled by navmesh_rebuild_apply, the cache drops what crosses them next update
+
+    pathfinder_stats stats = {};
+};
+
+/// @note(ame): 0 workers means one per job thread
+void pathfind_init(navmesh *mesh, u32 workers = 0);
+void pathfind_free(navmesh *mesh);
+/// @note(ame): returns 0 without a navmesh
+path_ticket pathfind_request(navmesh *mesh, glm::vec3 start, glm::vec3 goal);
+/// @note(ame): anything but PathStatus_Pending releases the ticket, `result` gets the path if it's not null
+path_status pathfind_poll(navmesh *mesh, path_ticket ticket, path_result *result = nullptr);
+void pathfind_cancel(navmesh *mesh, path_ticket ticket);
+/// @note(ame): main thread, once per frame. Collects what the workers got done last frame and sends them off again.
+void pathfind_update(navmesh *mesh);
+void pathfind_wait(navmesh *mesh);
@@ -0,0 +1,100 @@
+//
+// $Notice: Xander Studios @ 2024
+// $Author: Amélie Heinrich
+// $Create Time: 2024-11-22 19:02:37
+//
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <unordered_map>
+
+#include "wn_common.h"
+
+/// @note(ame): every importer output (.wnt, .wns, .wnp, .wnm, .wnb, .wnn) lives in .cache/ under a content addressed name.
+/// The key is hash(source bytes, importer name, importer version, importer settings), so editing a source,
+/// bumping an importer or changing its settings all land on a new key. Stale entries are never overwritten,
+/// they just stop being touched and get evicted once the cache goes over budget.
+
+#define ASSET_CACHE_DIRECTORY ".cache/"
+#define ASSET_CACHE_MANIFEST ".cache/manifest.json"
+#define ASSET_CACHE_MANIFEST_VERSION 1
+
+struct asset_cache_entry
+{
+    std::string file;
+    u64 size;
+    u64 last_used; /// @note(ame): asset_cache::tick at the last lookup/commit
+};
+
+/// @note(ame): content hashes are memoized against the file time and size, so a warm start only stats the sources
+struct asset_cache_source
+{
+    u32 low_time;
+    u32 high_time;
+    u64 size;
+    u64 hash;
+};
+
+struct asset_cache_stats
+{
+    u64 hits;
+    u64 misses;
+    u64 bytes_read;
+    u64 bytes_written;
+    u64 evictions;
+    u64 bytes_evicted;
+    u64 resident_bytes;
+    u64 entry_count;
+};
+
+struct asset_cache
+{
+    std::mutex lock;
+    std::unordered_map<u64, asset_cache_entry> entries;
+    std::unordered_map<std::string, asset_cache_source> sources;
+    std::unordered_map<std::string, u64> stamps;
+    std::unordered_map<u64, u32> pins; /// @note(ame): entries mapped by live resources, eviction leaves them alone
+    u64 total_size = 0;
+    u64 max_size = 0;
+    u64 tick = 0;
+    u64 temp_counter = 0;
+    bool dirty = false;
+    bool touched = false; /// @note(ame): hits moved LRU ticks, only written out with the next save
+    asset_cache_stats stats = {};
+};
+
+extern asset_cache assets;
+
+void asset_cache_init();
+void asset_cache_exit();
+void asset_cache_save_manifest();
+
+/// @note(ame): returns 0 if the source doesn't exist
+u64 asset_cache_source_hash(const std::string& path);
+u64 asset_cache_key(const std::string& source, const char *importer, u32 version, u64 settings = 0);
+u64 asset_cache_key(const std::vector<std::string>& sources, const char *importer, u32 version, u64 settings = 0);
+/// @note(ame): for importers that already hashed their sources once and derive several entries from them
+u64 asset_cache_key_from_hash(u64 content_hash, const char *importer, u32 version, u64 settings = 0);
+
+/// @note(ame): on a hit, out_path is the file to read. Counts towards hits/misses. `extension` is the one the entry was
+/// committed with, it's how packed and unlisted loose entries are found.
+bool asset_cache_lookup(u64 key, const char *extension, std::string *out_path);
+/// @note(ame): lookup + pin, for entries that stay mapped past the load (baked meshes, textures). Every hit needs a release.
+bool asset_cache_acquire(u64 key, const char *extension, std::string *out_path);
+void asset_cache_release(u64 key);
+/// @note(ame): writers write to a temp path then commit it. The commit renames the file in place atomically,
+/// so a crash mid-write leaves a stray .tmp file behind instead of a corrupted cache entry.
+std::string asset_cache_temp_path(u64 key);
+std::string asset_cache_commit(u64 key, const std::string& temp_path, const char *extension);
+void asset_cache_discard(const std::string& temp_path);
+std::string asset_cache_store(u64 key, const void *data, u64 size, const char *extension);
+
+/// @note(ame): stamps let a whole import pass be skipped, ie. "everything under assets/ is baked as of this listing".
+/// They are all dropped as soon as any entry is evicted or goes missing, so a matching stamp means every entry is there.
+u64 asset_cache_get_stamp(const std::string& name);
+void asset_cache_set_stamp(const std::string& name, u64 value);
+
+asset_cache_stats asset_cache_get_stats();
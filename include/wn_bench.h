@@ -0,0 +1,16 @@
+//
+// $Notice: Xander Studios @ 2024
+// $Author: Amélie Heinrich
+// $Create Time: 2024-11-22 16:20:52
+//
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "wn_common.h"
+
+/// @note(ame): benchmarks live in the developper console. They never touch the GPU, so they can run while the game is paused in the editor.
+
+void bench_init();
@@ -10,14 +10,26 @@
 #include <string>
 
 #include "wn_common.h"
+#include "wn_filesystem.h"
 
 /// @todo(ame): compressed bitmaps using BC7 and XTC (my own texture format hdzahdzadzaiudhzadza :333)
 
+/// @note(ame): bump when the .wnt layout or the baking pipeline changes, old entries are then ignored
+#define BITMAP_IMPORTER_VERSION 3
+
+enum bitmap_format
+{
+    BitmapFormat_RGBA8,
+    BitmapFormat_BC7,
+    BitmapFormat_BC6H /// @note(ame): .hdr sources, unsigned half floats
+};
+
 struct bitmap_header
 {
     i32 width;
     i32 height;
     i32 levels;
+    i32 format;
 };
 
 struct uncompressed_bitmap
@@ -25,10 +37,32 @@ struct uncompressed_bitmap
     i32 width;
     i32 height;
     i32 levels = 1;
-    bool compressed = false;
-    std::vector<u8> pixels; 
+    bitmap_format format = BitmapFormat_RGBA8;
+    std::vector<u8> pixels; /// @note(ame): decoded images own their pixels
+    fs_mapped_file mapped; /// @note(ame): cached ones are read in place from the .wnt mapping
+    u64 cache_key = 0; /// @note(ame): the .wnt's, pinned in the asset cache until uncompressed_bitmap_free
+};
+
+struct bitmap_bake_stats
+{
+    u32 scanned;
+    u32 up_to_date;
+    u32 baked;
+    u32 failed;
+    u64 pixels;
+    u64 input_bytes;
+    u64 output_bytes;
+    f32 seconds;
 };
 
-void bitmap_compress_recursive(const std::string& directory);
+/// @note(ame): main thread, before anything gets baked or loaded
+void bitmap_init();
+u64 bitmap_cache_key(const std::string& path);
+/// @note(ame): bakes every texture under `directory` that isn't in the asset cache yet, in parallel on the job system
+bitmap_bake_stats bitmap_compress_recursive(const std::string& directory);
 
 void uncompressed_bitmap_load(uncompressed_bitmap *bitmap, const std::string& path);
+void uncompressed_bitmap_free(uncompressed_bitmap *bitmap);
+/// @note(ame): every level back to back, wherever they live
+const u8 *uncompressed_bitmap_data(const uncompressed_bitmap *bitmap);
+u64 uncompressed_bitmap_size(const uncompressed_bitmap *bitmap);
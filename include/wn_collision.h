@@ -0,0 +1,71 @@
+//
+// $Notice: Xander Studios @ 2024
+// $Author: Amélie Heinrich
+// $Create Time: 2024-11-23 19:12:40
+//
+
+#pragma once
+
+#include <vector>
+
+#include "wn_common.h"
+#include "wn_physics.h"
+#include "wn_geometry.h"
+
+/// @note(ame): COLLISION COOKER
+/// Geometry goes in, Jolt shapes come out, cooked in parallel on the job system. Every source is keyed by the hash of its
+/// positions, indices, transform and the cook settings, and all the shapes of a batch (one model) share a single .wnp:
+/// header | entries sorted by hash | shapes saved with SaveWithChildren, 16 byte aligned. Loading it is one map.
+#define WNP_MAGIC 0x31504E57 /// @note(ame): "WNP1"
+#define WNP_VERSION 1
+#define WNP_ALIGNMENT 16
+
+enum collision_mode
+{
+    CollisionMode_Mesh, /// @note(ame): BVH triangle mesh, exact but static only. Level geometry is concave, so it's the default.
+    CollisionMode_ConvexHull, /// @note(ame): one hull per source
+    CollisionMode_Decompose /// @note(ame): approximate convex decomposition, a static compound of hulls
+};
+
+struct collision_settings
+{
+    collision_mode mode;
+    u32 decompose_depth; /// @note(ame): up to 2^depth hulls per source
+    u32 decompose_min_triangles; /// @note(ame): parts with fewer triangles aren't split any further
+};
+
+struct collision_source
+{
+    glm::mat4 transform;
+    geometry_view geometry; /// @note(ame): usually a slice of the model's streams, with the primitive's own indices
+
+    u64 hash = 0;
+    physics_shape *shape = nullptr; /// @note(ame): output, owned by the caller
+};
+
+struct wnp_header
+{
+    u32 magic;
+    u32 version;
+    u32 shape_count;
+    u32 pad;
+};
+
+struct wnp_entry
+{
+    u64 hash;
+    u64 offset;
+    u64 size;
+    u32 rb_type;
+    u32 pad;
+};
+
+/// @note(ame): registers the collision_* cvars and the collision_cook command. Main thread.
+void collision_init();
+collision_settings collision_get_settings();
+u64 collision_settings_hash(const collision_settings& settings);
+
+u64 collision_source_hash(const collision_source *source, const collision_settings& settings);
+physics_shape *collision_cook(const collision_source *source, const collision_settings& settings);
+/// @note(ame): hashes and cooks every source. With `cache` set the whole batch is loaded from (or saved to) one .wnp.
+void collision_cook_batch(std::vector<collision_source>& sources, const collision_settings& settings, bool cache = true, u32 max_threads = 0);
@@ -39,4 +39,8 @@ extern console_var_registry cvars;
 
 void cvar_load(const std::string& registry_path);
 console_var* cvar_get(const std::string& cvar_name);
+/// @note(ame): same as cvar_get, but creates the var with a default value when cvars.json doesn't have it yet
+console_var* cvar_register_unsigned(const std::string& cvar_name, u32 value);
+console_var* cvar_register_float(const std::string& cvar_name, f32 value);
+console_var* cvar_register_bool(const std::string& cvar_name, bool value);
 void cvar_save(const std::string& registry_path);
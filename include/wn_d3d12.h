@@ -343,7 +343,8 @@ void command_buffer_end_gui(command_buffer *buf);
 
 // command buffer copy
 void command_buffer_copy_texture_to_texture(command_buffer *buf, texture *dst, texture *src);
-void command_buffer_copy_buffer_to_texture(command_buffer *buf, texture *dst, buffer *src, u32 mip_count = 1);
+/// @note(ame): src_offset must be D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT aligned
+void command_buffer_copy_buffer_to_texture(command_buffer *buf, texture *dst, buffer *src, u32 mip_count = 1, u64 src_offset = 0);
 void command_buffer_copy_buffer_to_buffer(command_buffer *buf, buffer *dst, buffer *src);
 
 /// @note(ame): hot reloadable pipeline
@@ -22,6 +22,29 @@ struct file_watch
     timer check_timer;
 };
 
+/// @note(ame): read-only view of a whole file, straight from the page cache. `data` stays valid until fs_unmap.
+struct fs_mapped_file
+{
+    const u8 *data = nullptr;
+    u64 size = 0;
+
+    /// @note(ame): set when the file came out of a mounted .wnpak, `owned` holds decompressed entries
+    bool packed = false;
+    u8 *owned = nullptr;
+
+#if defined(_WIN32)
+    void *file = nullptr;
+    void *mapping = nullptr;
+#else
+    i32 fd = -1;
+#endif
+};
+
+/// @note(ame): returns false if the file can't be opened. Empty files map fine, with data = nullptr.
+/// Every read below looks in the mounted archives (wn_pak.h) before the loose file.
+bool fs_map(fs_mapped_file *file, const std::string& path);
+void fs_unmap(fs_mapped_file *file);
+
 void file_watch_start(file_watch *watch, const std::string& path);
 bool file_watch_check(file_watch *watch);
 
@@ -29,9 +52,11 @@ bool fs_exists(const std::string& path);
 bool fs_isdir(const std::string& path);
 void fs_create(const std::string& path);
 void fs_createdir(const std::string& path);
+/// @note(ame): replaces the destination atomically, so readers never see a half written file
+bool fs_rename(const std::string& from, const std::string& to);
+bool fs_delete(const std::string& path);
 std::string fs_getextension(const std::string& path);
-std::string fs_cachepath(const std::string& path);
-i32 fs_filesize(const std::string& path);
+u64 fs_filesize(const std::string& path);
 std::string fs_readtext(const std::string& path);
 std::vector<uint8_t> fs_readbytes(const std::string& path);
 void fs_getfiletime(const std::string& path, u32& low, u32& high);
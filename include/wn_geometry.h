@@ -0,0 +1,57 @@
+//
+// $Notice: Xander Studios @ 2024
+// $Author: Amélie Heinrich
+// $Create Time: 2024-11-28 18:41:09
+//
+
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "wn_common.h"
+
+/// @note(ame): GEOMETRY STREAMS
+/// Positions only, one float stream per axis, plus the index list. A model flattens its primitives into these once and
+/// collision cooking, navmesh baking and culling all read them through a geometry_view. Nobody copies them into their own
+/// vertex format anymore, whatever needs a different layout (ie. Recast) builds it for the few triangles it's working on.
+
+struct geometry_streams
+{
+    std::vector<f32> x;
+    std::vector<f32> y;
+    std::vector<f32> z;
+    std::vector<u32> indices;
+};
+
+/// @note(ame): doesn't own anything, valid for as long as what it points into
+struct geometry_view
+{
+    const f32 *x = nullptr;
+    const f32 *y = nullptr;
+    const f32 *z = nullptr;
+    u64 vertex_count = 0;
+    const u32 *indices = nullptr;
+    u64 index_count = 0;
+};
+
+void geometry_resize(geometry_streams *streams, u64 vertex_count, u64 index_count);
+u64 geometry_memory(const geometry_streams& streams);
+
+geometry_view geometry_get_view(const geometry_streams& streams);
+/// @note(ame): `vertex_count` vertices from `first_vertex` on, with indices of their own (ie. relative to `first_vertex`)
+geometry_view geometry_subview(const geometry_view& view, u64 first_vertex, u64 vertex_count, const u32 *indices, u64 index_count);
+
+inline glm::vec3 geometry_position(const geometry_view& view, u64 index)
+{
+    return glm::vec3(view.x[index], view.y[index], view.z[index]);
+}
+
+/// @note(ame): deinterleaves `count` vec3 positions, `stride` bytes apart, into the streams from `offset` on
+void geometry_scatter_positions(geometry_streams *streams, u64 offset, const u8 *positions, u64 stride, u64 count);
+void geometry_bounds(const geometry_view& view, glm::vec3 *min, glm::vec3 *max);
+u64 geometry_hash(const geometry_view& view, u64 seed);
+
+/// @note(ame): one byte per triangle, `walkable` where the face normal is within `max_slope` degrees of straight up and 0
+/// everywhere else, degenerate triangles included. Eight triangles at a time on AVX2, four on SSE.
+void geometry_classify_slopes(const geometry_view& view, f32 max_slope, u8 walkable, u64 first_triangle, u64 triangle_count, u8 *out);
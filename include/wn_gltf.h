@@ -13,10 +13,12 @@
 #include <array>
 #include <unordered_map>
 #include <memory>
+#include <atomic>
 
 #include "wn_d3d12.h"
 #include "wn_bitmap.h"
 #include "wn_physics.h"
+#include "wn_geometry.h"
 
 struct resource;
 
@@ -64,13 +66,103 @@ struct gltf_node
     std::vector<gltf_node*> children;
 };
 
+/// @note(ame): CPU side of a primitive import. Filled in parallel by the job system, then merged in order.
+struct gltf_primitive_import
+{
+    cgltf_primitive *primitive = nullptr; /// @note(ame): null when the primitive comes from a baked mesh
+    gltf_node *node;
+    u32 physics_index;
+    std::string albedo_path;
+
+    /// @note(ame): views on the vectors below when imported from glTF, or straight into the .wnm blob when baked
+    const gltf_vertex *vertex_data = nullptr;
+    const u32 *index_data = nullptr;
+    u32 vertex_count = 0;
+    u32 index_count = 0;
+
+    std::vector<gltf_vertex> vertices;
+    std::vector<u32> indices;
+    physics_shape *shape = nullptr;
+
+    u32 vertex_offset = 0;
+    u32 index_offset = 0;
+};
+
+/// @note(ame): BAKED MESHES (.wnm)
+/// One file per model: header, node hierarchy, primitives, materials, strings, then the vertex and index blobs.
+/// Every section is 16 byte aligned so the blobs can be used in place, straight from the file.
+#define WNM_MAGIC 0x314D4E57 /// @note(ame): "WNM1"
+#define WNM_VERSION 2
+
+struct wnm_header
+{
+    u32 magic;
+    u32 version;
+
+    u32 node_count;
+    u32 primitive_count;
+    u32 material_count;
+    u32 string_size;
+    u64 vertex_count;
+    u64 index_count;
+
+    u64 nodes_offset;
+    u64 primitives_offset;
+    u64 materials_offset;
+    u64 strings_offset;
+    u64 vertices_offset;
+    u64 indices_offset;
+};
+
+/// @note(ame): nodes are stored depth first, so a parent always comes before its children
+struct wnm_node
+{
+    glm::mat4 transform;
+    i32 parent;
+    u32 name;
+    u32 first_primitive;
+    u32 primitive_count;
+};
+
+struct wnm_primitive
+{
+    u64 vertex_offset;
+    u64 index_offset;
+    u32 vertex_count;
+    u32 index_count;
+    i32 material;
+    u32 physics_index;
+};
+
+struct wnm_material
+{
+    i32 albedo; /// @note(ame): offset in the string table, -1 if none
+};
+
+/// @note(ame): views into the mapped .wnm, valid until gltf_baked_close
+struct gltf_baked_mesh
+{
+    fs_mapped_file file;
+    u64 key = 0; /// @note(ame): pinned in the asset cache while open
+
+    const wnm_header *header;
+    const wnm_node *nodes;
+    const wnm_primitive *primitives;
+    const wnm_material *materials;
+    const char *strings;
+    const gltf_vertex *vertices;
+    const u32 *indices;
+};
+
 struct gltf_model
 {
     std::string path;
     std::string directory;
+    u64 source_hash; /// @note(ame): content hash of the .gltf and every buffer file it references, every cache entry of the model derives from it
     bool gen_collisions;
+    bool cache_collisions = true;
 
-    gltf_node *root;
+    gltf_node *root = nullptr;
     std::vector<gltf_material> materials;
     std::unordered_map<std::string, gltf_texture> textures;
     u32 physics_counter = 0;
@@ -81,9 +173,44 @@ struct gltf_model
     u32 vtx_count;
     u32 idx_count;
 
-    std::vector<gltf_vertex> flattened_vertices;
-    std::vector<u32> flattened_indices;
+    /// @note(ame): every primitive's positions and indices back to back, indices rebased. Untransformed, like the primitives.
+    geometry_streams geometry;
+};
+
+/// @note(ame): bulk accessor decoding. `out` is strided so it can write straight into a gltf_vertex field.
+void gltf_accessor_unpack_floats(const cgltf_accessor *accessor, f32 *out, u32 components, u64 out_stride);
+void gltf_accessor_unpack_joints(const cgltf_accessor *accessor, i32 *out, u64 out_stride);
+void gltf_accessor_unpack_indices(const cgltf_accessor *accessor, u32 *out, u32 base_vertex = 0);
+
+/// @note(ame): the .gltf plus every external buffer it references. The buffer list is cached, so only the first import
+/// of a .gltf parses it; after that it's a stat per file.
+u64 gltf_source_hash(const std::string& path);
+u64 gltf_baked_key(u64 source_hash);
+/// @note(ame): returns false if there is no baked mesh for `source_hash`, ie. gltf_source_hash of the model
+bool gltf_baked_open(gltf_baked_mesh *baked, u64 source_hash);
+void gltf_baked_close(gltf_baked_mesh *baked);
+
+/// @note(ame): what a load keeps alive between its CPU half and its GPU half
+struct gltf_load_state
+{
+    std::vector<gltf_primitive_import> imports;
+    gltf_baked_mesh baked;
+    cgltf_data *data = nullptr;
 };
 
+/// @note(ame): import + upload, on the calling thread
 void gltf_model_load(gltf_model *model, const std::string& path, bool generate_collisions = true);
+/// @note(ame): parse, decode, cook and bake. No GPU or physics body work, so it can run on a worker.
+void gltf_model_import(gltf_model *model, gltf_load_state *state, const std::string& path, bool generate_collisions = true);
+/// @note(ame): same, but logs and returns false instead of throwing, and gives up between stages once `cancelled` is set.
+/// Either way whatever it got through is left in `state` for gltf_model_discard.
+bool gltf_model_try_import(gltf_model *model, gltf_load_state *state, const std::string& path, bool generate_collisions, const std::atomic<bool> *cancelled = nullptr);
+/// @note(ame): buffers, bodies and textures for an import. Main thread.
+void gltf_model_upload(gltf_model *model, gltf_load_state *state);
+/// @note(ame): throws away an import that never got uploaded
+void gltf_model_discard(gltf_model *model, gltf_load_state *state);
+/// @note(ame): decodes every import and merges it into the model's geometry streams, then cooks the collisions off them. No GPU work.
+void gltf_import_primitives(gltf_model *model, std::vector<gltf_primitive_import>& imports, u32 max_threads = 0);
+/// @note(ame): takes the static bodies of the model in or out of the physics world, for models that stay resident while unused. Main thread.
+void gltf_model_set_collisions(gltf_model *model, bool enabled);
 void gltf_model_free(gltf_model *model);
@@ -0,0 +1,51 @@
+//
+// $Notice: Xander Studios @ 2024
+// $Author: Amélie Heinrich
+// $Create Time: 2024-11-22 14:03:11
+//
+
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <condition_variable>
+
+#include "wn_common.h"
+
+/// @note(ame): tracks a batch of jobs so that a caller can wait on only its own work
+struct job_counter
+{
+    std::atomic<u32> pending = 0;
+};
+
+struct job_entry
+{
+    std::function<void()> fn;
+    job_counter *counter;
+};
+
+struct job_system
+{
+    std::vector<std::thread> workers;
+    std::deque<job_entry> queue;
+    std::mutex lock;
+    std::condition_variable wake;
+    bool quit;
+};
+
+extern job_system jobs;
+
+void job_system_init(u32 thread_count = 0);
+void job_system_exit();
+u32 job_system_thread_count();
+
+void job_push(const std::function<void()>& fn, job_counter *counter = nullptr);
+/// @note(ame): the waiting thread helps out with the queued jobs of `counter` (and only those), so nested waits can't
+/// deadlock the pool and a short wait never picks up somebody else's long job
+void job_wait(job_counter *counter);
+/// @note(ame): max_threads = 0 means every worker + the calling thread
+void job_parallel_for(u32 count, const std::function<void(u32)>& fn, u32 max_threads = 0);
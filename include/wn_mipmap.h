@@ -0,0 +1,46 @@
+//
+// $Notice: Xander Studios @ 2024
+// $Author: Amélie Heinrich
+// $Create Time: 2024-11-23 10:14:26
+//
+
+#pragma once
+
+#include <vector>
+
+#include "wn_common.h"
+
+/// @note(ame): CPU mip chain generation for RGBA8 images.
+/// Filtering happens in linear space with premultiplied alpha, each level is built from the previous one.
+/// Dimensions round down like D3D12 does (5x3 -> 2x1 -> 1x1).
+
+enum mip_filter
+{
+    MipFilter_Box,
+    MipFilter_Kaiser
+};
+
+enum mip_isa
+{
+    MipIsa_Auto,
+    MipIsa_Scalar,
+    MipIsa_SSE4,
+    MipIsa_AVX2
+};
+
+struct mip_chain
+{
+    i32 width;
+    i32 height;
+    i32 levels;
+    std::vector<u8> pixels; /// @note(ame): every level back to back, tightly packed, level 0 first
+    std::vector<u64> offsets;
+};
+
+i32 mip_level_count(i32 width, i32 height);
+/// @note(ame): srgb = false filters the color channels as plain linear data (normal maps, masks...)
+void mip_chain_build(mip_chain *chain, const u8 *rgba, i32 width, i32 height, mip_filter filter = MipFilter_Box, bool srgb = true, mip_isa isa = MipIsa_Auto);
+
+i32 mip_level_width(const mip_chain *chain, i32 level);
+i32 mip_level_height(const mip_chain *chain, i32 level);
+const u8 *mip_level_data(const mip_chain *chain, i32 level);
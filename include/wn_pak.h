@@ -0,0 +1,111 @@
+//
+// $Notice: Xander Studios @ 2024
+// $Author: Amélie Heinrich
+// $Create Time: 2024-11-23 17:41:09
+//
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <shared_mutex>
+
+#include "wn_common.h"
+#include "wn_filesystem.h"
+
+/// @note(ame): PACKED ARCHIVES (.wnpak)
+/// header | entry data | chunk table | entries (sorted by path hash) | path strings
+/// Compressed entries are cut in PAK_CHUNK_SIZE chunks, each compressed on its own (LZ4 block format) so any
+/// range can be read without decoding the whole file. Entries that don't compress are stored raw, 16 byte aligned like
+/// every other blob we map, and fs_map hands out views straight into the archive mapping for them. The view lives in
+/// the archive's own mapping so there's nothing to gain from page aligning it, only padding to lose on small files.
+#define PAK_MAGIC 0x4B41504E /// @note(ame): "NPAK"
+#define PAK_VERSION 1
+#define PAK_CHUNK_SIZE (64 * 1024)
+#define PAK_RAW_ALIGNMENT 16
+#define PAK_CHUNK_ALIGNMENT 16
+
+enum pak_flags
+{
+    PakFlag_Compressed = 1 << 0
+};
+
+struct pak_header
+{
+    u32 magic;
+    u32 version;
+    u32 entry_count;
+    u32 chunk_count;
+    u32 chunk_size;
+    u32 string_size;
+
+    u64 chunks_offset;
+    u64 entries_offset;
+    u64 strings_offset;
+};
+
+struct pak_entry
+{
+    u64 hash; /// @note(ame): pak_hash of the path
+    u64 content_hash;
+    u64 size;
+    u64 offset; /// @note(ame): raw entries only
+    u32 first_chunk;
+    u32 chunk_count;
+    u32 name; /// @note(ame): offset in the string table
+    u32 flags;
+};
+
+struct pak_chunk
+{
+    u64 offset;
+    u32 stored_size;
+    u32 flags; /// @note(ame): a chunk that didn't shrink is kept raw
+};
+
+struct pak_archive
+{
+    std::string path;
+    fs_mapped_file file;
+
+    const pak_header *header;
+    const pak_chunk *chunks;
+    const pak_entry *entries;
+    const char *strings;
+};
+
+struct pak_registry
+{
+    std::shared_mutex lock;
+    std::vector<pak_archive*> mounts; /// @note(ame): last mounted wins
+};
+
+extern pak_registry paks;
+
+u64 pak_hash(const std::string& path);
+
+/// @note(ame): LZ4 block format. compress returns 0 when the output doesn't fit in `capacity`.
+u64 pak_compress(const u8 *src, u64 size, u8 *dst, u64 capacity);
+bool pak_decompress(const u8 *src, u64 size, u8 *dst, u64 dst_size);
+
+bool pak_mount(const std::string& path);
+/// @note(ame): mounts every .wnpak directly inside `directory`
+void pak_mount_directory(const std::string& directory);
+/// @note(ame): every view fs_map handed out from the archive must be unmapped first
+bool pak_unmount(const std::string& path);
+void pak_unmount_all();
+
+/// @note(ame): thread safe, the returned entry lives as long as its archive is mounted. Only use it where nothing can
+/// unmount in the meantime, pak_stat and pak_open hold the mount lock for the whole lookup.
+const pak_entry *pak_find(const std::string& path, pak_archive **archive);
+/// @note(ame): copies the entry out, false when no mounted archive has `path`
+bool pak_stat(const std::string& path, pak_entry *out);
+/// @note(ame): pak_find + pak_map in one go. False when no mounted archive has `path`, `*mapped` says whether mapping it worked.
+bool pak_open(const std::string& path, fs_mapped_file *file, bool *mapped);
+bool pak_read(pak_archive *archive, const pak_entry *entry, u64 offset, u64 size, u8 *out);
+/// @note(ame): fills in `file`: a view into the archive for raw entries, a decompressed copy otherwise
+bool pak_map(pak_archive *archive, const pak_entry *entry, fs_mapped_file *file);
+
+/// @note(ame): packs every file under `directory` (paths stored as seen from the working directory)
+bool pak_build(const std::string& directory, const std::string& output, bool compress = true);
+void pak_init();
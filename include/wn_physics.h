@@ -6,9 +6,14 @@
 
 #pragma once
 
+#include <type_traits>
 #include <memory>
 #include <vector>
 #include <fstream>
+#include <cstring>
+#include <atomic>
+#include <unordered_map>
+#include <unordered_set>
 
 #define GLM_ENABLE_EXPERIMENTAL
 #include <glm/glm.hpp>
@@ -29,8 +34,10 @@
 #include <Jolt/Physics/PhysicsSystem.h>
 #include <Jolt/Physics/Collision/Shape/BoxShape.h>
 #include <Jolt/Physics/Collision/Shape/CapsuleShape.h>
+#include <Jolt/Physics/Collision/Shape/SphereShape.h>
 #include <Jolt/Physics/Collision/Shape/MeshShape.h>
 #include <Jolt/Physics/Collision/Shape/ConvexHullShape.h>
+#include <Jolt/Physics/Collision/Shape/StaticCompoundShape.h>
 #include <Jolt/Physics/Body/BodyCreationSettings.h>
 #include <Jolt/Physics/Body/BodyActivationListener.h>
 #include <Jolt/Physics/Character/Character.h>
@@ -41,12 +48,15 @@
 #include <Jolt/Physics/Collision/CollisionCollector.h>
 #include <Jolt/Physics/Collision/CollisionCollectorImpl.h>
 #include <Jolt/Physics/Collision/ShapeCast.h>
+#include <Jolt/Physics/Body/BodyLock.h>
+#include <Jolt/Physics/StateRecorderImpl.h>
 
 #include "wn_common.h"
 #include "wn_output.h"
 #include "wn_timer.h"
 #include "wn_debug_renderer.h"
 #include "wn_filesystem.h"
+#include "wn_queue.h"
 
 struct entity;
 
@@ -63,7 +73,8 @@ enum RigidbodyType
     RigidbodyType_Box,
     RigidbodyType_Capsule,
     RigidbodyType_Mesh,
-    RigidbodyType_ConvexHull
+    RigidbodyType_ConvexHull,
+    RigidbodyType_Compound
 };
 
 struct physics_shape
@@ -72,7 +83,7 @@ struct physics_shape
     JPH::Ref<JPH::PhysicsMaterial> material = nullptr;
     JPH::Ref<JPH::Shape> shape;
 
-    ~physics_shape()
+    virtual ~physics_shape()
     {
     }
 
@@ -93,6 +104,9 @@ struct physics_shape
     }
 };
 
+/// @note(ame): bodies, importers and the benches all own shapes through a physics_shape*, keep the destructor virtual
+static_assert(std::has_virtual_destructor<physics_shape>::value, "physics_shape is deleted through the base pointer");
+
 struct box_shape : public physics_shape
 {
     glm::vec3 size;
@@ -160,6 +174,27 @@ struct mesh_shape : public physics_shape
         }
         shape = result.Get();
     }
+
+    /// @note(ame): indexed version, doesn't keep the triangles around
+    mesh_shape(const JPH::VertexList& vertices, const JPH::IndexedTriangleList& indices, JPH::Ref<JPH::PhysicsMaterial> m = nullptr) {
+        material = m;
+        rb_type = RigidbodyType_Mesh;
+
+        JPH::ShapeSettings::ShapeResult result;
+
+        JPH::PhysicsMaterialList list;
+        if (material) {
+            list.push_back(material);
+        }
+
+        JPH::MeshShapeSettings settings(vertices, indices, list);
+        result = settings.Create();
+        if (result.HasError()) {
+            log("%s", result.GetError().c_str());
+            throw_error("Somehow failed to create a Jolt shape, lol");
+        }
+        shape = result.Get();
+    }
 };
 
 struct convex_hull_shape : public physics_shape
@@ -183,6 +218,47 @@ struct convex_hull_shape : public physics_shape
     }
 };
 
+/// @note(ame): Jolt input stream over a mapped file
+struct mapped_stream_in : public JPH::StreamIn
+{
+    const u8 *data;
+    u64 size;
+    u64 offset = 0;
+    bool failed = false;
+
+    mapped_stream_in(const fs_mapped_file *file)
+        : data(file->data), size(file->size)
+    {
+    }
+
+    mapped_stream_in(const u8 *d, u64 s)
+        : data(d), size(s)
+    {
+    }
+
+    void ReadBytes(void *out, size_t count) override
+    {
+        if (count > size - offset) {
+            memset(out, 0, count);
+            offset = size;
+            failed = true;
+            return;
+        }
+        memcpy(out, data + offset, count);
+        offset += count;
+    }
+
+    bool IsEOF() const override
+    {
+        return offset >= size;
+    }
+
+    bool IsFailed() const override
+    {
+        return failed;
+    }
+};
+
 struct cached_shape : public physics_shape
 {
     std::string shape_path;
@@ -193,10 +269,52 @@ struct cached_shape : public physics_shape
         material = m;
         rb_type = RigidbodyType_ConvexHull;
     
-        std::ifstream stream(shape_path, std::ios_base::binary);
+        fs_mapped_file file;
+        if (!fs_map(&file, shape_path)) {
+            log("[physics] failed to map cached shape %s", shape_path.c_str());
+            throw_error("Somehow failed to create a Jolt shape, lol");
+        }
 
-        JPH::StreamInWrapper stream_in(stream);
+        mapped_stream_in stream_in(&file);
         JPH::Shape::ShapeResult result = JPH::Shape::sRestoreFromBinaryState(stream_in);
+        fs_unmap(&file);
+        if (result.HasError()) {
+            log("%s", result.GetError().c_str());
+            throw_error("Somehow failed to create a Jolt shape, lol");
+        }
+        shape = result.Get();
+    }
+
+    /// @note(ame): a shape saved with SaveWithChildren, `materials` seeds the material ids it was saved with
+    cached_shape(const u8 *data, u64 size, RigidbodyType type, JPH::Shape::IDToMaterialMap& materials, JPH::Ref<JPH::PhysicsMaterial> m = nullptr)
+    {
+        material = m;
+        rb_type = type;
+
+        mapped_stream_in stream_in(data, size);
+        JPH::Shape::IDToShapeMap shapes;
+        JPH::Shape::ShapeResult result = JPH::Shape::sRestoreWithChildren(stream_in, shapes, materials);
+        if (result.HasError() || stream_in.IsFailed()) {
+            log("%s", result.HasError() ? result.GetError().c_str() : "truncated shape");
+            throw_error("Somehow failed to create a Jolt shape, lol");
+        }
+        shape = result.Get();
+    }
+};
+
+/// @note(ame): a static compound of convex hulls, what convex decomposition ends up as
+struct compound_shape : public physics_shape
+{
+    compound_shape(const std::vector<JPH::Ref<JPH::Shape>>& parts, JPH::Ref<JPH::PhysicsMaterial> m = nullptr) {
+        material = m;
+        rb_type = RigidbodyType_Compound;
+
+        JPH::StaticCompoundShapeSettings settings;
+        for (auto& part : parts) {
+            settings.AddShape(JPH::Vec3::sZero(), JPH::Quat::sIdentity(), part);
+        }
+
+        JPH::ShapeSettings::ShapeResult result = settings.Create();
         if (result.HasError()) {
             log("%s", result.GetError().c_str());
             throw_error("Somehow failed to create a Jolt shape, lol");
@@ -218,10 +336,37 @@ struct physics_body
     JPH::Body* body;
     physics_shape* shape;
     bool is_static = false;
+
+    /// @note(ame): state at the last two fixed steps, dynamic bodies only. Rendering blends between them.
+    glm::vec3 prev_position;
+    glm::quat prev_rotation;
+    glm::vec3 position;
+    glm::quat rotation;
 };
 
 void physics_body_init(physics_body *body, physics_shape *shape, glm::vec3 position = glm::vec3(0.0f), bool is_static = false, void *user_data = nullptr);
 void physics_body_free(physics_body *body);
+glm::mat4 physics_body_get_transform(physics_body *body);
+/// @note(ame): interpolated between the last two fixed steps, for rendering
+glm::mat4 physics_body_get_render_transform(physics_body *body);
+/// @note(ame): world space AABB at the last fixed step
+void physics_body_get_bounds(physics_body *body, glm::vec3 *min, glm::vec3 *max);
+
+/// @note(ame): BATCHED STATIC BODIES
+/// Adding bodies one by one inserts them one by one in the broadphase tree. A batch creates the bodies right away but
+/// only inserts them on commit, all at once through AddBodiesPrepare/AddBodiesFinalize, in the NON_MOVING layer and asleep.
+struct physics_body_batch
+{
+    std::vector<JPH::BodyID> ids;
+};
+
+void physics_body_batch_add(physics_body_batch *batch, physics_body *body, physics_shape *shape, glm::vec3 position = glm::vec3(0.0f), void *user_data = nullptr);
+void physics_body_batch_commit(physics_body_batch *batch);
+/// @note(ame): bulk insert/remove of existing static bodies, the ones already in (or out) are skipped
+void physics_bodies_add(const std::vector<physics_body*>& bodies);
+void physics_bodies_remove(const std::vector<physics_body*>& bodies);
+/// @note(ame): removes and destroys all the bodies at once, then deletes their shapes
+void physics_bodies_free(const std::vector<physics_body*>& bodies);
 ray_result physics_body_trace_ray(physics_body *body, glm::vec3 start, glm::vec3 end);
 
 /// @note(ame): controllers
@@ -231,17 +376,74 @@ struct physics_character
     JPH::CharacterVirtual* character;
     physics_shape *shape;
     JPH::BodyID body_index;
+
+    glm::vec3 prev_position;
+    glm::quat prev_rotation;
+    glm::vec3 position;
+    glm::quat rotation;
 };
 
 void physics_character_init(physics_character *c, physics_shape *shape, glm::vec3 position, void *user_data = nullptr);
 void physics_character_move(physics_character *c, glm::vec3 velocity);
 glm::mat4 physics_character_get_transform(physics_character *c);
 glm::vec3 physics_character_get_position(physics_character *c);
+/// @note(ame): interpolated between the last two fixed steps, for rendering
+glm::mat4 physics_character_get_render_transform(physics_character *c);
+glm::vec3 physics_character_get_render_position(physics_character *c);
 void physics_character_set_position(physics_character *c, glm::vec3 p);
 void physics_character_free(physics_character *c);
 ray_result physics_character_trace_ray(physics_character *c, glm::vec3 start, glm::vec3 end);
 ray_result physics_character_trace_ray_dir(physics_character *c, glm::vec3 start, glm::vec3 dir);
 
+/// @note(ame): BATCHED QUERIES
+/// Rays or sphere/capsule sweeps against the whole world, run in parallel on the Jolt job system. One shape per batch,
+/// inputs and results are parallel arrays: query i goes from origins[i] to origins[i] + directions[i].
+
+/// @note(ame): object layer bits, in the same order as the layers
+enum physics_query_layer
+{
+    PhysicsQueryLayer_Static = 1 << 0,
+    PhysicsQueryLayer_Dynamic = 1 << 1,
+    PhysicsQueryLayer_Character = 1 << 2,
+    PhysicsQueryLayer_CharacterGhost = 1 << 3,
+    PhysicsQueryLayer_Trigger = 1 << 4,
+    PhysicsQueryLayer_Default = PhysicsQueryLayer_Static | PhysicsQueryLayer_Dynamic | PhysicsQueryLayer_Character
+};
+
+enum physics_query_shape
+{
+    PhysicsQuery_Ray,
+    PhysicsQuery_Sphere,
+    PhysicsQuery_Capsule /// @note(ame): upright, like the characters
+};
+
+/// @note(ame): queries per job, batches smaller than this run on the calling thread
+#define PHYSICS_QUERIES_PER_JOB 64
+
+struct physics_query_batch
+{
+    physics_query_shape shape = PhysicsQuery_Ray;
+    /// @note(ame): the player capsule's by default. Jolt asserts on empty shapes, so both have to stay positive.
+    f32 radius = 0.5f;
+    f32 half_height = 0.75f;
+    u32 layers = PhysicsQueryLayer_Default;
+
+    std::vector<glm::vec3> origins;
+    std::vector<glm::vec3> directions;
+
+    /// @note(ame): results, filled by physics_query_batch_run
+    std::vector<u8> hits;
+    std::vector<f32> fractions; /// @note(ame): 1 on a miss
+    std::vector<glm::vec3> points;
+    std::vector<glm::vec3> normals;
+    std::vector<JPH::BodyID> bodies;
+};
+
+void physics_query_batch_add(physics_query_batch *batch, glm::vec3 origin, glm::vec3 direction);
+void physics_query_batch_clear(physics_query_batch *batch);
+/// @note(ame): max_jobs 0 uses every Jolt worker, 1 runs everything on the calling thread
+void physics_query_batch_run(physics_query_batch *batch, u32 max_jobs = 0);
+
 /// @note(ame): trigger
 struct physics_trigger
 {
@@ -271,31 +473,117 @@ class BPLayerInterfaceImpl;
 class MyContactListener;
 class MyBodyActivationListener;
 
-struct contact_removed_event
+enum physics_contact_type
+{
+    PhysicsContact_Enter,
+    PhysicsContact_Stay,
+    PhysicsContact_Exit
+};
+
+/// @note(ame): TRIGGER EVENTS
+/// The contact listener runs on the Jolt workers during PhysicsSystem::Update and only pushes events in a lock-free ring.
+/// physics_dispatch_contacts drains it on the stepping thread once the step is done. Jolt reports every sub shape pair,
+/// so contacts are counted per body pair: enter on the first, exit on the last, and at most one stay per pair and step.
+struct physics_contact_event
+{
+    JPH::BodyID trigger; /// @note(ame): exits can't look at the layers, they come in whatever order Jolt gives
+    JPH::BodyID other;
+    physics_contact_type type;
+};
+
+struct physics_trigger_pair
+{
+    JPH::BodyID trigger;
+    JPH::BodyID other;
+    u32 contacts = 0;
+};
+
+struct physics_contact_stats
+{
+    u64 events;
+    u64 duplicates;
+    u64 enters;
+    u64 stays;
+    u64 exits;
+    std::atomic<u64> dropped;
+    f32 dispatch_ms;
+};
+
+struct physics_contact_queue
 {
-    JPH::BodyID body1;
-    JPH::BodyID body2;
+    mpmc_queue<physics_contact_event> events;
+    /// @note(ame): trigger pairs in contact. Written by the dispatch only, so the listener can read it during Update.
+    std::unordered_map<u64, physics_trigger_pair> pairs;
+    std::unordered_set<u64> stayed;
+    physics_contact_stats stats;
 };
 
-struct contact_removed_queue
+/// @note(ame): characters are updated in chunks of at least this many per job
+#define PHYSICS_CHARACTERS_PER_JOB 8
+
+/// @note(ame): FIXED TIMESTEP
+/// Frame time goes in the accumulator, whole steps come out. A frame never runs more than `max_steps` steps, the time
+/// it couldn't catch up on is dropped. Only doubles and integers, so feeding the same frame times gives the same steps.
+#define PHYSICS_STEP_HZ 90
+
+struct physics_clock
 {
-    std::vector<contact_removed_event> events;
+    f64 step = 1.0 / PHYSICS_STEP_HZ;
+    f64 accumulator = 0.0;
+    u32 max_steps = 8;
+
+    u64 steps = 0;
+    u64 dropped = 0;
 };
 
+/// @note(ame): returns how many steps to run for `elapsed` seconds
+u32 physics_clock_advance(physics_clock *clock, f64 elapsed);
+/// @note(ame): how far we are into the next step, [0, 1)
+f32 physics_clock_alpha(const physics_clock *clock);
+
+/// @note(ame): SNAPSHOTS
+/// The whole simulation: Jolt's SaveState (bodies, contacts, constraints), every CharacterVirtual, the trigger pairs and
+/// the clock. Restoring needs the same bodies and characters to exist, so it rewinds a loaded level, it doesn't load one.
+/// Deltas XOR a snapshot against a base and LZ4 the result, most of the state doesn't change from one step to the next.
+struct physics_snapshot
+{
+    std::string data;
+};
+
+struct physics_snapshot_delta
+{
+    u64 size; /// @note(ame): of the snapshot it decodes to
+    bool compressed;
+    std::vector<u8> bytes;
+};
+
+void physics_snapshot_save(physics_snapshot *snapshot);
+/// @note(ame): false if the snapshot doesn't match the bodies and characters in the world
+bool physics_snapshot_restore(const physics_snapshot *snapshot);
+void physics_snapshot_delta_encode(const physics_snapshot *base, const physics_snapshot *snapshot, physics_snapshot_delta *delta);
+bool physics_snapshot_delta_decode(const physics_snapshot *base, const physics_snapshot_delta *delta, physics_snapshot *out);
+
 struct physics_system
 {
     JPH::PhysicsSystem* system;
     JPH::JobSystemThreadPool* job_system;
     JPH::BodyInterface* body_interface;
+    JPH::TempAllocatorImpl* temp_allocator;
+    std::vector<JPH::TempAllocatorImpl*> character_allocators;
 
     MyContactListener* contact_listener;
     MyBodyActivationListener* activation_listener;
     BPLayerInterfaceImpl* broadphase_interface;
 
     std::vector<physics_character*> characters;
+    std::vector<physics_body*> dynamic_bodies;
     timer physics_timer;
+    physics_clock clock;
+
+    physics_contact_queue contact_queue;
 
-    contact_removed_queue contact_queue;
+    /// @note(ame): named slots for the physics_snapshot command, "level" is taken when a world finishes loading
+    std::unordered_map<std::string, physics_snapshot> snapshots;
 };
 
 extern physics_system physics;
@@ -303,6 +591,14 @@ extern physics_system physics;
 void physics_init();
 void physics_attach_debug_renderer(debug_renderer *dbg);
 void physics_draw();
+/// @note(ame): runs as many fixed steps as the frame time calls for
 void physics_update();
+void physics_step(f32 dt);
+/// @note(ame): ExtendedUpdate on every character, spread over the Jolt job system unless physics_parallel_characters is off
+void physics_step_characters(f32 dt);
+/// @note(ame): runs the trigger callbacks for the contacts of the last step
+void physics_dispatch_contacts();
+/// @note(ame): rebuilds the broadphase trees, call it once a level and its static bodies are in
+void physics_optimize_broadphase();
 void physics_clear_characters();
 void physics_exit();
@@ -0,0 +1,83 @@
+//
+// $Notice: Xander Studios @ 2024
+// $Author: Amélie Heinrich
+// $Create Time: 2024-11-23 21:36:14
+//
+
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "wn_common.h"
+#include "wn_timer.h"
+
+/// @note(ame): PHYSICS PROFILER
+/// Every physics_step records how long each of its phases took and what the world looked like, in a ring of the last
+/// physics_profile_history steps. Nothing in it needs a window: the console prints it, and it exports to a Chrome trace
+/// (chrome://tracing or ui.perfetto.dev) so the benchmarks can dump the same thing.
+enum physics_phase
+{
+    PhysicsPhase_Step, /// @note(ame): all of it
+    PhysicsPhase_Jolt, /// @note(ame): PhysicsSystem::Update
+    PhysicsPhase_Contacts, /// @note(ame): trigger dispatch and callbacks
+    PhysicsPhase_Characters,
+    PhysicsPhase_Sync, /// @note(ame): reading back the dynamic bodies
+    PhysicsPhase_Max
+};
+
+struct physics_step_profile
+{
+    u64 step;
+    f64 begin_us[PhysicsPhase_Max]; /// @note(ame): since physics_profiler_init
+    f32 ms[PhysicsPhase_Max];
+
+    u32 bodies;
+    u32 active_bodies;
+    u32 characters;
+    u32 contacts_added;
+    u32 contacts_persisted;
+    u32 contacts_removed;
+    u32 trigger_events;
+    u32 trigger_pairs;
+};
+
+struct physics_profiler
+{
+    bool enabled;
+    timer epoch;
+
+    std::vector<physics_step_profile> history;
+    u64 steps; /// @note(ame): every step ever profiled, clearing doesn't reset it
+    u64 recorded; /// @note(ame): since the last clear, the newest is at (recorded - 1) % history.size()
+    physics_step_profile current;
+
+    /// @note(ame): bumped by the contact listener from the Jolt workers
+    std::atomic<u32> contacts_added;
+    std::atomic<u32> contacts_persisted;
+    std::atomic<u32> contacts_removed;
+};
+
+extern physics_profiler physics_profile;
+
+/// @note(ame): times one phase of the current step
+struct physics_profile_scope
+{
+    physics_phase phase;
+    f64 begin;
+
+    physics_profile_scope(physics_phase p);
+    ~physics_profile_scope();
+};
+
+/// @note(ame): registers physics_profile* cvars and the physics_profile command. Main thread.
+void physics_profiler_init();
+void physics_profiler_begin_step();
+/// @note(ame): takes ownership of the counters of the step and pushes it in the history
+void physics_profiler_end_step(u32 bodies, u32 active_bodies, u32 characters, u32 trigger_events, u32 trigger_pairs);
+void physics_profiler_clear();
+/// @note(ame): last `count` steps, 0 for the whole history, oldest first
+std::vector<physics_step_profile> physics_profiler_history(u32 count = 0);
+void physics_profiler_summary(u32 count = 0);
+void physics_profiler_export(const std::string& path, u32 count = 0);
@@ -8,6 +8,8 @@
 
 #include "wn_world.h"
 
+#define PLAYER_MODEL_PATH "assets/gltfs/player/untitled.gltf"
+
 void player_init(entity *p, glm::vec3 start_pos);
 void player_update(entity *p, f32 dt);
 void player_debug_draw(entity *p);
@@ -0,0 +1,104 @@
+//
+// $Notice: Xander Studios @ 2024
+// $Author: Amélie Heinrich
+// $Create Time: 2024-11-23 14:02:51
+//
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+
+#include "wn_common.h"
+
+/// @note(ame): bounded lock-free queue (Dmitry Vyukov's MPMC ring). Any number of producers and consumers,
+/// no allocation after init. Every cell carries a sequence number telling whose turn it is, so a push or
+/// a pop is one CAS on the shared position plus one release store on the cell.
+template<typename T>
+struct mpmc_queue
+{
+    struct cell
+    {
+        std::atomic<u64> sequence;
+        T data;
+    };
+
+    std::unique_ptr<cell[]> cells;
+    u64 mask = 0;
+
+    alignas(64) std::atomic<u64> enqueue_pos = 0;
+    alignas(64) std::atomic<u64> dequeue_pos = 0;
+};
+
+/// @note(ame): capacity is rounded up to a power of two
+template<typename T>
+void mpmc_queue_init(mpmc_queue<T> *queue, u64 capacity)
+{
+    u64 size = 2;
+    while (size < capacity) {
+        size <<= 1;
+    }
+
+    queue->cells.reset(new typename mpmc_queue<T>::cell[size]);
+    queue->mask = size - 1;
+    for (u64 i = 0; i < size; i++) {
+        queue->cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    queue->enqueue_pos.store(0, std::memory_order_relaxed);
+    queue->dequeue_pos.store(0, std::memory_order_relaxed);
+}
+
+/// @note(ame): returns false when the queue is full
+template<typename T>
+bool mpmc_queue_push(mpmc_queue<T> *queue, const T& value)
+{
+    u64 pos = queue->enqueue_pos.load(std::memory_order_relaxed);
+    while (true) {
+        typename mpmc_queue<T>::cell *cell = &queue->cells[pos & queue->mask];
+        u64 sequence = cell->sequence.load(std::memory_order_acquire);
+        i64 diff = (i64)sequence - (i64)pos;
+        if (diff == 0) {
+            if (queue->enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                cell->data = value;
+                cell->sequence.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = queue->enqueue_pos.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+/// @note(ame): returns false when the queue is empty
+template<typename T>
+bool mpmc_queue_pop(mpmc_queue<T> *queue, T *out)
+{
+    u64 pos = queue->dequeue_pos.load(std::memory_order_relaxed);
+    while (true) {
+        typename mpmc_queue<T>::cell *cell = &queue->cells[pos & queue->mask];
+        u64 sequence = cell->sequence.load(std::memory_order_acquire);
+        i64 diff = (i64)sequence - (i64)(pos + 1);
+        if (diff == 0) {
+            if (queue->dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                *out = cell->data;
+                cell->sequence.store(pos + queue->mask + 1, std::memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = queue->dequeue_pos.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+/// @note(ame): approximate, only meant for stats
+template<typename T>
+u64 mpmc_queue_size(mpmc_queue<T> *queue)
+{
+    u64 enqueued = queue->enqueue_pos.load(std::memory_order_relaxed);
+    u64 dequeued = queue->dequeue_pos.load(std::memory_order_relaxed);
+    return enqueued > dequeued ? enqueued - dequeued : 0;
+}
@@ -7,10 +7,23 @@
 #pragma once
 
 #include <unordered_map>
+#include <atomic>
+#include <mutex>
+#include <thread>
 
 #include "wn_gltf.h"
 #include "wn_d3d12.h"
 #include "wn_video.h"
+#include "wn_queue.h"
+#include "wn_job.h"
+
+/// @note(ame): RESOURCE CACHE
+/// request -> CPU side on the job system (GLTF import) -> main thread creates the GPU side (GLTF upload, texture enqueue)
+/// in resource_cache_update or in a wait. Requests for a path that is already cached or in flight share the same resource.
+/// The map is split in shards with their own lock. A resource that drops to 0 references stays resident on an LRU list,
+/// and only gets evicted (on the main thread) once the resident bytes go over the resource_cpu_mb/resource_gpu_mb budgets.
+#define RESOURCE_CACHE_SHARDS 16
+#define RESOURCE_CACHE_QUEUE_CAPACITY 4096
 
 enum resource_type
 {
@@ -19,25 +32,103 @@ enum resource_type
     ResourceType_Skybox, /// @note(ame): unused
     ResourceType_Audio, /// @note(ame): unused
     ResourceType_Navmesh, /// @note(ame): unused
-    ResourceType_Script /// @note(ame): unused
+    ResourceType_Script, /// @note(ame): unused
+    ResourceType_Max
+};
+
+enum resource_state
+{
+    ResourceState_Loading, /// @note(ame): CPU side in flight, or waiting on the main thread
+    ResourceState_Ready
 };
 
 struct resource
 {
     std::string path;
     resource_type type;
+    bool gen_collisions;
 
     gltf_model model;
     texture tex;
-    u32 ref_count = 0; /// @note(ame): used for resource reuse
+    std::atomic<u32> ref_count = 0; /// @note(ame): used for resource reuse
+    std::atomic<u32> state = ResourceState_Loading;
+    bool ready = true; /// @note(ame): false while a texture is still streaming in
+
+    job_counter loading;
+    gltf_load_state import;
+    bool created = false; /// @note(ame): main thread only, the GPU side exists
+
+    /// @note(ame): residency, sizes are filled in on the main thread once the GPU side exists
+    u64 cpu_bytes = 0;
+    u64 gpu_bytes = 0;
+    bool measured = false;
+    bool in_lru = false; /// @note(ame): guarded by resource_cache::lru_lock
+    resource *lru_prev = nullptr;
+    resource *lru_next = nullptr;
 };
 
-struct resource_cache
+struct resource_cache_shard
 {
+    std::mutex lock;
     std::unordered_map<std::string, resource*> resources;
 };
 
+struct resource_cache_stats
+{
+    std::atomic<u64> requests;
+    std::atomic<u64> hits; /// @note(ame): cached or already in flight
+    std::atomic<u64> loads;
+    std::atomic<u64> discarded; /// @note(ame): given back before the main thread got to them
+    std::atomic<u64> revived; /// @note(ame): hits on a resource sitting on the LRU list
+    std::atomic<u64> freed;
+    std::atomic<u64> evictions;
+    std::atomic<u64> evicted_bytes;
+};
+
+/// @note(ame): main thread only
+struct resource_residency
+{
+    u64 count[ResourceType_Max];
+    u64 cpu_bytes[ResourceType_Max];
+    u64 gpu_bytes[ResourceType_Max];
+    u64 cpu_total;
+    u64 gpu_total;
+    std::vector<resource*> unmeasured; /// @note(ame): textures still streaming in
+};
+
+struct resource_cache
+{
+    resource_cache_shard shards[RESOURCE_CACHE_SHARDS];
+    mpmc_queue<resource*> loaded; /// @note(ame): CPU side done, each entry holds a reference
+    std::thread::id main_thread;
+
+    /// @note(ame): lock order is shard -> lru_lock. Head is the most recently released.
+    std::mutex lru_lock;
+    resource *lru_head = nullptr;
+    resource *lru_tail = nullptr;
+    u64 lru_count = 0;
+
+    resource_residency residency = {};
+    resource_cache_stats stats;
+};
+
+extern resource_cache global_cache;
+
 void resource_cache_init();
+/// @note(ame): returns right away. Touch `model`/`tex` only once `state` is ResourceState_Ready (or after a wait).
+resource *resource_cache_request(const std::string& path, resource_type type, bool gen_collisions = true);
+/// @note(ame): only the main thread creates GPU resources, waiting from a job the main thread is itself waiting on will hang
+void resource_cache_wait(resource *res);
+/// @note(ame): the CPU sides of the whole set run in parallel, request everything first then wait once
+void resource_cache_wait_all(const std::vector<resource*>& set);
+/// @note(ame): request + wait
 resource *resource_cache_get(const std::string& path, resource_type type, bool gen_collisions = true);
+/// @note(ame): finishes a GLTF imported off the main thread (gltf_model_import). If the path is already cached the import is thrown away.
+resource *resource_cache_get_imported(const std::string& path, gltf_model *model, gltf_load_state *state);
+/// @note(ame): any thread. At 0 references the resource goes on the LRU list, a later request brings it back for free.
 void resource_cache_give_back(resource *res);
+/// @note(ame): main thread, once per frame. Finishes loaded resources and evicts down to the budgets.
+void resource_cache_update();
+/// @note(ame): main thread, evicts zero-ref resources (oldest first) until both totals fit
+void resource_cache_evict(u64 cpu_budget, u64 gpu_budget);
 void resource_cache_free();
@@ -19,11 +19,12 @@ enum shader_type
     /// @todo(ame): Mesh, amplification, raytracing?
 };
 
+/// @note(ame): bump when the .wns layout or the compiler arguments change
+#define SHADER_IMPORTER_VERSION 2
+
 struct shader_header
 {
     shader_type type;
-    u32 low_time;
-    u32 high_time;
     u32 size;
 };
 
@@ -20,4 +20,6 @@ struct timer
 
 void timer_init(timer *t);
 f32 timer_elasped(timer *t);
+/// @note(ame): microseconds, in double precision so it stays exact over hours
+f64 timer_elasped_us(timer *t);
 void timer_restart(timer *t);
@@ -7,23 +7,148 @@
 #pragma once
 
 #include <vector>
+#include <deque>
+#include <atomic>
+#include <unordered_map>
 
 #include "wn_bitmap.h"
 #include "wn_d3d12.h"
 #include "wn_output.h"
+#include "wn_queue.h"
+#include "wn_job.h"
+#include "wn_timer.h"
 
-struct upload_job
+/// @note(ame): STREAMING UPLOADER
+/// enqueue -> decode on the job system -> lock-free ready queue -> uploader_ctx_update copies into a persistent
+/// staging ring, under a per frame byte budget. Ring space comes back when the fence of the submit that used it passes.
+/// Copies go on the graphics queue ahead of the frame, so a texture can be sampled as soon as it is marked ready.
+
+struct upload_request
 {
     /// @todo(ame): support geometry
     std::string path;
     uncompressed_bitmap bitmap;
     texture* output_tex;
+    bool *ready; /// @note(ame): set to true once the copy is submitted, can be null
+
+    std::atomic<bool> cancelled = false;
+    bool prepared = false;
+    u64 staging_size = 0;
+};
+
+/// @note(ame): everything that talks to the GPU. The null backend makes the ring + queue logic run headless.
+struct copy_backend
+{
+    u64 alignment = 1;
+
+    virtual ~copy_backend() {}
+
+    virtual u8 *create_ring(u64 size) = 0;
+    virtual void destroy_ring() = 0;
+    /// @note(ame): creates the destination, returns how many staging bytes the request needs
+    virtual u64 prepare(upload_request *request) = 0;
+    /// @note(ame): `staging` points at ring_offset in the ring
+    virtual void record(upload_request *request, u8 *staging, u64 ring_offset) = 0;
+    /// @note(ame): for requests bigger than the whole ring
+    virtual void record_dedicated(upload_request *request) = 0;
+    virtual u64 submit() = 0;
+    virtual u64 completed_value() = 0;
+    virtual void retire(u64 completed) = 0;
+    virtual void wait(u64 value) = 0;
+};
+
+struct null_copy_backend : public copy_backend
+{
+    f32 latency_ms = 0.0f; /// @note(ame): simulated time between a submit and its fence completing
+
+    timer clock;
+    std::vector<u8> ring;
+    std::vector<std::pair<u64, std::vector<u8>>> dedicated;
+    std::deque<std::pair<u64, f64>> submits;
+    u64 fence_value = 0;
+    u64 completed = 0;
+    u64 recorded = 0;
+    u64 pending_dedicated = 0;
+
+    null_copy_backend();
+    u8 *create_ring(u64 size) override;
+    void destroy_ring() override;
+    u64 prepare(upload_request *request) override;
+    void record(upload_request *request, u8 *staging, u64 ring_offset) override;
+    void record_dedicated(upload_request *request) override;
+    u64 submit() override;
+    u64 completed_value() override;
+    void retire(u64 completed) override;
+    void wait(u64 value) override;
+};
+
+struct upload_ring_region
+{
+    u64 bytes; /// @note(ame): includes alignment padding and the bytes skipped when wrapping
+    u64 end;
+    u64 fence_value;
+};
+
+struct upload_ring
+{
+    u8 *memory;
+    u64 size;
+    u64 head;
+    u64 tail;
+    u64 used;
+
+    std::deque<upload_ring_region> in_flight;
+    u64 unsubmitted; /// @note(ame): how many regions at the back of in_flight don't have a fence yet
+};
+
+void upload_ring_init(upload_ring *ring, u8 *memory, u64 size);
+bool upload_ring_alloc(upload_ring *ring, u64 size, u64 alignment, u64 *offset);
+void upload_ring_submit(upload_ring *ring, u64 fence_value);
+void upload_ring_retire(upload_ring *ring, u64 completed_value);
+
+struct uploader_stats
+{
+    u64 frames;
+    u64 textures;
+    u64 bytes;
+    u64 max_frame_bytes;
+    u64 budget_stalls; /// @note(ame): frames that stopped because the byte budget ran out
+    u64 ring_stalls; /// @note(ame): frames that stopped because the ring was full
+    u64 dedicated; /// @note(ame): requests too big for the ring
+    f32 flush_wait_ms;
 };
 
 struct uploader_ctx
 {
-    std::vector<upload_job> jobs;
+    copy_backend *backend = nullptr;
+    upload_ring ring = {};
+
+    mpmc_queue<upload_request*> decoded;
+    job_counter decoding;
+    upload_request *stalled = nullptr; /// @note(ame): popped but didn't fit, goes first next update
+    std::unordered_map<texture*, upload_request*> pending;
+    u64 outstanding = 0;
+    u64 last_fence = 0;
+
+    uploader_stats stats = {};
 };
 
-void uploader_ctx_enqueue(const std::string& path, texture *out);
+extern uploader_ctx uploader;
+
+void uploader_ctx_init(uploader_ctx *ctx, copy_backend *backend, u64 ring_size);
+void uploader_ctx_exit(uploader_ctx *ctx);
+/// @note(ame): takes ownership of the request, the bitmap must already be decoded
+void uploader_ctx_push(uploader_ctx *ctx, upload_request *request);
+/// @note(ame): main thread, once per frame
+void uploader_ctx_update(uploader_ctx *ctx, u64 budget);
+/// @note(ame): returns once every enqueued request has been submitted
+void uploader_ctx_drain(uploader_ctx *ctx);
+
+/// @note(ame): global uploader, backed by D3D12
+void uploader_init();
+void uploader_exit();
+void uploader_ctx_enqueue(const std::string& path, texture *out, bool *ready = nullptr);
+/// @note(ame): returns false if the request already created the texture, the caller then frees it
+bool uploader_ctx_cancel(texture *out);
 void uploader_ctx_flush();
+void uploader_update();
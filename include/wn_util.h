@@ -8,5 +8,14 @@
 
 #include "wn_common.h"
 
-u64 wn_hash(const void *key, u32 len, u64 seed);
+u64 wn_hash(const void *key, u64 len, u64 seed);
 u64 wn_uuid();
+
+struct cpu_features
+{
+    bool sse41;
+    bool avx2;
+};
+
+/// @note(ame): queried once, cached after that
+const cpu_features& wn_cpu_features();
@@ -6,20 +6,31 @@
 
 #pragma once
 
+#include <atomic>
+#include <cfloat>
+#include <json/json.hpp>
+
 #include "wn_gltf.h"
 #include "wn_script.h"
 #include "wn_audio.h"
 #include "wn_resource_cache.h"
 #include "wn_ai.h"
+#include "wn_job.h"
 
 struct game_world;
 
+/// @note(ame): enemy capsule, the height doesn't count the caps
+#define ENEMY_RADIUS 0.4f
+#define ENEMY_HEIGHT 1.0f
+#define ENEMY_SPEED 3.5f
+
 enum entity_type
 {
     EntityType_NotPrecised,
     EntityType_Player,
     EntityType_Trigger,
-    EntityType_Enemy
+    EntityType_Enemy,
+    EntityType_Prop
 };
 
 enum trigger_type
@@ -52,11 +63,17 @@ struct entity
     game_world *parent_world;
 
     /// @brief Components
-    bool has_model;
-    resource* model;
+    bool has_model = false;
+    resource* model = nullptr; /// @note(ame): drawn at the body's (or character's) interpolated transform once it's ready
 
     bool has_physics_body;
     physics_body physics_body;
+    /// @note(ame): props and enemies, where the world JSON put them. That's what gets saved, not where they've been
+    /// pushed since.
+    glm::vec3 spawn_position = glm::vec3(0.0f);
+    glm::vec3 spawn_size = glm::vec3(0.0f);
+    /// @note(ame): EntityType_Prop tagged "navmesh_obstacle" in the world JSON, 0 otherwise
+    u32 navmesh_obstacle = 0;
 
     bool has_trigger;
     physics_trigger trigger;
@@ -71,10 +88,14 @@ struct entity
     glm::vec3 point_forward;
     glm::mat4 view_matrix;
 
-    /// @note(ame): unique to player entity
+    /// @note(ame): player and enemies
     bool has_physics_character;
     physics_character character;
 
+    /// @note(ame): EntityType_Enemy, its agent in the world navmesh crowd
+    i32 crowd_agent = -1;
+    glm::vec3 crowd_target = glm::vec3(FLT_MAX);
+
     bool has_scripts;
     std::vector<game_script> scripts;
 };
@@ -94,6 +115,7 @@ struct game_world
 
     /// @note(ame): World navmesh
     navmesh world_navmesh;
+    u64 crowd_steps = 0; /// @note(ame): physics.clock.steps at the last crowd update
 
     /// @note(ame): Game objects
     resource* level;
@@ -115,10 +137,62 @@ struct game_world_info
 
 void game_world_init(game_world *world, game_world_info *info);
 void game_world_load(game_world *world, const std::string& path);
+/// @note(ame): once the world is the current one and whatever it replaced has been freed. Takes the "level" snapshot.
+void game_world_enter(game_world *world);
 void game_world_save(game_world *world, const std::string& path = "");
 void game_world_remove_entity(game_world *world, entity* e);
 entity* game_world_add_trigger(game_world *world, glm::vec3 position, glm::vec3 size, glm::quat q = glm::quat(1.0f, 0.0f, 0.0f, 0.0f));
+/// @note(ame): a box prop, `size` being the half extents. Navmesh obstacles carve the world navmesh wherever the body goes.
+entity* game_world_add_body(game_world *world, glm::vec3 position, glm::vec3 size, bool dynamic, bool navmesh_obstacle);
+/// @note(ame): an enemy standing at `position` (its feet), chasing the player through the navmesh crowd
+entity* game_world_add_enemy(game_world *world, glm::vec3 position);
 void game_world_update(game_world *world, f32 dt);
 void game_world_free(game_world *world);
 
+/// @note(ame): LEVEL PRELOADING
+/// Once the player is within `preload_radius` of a transition trigger, the level behind it gets parsed, imported and cooked
+/// on the job system, and its navmesh loaded (or baked) with the obstacles it starts with carved out. Interact then only
+/// has the GPU + physics half left to do. Walking away cancels it.
+
+struct game_world_preload
+{
+    std::string path;
+    job_counter counter;
+    std::atomic<bool> cancelled = false;
+    resource *resident_level = nullptr; /// @note(ame): the current world's level model, set before the job starts. Not a reference,
+                                        /// game_world_free waits on the job before letting go of it.
+
+    /// @note(ame): written by the job, only read once the counter hits zero
+    nlohmann::json root;
+    std::string level_path;
+    gltf_model model;
+    gltf_load_state state;
+    bool imported = false;
+    bool resident = false; /// @note(ame): same level model as the current world, the resource cache already has it
+    navmesh world_navmesh; /// @note(ame): crowd and pathfinder included, nothing but the job touches it until the swap
+    bool failed = false; /// @note(ame): reported on the main thread, which then loads it the slow way
+};
+
+struct game_world_preloader
+{
+    game_world_preload *current = nullptr;
+    std::vector<game_world_preload*> cancelled; /// @note(ame): freed once their job is done
+
+    u32 started;
+    u32 used;
+    u32 missed; /// @note(ame): level changes that had nothing preloaded
+    u32 discarded;
+};
+
+extern game_world_preloader preloader;
+
+/// @note(ame): main thread, once per frame
+void game_world_preload_update(game_world *world);
+/// @note(ame): loads `path` from the preload if there is one (waiting on it if it is still in flight), else from scratch
+void game_world_load_preloaded(game_world *world, const std::string& path);
+/// @note(ame): waits on the preloads still reading `level`, before it can go away
+void game_world_preload_release(resource *level);
+void game_world_preload_init();
+void game_world_preload_exit();
+
 /// @todo(ame): Serialization
@@ -4,8 +4,20 @@
 // $Create Time: 2024-11-11 16:32:01
 //
 
+#include <cfloat>
+#include <algorithm>
+
+#include <recast/DetourCommon.h>
+
 #include "wn_ai.h"
 #include "wn_output.h"
+#include "wn_asset_cache.h"
+#include "wn_filesystem.h"
+#include "wn_cvar.h"
+#include "wn_job.h"
+#include "wn_timer.h"
+#include "wn_util.h"
+#include "wn_pak.h"
 
 class navmesh_ctx : public rcContext
 {
@@ -23,211 +35,1478 @@ protected:
     }
 };
 
-void navmesh_init(navmesh *mesh, const navmesh_build_info& info)
+void navmesh_system_init()
 {
-    /// @note(ame): calculate bounding box
-    std::vector<f32> vertices;
-    std::vector<i32> triangles;
+    cvar_register_unsigned("navmesh_tile_size", 64);
+    cvar_register_float("navmesh_cell_size", 0.3f);
+    cvar_register_float("navmesh_cell_height", 0.2f);
+    cvar_register_float("navmesh_rebuild_budget_ms", 2.0f);
+    cvar_register_float("navmesh_obstacle_threshold", 0.1f);
+    cvar_register_unsigned("crowd_max_agents", 256);
+    cvar_register_float("crowd_retarget_distance", 1.0f);
+    cvar_register_unsigned("pathfind_cache_size", 256);
+    cvar_register_float("pathfind_budget_ms", 1.0f);
+}
 
-    for (auto& vertex : info.vertices) {
-        vertices.push_back(vertex.Position.x);
-        vertices.push_back(vertex.Position.y);
-        vertices.push_back(vertex.Position.z);
-    }
-    for (auto& tri : info.indices) {
-        triangles.push_back(i32(tri));
+navmesh_settings navmesh_get_settings()
+{
+    static console_var *tile_size = cvar_get("navmesh_tile_size");
+    static console_var *cell_size = cvar_get("navmesh_cell_size");
+    static console_var *cell_height = cvar_get("navmesh_cell_height");
+
+    navmesh_settings settings = {};
+    settings.cell_size = std::max(cell_size->as.f, 0.05f);
+    settings.cell_height = std::max(cell_height->as.f, 0.05f);
+    settings.agent_height = 2.0f;
+    settings.agent_radius = 0.5f;
+    settings.agent_max_climb = 0.9f;
+    settings.agent_max_slope = 45.0f;
+    settings.tile_size = std::clamp<u32>(tile_size->as.u, 16, 1024);
+    return settings;
+}
+
+u64 navmesh_settings_hash(const navmesh_settings& settings)
+{
+    return wn_hash(&settings, sizeof(settings), 1000);
+}
+
+/// @note(ame): what every tile reads from. The positions are the caller's, only the per-triangle data is ours.
+struct navmesh_geometry
+{
+    geometry_view view;
+    std::vector<u8> areas; /// @note(ame): one per triangle
+    std::vector<std::vector<u32>> tile_triangles; /// @note(ame): the triangles overlapping each tile, border included
+};
+
+/// @note(ame): RC_WALKABLE_AREA where the face is flat enough to stand on, RC_NULL_AREA (0) everywhere else
+void navmesh_mark_walkable(navmesh_geometry *geometry, f32 max_slope, u32 max_threads)
+{
+    const u32 chunk = 16384;
+    u32 triangle_count = (u32)geometry->areas.size();
+    job_parallel_for((triangle_count + chunk - 1) / chunk, [&](u32 block) {
+        u32 first = block * chunk;
+        u32 count = std::min(triangle_count - first, chunk);
+        geometry_classify_slopes(geometry->view, max_slope, RC_WALKABLE_AREA, first, count, geometry->areas.data() + first);
+    }, max_threads);
+}
+
+/// @note(ame): buckets every triangle into the tiles its bounds overlap
+void navmesh_bucket_triangles(navmesh_geometry *geometry, const navmesh *mesh)
+{
+    const f32 tile_width = mesh->settings.tile_size * mesh->config.cs;
+    const f32 border = mesh->config.borderSize * mesh->config.cs;
+    const f32 *origin = mesh->params.orig;
+
+    geometry->tile_triangles.assign(mesh->tiles_x * mesh->tiles_z, {});
+    u32 triangle_count = (u32)geometry->areas.size();
+    for (u32 i = 0; i < triangle_count; i++) {
+        glm::vec3 min(FLT_MAX), max(-FLT_MAX);
+        for (u32 j = 0; j < 3; j++) {
+            glm::vec3 v = geometry_position(geometry->view, geometry->view.indices[i * 3 + j]);
+            min = glm::min(min, v);
+            max = glm::max(max, v);
+        }
+
+        i32 x0 = std::max((i32)std::floor((min.x - origin[0] - border) / tile_width), 0);
+        i32 x1 = std::min((i32)std::floor((max.x - origin[0] + border) / tile_width), (i32)mesh->tiles_x - 1);
+        i32 z0 = std::max((i32)std::floor((min.z - origin[2] - border) / tile_width), 0);
+        i32 z1 = std::min((i32)std::floor((max.z - origin[2] + border) / tile_width), (i32)mesh->tiles_z - 1);
+        for (i32 z = z0; z <= z1; z++) {
+            for (i32 x = x0; x <= x1; x++) {
+                geometry->tile_triangles[z * mesh->tiles_x + x].push_back(i);
+            }
+        }
     }
+}
 
-    const f32 agent_height = 2.0f;
-    const f32 agent_max_climb = 0.9f;
-    const f32 agent_radius = 0.5f;
+/// @note(ame): everything a tile allocates on its way to a Detour tile, freed whichever step fails
+struct navmesh_tile_scratch
+{
+    rcHeightfield* height_field = nullptr;
+    rcCompactHeightfield* compact_height_field = nullptr;
+    rcContourSet* contour_set = nullptr;
+    rcPolyMesh* poly_mesh = nullptr;
+    rcPolyMeshDetail* poly_mesh_detail = nullptr;
 
-    mesh->config = {};
-    mesh->config.cs = 0.3f;
-    mesh->config.ch = 0.2f;
-    mesh->config.walkableHeight = (i32)ceilf(agent_height / mesh->config.ch);
-	mesh->config.walkableClimb = (i32)floorf(agent_max_climb / mesh->config.ch);
-	mesh->config.walkableRadius = (i32)ceilf(agent_radius / mesh->config.cs);
-    mesh->config.walkableSlopeAngle = 45.0f;
-	mesh->config.maxEdgeLen = (i32)(12.0f / mesh->config.cs);
-    mesh->config.maxSimplificationError = 1.3f;
-	mesh->config.minRegionArea = (i32)rcSqr(8);		// Note: area = size*size
-	mesh->config.mergeRegionArea = (i32)rcSqr(20);	// Note: area = size*size
-	mesh->config.maxVertsPerPoly = (i32)6.0f;
-	mesh->config.detailSampleDist = 6.0f < 0.9f ? 0 : mesh->config.cs * 6.0f;
-	mesh->config.detailSampleMaxError = mesh->config.ch * 1.0f;
-
-    rcVcopy(mesh->config.bmin, glm::value_ptr(info.min));
-	rcVcopy(mesh->config.bmax, glm::value_ptr(info.max));
-    rcCalcGridSize(mesh->config.bmin, mesh->config.bmax, mesh->config.cs, &mesh->config.width, &mesh->config.height);
-
-    mesh->height_field = rcAllocHeightfield();
-    if (!mesh->height_field) {
-        log("[navmesh] failed to allocate height field!");
-        throw_error("AI error");
+    ~navmesh_tile_scratch()
+    {
+        rcFreePolyMeshDetail(poly_mesh_detail);
+        rcFreePolyMesh(poly_mesh);
+        rcFreeContourSet(contour_set);
+        rcFreeCompactHeightfield(compact_height_field);
+        rcFreeHeightField(height_field);
     }
+};
 
-    if (!rcCreateHeightfield(nullptr,
-                             *mesh->height_field,
-                             mesh->config.width,
-                             mesh->config.height,
-                             mesh->config.bmin,
-                             mesh->config.bmax,
-                             mesh->config.cs,
-                             mesh->config.ch)) {
-        log("[navmesh] failed to create height field!");
-        throw_error("AI error");
+bool navmesh_tile_fail(const navmesh_tile_data *tile, const char *step)
+{
+    log("[navmesh] tile (%d, %d): failed to %s!", tile->x, tile->z, step);
+    return false;
+}
+
+/// @note(ame): the tile plus a border, so the regions line up with the neighbouring tiles
+rcConfig navmesh_tile_config(const navmesh *mesh, i32 x, i32 z)
+{
+    rcConfig config = mesh->config;
+    const f32 tile_width = mesh->settings.tile_size * config.cs;
+    const f32 border = config.borderSize * config.cs;
+    config.bmin[0] = mesh->params.orig[0] + x * tile_width - border;
+    config.bmin[2] = mesh->params.orig[2] + z * tile_width - border;
+    config.bmax[0] = mesh->params.orig[0] + (x + 1) * tile_width + border;
+    config.bmax[2] = mesh->params.orig[2] + (z + 1) * tile_width + border;
+    return config;
+}
+
+/// @note(ame): the triangles of the tile down to a filtered compact heightfield, erosion not included.
+/// An empty tile succeeds with no heightfield.
+bool navmesh_rasterize_tile(const navmesh *mesh, const navmesh_geometry& geometry, const navmesh_tile_data *tile, rcContext *ctx, navmesh_tile_scratch *scratch)
+{
+    const std::vector<u32>& tile_triangles = geometry.tile_triangles[tile->z * mesh->tiles_x + tile->x];
+    if (tile_triangles.empty()) {
+        return true;
     }
 
-    u8* tri_areas = new u8[triangles.size()];
-    memset(tri_areas, 0, triangles.size());
-    /// @note(ame): mark walkable triangles
-    {
-        const f32 threshold = std::cosf(glm::radians(mesh->config.walkableSlopeAngle));
+    rcConfig config = navmesh_tile_config(mesh, tile->x, tile->z);
 
-        for (i32 i = 0; i < info.indices.size(); i++) {
-            if (info.vertices[info.indices[i]].Normals.y > threshold) {
-                tri_areas[i] = RC_WALKABLE_AREA;
-            }
+    /// @note(ame): Recast wants interleaved positions, so the tile gets its own triangle soup. Only its triangles, and they
+    /// all get rasterized anyway, so that's the one pass over them we'd have paid for.
+    std::vector<f32> vertices(tile_triangles.size() * 9);
+    std::vector<u8> areas(tile_triangles.size());
+    for (u64 i = 0; i < tile_triangles.size(); i++) {
+        u32 triangle = tile_triangles[i];
+        for (u32 j = 0; j < 3; j++) {
+            u32 index = geometry.view.indices[triangle * 3 + j];
+            vertices[i * 9 + j * 3 + 0] = geometry.view.x[index];
+            vertices[i * 9 + j * 3 + 1] = geometry.view.y[index];
+            vertices[i * 9 + j * 3 + 2] = geometry.view.z[index];
         }
+        areas[i] = geometry.areas[triangle];
     }
 
-    rcContext *ctx = new navmesh_ctx;
-    ctx->enableLog(true);
-
+    scratch->height_field = rcAllocHeightfield();
+    if (!scratch->height_field) {
+        return navmesh_tile_fail(tile, "allocate height field");
+    }
+    if (!rcCreateHeightfield(ctx, *scratch->height_field, config.width, config.height, config.bmin, config.bmax, config.cs, config.ch)) {
+        return navmesh_tile_fail(tile, "create height field");
+    }
     if (!rcRasterizeTriangles(ctx,
                               vertices.data(),
-                              vertices.size(),
-                              triangles.data(),
-                              tri_areas,
-                              triangles.size() / 3,
-                              *mesh->height_field,
-                              mesh->config.walkableClimb)) {
-        log("[navmesh] failed to rasterize triangles!");
-        throw_error("AI error");
+                              areas.data(),
+                              (i32)areas.size(),
+                              *scratch->height_field,
+                              config.walkableClimb)) {
+        return navmesh_tile_fail(tile, "rasterize triangles");
     }
 
-    mesh->compact_height_field = rcAllocCompactHeightfield();
-    if (!mesh->compact_height_field) {
-        log("[navmesh] failed to allocate compact heightfield!");
-        throw_error("AI error");
+    rcFilterLowHangingWalkableObstacles(ctx, config.walkableClimb, *scratch->height_field);
+    rcFilterLedgeSpans(ctx, config.walkableHeight, config.walkableClimb, *scratch->height_field);
+    rcFilterWalkableLowHeightSpans(ctx, config.walkableHeight, *scratch->height_field);
+
+    scratch->compact_height_field = rcAllocCompactHeightfield();
+    if (!scratch->compact_height_field) {
+        return navmesh_tile_fail(tile, "allocate compact heightfield");
     }
+    if (!rcBuildCompactHeightfield(ctx, config.walkableHeight, config.walkableClimb, *scratch->height_field, *scratch->compact_height_field)) {
+        return navmesh_tile_fail(tile, "build compact heightfield");
+    }
+    rcFreeHeightField(scratch->height_field);
+    scratch->height_field = nullptr;
+    return true;
+}
 
-    if (!rcBuildCompactHeightfield(ctx, mesh->config.walkableHeight, mesh->config.walkableClimb, *mesh->height_field, *mesh->compact_height_field)) {
-        log("[navmesh] failed to build compact heightfield!");
-        throw_error("AI error");
+/// @note(ame): obstacles, erosion, partition, contours and polygons, then the Detour tile. An empty tile succeeds with no data.
+bool navmesh_finish_tile(const navmesh *mesh, const std::vector<navmesh_obstacle>& obstacles, navmesh_tile_data *tile, rcContext *ctx, navmesh_tile_scratch *scratch)
+{
+    rcConfig config = navmesh_tile_config(mesh, tile->x, tile->z);
+    rcCompactHeightfield *chf = scratch->compact_height_field;
+
+    /// @note(ame): carved before erosion, so agents keep their radius away from obstacles too. Spans the obstacle stands on
+    /// sit right under it, hence the climb below its bounds.
+    for (const navmesh_obstacle& obstacle : obstacles) {
+        if (obstacle.max.x < config.bmin[0] || obstacle.min.x > config.bmax[0] || obstacle.max.z < config.bmin[2] || obstacle.min.z > config.bmax[2]) {
+            continue;
+        }
+        glm::vec3 min = obstacle.min - glm::vec3(0.0f, mesh->settings.agent_max_climb, 0.0f);
+        rcMarkBoxArea(ctx, glm::value_ptr(min), glm::value_ptr(obstacle.max), RC_NULL_AREA, *chf);
     }
 
-    if (!rcErodeWalkableArea(ctx, mesh->config.walkableRadius, *mesh->compact_height_field)) {
-        log("[navmesh] failed to erode walkable area!");
-        throw_error("AI error");
+    if (!rcErodeWalkableArea(ctx, config.walkableRadius, *chf)) {
+        return navmesh_tile_fail(tile, "erode walkable area");
+    }
+
+    /// @note(ame): still watershed -- slow, but tiles are small, build in parallel and get baked anyway
+    if (!rcBuildDistanceField(ctx, *chf)) {
+        return navmesh_tile_fail(tile, "build distance field");
+    }
+    if (!rcBuildRegions(ctx, *chf, config.borderSize, config.minRegionArea, config.mergeRegionArea)) {
+        return navmesh_tile_fail(tile, "build regions");
     }
 
-    /// @note(ame): This uses the watershed navmesh approach -- its slow to compute but great since we'll bake them anyway.
-    /// Check out this: https://github.com/recastnavigation/recastnavigation/blob/main/RecastDemo/Source/Sample_SoloMesh.cpp#L521
+    scratch->contour_set = rcAllocContourSet();
+    if (!scratch->contour_set) {
+        return navmesh_tile_fail(tile, "allocate contour set");
+    }
+    if (!rcBuildContours(ctx, *chf, config.maxSimplificationError, config.maxEdgeLen, *scratch->contour_set)) {
+        return navmesh_tile_fail(tile, "build contour set");
+    }
+    if (scratch->contour_set->nconts == 0) {
+        return true;
+    }
 
-    if (!rcBuildDistanceField(ctx, *mesh->compact_height_field)) {
-        log("[navmesh] failed to build distance field!");
-        throw_error("AI error");
+    scratch->poly_mesh = rcAllocPolyMesh();
+    if (!scratch->poly_mesh) {
+        return navmesh_tile_fail(tile, "allocate poly mesh");
+    }
+    if (!rcBuildPolyMesh(ctx, *scratch->contour_set, config.maxVertsPerPoly, *scratch->poly_mesh)) {
+        return navmesh_tile_fail(tile, "build poly mesh");
     }
 
-    if (!rcBuildRegions(ctx, *mesh->compact_height_field, 0, mesh->config.minRegionArea, mesh->config.mergeRegionArea)) {
-        log("[navmesh] failed to build navmesh regions!");
-        throw_error("AI error");
+    scratch->poly_mesh_detail = rcAllocPolyMeshDetail();
+    if (!scratch->poly_mesh_detail) {
+        return navmesh_tile_fail(tile, "allocate poly mesh detail");
+    }
+    if (!rcBuildPolyMeshDetail(ctx, *scratch->poly_mesh, *chf, config.detailSampleDist, config.detailSampleMaxError, *scratch->poly_mesh_detail)) {
+        return navmesh_tile_fail(tile, "build poly mesh detail");
     }
 
-    mesh->contour_set = rcAllocContourSet();
-    if (!mesh->contour_set) {
-        log("[navmesh] failed to allocate contour set!");
-        throw_error("AI error");
+    rcPolyMesh *poly_mesh = scratch->poly_mesh;
+    if (poly_mesh->npolys == 0) {
+        return true;
+    }
+    if (poly_mesh->nverts >= 0xffff) {
+        return navmesh_tile_fail(tile, "fit the tile in 16 bit vertex indices, lower navmesh_tile_size");
     }
 
-    if (!rcBuildContours(ctx, *mesh->compact_height_field, mesh->config.maxSimplificationError, mesh->config.maxEdgeLen, *mesh->contour_set)) {
-        log("[navmesh] failed to build contour set!");
-        throw_error("AI error");
+    /// @note(ame): the default query filter skips polygons without flags
+    for (i32 i = 0; i < poly_mesh->npolys; i++) {
+        if (poly_mesh->areas[i] == RC_WALKABLE_AREA) {
+            poly_mesh->flags[i] = NavmeshPoly_Walk;
+        }
     }
 
-    mesh->poly_mesh = rcAllocPolyMesh();
-    if (!mesh->poly_mesh) {
-        log("[navmesh] failed to allocate poly mesh!");
-        throw_error("AI error");
+    dtNavMeshCreateParams params;
+    memset(&params, 0, sizeof(params));
+    params.verts = poly_mesh->verts;
+    params.vertCount = poly_mesh->nverts;
+    params.polys = poly_mesh->polys;
+    params.polyAreas = poly_mesh->areas;
+    params.polyFlags = poly_mesh->flags;
+    params.polyCount = poly_mesh->npolys;
+    params.nvp = poly_mesh->nvp;
+    params.detailMeshes = scratch->poly_mesh_detail->meshes;
+    params.detailVerts = scratch->poly_mesh_detail->verts;
+    params.detailVertsCount = scratch->poly_mesh_detail->nverts;
+    params.detailTris = scratch->poly_mesh_detail->tris;
+    params.detailTriCount = scratch->poly_mesh_detail->ntris;
+    params.walkableHeight = mesh->settings.agent_height;
+    params.walkableRadius = mesh->settings.agent_radius;
+    params.walkableClimb = mesh->settings.agent_max_climb;
+    params.tileX = tile->x;
+    params.tileY = tile->z;
+    params.tileLayer = 0;
+    rcVcopy(params.bmin, poly_mesh->bmin);
+    rcVcopy(params.bmax, poly_mesh->bmax);
+    params.cs = config.cs;
+    params.ch = config.ch;
+    params.buildBvTree = true;
+
+    if (!dtCreateNavMeshData(&params, &tile->data, &tile->size)) {
+        return navmesh_tile_fail(tile, "create navmesh data");
     }
+    return true;
+}
 
-    if (!rcBuildPolyMesh(ctx, *mesh->contour_set, mesh->config.maxVertsPerPoly, *mesh->poly_mesh)) {
-        log("[navmesh] failed to build poly mesh!");
-        throw_error("AI error");
+/// @note(ame): COMPACT HEIGHTFIELDS
+/// header | cells | spans | areas. Distances and regions are rebuilt every time, they aren't stored.
+struct navmesh_heightfield_header
+{
+    i32 width;
+    i32 height;
+    i32 span_count;
+    i32 walkable_height;
+    i32 walkable_climb;
+    i32 border_size;
+    f32 bmin[3];
+    f32 bmax[3];
+    f32 cs;
+    f32 ch;
+};
+
+void navmesh_heightfield_pack(const rcCompactHeightfield& chf, navmesh_heightfield *out)
+{
+    navmesh_heightfield_header header = {};
+    header.width = chf.width;
+    header.height = chf.height;
+    header.span_count = chf.spanCount;
+    header.walkable_height = chf.walkableHeight;
+    header.walkable_climb = chf.walkableClimb;
+    header.border_size = chf.borderSize;
+    rcVcopy(header.bmin, chf.bmin);
+    rcVcopy(header.bmax, chf.bmax);
+    header.cs = chf.cs;
+    header.ch = chf.ch;
+
+    u64 cells_size = u64(chf.width) * chf.height * sizeof(rcCompactCell);
+    u64 spans_size = u64(chf.spanCount) * sizeof(rcCompactSpan);
+    u64 areas_size = u64(chf.spanCount);
+
+    std::vector<u8> raw(sizeof(header) + cells_size + spans_size + areas_size);
+    u8 *cursor = raw.data();
+    memcpy(cursor, &header, sizeof(header));
+    cursor += sizeof(header);
+    memcpy(cursor, chf.cells, cells_size);
+    cursor += cells_size;
+    memcpy(cursor, chf.spans, spans_size);
+    cursor += spans_size;
+    memcpy(cursor, chf.areas, areas_size);
+
+    out->size = raw.size();
+    out->bytes.resize(raw.size());
+    u64 compressed = pak_compress(raw.data(), raw.size(), out->bytes.data(), raw.size());
+    out->compressed = compressed > 0;
+    if (out->compressed) {
+        out->bytes.resize(compressed);
+    } else {
+        out->bytes = std::move(raw);
     }
+}
 
-    mesh->poly_mesh_detail = rcAllocPolyMeshDetail();
-    if (!mesh->poly_mesh_detail) {
-        log("[navmesh] failed to allocate poly mesh detail!");
-        throw_error("AI error");
+bool navmesh_heightfield_unpack(const navmesh_heightfield& in, rcCompactHeightfield *chf)
+{
+    std::vector<u8> raw(in.size);
+    if (in.compressed) {
+        if (!pak_decompress(in.bytes.data(), in.bytes.size(), raw.data(), raw.size())) {
+            return false;
+        }
+    } else {
+        if (in.bytes.size() != in.size) {
+            return false;
+        }
+        memcpy(raw.data(), in.bytes.data(), in.size);
+    }
+    if (raw.size() < sizeof(navmesh_heightfield_header)) {
+        return false;
     }
 
-    if (!rcBuildPolyMeshDetail(ctx, *mesh->poly_mesh, *mesh->compact_height_field, mesh->config.detailSampleDist, mesh->config.detailSampleMaxError, *mesh->poly_mesh_detail)) {
-        log("[navmesh] failed to build poly mesh detail!");
-        throw_error("AI error");
+    navmesh_heightfield_header header;
+    memcpy(&header, raw.data(), sizeof(header));
+    u64 cells_size = u64(header.width) * header.height * sizeof(rcCompactCell);
+    u64 spans_size = u64(header.span_count) * sizeof(rcCompactSpan);
+    u64 areas_size = u64(header.span_count);
+    if (sizeof(header) + cells_size + spans_size + areas_size != raw.size()) {
+        return false;
     }
 
-    u8* nav_data;
-    i32 nav_data_size;
+    chf->width = header.width;
+    chf->height = header.height;
+    chf->spanCount = header.span_count;
+    chf->walkableHeight = header.walkable_height;
+    chf->walkableClimb = header.walkable_climb;
+    chf->borderSize = header.border_size;
+    rcVcopy(chf->bmin, header.bmin);
+    rcVcopy(chf->bmax, header.bmax);
+    chf->cs = header.cs;
+    chf->ch = header.ch;
 
-    dtNavMeshCreateParams params;
-	memset(&params, 0, sizeof(params));
-	params.verts = mesh->poly_mesh->verts;
-	params.vertCount = mesh->poly_mesh->nverts;
-	params.polys = mesh->poly_mesh->polys;
-	params.polyAreas = mesh->poly_mesh->areas;
-	params.polyFlags = mesh->poly_mesh->flags;
-	params.polyCount = mesh->poly_mesh->npolys;
-	params.nvp = mesh->poly_mesh->nvp;
-	params.detailMeshes = mesh->poly_mesh_detail->meshes;
-	params.detailVerts = mesh->poly_mesh_detail->verts;
-	params.detailVertsCount = mesh->poly_mesh_detail->nverts;
-	params.detailTris = mesh->poly_mesh_detail->tris;
-	params.detailTriCount = mesh->poly_mesh_detail->ntris;
-	params.walkableHeight = agent_height;
-	params.walkableRadius = agent_radius;
-	params.walkableClimb = agent_max_climb;
-	rcVcopy(params.bmin, mesh->poly_mesh->bmin);
-	rcVcopy(params.bmax, mesh->poly_mesh->bmax);
-	params.cs = mesh->config.cs;
-	params.ch = mesh->config.ch;
-	params.buildBvTree = true;
-
-    if (!dtCreateNavMeshData(&params, &nav_data, &nav_data_size)) {
-        log("[navmesh] failed to create navmesh data!");
-        throw_error("AI error");
+    chf->cells = (rcCompactCell*)rcAlloc(cells_size, RC_ALLOC_PERM);
+    chf->spans = (rcCompactSpan*)rcAlloc(spans_size, RC_ALLOC_PERM);
+    chf->areas = (u8*)rcAlloc(areas_size, RC_ALLOC_PERM);
+    if (!chf->cells || !chf->spans || !chf->areas) {
+        return false;
+    }
+
+    const u8 *cursor = raw.data() + sizeof(header);
+    memcpy(chf->cells, cursor, cells_size);
+    cursor += cells_size;
+    memcpy(chf->spans, cursor, spans_size);
+    cursor += spans_size;
+    memcpy(chf->areas, cursor, areas_size);
+    return true;
+}
+
+/// @note(ame): returns false if a step failed. Tiles that end up with polygons keep their heightfield for the rebuilds.
+bool navmesh_build_tile(const navmesh *mesh, const navmesh_geometry& geometry, navmesh_tile_data *tile)
+{
+    navmesh_ctx ctx;
+    ctx.enableLog(true);
+    navmesh_tile_scratch scratch;
+
+    if (!navmesh_rasterize_tile(mesh, geometry, tile, &ctx, &scratch)) {
+        return false;
+    }
+    if (!scratch.compact_height_field) {
+        return true;
     }
 
-    /// @todo(ame): Bake that
-    ///
-    //////
+    /// @note(ame): packed up front, erosion works in place
+    navmesh_heightfield heightfield;
+    navmesh_heightfield_pack(*scratch.compact_height_field, &heightfield);
 
+    std::vector<navmesh_obstacle> no_obstacles;
+    if (!navmesh_finish_tile(mesh, no_obstacles, tile, &ctx, &scratch)) {
+        return false;
+    }
+    if (tile->data) {
+        tile->heightfield = std::move(heightfield);
+    }
+    return true;
+}
+
+/// @note(ame): the tile grid, the per tile config and an empty dtNavMesh to add the tiles to
+void navmesh_setup(navmesh *mesh, glm::vec3 min, glm::vec3 max, const navmesh_settings& settings)
+{
+    mesh->settings = settings;
+
+    mesh->config = {};
+    mesh->config.cs = settings.cell_size;
+    mesh->config.ch = settings.cell_height;
+    mesh->config.walkableSlopeAngle = settings.agent_max_slope;
+    mesh->config.walkableHeight = (i32)ceilf(settings.agent_height / mesh->config.ch);
+    mesh->config.walkableClimb = (i32)floorf(settings.agent_max_climb / mesh->config.ch);
+    mesh->config.walkableRadius = (i32)ceilf(settings.agent_radius / mesh->config.cs);
+    mesh->config.maxEdgeLen = (i32)(12.0f / mesh->config.cs);
+    mesh->config.maxSimplificationError = 1.3f;
+    mesh->config.minRegionArea = (i32)rcSqr(8);		// Note: area = size*size
+    mesh->config.mergeRegionArea = (i32)rcSqr(20);	// Note: area = size*size
+    mesh->config.maxVertsPerPoly = 6;
+    mesh->config.detailSampleDist = mesh->config.cs * 6.0f;
+    mesh->config.detailSampleMaxError = mesh->config.ch * 1.0f;
+    mesh->config.tileSize = (i32)settings.tile_size;
+    mesh->config.borderSize = mesh->config.walkableRadius + 3;
+    mesh->config.width = mesh->config.tileSize + mesh->config.borderSize * 2;
+    mesh->config.height = mesh->config.tileSize + mesh->config.borderSize * 2;
+    rcVcopy(mesh->config.bmin, glm::value_ptr(min));
+    rcVcopy(mesh->config.bmax, glm::value_ptr(max));
+
+    i32 grid_width, grid_height;
+    rcCalcGridSize(mesh->config.bmin, mesh->config.bmax, mesh->config.cs, &grid_width, &grid_height);
+    mesh->tiles_x = std::max((grid_width + mesh->config.tileSize - 1) / mesh->config.tileSize, 1);
+    mesh->tiles_z = std::max((grid_height + mesh->config.tileSize - 1) / mesh->config.tileSize, 1);
+
+    /// @note(ame): a poly ref has 22 bits to split between the tile and the polygon within it
+    i32 tile_bits = std::min((i32)dtIlog2(dtNextPow2(mesh->tiles_x * mesh->tiles_z)), 14);
+    mesh->params = {};
+    rcVcopy(mesh->params.orig, mesh->config.bmin);
+    mesh->params.tileWidth = settings.tile_size * mesh->config.cs;
+    mesh->params.tileHeight = settings.tile_size * mesh->config.cs;
+    mesh->params.maxTiles = 1 << tile_bits;
+    mesh->params.maxPolys = 1 << (22 - tile_bits);
+
+    mesh->heightfields.assign(mesh->tiles_x * mesh->tiles_z, {});
+}
+
+void navmesh_create(navmesh *mesh)
+{
     mesh->mesh = dtAllocNavMesh();
     if (!mesh->mesh) {
         log("[navmesh] failed to allocate navmesh");
         throw_error("AI error");
     }
 
-    dtStatus status = mesh->mesh->init(nav_data, nav_data_size, DT_TILE_FREE_DATA);
+    dtStatus status = mesh->mesh->init(&mesh->params);
     if (dtStatusFailed(status)) {
-        dtFree(nav_data);
         log("[navmesh] failed to create navmesh!");
         throw_error("AI error");
     }
 
-    delete tri_areas;
-    delete ctx;
+    mesh->tile_count = 0;
+    mesh->poly_count = 0;
+}
+
+/// @note(ame): the navmesh owns the data from here, whether it made it in or not
+void navmesh_add_tile(navmesh *mesh, u8 *data, i32 size)
+{
+    dtTileRef ref = 0;
+    if (dtStatusFailed(mesh->mesh->addTile(data, size, DT_TILE_FREE_DATA, 0, &ref))) {
+        log("[navmesh] failed to add tile!");
+        dtFree(data);
+        return;
+    }
+    mesh->tile_count++;
+    mesh->poly_count += mesh->mesh->getTileByRef(ref)->header->polyCount;
+}
+
+void navmesh_bounds(const navmesh_build_info& info, glm::vec3 *min, glm::vec3 *max)
+{
+    if (info.min != info.max) {
+        *min = info.min;
+        *max = info.max;
+        return;
+    }
+    geometry_bounds(info.geometry, min, max);
+}
+
+bool navmesh_bake(navmesh *mesh, const navmesh_build_info& info, const navmesh_settings& settings, u32 max_threads)
+{
+    if (info.geometry.index_count < 3) {
+        log("[navmesh] no geometry to bake");
+        return false;
+    }
+
+    timer t;
+    timer_init(&t);
+
+    glm::vec3 min, max;
+    navmesh_bounds(info, &min, &max);
+    navmesh_setup(mesh, min, max, settings);
+    navmesh_create(mesh);
+
+    navmesh_geometry geometry;
+    geometry.view = info.geometry;
+    geometry.areas.resize(info.geometry.index_count / 3);
+
+    navmesh_mark_walkable(&geometry, settings.agent_max_slope, max_threads);
+    navmesh_bucket_triangles(&geometry, mesh);
+
+    std::vector<navmesh_tile_data> tiles(mesh->tiles_x * mesh->tiles_z);
+    for (u32 i = 0; i < tiles.size(); i++) {
+        tiles[i].x = i % mesh->tiles_x;
+        tiles[i].z = i / mesh->tiles_x;
+    }
+
+    std::atomic<u32> failed = 0;
+    job_parallel_for(tiles.size(), [&](u32 i) {
+        if (!navmesh_build_tile(mesh, geometry, &tiles[i])) {
+            failed++;
+        }
+    }, max_threads);
+
+    /// @note(ame): addTile isn't thread safe, the tiles go in in order once they're all built
+    for (u32 i = 0; i < tiles.size(); i++) {
+        if (tiles[i].data) {
+            navmesh_add_tile(mesh, tiles[i].data, tiles[i].size);
+        }
+        mesh->heightfields[i] = std::move(tiles[i].heightfield);
+    }
+
+    log("[navmesh] baked %u tiles (%ux%u grid, %u cells each, %u polys) from %u triangles in %.2f ms%s",
+        mesh->tile_count, mesh->tiles_x, mesh->tiles_z, settings.tile_size, mesh->poly_count, (u32)geometry.areas.size(), timer_elasped(&t),
+        failed ? ", some tiles failed" : "");
+    return failed == 0;
+}
+
+/// @note(ame): BAKED NAVMESHES
+
+bool navmesh_load(navmesh *mesh, const std::string& path, glm::vec3 min, glm::vec3 max, const navmesh_settings& settings)
+{
+    fs_mapped_file file;
+    if (!fs_map(&file, path)) {
+        return false;
+    }
+
+    const wnn_header *header = reinterpret_cast<const wnn_header*>(file.data);
+    bool valid = file.size >= sizeof(wnn_header)
+              && header->magic == WNN_MAGIC
+              && header->version == WNN_VERSION
+              && sizeof(wnn_header) + u64(header->tile_count) * sizeof(wnn_entry) <= file.size;
+    if (!valid) {
+        log("[navmesh] %s is stale or corrupted, rebaking", path.c_str());
+        fs_unmap(&file);
+        return false;
+    }
+
+    const wnn_entry *entries = reinterpret_cast<const wnn_entry*>(file.data + sizeof(wnn_header));
+    for (u32 i = 0; i < header->tile_count; i++) {
+        if (entries[i].offset + entries[i].size > file.size || entries[i].heightfield_offset + entries[i].heightfield_size > file.size) {
+            log("[navmesh] %s is truncated, rebaking", path.c_str());
+            fs_unmap(&file);
+            return false;
+        }
+    }
+
+    navmesh_setup(mesh, min, max, settings);
+    mesh->params = header->params;
+    navmesh_create(mesh);
+
+    for (u32 i = 0; i < header->tile_count; i++) {
+        const wnn_entry& entry = entries[i];
+        u8 *data = (u8*)dtAlloc((i32)entry.size, DT_ALLOC_PERM);
+        memcpy(data, file.data + entry.offset, entry.size);
+        navmesh_add_tile(mesh, data, (i32)entry.size);
+
+        if (entry.x >= 0 && entry.x < (i32)mesh->tiles_x && entry.z >= 0 && entry.z < (i32)mesh->tiles_z) {
+            navmesh_heightfield& heightfield = mesh->heightfields[entry.z * mesh->tiles_x + entry.x];
+            heightfield.size = entry.heightfield_raw_size;
+            heightfield.compressed = entry.heightfield_compressed != 0;
+            heightfield.bytes.assign(file.data + entry.heightfield_offset, file.data + entry.heightfield_offset + entry.heightfield_size);
+        }
+    }
+
+    fs_unmap(&file);
+    return true;
+}
+
+void navmesh_save(navmesh *mesh, u64 key)
+{
+    const dtNavMesh *nav = mesh->mesh;
+
+    std::vector<wnn_entry> entries;
+    std::vector<const dtMeshTile*> tiles;
+    u64 offset = sizeof(wnn_header);
+    for (i32 i = 0; i < nav->getMaxTiles(); i++) {
+        const dtMeshTile *tile = nav->getTile(i);
+        if (tile && tile->header && tile->dataSize > 0) {
+            tiles.push_back(tile);
+        }
+    }
+    offset += tiles.size() * sizeof(wnn_entry);
+
+    entries.resize(tiles.size());
+    std::vector<const navmesh_heightfield*> heightfields(tiles.size());
+    for (u64 i = 0; i < tiles.size(); i++) {
+        offset = (offset + WNN_ALIGNMENT - 1) & ~u64(WNN_ALIGNMENT - 1);
+        entries[i].x = tiles[i]->header->x;
+        entries[i].z = tiles[i]->header->y;
+        entries[i].offset = offset;
+        entries[i].size = tiles[i]->dataSize;
+        offset += tiles[i]->dataSize;
+
+        heightfields[i] = &mesh->heightfields[entries[i].z * mesh->tiles_x + entries[i].x];
+        offset = (offset + WNN_ALIGNMENT - 1) & ~u64(WNN_ALIGNMENT - 1);
+        entries[i].heightfield_offset = offset;
+        entries[i].heightfield_size = heightfields[i]->bytes.size();
+        entries[i].heightfield_raw_size = heightfields[i]->size;
+        entries[i].heightfield_compressed = heightfields[i]->compressed;
+        offset += heightfields[i]->bytes.size();
+    }
+
+    std::vector<u8> data(offset, 0);
+    wnn_header *header = reinterpret_cast<wnn_header*>(data.data());
+    header->magic = WNN_MAGIC;
+    header->version = WNN_VERSION;
+    header->tile_count = (u32)entries.size();
+    header->params = mesh->params;
+    memcpy(data.data() + sizeof(wnn_header), entries.data(), entries.size() * sizeof(wnn_entry));
+    for (u64 i = 0; i < entries.size(); i++) {
+        memcpy(data.data() + entries[i].offset, tiles[i]->data, tiles[i]->dataSize);
+        memcpy(data.data() + entries[i].heightfield_offset, heightfields[i]->bytes.data(), heightfields[i]->bytes.size());
+    }
+
+    asset_cache_store(key, data.data(), data.size(), ".wnn");
+}
+
+void navmesh_init(navmesh *mesh, const navmesh_build_info& info, bool cache, u32 max_threads)
+{
+    timer t;
+    timer_init(&t);
+
+    navmesh_settings settings = navmesh_get_settings();
+    glm::vec3 min, max;
+    navmesh_bounds(info, &min, &max);
+
+    u64 key = 0;
+    if (cache) {
+        u64 content_hash = info.content_hash;
+        if (!content_hash) {
+            content_hash = geometry_hash(info.geometry, 1000);
+        }
+        /// @note(ame): the bounds come from the world JSON, the same level can have a different navmesh
+        content_hash = wn_hash(&min, sizeof(min), content_hash);
+        content_hash = wn_hash(&max, sizeof(max), content_hash);
+        key = asset_cache_key_from_hash(content_hash, "navmesh", WNN_VERSION, navmesh_settings_hash(settings));
+
+        std::string cached;
+        if (asset_cache_lookup(key, ".wnn", &cached) && navmesh_load(mesh, cached, min, max, settings)) {
+            log("[navmesh] loaded %u tiles (%u polys) from %s in %.2f ms", mesh->tile_count, mesh->poly_count, cached.c_str(), timer_elasped(&t));
+            return;
+        }
+        navmesh_free(mesh);
+    }
+
+    bool baked = navmesh_bake(mesh, info, settings, max_threads);
+    if (cache && baked) {
+        navmesh_save(mesh, key);
+    }
 }
 
 void navmesh_free(navmesh *mesh)
 {
+    crowd_free(mesh);
+    pathfind_free(mesh);
+
+    /// @note(ame): the round in flight reads the heightfields, let it finish and throw its tiles away
+    if (mesh->rebuild) {
+        job_wait(&mesh->rebuild->counter);
+        for (auto& tile : mesh->rebuild->built) {
+            dtFree(tile.data);
+        }
+        delete mesh->rebuild;
+        mesh->rebuild = nullptr;
+    }
+
     dtFreeNavMesh(mesh->mesh);
+    mesh->mesh = nullptr;
+    mesh->tile_count = 0;
+    mesh->poly_count = 0;
+
+    mesh->heightfields.clear();
+    mesh->obstacles.clear();
+    mesh->dirty_tiles.clear();
+}
+
+/// @note(ame): DYNAMIC OBSTACLES
+
+/// @note(ame): every tile whose heightfield, border included, overlaps the bounds
+void navmesh_dirty_bounds(navmesh *mesh, glm::vec3 min, glm::vec3 max)
+{
+    if (!mesh->mesh) {
+        return;
+    }
+
+    const f32 tile_width = mesh->params.tileWidth;
+    const f32 border = mesh->config.borderSize * mesh->config.cs;
+    i32 x0 = std::max((i32)std::floor((min.x - mesh->params.orig[0] - border) / tile_width), 0);
+    i32 x1 = std::min((i32)std::floor((max.x - mesh->params.orig[0] + border) / tile_width), (i32)mesh->tiles_x - 1);
+    i32 z0 = std::max((i32)std::floor((min.z - mesh->params.orig[2] - border) / tile_width), 0);
+    i32 z1 = std::min((i32)std::floor((max.z - mesh->params.orig[2] + border) / tile_width), (i32)mesh->tiles_z - 1);
+    for (i32 z = z0; z <= z1; z++) {
+        for (i32 x = x0; x <= x1; x++) {
+            u32 index = z * mesh->tiles_x + x;
+            if (!mesh->heightfields[index].bytes.empty()) {
+                mesh->dirty_tiles.insert(index);
+            }
+        }
+    }
+}
+
+u32 navmesh_obstacle_add(navmesh *mesh, glm::vec3 min, glm::vec3 max)
+{
+    u32 id = mesh->next_obstacle++;
+    mesh->obstacles[id] = { min, max };
+    navmesh_dirty_bounds(mesh, min, max);
+    return id;
+}
+
+void navmesh_obstacle_move(navmesh *mesh, u32 id, glm::vec3 min, glm::vec3 max)
+{
+    auto it = mesh->obstacles.find(id);
+    if (it == mesh->obstacles.end()) {
+        return;
+    }
+    /// @note(ame): the tiles it leaves need rebuilding as much as the ones it enters
+    navmesh_dirty_bounds(mesh, it->second.min, it->second.max);
+    navmesh_dirty_bounds(mesh, min, max);
+    it->second = { min, max };
+}
+
+void navmesh_obstacle_remove(navmesh *mesh, u32 id)
+{
+    auto it = mesh->obstacles.find(id);
+    if (it == mesh->obstacles.end()) {
+        return;
+    }
+    navmesh_dirty_bounds(mesh, it->second.min, it->second.max);
+    mesh->obstacles.erase(it);
+}
+
+/// @note(ame): a failed tile keeps the one that's in the navmesh
+bool navmesh_rebuild_tile(const navmesh *mesh, u32 index, const std::vector<navmesh_obstacle>& obstacles, navmesh_tile_data *tile)
+{
+    tile->x = index % mesh->tiles_x;
+    tile->z = index / mesh->tiles_x;
+
+    navmesh_ctx ctx;
+    ctx.enableLog(true);
+    navmesh_tile_scratch scratch;
+    scratch.compact_height_field = rcAllocCompactHeightfield();
+    if (!scratch.compact_height_field || !navmesh_heightfield_unpack(mesh->heightfields[index], scratch.compact_height_field)) {
+        return navmesh_tile_fail(tile, "unpack its heightfield");
+    }
+    return navmesh_finish_tile(mesh, obstacles, tile, &ctx, &scratch);
+}
+
+/// @note(ame): the job side of a round. Always rebuilds at least one tile so a tiny budget still makes progress.
+void navmesh_rebuild_tiles(const navmesh *mesh, navmesh_rebuild *rebuild, f32 budget_ms)
+{
+    timer t;
+    timer_init(&t);
+
+    for (u64 i = 0; i < rebuild->tiles.size(); i++) {
+        if (i > 0 && timer_elasped(&t) > budget_ms) {
+            rebuild->leftover.assign(rebuild->tiles.begin() + i, rebuild->tiles.end());
+            break;
+        }
+
+        navmesh_tile_data tile;
+        if (navmesh_rebuild_tile(mesh, rebuild->tiles[i], rebuild->obstacles, &tile)) {
+            rebuild->built.push_back(tile);
+        }
+    }
+
+    rebuild->ms = timer_elasped(&t);
+}
+
+navmesh_rebuild *navmesh_rebuild_begin(navmesh *mesh)
+{
+    navmesh_rebuild *rebuild = new navmesh_rebuild;
+    rebuild->tiles.assign(mesh->dirty_tiles.begin(), mesh->dirty_tiles.end());
+    for (auto& [id, obstacle] : mesh->obstacles) {
+        rebuild->obstacles.push_back(obstacle);
+    }
+    mesh->dirty_tiles.clear();
+    return rebuild;
+}
+
+/// @note(ame): main thread. A built tile with no data means the obstacles ate all of its polygons.
+void navmesh_rebuild_apply(navmesh *mesh, navmesh_rebuild *rebuild)
+{
+    /// @note(ame): the crowd step reads the tiles we're about to swap. Agents standing on a swapped tile replan on their own.
+    crowd_wait(mesh);
+    pathfind_wait(mesh);
+
+    for (auto& tile : rebuild->built) {
+        dtTileRef ref = mesh->mesh->getTileRefAt(tile.x, tile.z, 0);
+        if (ref) {
+            mesh->poly_count -= mesh->mesh->getTileByRef(ref)->header->polyCount;
+            mesh->tile_count--;
+            mesh->mesh->removeTile(ref, nullptr, nullptr);
+        }
+        if (tile.data) {
+            navmesh_add_tile(mesh, tile.data, tile.size);
+        }
+    }
+    mesh->dirty_tiles.insert(rebuild->leftover.begin(), rebuild->leftover.end());
+
+    if (!rebuild->built.empty()) {
+        mesh->revision++;
+        if (mesh->paths) {
+            for (auto& tile : rebuild->built) {
+                mesh->paths->swapped_tiles.push_back(tile.x + tile.z * mesh->tiles_x);
+            }
+        }
+    }
+    mesh->rebuild_stats.rounds++;
+    mesh->rebuild_stats.tiles += rebuild->built.size();
+    mesh->rebuild_stats.last_ms = rebuild->ms;
+    mesh->rebuild_stats.worst_ms = std::max(mesh->rebuild_stats.worst_ms, rebuild->ms);
+    delete rebuild;
+}
+
+void navmesh_update(navmesh *mesh)
+{
+    static console_var *budget = cvar_get("navmesh_rebuild_budget_ms");
+
+    if (mesh->rebuild) {
+        if (mesh->rebuild->counter.pending > 0) {
+            return;
+        }
+        navmesh_rebuild_apply(mesh, mesh->rebuild);
+        mesh->rebuild = nullptr;
+    }
+    if (!mesh->mesh || mesh->dirty_tiles.empty()) {
+        return;
+    }
+
+    navmesh_rebuild *rebuild = navmesh_rebuild_begin(mesh);
+    f32 budget_ms = budget->as.f;
+    mesh->rebuild = rebuild;
+    job_push([mesh, rebuild, budget_ms]() {
+        navmesh_rebuild_tiles(mesh, rebuild, budget_ms);
+    }, &rebuild->counter);
+}
+
+void navmesh_wait(navmesh *mesh)
+{
+    if (mesh->rebuild) {
+        job_wait(&mesh->rebuild->counter);
+        navmesh_rebuild_apply(mesh, mesh->rebuild);
+        mesh->rebuild = nullptr;
+    }
+}
+
+void navmesh_flush(navmesh *mesh)
+{
+    navmesh_wait(mesh);
+    if (!mesh->mesh || mesh->dirty_tiles.empty()) {
+        return;
+    }
+
+    timer t;
+    timer_init(&t);
+
+    /// @note(ame): no budget and nothing else going on, so every tile gets its own job
+    navmesh_rebuild *rebuild = navmesh_rebuild_begin(mesh);
+    std::vector<navmesh_tile_data> tiles(rebuild->tiles.size());
+    std::vector<u8> built(rebuild->tiles.size());
+    job_parallel_for(rebuild->tiles.size(), [&](u32 i) {
+        built[i] = navmesh_rebuild_tile(mesh, rebuild->tiles[i], rebuild->obstacles, &tiles[i]);
+    });
+    for (u64 i = 0; i < tiles.size(); i++) {
+        if (built[i]) {
+            rebuild->built.push_back(tiles[i]);
+        }
+    }
+    rebuild->ms = timer_elasped(&t);
+    navmesh_rebuild_apply(mesh, rebuild);
+}
+
+/// @note(ame): CROWD
+
+/// @note(ame): generous on the height so a target at a character's center still finds the floor under it
+static const f32 crowd_target_extents[3] = { 2.0f, 4.0f, 2.0f };
+
+void crowd_init(navmesh *mesh, u32 max_agents)
+{
+    crowd_free(mesh);
+    if (!mesh->mesh) {
+        return;
+    }
+
+    mesh->query = dtAllocNavMeshQuery();
+    if (!mesh->query || dtStatusFailed(mesh->query->init(mesh->mesh, 2048))) {
+        log("[navmesh] Failed to init the navmesh query!");
+        crowd_free(mesh);
+        return;
+    }
+    mesh->agent_manager = dtAllocCrowd();
+    if (!mesh->agent_manager || !mesh->agent_manager->init(max_agents, CROWD_MAX_AGENT_RADIUS, mesh->mesh)) {
+        log("[navmesh] Failed to init the crowd!");
+        crowd_free(mesh);
+        return;
+    }
+    mesh->agent_manager->getEditableFilter(0)->setIncludeFlags(NavmeshPoly_Walk);
+
+    mesh->crowd_job = new job_counter;
+    mesh->crowd_stats = {};
+}
+
+void crowd_free(navmesh *mesh)
+{
+    crowd_wait(mesh);
+    delete mesh->crowd_job;
+    mesh->crowd_job = nullptr;
+
+    dtFreeCrowd(mesh->agent_manager);
+    mesh->agent_manager = nullptr;
+    dtFreeNavMeshQuery(mesh->query);
+    mesh->query = nullptr;
+}
+
+i32 crowd_agent_add(navmesh *mesh, glm::vec3 position, f32 radius, f32 height, f32 max_speed)
+{
+    if (!mesh->agent_manager) {
+        return -1;
+    }
+    crowd_wait(mesh);
+
+    /// @note(ame): dtCrowd hands out an agent even when it can't place it, it just never moves. Check it lands first.
+    dtPolyRef ref = 0;
+    f32 nearest[3];
+    const dtQueryFilter *filter = mesh->agent_manager->getFilter(0);
+    if (dtStatusFailed(mesh->query->findNearestPoly(glm::value_ptr(position), crowd_target_extents, filter, &ref, nearest)) || !ref) {
+        return -1;
+    }
+
+    dtCrowdAgentParams params = {};
+    params.radius = radius;
+    params.height = height;
+    params.maxAcceleration = max_speed * 4.0f;
+    params.maxSpeed = max_speed;
+    params.collisionQueryRange = radius * 12.0f;
+    params.pathOptimizationRange = radius * 30.0f;
+    params.separationWeight = 2.0f;
+    params.updateFlags = DT_CROWD_ANTICIPATE_TURNS | DT_CROWD_OPTIMIZE_VIS | DT_CROWD_OPTIMIZE_TOPO | DT_CROWD_OBSTACLE_AVOIDANCE | DT_CROWD_SEPARATION;
+    params.obstacleAvoidanceType = 3;
+    params.queryFilterType = 0;
+    i32 agent = mesh->agent_manager->addAgent(nearest, &params);
+    if (agent >= 0 && mesh->agent_manager->getAgent(agent)->state == DT_CROWDAGENT_STATE_INVALID) {
+        mesh->agent_manager->removeAgent(agent);
+        return -1;
+    }
+    return agent;
+}
+
+void crowd_agent_remove(navmesh *mesh, i32 agent)
+{
+    if (!mesh->agent_manager || agent < 0) {
+        return;
+    }
+    crowd_wait(mesh);
+    mesh->agent_manager->removeAgent(agent);
+}
+
+bool crowd_agent_set_target(navmesh *mesh, i32 agent, glm::vec3 target)
+{
+    if (!mesh->agent_manager || agent < 0) {
+        return false;
+    }
+    crowd_wait(mesh);
+
+    dtPolyRef ref = 0;
+    f32 nearest[3];
+    const dtQueryFilter *filter = mesh->agent_manager->getFilter(0);
+    if (dtStatusFailed(mesh->query->findNearestPoly(glm::value_ptr(target), crowd_target_extents, filter, &ref, nearest)) || !ref) {
+        return false;
+    }
+    return mesh->agent_manager->requestMoveTarget(agent, ref, nearest);
+}
+
+/// @note(ame): snaps the agent back onto wherever its character got pushed to. The corridor fixes itself up next step.
+void crowd_agent_set_position(navmesh *mesh, i32 agent, glm::vec3 position)
+{
+    if (!mesh->agent_manager || agent < 0) {
+        return;
+    }
+    crowd_wait(mesh);
+
+    dtCrowdAgent *ag = mesh->agent_manager->getEditableAgent(agent);
+    if (ag && ag->active) {
+        dtVcopy(ag->npos, glm::value_ptr(position));
+    }
+}
+
+glm::vec3 crowd_agent_get_position(navmesh *mesh, i32 agent)
+{
+    if (!mesh->agent_manager || agent < 0) {
+        return glm::vec3(0.0f);
+    }
+    crowd_wait(mesh);
+
+    const dtCrowdAgent *ag = mesh->agent_manager->getAgent(agent);
+    return ag && ag->active ? glm::make_vec3(ag->npos) : glm::vec3(0.0f);
+}
+
+glm::vec3 crowd_agent_get_velocity(navmesh *mesh, i32 agent)
+{
+    if (!mesh->agent_manager || agent < 0) {
+        return glm::vec3(0.0f);
+    }
+    crowd_wait(mesh);
+
+    const dtCrowdAgent *ag = mesh->agent_manager->getAgent(agent);
+    return ag && ag->active ? glm::make_vec3(ag->vel) : glm::vec3(0.0f);
+}
+
+void crowd_update_async(navmesh *mesh, u32 steps, f32 dt)
+{
+    if (!mesh->agent_manager || steps == 0) {
+        return;
+    }
+    crowd_wait(mesh);
+
+    /// @note(ame): a hitch shouldn't turn into a hundred crowd steps, the agents just move a bit slower for a frame
+    steps = std::min(steps, 4u);
+    job_push([mesh, steps, dt]() {
+        timer t;
+        timer_init(&t);
+        for (u32 i = 0; i < steps; i++) {
+            mesh->agent_manager->update(dt, nullptr);
+        }
+
+        f32 ms = timer_elasped(&t);
+        mesh->crowd_stats.updates += steps;
+        mesh->crowd_stats.last_ms = ms;
+        mesh->crowd_stats.worst_ms = std::max(mesh->crowd_stats.worst_ms, ms);
+    }, mesh->crowd_job);
+}
+
+void crowd_wait(navmesh *mesh)
+{
+    if (mesh->crowd_job) {
+        job_wait(mesh->crowd_job);
+    }
+}
+
+/// @note(ame): PATHFINDING
+
+static const f32 pathfind_extents[3] = { 2.0f, 4.0f, 2.0f };
+
+u64 pathfind_cache_key(dtPolyRef start, dtPolyRef goal)
+{
+    return (u64(start) * 0x9E3779B97F4A7C15ull) ^ u64(goal);
+}
+
+/// @note(ame): fills in the points along the corridor. A partial path ends as close to the goal as its last polygon gets.
+void pathfind_straighten(const dtNavMeshQuery *query, path_request *request)
+{
+    path_result *result = &request->result;
+    if (result->corridor.empty()) {
+        result->status = PathStatus_Failed;
+        return;
+    }
+
+    f32 end[3];
+    dtVcopy(end, glm::value_ptr(request->goal));
+    if (result->corridor.back() != request->goal_ref) {
+        query->closestPointOnPoly(result->corridor.back(), glm::value_ptr(request->goal), end, nullptr);
+    }
+
+    f32 points[PATHFIND_MAX_POLYS * 3];
+    i32 count = 0;
+    query->findStraightPath(glm::value_ptr(request->start), end, result->corridor.data(), (i32)result->corridor.size(), points, nullptr, nullptr, &count, PATHFIND_MAX_POLYS);
+    result->points.resize(count);
+    for (i32 i = 0; i < count; i++) {
+        result->points[i] = glm::make_vec3(points + i * 3);
+    }
+}
+
+void pathfind_cache_insert(navmesh *mesh, path_request *request)
+{
+    pathfinder *paths = mesh->paths;
+    if (!paths->cache_size) {
+        return;
+    }
+
+    u64 key = pathfind_cache_key(request->start_ref, request->goal_ref);
+    auto it = paths->cache_lookup.find(key);
+    if (it != paths->cache_lookup.end()) {
+        paths->cache.erase(it->second);
+    }
+    paths->cache.push_front({ key, request->result.corridor, {}, request->result.status == PathStatus_Partial });
+    paths->cache_lookup[key] = paths->cache.begin();
+
+    std::vector<u32>& tiles = paths->cache.front().tiles;
+    for (dtPolyRef ref : request->result.corridor) {
+        const dtMeshTile *tile = nullptr;
+        const dtPoly *poly = nullptr;
+        if (dtStatusSucceed(mesh->mesh->getTileAndPolyByRef(ref, &tile, &poly))) {
+            tiles.push_back(tile->header->x + tile->header->y * mesh->tiles_x);
+        }
+    }
+    std::sort(tiles.begin(), tiles.end());
+    tiles.erase(std::unique(tiles.begin(), tiles.end()), tiles.end());
+
+    if (paths->cache.size() > paths->cache_size) {
+        paths->cache_lookup.erase(paths->cache.back().key);
+        paths->cache.pop_back();
+    }
+}
+
+/// @note(ame): main thread. Looks up the polygons, returns true if that was enough to finish the request -- nothing near
+/// the start or the goal, or the corridor was cached.
+bool pathfind_resolve(navmesh *mesh, path_request *request)
+{
+    pathfinder *paths = mesh->paths;
+    request->revision = mesh->revision;
+    request->start_ref = 0;
+    request->goal_ref = 0;
+
+    f32 start[3];
+    f32 goal[3];
+    paths->query->findNearestPoly(glm::value_ptr(request->start), pathfind_extents, &paths->filter, &request->start_ref, start);
+    paths->query->findNearestPoly(glm::value_ptr(request->goal), pathfind_extents, &paths->filter, &request->goal_ref, goal);
+    if (!request->start_ref || !request->goal_ref) {
+        request->result.status = PathStatus_Failed;
+        paths->stats.failed++;
+        return true;
+    }
+    request->start = glm::make_vec3(start);
+    request->goal = glm::make_vec3(goal);
+
+    auto it = paths->cache_lookup.find(pathfind_cache_key(request->start_ref, request->goal_ref));
+    if (it == paths->cache_lookup.end()) {
+        return false;
+    }
+    paths->cache.splice(paths->cache.begin(), paths->cache, it->second);
+    request->result.corridor = it->second->corridor;
+    request->result.status = it->second->partial ? PathStatus_Partial : PathStatus_Done;
+    pathfind_straighten(paths->query, request);
+    paths->stats.cache_hits++;
+    paths->stats.completed++;
+    return true;
+}
+
+void pathfind_worker_finish(pathfinder_worker *worker, dtStatus status)
+{
+    path_request *request = worker->current;
+    path_result *result = &request->result;
+    result->status = PathStatus_Failed;
+
+    if (dtStatusSucceed(status)) {
+        dtPolyRef corridor[PATHFIND_MAX_POLYS];
+        i32 count = 0;
+        status = worker->query->finalizeSlicedFindPath(corridor, &count, PATHFIND_MAX_POLYS);
+        if (dtStatusSucceed(status) && count > 0) {
+            result->corridor.assign(corridor, corridor + count);
+            result->status = dtStatusDetail(status, DT_PARTIAL_RESULT) ? PathStatus_Partial : PathStatus_Done;
+            pathfind_straighten(worker->query, request);
+        }
+    }
+
+    worker->done.push_back(request);
+    worker->current = nullptr;
+}
+
+/// @note(ame): job side. Goes through the batch until it's empty or the budget is gone, always getting at least one slice in.
+void pathfind_worker_run(pathfinder *paths, pathfinder_worker *worker, f32 budget_ms)
+{
+    timer t;
+    timer_init(&t);
+
+    worker->iterations = 0;
+    do {
+        if (!worker->current) {
+            if (worker->next == worker->batch.size()) {
+                break;
+            }
+            worker->current = worker->batch[worker->next++];
+
+            path_request *request = worker->current;
+            dtStatus status = worker->query->initSlicedFindPath(request->start_ref, request->goal_ref, glm::value_ptr(request->start), glm::value_ptr(request->goal), &paths->filter);
+            if (dtStatusFailed(status)) {
+                pathfind_worker_finish(worker, status);
+                continue;
+            }
+        }
+
+        i32 iterations = 0;
+        dtStatus status = worker->query->updateSlicedFindPath(PATHFIND_SLICE_ITERATIONS, &iterations);
+        worker->iterations += iterations;
+        if (!dtStatusInProgress(status)) {
+            pathfind_worker_finish(worker, status);
+        }
+    } while (timer_elasped(&t) < budget_ms);
+
+    worker->ms = timer_elasped(&t);
+}
+
+void pathfind_init(navmesh *mesh, u32 workers)
+{
+    static console_var *cache_size = cvar_get("pathfind_cache_size");
+
+    pathfind_free(mesh);
+    if (!mesh->mesh) {
+        return;
+    }
+
+    pathfinder *paths = new pathfinder;
+    paths->filter.setIncludeFlags(NavmeshPoly_Walk);
+    paths->cache_size = cache_size->as.u;
+    paths->query = dtAllocNavMeshQuery();
+    bool ok = paths->query && dtStatusSucceed(paths->query->init(mesh->mesh, PATHFIND_QUERY_NODES));
+
+    paths->workers.resize(workers ? workers : std::max(job_system_thread_count(), 1u));
+    for (auto& worker : paths->workers) {
+        worker.query = dtAllocNavMeshQuery();
+        ok = ok && worker.query && dtStatusSucceed(worker.query->init(mesh->mesh, PATHFIND_QUERY_NODES));
+    }
+
+    mesh->paths = paths;
+    if (!ok) {
+        log("[navmesh] Failed to init the pathfinding queries!");
+        pathfind_free(mesh);
+    }
+}
+
+void pathfind_free(navmesh *mesh)
+{
+    pathfinder *paths = mesh->paths;
+    if (!paths) {
+        return;
+    }
+    pathfind_wait(mesh);
+
+    /// @note(ame): every request is in `requests` unless it was orphaned, and those are still with a worker
+    for (auto& worker : paths->workers) {
+        std::vector<path_request*> owned = worker.done;
+        owned.insert(owned.end(), worker.batch.begin() + worker.next, worker.batch.end());
+        if (worker.current) {
+            owned.push_back(worker.current);
+        }
+        for (path_request *request : owned) {
+            if (request->orphaned) {
+                delete request;
+            }
+        }
+        dtFreeNavMeshQuery(worker.query);
+    }
+    for (auto& [ticket, request] : paths->requests) {
+        delete request;
+    }
+
+    dtFreeNavMeshQuery(paths->query);
+    delete paths;
+    mesh->paths = nullptr;
+}
+
+path_ticket pathfind_request(navmesh *mesh, glm::vec3 start, glm::vec3 goal)
+{
+    pathfinder *paths = mesh->paths;
+    if (!paths) {
+        return 0;
+    }
+
+    path_request *request = new path_request;
+    request->ticket = paths->next_ticket++;
+    request->start = start;
+    request->goal = goal;
+    request->result.status = PathStatus_Pending;
+    paths->requests[request->ticket] = request;
+    paths->stats.requests++;
+
+    if (!pathfind_resolve(mesh, request)) {
+        paths->queue.push_back(request);
+    }
+    return request->ticket;
+}
+
+path_status pathfind_poll(navmesh *mesh, path_ticket ticket, path_result *result)
+{
+    pathfinder *paths = mesh->paths;
+    if (!paths) {
+        return PathStatus_Invalid;
+    }
+
+    auto it = paths->requests.find(ticket);
+    if (it == paths->requests.end()) {
+        return PathStatus_Invalid;
+    }
+
+    /// @note(ame): a dispatched request belongs to its worker until the next pathfind_update, even if it's done already
+    path_request *request = it->second;
+    if (request->dispatched) {
+        return PathStatus_Pending;
+    }
+    path_status status = request->result.status;
+    if (status == PathStatus_Pending) {
+        return status;
+    }
+    if (result) {
+        *result = std::move(request->result);
+    }
+    paths->requests.erase(it);
+    delete request;
+    return status;
+}
+
+void pathfind_cancel(navmesh *mesh, path_ticket ticket)
+{
+    pathfinder *paths = mesh->paths;
+    if (!paths) {
+        return;
+    }
 
-    rcFreePolyMeshDetail(mesh->poly_mesh_detail);
-    rcFreePolyMesh(mesh->poly_mesh);
-    rcFreeContourSet(mesh->contour_set);
-    rcFreeCompactHeightfield(mesh->compact_height_field);
-    rcFreeHeightField(mesh->height_field);
+    auto it = paths->requests.find(ticket);
+    if (it == paths->requests.end()) {
+        return;
+    }
+
+    path_request *request = it->second;
+    paths->requests.erase(it);
+    if (request->dispatched) {
+        request->orphaned = true;
+        return;
+    }
+    auto queued = std::find(paths->queue.begin(), paths->queue.end(), request);
+    if (queued != paths->queue.end()) {
+        paths->queue.erase(queued);
+    }
+    delete request;
+}
+
+/// @note(ame): a request the worker didn't get to, or whose sliced query was cut short by a tile swap, goes back in front
+void pathfind_requeue(navmesh *mesh, path_request *request)
+{
+    request->dispatched = false;
+    if (request->orphaned) {
+        delete request;
+        return;
+    }
+    if (request->revision != mesh->revision && pathfind_resolve(mesh, request)) {
+        return;
+    }
+    mesh->paths->queue.push_front(request);
+}
+
+void pathfind_update(navmesh *mesh)
+{
+    static console_var *budget = cvar_get("pathfind_budget_ms");
+
+    pathfinder *paths = mesh->paths;
+    if (!paths) {
+        return;
+    }
+    pathfind_wait(mesh);
+
+    /// @note(ame): a corridor through a swapped tile might use polygons that aren't there anymore. The rest stay good, except
+    /// partial ones, which the new tiles could finish.
+    if (!paths->swapped_tiles.empty()) {
+        std::sort(paths->swapped_tiles.begin(), paths->swapped_tiles.end());
+        for (auto it = paths->cache.begin(); it != paths->cache.end();) {
+            bool crosses = it->partial;
+            for (u32 i = 0; i < it->tiles.size() && !crosses; i++) {
+                crosses = std::binary_search(paths->swapped_tiles.begin(), paths->swapped_tiles.end(), it->tiles[i]);
+            }
+            if (!crosses) {
+                ++it;
+                continue;
+            }
+            paths->cache_lookup.erase(it->key);
+            it = paths->cache.erase(it);
+            paths->stats.evicted++;
+        }
+        paths->swapped_tiles.clear();
+    }
+
+    f32 worker_ms = 0.0f;
+    for (auto& worker : paths->workers) {
+        for (path_request *request : worker.done) {
+            request->dispatched = false;
+            if (request->orphaned) {
+                delete request;
+                continue;
+            }
+            if (request->result.status == PathStatus_Failed) {
+                paths->stats.failed++;
+                continue;
+            }
+            paths->stats.completed++;
+            /// @note(ame): found before the tiles changed, still handed over but not worth keeping
+            if (request->revision == mesh->revision) {
+                pathfind_cache_insert(mesh, request);
+            }
+        }
+        worker.done.clear();
+
+        for (u32 i = (u32)worker.batch.size(); i > worker.next; i--) {
+            pathfind_requeue(mesh, worker.batch[i - 1]);
+        }
+        worker.batch.clear();
+        worker.next = 0;
+
+        if (worker.current && (worker.current->orphaned || worker.current->revision != mesh->revision)) {
+            if (!worker.current->orphaned) {
+                paths->stats.restarted++;
+            }
+            pathfind_requeue(mesh, worker.current);
+            worker.current = nullptr;
+        }
+
+        paths->stats.iterations += worker.iterations;
+        worker.iterations = 0;
+        worker_ms = std::max(worker_ms, worker.ms);
+        worker.ms = 0.0f;
+    }
+    paths->stats.last_ms = worker_ms;
+    paths->stats.worst_ms = std::max(paths->stats.worst_ms, worker_ms);
+
+    /// @note(ame): deal the queue out round robin, a worker still busy with a query keeps it and gets a batch behind it
+    for (u32 dealt = 0; !paths->queue.empty() && dealt < paths->workers.size() * PATHFIND_MAX_BATCH; dealt++) {
+        path_request *request = paths->queue.front();
+        paths->queue.pop_front();
+        if (request->revision != mesh->revision && pathfind_resolve(mesh, request)) {
+            continue;
+        }
+        request->dispatched = true;
+        paths->workers[dealt % paths->workers.size()].batch.push_back(request);
+    }
+
+    f32 budget_ms = budget->as.f;
+    for (auto& worker : paths->workers) {
+        if (!worker.current && worker.batch.empty()) {
+            continue;
+        }
+        pathfinder_worker *w = &worker;
+        job_push([paths, w, budget_ms]() {
+            pathfind_worker_run(paths, w, budget_ms);
+        }, &paths->counter);
+    }
+}
+
+void pathfind_wait(navmesh *mesh)
+{
+    if (mesh->paths) {
+        job_wait(&mesh->paths->counter);
+    }
 }
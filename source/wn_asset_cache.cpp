@@ -0,0 +1,429 @@
+//
+// $Notice: Xander Studios @ 2024
+// $Author: Amélie Heinrich
+// $Create Time: 2024-11-22 19:10:02
+//
+
+#include <filesystem>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+
+#include "wn_asset_cache.h"
+#include "wn_filesystem.h"
+#include "wn_dev_console.h"
+#include "wn_output.h"
+#include "wn_cvar.h"
+#include "wn_util.h"
+#include "wn_pak.h"
+
+asset_cache assets;
+
+std::string asset_cache_key_string(u64 key)
+{
+    char buffer[17];
+    snprintf(buffer, sizeof(buffer), "%016llx", (unsigned long long)key);
+    return buffer;
+}
+
+/// @note(ame): drops anything the manifest doesn't know about -- old path hashed files, or .tmp files from a crash
+void asset_cache_sweep(bool keep_entries)
+{
+    std::unordered_map<std::string, bool> known;
+    if (keep_entries) {
+        for (auto& pair : assets.entries) {
+            known[pair.second.file] = true;
+        }
+    }
+
+    for (const auto& dir_entry : std::filesystem::directory_iterator(ASSET_CACHE_DIRECTORY)) {
+        if (!dir_entry.is_regular_file()) {
+            continue;
+        }
+
+        std::string entry_path = dir_entry.path().string();
+        std::replace(entry_path.begin(), entry_path.end(), '\\', '/');
+        if (entry_path == ASSET_CACHE_MANIFEST || known.count(entry_path)) {
+            continue;
+        }
+
+        log("[asset_cache] removing untracked file %s", entry_path.c_str());
+        fs_delete(entry_path);
+    }
+}
+
+/// @note(ame): caller holds the lock
+void asset_cache_evict(u64 keep)
+{
+    if (assets.total_size <= assets.max_size) {
+        return;
+    }
+
+    std::vector<std::pair<u64, u64>> lru;
+    lru.reserve(assets.entries.size());
+    for (auto& pair : assets.entries) {
+        if (pair.first != keep) {
+            lru.push_back({ pair.second.last_used, pair.first });
+        }
+    }
+    std::sort(lru.begin(), lru.end());
+
+    for (auto& candidate : lru) {
+        if (assets.total_size <= assets.max_size) {
+            break;
+        }
+        if (assets.pins.count(candidate.second)) {
+            continue;
+        }
+
+        /// @note(ame): Windows won't delete a file somebody still has open. It stays an entry, and counted, until a later
+        /// eviction gets it.
+        asset_cache_entry& entry = assets.entries[candidate.second];
+        if (!fs_delete(entry.file) && fs_exists(entry.file)) {
+            continue;
+        }
+        assets.total_size -= entry.size;
+        assets.stats.evictions++;
+        assets.stats.bytes_evicted += entry.size;
+        assets.entries.erase(candidate.second);
+        assets.stamps.clear();
+    }
+    assets.dirty = true;
+}
+
+void asset_cache_init()
+{
+    if (!fs_exists(ASSET_CACHE_DIRECTORY)) {
+        fs_createdir(ASSET_CACHE_DIRECTORY);
+    }
+
+    assets.max_size = u64(cvar_register_unsigned("cache_max_mb", 4096)->as.u) * 1024 * 1024;
+
+    bool valid_manifest = false;
+    if (fs_exists(ASSET_CACHE_MANIFEST)) {
+        nlohmann::json root = fs_loadjson(ASSET_CACHE_MANIFEST);
+        if (root.value("version", 0u) == ASSET_CACHE_MANIFEST_VERSION) {
+            valid_manifest = true;
+            assets.tick = root["tick"].template get<u64>();
+
+            for (auto& item : root["entries"]) {
+                asset_cache_entry entry;
+                entry.file = item["file"].template get<std::string>();
+                entry.size = item["size"].template get<u64>();
+                entry.last_used = item["last_used"].template get<u64>();
+
+                assets.entries[item["key"].template get<u64>()] = entry;
+                assets.total_size += entry.size;
+            }
+            for (auto& item : root["sources"]) {
+                asset_cache_source source;
+                source.low_time = item["low_time"].template get<u32>();
+                source.high_time = item["high_time"].template get<u32>();
+                source.size = item["size"].template get<u64>();
+                source.hash = item["hash"].template get<u64>();
+
+                assets.sources[item["path"].template get<std::string>()] = source;
+            }
+            for (auto& item : root["stamps"].items()) {
+                assets.stamps[item.key()] = item.value().template get<u64>();
+            }
+        }
+    }
+
+    if (!valid_manifest) {
+        log("[asset_cache] no valid manifest, starting from an empty cache");
+        assets.entries.clear();
+        assets.sources.clear();
+        assets.stamps.clear();
+        assets.total_size = 0;
+    }
+    asset_cache_sweep(valid_manifest);
+    asset_cache_evict(0);
+
+    log("[asset_cache] %d entries, %d MB / %d MB", (i32)assets.entries.size(), (i32)(assets.total_size / (1024 * 1024)), (i32)(assets.max_size / (1024 * 1024)));
+
+    dev_console_add_command("cache_stats", [](std::vector<std::string>) {
+        asset_cache_stats stats = asset_cache_get_stats();
+        log("[asset_cache] %llu hits, %llu misses", stats.hits, stats.misses);
+        log("[asset_cache] %llu KB read, %llu KB written", stats.bytes_read / 1024, stats.bytes_written / 1024);
+        log("[asset_cache] %llu evictions (%llu KB)", stats.evictions, stats.bytes_evicted / 1024);
+        log("[asset_cache] %llu entries, %llu KB resident", stats.entry_count, stats.resident_bytes / 1024);
+    });
+}
+
+void asset_cache_exit()
+{
+    asset_cache_save_manifest();
+}
+
+void asset_cache_save_manifest()
+{
+    std::unique_lock<std::mutex> lock(assets.lock);
+    if (!assets.dirty && !assets.touched) {
+        return;
+    }
+
+    nlohmann::json root;
+    root["version"] = ASSET_CACHE_MANIFEST_VERSION;
+    root["tick"] = assets.tick;
+    root["entries"] = nlohmann::json::array();
+    for (auto& pair : assets.entries) {
+        nlohmann::json item;
+        item["key"] = pair.first;
+        item["file"] = pair.second.file;
+        item["size"] = pair.second.size;
+        item["last_used"] = pair.second.last_used;
+        root["entries"].push_back(item);
+    }
+    root["sources"] = nlohmann::json::array();
+    for (auto& pair : assets.sources) {
+        nlohmann::json item;
+        item["path"] = pair.first;
+        item["low_time"] = pair.second.low_time;
+        item["high_time"] = pair.second.high_time;
+        item["size"] = pair.second.size;
+        item["hash"] = pair.second.hash;
+        root["sources"].push_back(item);
+    }
+    root["stamps"] = nlohmann::json::object();
+    for (auto& pair : assets.stamps) {
+        root["stamps"][pair.first] = pair.second;
+    }
+
+    std::string temp = std::string(ASSET_CACHE_MANIFEST) + ".tmp";
+    fs_writejson(temp, root);
+    if (!fs_rename(temp, ASSET_CACHE_MANIFEST)) {
+        log("[asset_cache] failed to write manifest");
+        return;
+    }
+    assets.dirty = false;
+    assets.touched = false;
+}
+
+u64 asset_cache_source_hash(const std::string& path)
+{
+    if (!fs_exists(path)) {
+        return 0;
+    }
+
+    asset_cache_source source = {};
+    fs_getfiletime(path, source.low_time, source.high_time);
+    source.size = fs_filesize(path);
+
+    {
+        std::unique_lock<std::mutex> lock(assets.lock);
+        auto it = assets.sources.find(path);
+        if (it != assets.sources.end() && it->second.low_time == source.low_time && it->second.high_time == source.high_time && it->second.size == source.size) {
+            return it->second.hash;
+        }
+    }
+
+    /// @note(ame): hash outside of the lock, importers run this from the job system
+    fs_mapped_file file;
+    if (!fs_map(&file, path)) {
+        return 0;
+    }
+    source.hash = wn_hash(file.data, file.size, 1000);
+    fs_unmap(&file);
+
+    std::unique_lock<std::mutex> lock(assets.lock);
+    assets.sources[path] = source;
+    assets.dirty = true;
+    return source.hash;
+}
+
+u64 asset_cache_key(const std::string& source, const char *importer, u32 version, u64 settings)
+{
+    return asset_cache_key(std::vector<std::string>{ source }, importer, version, settings);
+}
+
+u64 asset_cache_key(const std::vector<std::string>& sources, const char *importer, u32 version, u64 settings)
+{
+    u64 content_hash = 1000;
+    for (auto& source : sources) {
+        u64 content = asset_cache_source_hash(source);
+        content_hash = wn_hash(&content, sizeof(content), content_hash);
+    }
+    return asset_cache_key_from_hash(content_hash, importer, version, settings);
+}
+
+u64 asset_cache_key_from_hash(u64 content_hash, const char *importer, u32 version, u64 settings)
+{
+    u64 key = wn_hash(importer, strlen(importer), content_hash);
+    key = wn_hash(&version, sizeof(version), key);
+    key = wn_hash(&settings, sizeof(settings), key);
+    return key;
+}
+
+/// @note(ame): caller holds the lock
+bool asset_cache_lookup_locked(u64 key, const char *extension, std::string *out_path)
+{
+    auto it = assets.entries.find(key);
+    if (it == assets.entries.end()) {
+        /// @note(ame): shipped builds have .cache/ baked into a .wnpak and no manifest to go with it. After that, a loose
+        /// file the manifest doesn't know about (written by another instance or a tool, or a manifest that got lost) is
+        /// just as good, keys are content addressed. It gets adopted so eviction sees it.
+        std::string cached = ASSET_CACHE_DIRECTORY + asset_cache_key_string(key) + extension;
+        pak_entry entry;
+        if (pak_stat(cached, &entry)) {
+            assets.stats.hits++;
+            assets.stats.bytes_read += entry.size;
+            if (out_path) {
+                *out_path = cached;
+            }
+            return true;
+        }
+        if (std::filesystem::is_regular_file(cached)) {
+            asset_cache_entry& adopted = assets.entries[key];
+            adopted.file = cached;
+            adopted.size = std::filesystem::file_size(cached);
+            adopted.last_used = ++assets.tick;
+            assets.total_size += adopted.size;
+            assets.stats.hits++;
+            assets.stats.bytes_read += adopted.size;
+            assets.dirty = true;
+            if (out_path) {
+                *out_path = cached;
+            }
+            return true;
+        }
+
+        assets.stats.misses++;
+        return false;
+    }
+
+    /// @note(ame): someone cleaned .cache/ by hand
+    if (!fs_exists(it->second.file)) {
+        assets.total_size -= it->second.size;
+        assets.entries.erase(it);
+        assets.stamps.clear();
+        assets.stats.misses++;
+        assets.dirty = true;
+        return false;
+    }
+
+    /// @note(ame): a hit only bumps the LRU tick. Nothing else needs saving for it, it gets written once at exit
+    /// instead of marking the manifest dirty.
+    it->second.last_used = ++assets.tick;
+    assets.touched = true;
+    assets.stats.hits++;
+    assets.stats.bytes_read += it->second.size;
+    if (out_path) {
+        *out_path = it->second.file;
+    }
+    return true;
+}
+
+bool asset_cache_lookup(u64 key, const char *extension, std::string *out_path)
+{
+    std::unique_lock<std::mutex> lock(assets.lock);
+    return asset_cache_lookup_locked(key, extension, out_path);
+}
+
+bool asset_cache_acquire(u64 key, const char *extension, std::string *out_path)
+{
+    std::unique_lock<std::mutex> lock(assets.lock);
+    if (!asset_cache_lookup_locked(key, extension, out_path)) {
+        return false;
+    }
+    assets.pins[key]++;
+    return true;
+}
+
+void asset_cache_release(u64 key)
+{
+    std::unique_lock<std::mutex> lock(assets.lock);
+    auto it = assets.pins.find(key);
+    if (it != assets.pins.end() && --it->second == 0) {
+        assets.pins.erase(it);
+    }
+}
+
+std::string asset_cache_temp_path(u64 key)
+{
+    u64 counter = 0;
+    {
+        std::unique_lock<std::mutex> lock(assets.lock);
+        counter = assets.temp_counter++;
+    }
+    return ASSET_CACHE_DIRECTORY + asset_cache_key_string(key) + "." + std::to_string(counter) + ".tmp";
+}
+
+std::string asset_cache_commit(u64 key, const std::string& temp_path, const char *extension)
+{
+    std::string final_path = ASSET_CACHE_DIRECTORY + asset_cache_key_string(key) + extension;
+
+    u64 size = fs_filesize(temp_path);
+    if (!fs_rename(temp_path, final_path)) {
+        log("[asset_cache] failed to commit %s", final_path.c_str());
+        fs_delete(temp_path);
+        return "";
+    }
+
+    std::unique_lock<std::mutex> lock(assets.lock);
+    auto it = assets.entries.find(key);
+    if (it != assets.entries.end()) {
+        assets.total_size -= it->second.size;
+    }
+
+    asset_cache_entry& entry = assets.entries[key];
+    entry.file = final_path;
+    entry.size = size;
+    entry.last_used = ++assets.tick;
+    assets.total_size += size;
+    assets.stats.bytes_written += size;
+    assets.dirty = true;
+
+    asset_cache_evict(key);
+    return final_path;
+}
+
+void asset_cache_discard(const std::string& temp_path)
+{
+    fs_delete(temp_path);
+}
+
+std::string asset_cache_store(u64 key, const void *data, u64 size, const char *extension)
+{
+    std::string temp = asset_cache_temp_path(key);
+    FILE *f = fopen(temp.c_str(), "wb");
+    if (!f) {
+        log("[asset_cache] failed to open %s", temp.c_str());
+        return "";
+    }
+    /// @note(ame): a short write (disk full...) must not become an entry
+    bool written = size == 0 || fwrite(data, size, 1, f) == 1;
+    written = fclose(f) == 0 && written;
+    if (!written) {
+        log("[asset_cache] failed to write %s", temp.c_str());
+        asset_cache_discard(temp);
+        return "";
+    }
+
+    return asset_cache_commit(key, temp, extension);
+}
+
+u64 asset_cache_get_stamp(const std::string& name)
+{
+    std::unique_lock<std::mutex> lock(assets.lock);
+
+    auto it = assets.stamps.find(name);
+    return it != assets.stamps.end() ? it->second : 0;
+}
+
+void asset_cache_set_stamp(const std::string& name, u64 value)
+{
+    std::unique_lock<std::mutex> lock(assets.lock);
+    assets.stamps[name] = value;
+    assets.dirty = true;
+}
+
+asset_cache_stats asset_cache_get_stats()
+{
+    std::unique_lock<std::mutex> lock(assets.lock);
+
+    asset_cache_stats stats = assets.stats;
+    stats.resident_bytes = assets.total_size;
+    stats.entry_count = assets.entries.size();
+    return stats;
+}
@@ -0,0 +1,1483 @@
+//
+// $Notice: Xander Studios @ 2024
+// $Author: Amélie Heinrich
+// $Create Time: 2024-11-22 16:24:07
+//
+
+#include <filesystem>
+#include <algorithm>
+#include <random>
+#include <thread>
+#include <cctype>
+#include <chrono>
+
+#include <json/json.hpp>
+#include <nvtt/nvtt.h>
+
+#include "wn_bench.h"
+#include "wn_dev_console.h"
+#include "wn_output.h"
+#include "wn_timer.h"
+#include "wn_job.h"
+#include "wn_gltf.h"
+#include "wn_mipmap.h"
+#include "wn_util.h"
+#include "wn_uploader.h"
+#include "wn_filesystem.h"
+#include "wn_pak.h"
+#include "wn_asset_cache.h"
+#include "wn_resource_cache.h"
+#include "wn_collision.h"
+#include "wn_cvar.h"
+#include "wn_world.h"
+#include "wn_physics_profiler.h"
+#include "wn_ai.h"
+
+u32 bench_arg(const std::vector<std::string>& args, u32 index, u32 fallback)
+{
+    if (args.size() > index) {
+        return std::stoul(args[index]);
+    }
+    return fallback;
+}
+
+/// @note(ame): different every call and every run, for cold passes that must not hit what an earlier run put in the
+/// cache. wn_uuid is std::rand, which is never seeded, so it hands out the same sequence every launch.
+u64 bench_cold_seed()
+{
+    static std::atomic<u64> counter = 0;
+    u64 seed[2] = { (u64)std::chrono::high_resolution_clock::now().time_since_epoch().count(), counter++ };
+    return wn_hash(seed, sizeof(seed), 1000);
+}
+
+std::string bench_base64(const std::vector<u8>& bytes)
+{
+    static const char *table = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    std::string out;
+    out.reserve(((bytes.size() + 2) / 3) * 4);
+    for (u64 i = 0; i < bytes.size(); i += 3) {
+        u32 chunk = bytes[i] << 16;
+        if (i + 1 < bytes.size()) chunk |= bytes[i + 1] << 8;
+        if (i + 2 < bytes.size()) chunk |= bytes[i + 2];
+
+        out.push_back(table[(chunk >> 18) & 63]);
+        out.push_back(table[(chunk >> 12) & 63]);
+        out.push_back(i + 1 < bytes.size() ? table[(chunk >> 6) & 63] : '=');
+        out.push_back(i + 2 < bytes.size() ? table[chunk & 63] : '=');
+    }
+    return out;
+}
+
+/// @note(ame): builds a glTF with `primitive_count` meshes, each one a `grid` x `grid` vertex plane, all in an embedded buffer.
+cgltf_data* bench_make_gltf(u32 primitive_count, u32 grid)
+{
+    std::vector<u8> blob;
+    auto push = [&](const void *data, u64 size) {
+        u64 offset = blob.size();
+        blob.resize(offset + size);
+        memcpy(blob.data() + offset, data, size);
+        return offset;
+    };
+
+    nlohmann::json root;
+    root["asset"]["version"] = "2.0";
+    root["scene"] = 0;
+    root["scenes"][0]["nodes"] = nlohmann::json::array();
+
+    u32 vertex_count = grid * grid;
+    u32 index_count = (grid - 1) * (grid - 1) * 6;
+
+    std::vector<f32> positions(vertex_count * 3);
+    std::vector<f32> normals(vertex_count * 3);
+    std::vector<f32> uvs(vertex_count * 2);
+    std::vector<u32> indices;
+    indices.reserve(index_count);
+
+    for (u32 y = 0; y < grid; y++) {
+        for (u32 x = 0; x < grid; x++) {
+            u32 v = y * grid + x;
+            positions[v * 3 + 0] = (f32)x;
+            positions[v * 3 + 1] = std::sin(x * 0.3f) * std::cos(y * 0.3f);
+            positions[v * 3 + 2] = (f32)y;
+            normals[v * 3 + 1] = 1.0f;
+            uvs[v * 2 + 0] = x / (f32)grid;
+            uvs[v * 2 + 1] = y / (f32)grid;
+        }
+    }
+    for (u32 y = 0; y < grid - 1; y++) {
+        for (u32 x = 0; x < grid - 1; x++) {
+            u32 v = y * grid + x;
+            indices.insert(indices.end(), { v, v + grid, v + 1, v + 1, v + grid, v + grid + 1 });
+        }
+    }
+
+    for (u32 i = 0; i < primitive_count; i++) {
+        struct stream { const void *data; u64 size; i32 component; const char *type; u32 count; i32 target; };
+        stream streams[] = {
+            { positions.data(), positions.size() * sizeof(f32), 5126, "VEC3", vertex_count, 34962 },
+            { normals.data(), normals.size() * sizeof(f32), 5126, "VEC3", vertex_count, 34962 },
+            { uvs.data(), uvs.size() * sizeof(f32), 5126, "VEC2", vertex_count, 34962 },
+            { indices.data(), indices.size() * sizeof(u32), 5125, "SCALAR", index_count, 34963 },
+        };
+
+        u32 first_accessor = root["accessors"].size();
+        for (auto& s : streams) {
+            nlohmann::json view;
+            view["buffer"] = 0;
+            view["byteOffset"] = push(s.data, s.size);
+            view["byteLength"] = s.size;
+            view["target"] = s.target;
+
+            nlohmann::json accessor;
+            accessor["bufferView"] = root["bufferViews"].size();
+            accessor["componentType"] = s.component;
+            accessor["type"] = s.type;
+            accessor["count"] = s.count;
+
+            root["bufferViews"].push_back(view);
+            root["accessors"].push_back(accessor);
+        }
+
+        nlohmann::json primitive;
+        primitive["attributes"]["POSITION"] = first_accessor + 0;
+        primitive["attributes"]["NORMAL"] = first_accessor + 1;
+        primitive["attributes"]["TEXCOORD_0"] = first_accessor + 2;
+        primitive["indices"] = first_accessor + 3;
+        primitive["mode"] = 4;
+
+        nlohmann::json mesh;
+        mesh["primitives"].push_back(primitive);
+        root["meshes"].push_back(mesh);
+
+        nlohmann::json node;
+        node["mesh"] = i;
+        node["translation"] = { (f32)(i % 32) * grid, 0.0f, (f32)(i / 32) * grid };
+        root["nodes"].push_back(node);
+        root["scenes"][0]["nodes"].push_back(i);
+    }
+
+    root["buffers"][0]["byteLength"] = blob.size();
+    root["buffers"][0]["uri"] = "data:application/octet-stream;base64," + bench_base64(blob);
+
+    std::string text = root.dump();
+
+    cgltf_options options = {};
+    cgltf_data *data = nullptr;
+    if (cgltf_parse(&options, text.data(), text.size(), &data) != cgltf_result_success) {
+        log("[bench] failed to parse synthetic glTF");
+        return nullptr;
+    }
+    if (cgltf_load_buffers(&options, data, "") != cgltf_result_success) {
+        log("[bench] failed to load synthetic glTF buffers");
+        cgltf_free(data);
+        return nullptr;
+    }
+    return data;
+}
+
+/// @note(ame): bench_gltf_import [primitives] [grid]
+void bench_gltf_import(std::vector<std::string> args)
+{
+    u32 primitive_count = bench_arg(args, 1, 256);
+    u32 grid = bench_arg(args, 2, 64);
+
+    cgltf_data *data = bench_make_gltf(primitive_count, grid);
+    if (!data) {
+        return;
+    }
+
+    gltf_node node = {};
+    node.transform = glm::mat4(1.0f);
+
+    log("[bench] gltf import: %d primitives, %d vertices each", primitive_count, grid * grid);
+
+    f32 baseline = 0.0f;
+    for (u32 threads = 1; threads <= job_system_thread_count(); threads *= 2) {
+        gltf_model model = {};
+        model.path = "bench://synthetic";
+        model.gen_collisions = true;
+        model.cache_collisions = false;
+
+        std::vector<gltf_primitive_import> imports(data->meshes_count);
+        for (u32 i = 0; i < data->meshes_count; i++) {
+            imports[i].primitive = &data->meshes[i].primitives[0];
+            imports[i].node = &node;
+            imports[i].physics_index = i;
+        }
+
+        timer t;
+        timer_init(&t);
+        gltf_import_primitives(&model, imports, threads);
+        f32 ms = timer_elasped(&t);
+        if (threads == 1) {
+            baseline = ms;
+        }
+
+        log("[bench]   %2d threads: %8.2f ms (x%.2f)", threads, ms, baseline / ms);
+
+        for (auto& prim : imports) {
+            delete prim.shape;
+        }
+    }
+
+    cgltf_free(data);
+}
+
+/// @note(ame): bench_collision [primitives] [grid] -- every cook mode, uncached, cold cache (cook + save) and warm cache (one .wnp)
+void bench_collision(std::vector<std::string> args)
+{
+    u32 primitive_count = bench_arg(args, 1, 64);
+    u32 grid = bench_arg(args, 2, 64);
+
+    cgltf_data *data = bench_make_gltf(primitive_count, grid);
+    if (!data) {
+        return;
+    }
+
+    gltf_node node = {};
+    node.transform = glm::mat4(1.0f);
+
+    gltf_model model = {};
+    model.path = "bench://synthetic";
+    model.gen_collisions = false;
+
+    std::vector<gltf_primitive_import> imports(data->meshes_count);
+    for (u32 i = 0; i < data->meshes_count; i++) {
+        imports[i].primitive = &data->meshes[i].primitives[0];
+        imports[i].node = &node;
+    }
+    gltf_import_primitives(&model, imports);
+
+    /// @note(ame): a fresh offset so the cold runs can't hit the cache of an earlier bench
+    glm::mat4 transform = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, (f32)(bench_cold_seed() % 100000), 0.0f));
+    std::vector<collision_source> sources(imports.size());
+    for (u64 i = 0; i < imports.size(); i++) {
+        sources[i].transform = transform;
+        sources[i].geometry = geometry_subview(geometry_get_view(model.geometry), imports[i].vertex_offset, imports[i].vertex_count, imports[i].index_data, imports[i].index_count);
+    }
+
+    log("[bench] collision cooking: %d primitives, %d triangles each", primitive_count, (grid - 1) * (grid - 1) * 2);
+
+    const char *mode_names[] = { "mesh", "convex hull", "convex decomposition" };
+    for (u32 mode = CollisionMode_Mesh; mode <= CollisionMode_Decompose; mode++) {
+        collision_settings settings = collision_get_settings();
+        settings.mode = (collision_mode)mode;
+
+        f32 timings[3];
+        for (u32 run = 0; run < 3; run++) {
+            timer t;
+            timer_init(&t);
+            collision_cook_batch(sources, settings, run > 0);
+            timings[run] = timer_elasped(&t);
+
+            for (auto& source : sources) {
+                delete source.shape;
+                source.shape = nullptr;
+            }
+        }
+
+        log("[bench]   %-20s cook %8.2f ms | cold cache %8.2f ms | warm cache %8.2f ms (x%.1f)", mode_names[mode], timings[0], timings[1], timings[2], timings[0] / timings[2]);
+    }
+
+    cgltf_free(data);
+}
+
+/// @note(ame): random downward rays over the synthetic level, returns the hit count
+u32 bench_cast_rays(const std::vector<glm::vec3>& origins, f32 *ms)
+{
+    timer t;
+    timer_init(&t);
+
+    u32 hits = 0;
+    for (const glm::vec3& origin : origins) {
+        hits += physics_character_trace_ray(nullptr, origin, origin - glm::vec3(0.0f, 20.0f, 0.0f)).hit;
+    }
+    *ms = timer_elasped(&t);
+    return hits;
+}
+
+/// @note(ame): bench_static_bodies [bodies] [rays] -- one by one vs batched insertion of a grid of static boxes, then raycasts
+void bench_static_bodies(std::vector<std::string> args)
+{
+    u32 body_count = bench_arg(args, 1, 16384);
+    u32 ray_count = bench_arg(args, 2, 100000);
+
+    u32 side = (u32)glm::ceil(glm::sqrt((f32)body_count));
+    f32 extent = side * 2.0f;
+
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<f32> height(0.1f, 4.0f);
+    std::uniform_real_distribution<f32> across(0.0f, extent);
+
+    std::vector<glm::vec3> positions(body_count);
+    std::vector<glm::vec3> sizes(body_count);
+    for (u32 i = 0; i < body_count; i++) {
+        sizes[i] = glm::vec3(0.9f, height(rng), 0.9f);
+        positions[i] = glm::vec3((i % side) * 2.0f, 1000.0f + sizes[i].y, (i / side) * 2.0f);
+    }
+
+    std::vector<glm::vec3> origins(ray_count);
+    for (u32 i = 0; i < ray_count; i++) {
+        origins[i] = glm::vec3(across(rng), 1010.0f, across(rng));
+    }
+
+    std::vector<physics_body> bodies(body_count);
+    std::vector<physics_body*> body_ptrs(body_count);
+    for (u32 i = 0; i < body_count; i++) {
+        body_ptrs[i] = &bodies[i];
+    }
+
+    log("[bench] static bodies: %d boxes, %d rays", body_count, ray_count);
+
+    /// @note(ame): one by one, CreateBody + AddBody each
+    {
+        timer t;
+        timer_init(&t);
+        for (u32 i = 0; i < body_count; i++) {
+            physics_body_init(&bodies[i], new box_shape(sizes[i], physics_materials::LevelMaterial), positions[i], true);
+        }
+        f32 insert_ms = timer_elasped(&t);
+
+        f32 ray_ms;
+        u32 hits = bench_cast_rays(origins, &ray_ms);
+        log("[bench]   one by one insert %8.2f ms | rays %8.2f ms (%.0f ns/ray, %d hits)", insert_ms, ray_ms, ray_ms * 1000000.0f / ray_count, hits);
+
+        physics_bodies_free(body_ptrs);
+    }
+
+    /// @note(ame): batched, then the same rays before and after OptimizeBroadPhase
+    {
+        timer t;
+        timer_init(&t);
+        physics_body_batch batch;
+        for (u32 i = 0; i < body_count; i++) {
+            physics_body_batch_add(&batch, &bodies[i], new box_shape(sizes[i], physics_materials::LevelMaterial), positions[i]);
+        }
+        physics_body_batch_commit(&batch);
+        f32 insert_ms = timer_elasped(&t);
+
+        f32 ray_ms;
+        u32 hits = bench_cast_rays(origins, &ray_ms);
+        log("[bench]   batched insert    %8.2f ms | rays %8.2f ms (%.0f ns/ray, %d hits)", insert_ms, ray_ms, ray_ms * 1000000.0f / ray_count, hits);
+
+        physics_optimize_broadphase();
+        hits = bench_cast_rays(origins, &ray_ms);
+        log("[bench]   after optimize             | rays %8.2f ms (%.0f ns/ray, %d hits)", ray_ms, ray_ms * 1000000.0f / ray_count, hits);
+
+        physics_bodies_free(body_ptrs);
+    }
+}
+
+/// @note(ame): bench_characters [steps] -- 1 to 1000 characters walking on a floor, serial vs spread over the Jolt job system
+void bench_characters(std::vector<std::string> args)
+{
+    u32 steps = bench_arg(args, 1, 60);
+
+    console_var *parallel = cvar_get("physics_parallel_characters");
+    bool was_parallel = parallel->as.b;
+
+    physics_body floor;
+    physics_body_init(&floor, new box_shape(glm::vec3(100.0f, 1.0f, 100.0f), physics_materials::LevelMaterial), glm::vec3(0.0f, 2999.0f, 0.0f), true);
+
+    /// @note(ame): the world's characters sit this one out
+    std::vector<physics_character*> world_characters = physics.characters;
+    physics.characters.clear();
+
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<f32> direction(-1.0f, 1.0f);
+
+    log("[bench] characters: %d steps per run, %d jobs max", steps, (i32)physics.character_allocators.size());
+    for (u32 count : { 1u, 10u, 100u, 1000u }) {
+        std::vector<physics_character> characters(count);
+        u32 side = (u32)glm::ceil(glm::sqrt((f32)count));
+        for (u32 i = 0; i < count; i++) {
+            glm::vec3 position((i % side) * 1.5f - side * 0.75f, 3001.0f, (i / side) * 1.5f - side * 0.75f);
+            physics_character_init(&characters[i], new capsule_shape(0.3f, 1.0f, physics_materials::CharacterMaterial), position);
+            physics_character_move(&characters[i], glm::vec3(direction(rng), 0.0f, direction(rng)) * 2.0f);
+        }
+
+        f32 timings[2];
+        for (u32 mode = 0; mode < 2; mode++) {
+            parallel->as.b = mode == 1;
+
+            timer t;
+            timer_init(&t);
+            for (u32 i = 0; i < steps; i++) {
+                physics_step_characters(1.0f / PHYSICS_STEP_HZ);
+            }
+            timings[mode] = timer_elasped(&t) / steps;
+        }
+        log("[bench]   %4d characters | serial %8.3f ms/step | parallel %8.3f ms/step (x%.1f)", count, timings[0], timings[1], timings[0] / timings[1]);
+
+        for (auto& character : characters) {
+            physics_character_free(&character);
+        }
+    }
+
+    parallel->as.b = was_parallel;
+    physics.characters = world_characters;
+    physics_body_free(&floor);
+}
+
+/// @note(ame): bench_triggers [triggers] [characters] [steps] -- characters sweep through a field of triggers. Checks that
+/// every pair sees enter, stays, exit in that order and times the dispatch. The per phase breakdown goes to bench_triggers_trace.json.
+void bench_triggers(std::vector<std::string> args)
+{
+    u32 trigger_count = bench_arg(args, 1, 4096);
+    u32 character_count = bench_arg(args, 2, 256);
+    u32 steps = bench_arg(args, 3, 180);
+
+    std::unordered_map<u64, u32> inside;
+    u64 violations = 0;
+    u64 fired[3] = {};
+    auto track = [&](entity *trigger, entity *other, physics_contact_type type) {
+        u32& state = inside[(trigger->id << 32) ^ other->id];
+        fired[type]++;
+        bool in_order = type == PhysicsContact_Enter ? state == 0 : state != 0;
+        if (!in_order) {
+            violations++;
+        }
+        state = type != PhysicsContact_Exit;
+    };
+
+    u32 side = (u32)glm::ceil(glm::sqrt((f32)trigger_count));
+    std::vector<entity> triggers(trigger_count);
+    for (u32 i = 0; i < trigger_count; i++) {
+        entity& e = triggers[i];
+        e.id = i;
+        e.has_trigger = true;
+        e.trigger.on_trigger_enter = [&](entity *t, entity *o) { track(t, o, PhysicsContact_Enter); };
+        e.trigger.on_trigger_stay = [&](entity *t, entity *o) { track(t, o, PhysicsContact_Stay); };
+        e.trigger.on_trigger_exit = [&](entity *t, entity *o) { track(t, o, PhysicsContact_Exit); };
+        physics_trigger_init(&e.trigger, glm::vec3((i % side) * 1.5f, 4000.0f, (i / side) * 1.5f), glm::vec3(0.5f), glm::quat(1.0f, 0.0f, 0.0f, 0.0f), &e);
+    }
+
+    /// @note(ame): the world's characters sit this one out
+    std::vector<physics_character*> world_characters = physics.characters;
+    physics.characters.clear();
+
+    std::vector<entity> characters(character_count);
+    for (u32 i = 0; i < character_count; i++) {
+        entity& e = characters[i];
+        e.id = trigger_count + i;
+        e.has_physics_character = true;
+        f32 lane = (i * side * 1.5f) / character_count;
+        physics_character_init(&e.character, new capsule_shape(0.3f, 1.0f, physics_materials::CharacterMaterial), glm::vec3(-2.0f, 4000.0f, lane), &e);
+        physics_character_move(&e.character, glm::vec3(6.0f, 0.0f, 0.0f));
+    }
+
+    physics_contact_stats& stats = physics.contact_queue.stats;
+    u64 events = stats.events;
+    u64 duplicates = stats.duplicates;
+    u64 dropped = stats.dropped.load();
+    f32 dispatch_ms = 0.0f;
+    f32 worst_ms = 0.0f;
+
+    physics_profiler_clear();
+
+    timer t;
+    timer_init(&t);
+    for (u32 i = 0; i < steps; i++) {
+        physics_step(1.0f / PHYSICS_STEP_HZ);
+        dispatch_ms += stats.dispatch_ms;
+        worst_ms = std::max(worst_ms, stats.dispatch_ms);
+    }
+    f32 total_ms = timer_elasped(&t);
+
+    events = stats.events - events;
+    log("[bench] triggers: %d triggers, %d characters, %d steps in %.2f ms", trigger_count, character_count, steps, total_ms);
+    log("[bench]   %llu events (%llu duplicates, %llu dropped) -> %llu enters, %llu stays, %llu exits",
+        events, stats.duplicates - duplicates, stats.dropped.load() - dropped, fired[PhysicsContact_Enter], fired[PhysicsContact_Stay], fired[PhysicsContact_Exit]);
+    log("[bench]   dispatch %.3f ms/step, worst %.3f ms, %.1f M events/s", dispatch_ms / steps, worst_ms, dispatch_ms > 0.0f ? events / (dispatch_ms * 1000.0f) : 0.0f);
+    log("[bench]   ordering: %s (%llu violations)", violations ? "FAILED" : "ok", violations);
+    physics_profiler_summary(steps);
+    physics_profiler_export("bench_triggers_trace.json", steps);
+
+    for (auto& e : characters) {
+        physics_character_free(&e.character);
+    }
+    physics.characters = world_characters;
+    for (auto& e : triggers) {
+        physics_trigger_free(&e.trigger);
+    }
+}
+
+/// @note(ame): bench_queries [boxes] -- per call raycasts vs batched rays, spheres and capsules at 10, 1k and 100k queries
+void bench_queries(std::vector<std::string> args)
+{
+    u32 body_count = bench_arg(args, 1, 4096);
+    u32 side = (u32)glm::ceil(glm::sqrt((f32)body_count));
+    f32 extent = side * 2.0f;
+
+    std::mt19937 rng(5678);
+    std::uniform_real_distribution<f32> height(0.1f, 4.0f);
+    std::uniform_real_distribution<f32> across(0.0f, extent);
+
+    std::vector<physics_body> bodies(body_count);
+    std::vector<physics_body*> body_ptrs(body_count);
+    physics_body_batch batch;
+    for (u32 i = 0; i < body_count; i++) {
+        glm::vec3 size(0.9f, height(rng), 0.9f);
+        physics_body_batch_add(&batch, &bodies[i], new box_shape(size, physics_materials::LevelMaterial), glm::vec3((i % side) * 2.0f, 5000.0f + size.y, (i / side) * 2.0f));
+        body_ptrs[i] = &bodies[i];
+    }
+    physics_body_batch_commit(&batch);
+    physics_optimize_broadphase();
+
+    log("[bench] queries: %d boxes", body_count);
+    for (u32 count : { 10u, 1000u, 100000u }) {
+        physics_query_batch queries;
+        for (u32 i = 0; i < count; i++) {
+            physics_query_batch_add(&queries, glm::vec3(across(rng), 5010.0f, across(rng)), glm::vec3(0.0f, -20.0f, 0.0f));
+        }
+
+        timer t;
+        timer_init(&t);
+        u32 single_hits = 0;
+        for (u32 i = 0; i < count; i++) {
+            single_hits += physics_character_trace_ray(nullptr, queries.origins[i], queries.origins[i] + queries.directions[i]).hit;
+        }
+        f32 single_ms = timer_elasped(&t);
+
+        f32 timings[3][2];
+        u32 hits[3] = {};
+        for (u32 shape = PhysicsQuery_Ray; shape <= PhysicsQuery_Capsule; shape++) {
+            queries.shape = (physics_query_shape)shape;
+            queries.radius = 0.3f;
+            queries.half_height = 0.5f;
+
+            for (u32 mode = 0; mode < 2; mode++) {
+                timer_init(&t);
+                physics_query_batch_run(&queries, mode == 0 ? 1 : 0);
+                timings[shape][mode] = timer_elasped(&t);
+            }
+            for (u8 hit : queries.hits) {
+                hits[shape] += hit;
+            }
+        }
+
+        log("[bench]   %6d queries | per call rays %8.3f ms (%d hits)", count, single_ms, single_hits);
+        log("[bench]                   | batched rays  %8.3f ms serial %8.3f ms parallel (%d hits%s)", timings[0][0], timings[0][1], hits[0], hits[0] == single_hits ? "" : ", MISMATCH");
+        log("[bench]                   | spheres       %8.3f ms serial %8.3f ms parallel (%d hits)", timings[1][0], timings[1][1], hits[1]);
+        log("[bench]                   | capsules      %8.3f ms serial %8.3f ms parallel (%d hits)", timings[2][0], timings[2][1], hits[2]);
+    }
+
+    physics_bodies_free(body_ptrs);
+}
+
+struct bench_stream
+{
+    std::vector<u8> bytes;
+    cgltf_buffer buffer;
+    cgltf_buffer_view view;
+    cgltf_accessor accessor;
+};
+
+void bench_make_stream(bench_stream *stream, cgltf_component_type component, cgltf_type type, bool normalized, u32 count)
+{
+    u64 element_size = cgltf_component_size(component) * cgltf_num_components(type);
+    stream->bytes.resize(element_size * count);
+    for (u64 i = 0; i < stream->bytes.size(); i++) {
+        stream->bytes[i] = (u8)(i * 31 + 7);
+    }
+    if (component == cgltf_component_type_r_32f) {
+        f32 *floats = reinterpret_cast<f32*>(stream->bytes.data());
+        for (u64 i = 0; i < stream->bytes.size() / sizeof(f32); i++) {
+            floats[i] = (f32)i * 0.25f;
+        }
+    }
+
+    stream->buffer = {};
+    stream->buffer.size = stream->bytes.size();
+    stream->buffer.data = stream->bytes.data();
+
+    stream->view = {};
+    stream->view.buffer = &stream->buffer;
+    stream->view.size = stream->bytes.size();
+
+    stream->accessor = {};
+    stream->accessor.component_type = component;
+    stream->accessor.type = type;
+    stream->accessor.normalized = normalized;
+    stream->accessor.count = count;
+    stream->accessor.stride = element_size;
+    stream->accessor.buffer_view = &stream->view;
+}
+
+/// @note(ame): bench_gltf_accessors [vertices]
+void bench_gltf_accessors(std::vector<std::string> args)
+{
+    u32 count = bench_arg(args, 1, 1000000);
+    std::vector<gltf_vertex> vertices(count);
+    std::vector<u32> indices(count);
+
+    struct bench_case { const char *name; cgltf_component_type component; cgltf_type type; bool normalized; u32 components; };
+    bench_case cases[] = {
+        { "POSITION f32 vec3", cgltf_component_type_r_32f, cgltf_type_vec3, false, 3 },
+        { "TEXCOORD u16n vec2", cgltf_component_type_r_16u, cgltf_type_vec2, true, 2 },
+        { "WEIGHTS u8n vec4", cgltf_component_type_r_8u, cgltf_type_vec4, true, 4 },
+    };
+
+    log("[bench] gltf accessors: %d elements", count);
+    for (auto& c : cases) {
+        bench_stream stream;
+        bench_make_stream(&stream, c.component, c.type, c.normalized, count);
+
+        timer t;
+        timer_init(&t);
+        for (u32 i = 0; i < count; i++) {
+            cgltf_accessor_read_float(&stream.accessor, i, vertices[i].Weights, 4);
+        }
+        f32 slow = timer_elasped(&t);
+
+        timer_restart(&t);
+        gltf_accessor_unpack_floats(&stream.accessor, vertices[0].Weights, c.components, sizeof(gltf_vertex));
+        f32 fast = timer_elasped(&t);
+
+        log("[bench]   %-20s per-vertex %8.2f ms | bulk %8.2f ms (x%.2f)", c.name, slow, fast, slow / fast);
+    }
+
+    cgltf_component_type index_types[] = { cgltf_component_type_r_16u, cgltf_component_type_r_32u };
+    for (auto type : index_types) {
+        bench_stream stream;
+        bench_make_stream(&stream, type, cgltf_type_scalar, false, count);
+
+        timer t;
+        timer_init(&t);
+        for (u32 i = 0; i < count; i++) {
+            indices[i] = cgltf_accessor_read_index(&stream.accessor, i);
+        }
+        f32 slow = timer_elasped(&t);
+
+        timer_restart(&t);
+        gltf_accessor_unpack_indices(&stream.accessor, indices.data());
+        f32 fast = timer_elasped(&t);
+
+        log("[bench]   %-20s per-index  %8.2f ms | bulk %8.2f ms (x%.2f)", type == cgltf_component_type_r_16u ? "INDICES u16" : "INDICES u32", slow, fast, slow / fast);
+    }
+}
+
+/// @note(ame): bench_gltf_load <path> -- the model must have been loaded once so its .wnm exists
+void bench_gltf_load(std::vector<std::string> args)
+{
+    if (args.size() < 2) {
+        log("usage: bench_gltf_load <path to gltf>");
+        return;
+    }
+    const std::string& path = args[1];
+
+    gltf_node node = {};
+    node.transform = glm::mat4(1.0f);
+
+    /// @note(ame): import path: parse + buffers + decode + merge
+    f32 import_ms = 0.0f;
+    {
+        timer t;
+        timer_init(&t);
+
+        cgltf_options options = {};
+        cgltf_data *data = nullptr;
+        if (cgltf_parse_file(&options, path.c_str(), &data) != cgltf_result_success || cgltf_load_buffers(&options, data, path.c_str()) != cgltf_result_success) {
+            log("[bench] failed to load %s", path.c_str());
+            return;
+        }
+
+        gltf_model model = {};
+        model.path = path;
+        model.gen_collisions = false;
+
+        std::vector<gltf_primitive_import> imports;
+        for (u32 i = 0; i < data->meshes_count; i++) {
+            for (u32 j = 0; j < data->meshes[i].primitives_count; j++) {
+                if (data->meshes[i].primitives[j].type != cgltf_primitive_type_triangles) {
+                    continue;
+                }
+                gltf_primitive_import prim;
+                prim.primitive = &data->meshes[i].primitives[j];
+                prim.node = &node;
+                imports.push_back(prim);
+            }
+        }
+        gltf_import_primitives(&model, imports);
+        cgltf_free(data);
+
+        import_ms = timer_elasped(&t);
+    }
+
+    /// @note(ame): baked path: read + merge
+    f32 baked_ms = 0.0f;
+    {
+        timer t;
+        timer_init(&t);
+
+        gltf_baked_mesh baked;
+        if (!gltf_baked_open(&baked, gltf_source_hash(path))) {
+            log("[bench] %s has no up to date .wnm, load it once first", path.c_str());
+            return;
+        }
+
+        gltf_model model = {};
+        model.path = path;
+        model.gen_collisions = false;
+
+        std::vector<gltf_primitive_import> imports(baked.header->primitive_count);
+        for (u32 i = 0; i < baked.header->primitive_count; i++) {
+            imports[i].node = &node;
+            imports[i].vertex_data = baked.vertices + baked.primitives[i].vertex_offset;
+            imports[i].index_data = baked.indices + baked.primitives[i].index_offset;
+            imports[i].vertex_count = baked.primitives[i].vertex_count;
+            imports[i].index_count = baked.primitives[i].index_count;
+        }
+        gltf_import_primitives(&model, imports);
+        gltf_baked_close(&baked);
+
+        baked_ms = timer_elasped(&t);
+    }
+
+    log("[bench] %s: glTF import %.2f ms | baked .wnm %.2f ms (x%.2f)", path.c_str(), import_ms, baked_ms, import_ms / baked_ms);
+}
+
+/// @note(ame): bench_mips [box|kaiser]
+void bench_mips(std::vector<std::string> args)
+{
+    mip_filter filter = (args.size() > 1 && args[1] == "kaiser") ? MipFilter_Kaiser : MipFilter_Box;
+    const cpu_features& features = wn_cpu_features();
+
+    for (i32 size : { 1024, 2048, 4096 }) {
+        /// @note(ame): gradient + noise, with some alpha so the premultiply isn't a no-op
+        std::vector<u8> rgba(u64(size) * size * 4);
+        for (i32 y = 0; y < size; y++) {
+            for (i32 x = 0; x < size; x++) {
+                u8 *p = rgba.data() + (u64(y) * size + x) * 4;
+                p[0] = (u8)(x * 255 / size);
+                p[1] = (u8)(y * 255 / size);
+                p[2] = (u8)((x ^ y) * 31);
+                p[3] = (u8)(128 + ((x * 7 + y * 13) & 127));
+            }
+        }
+
+        /// @note(ame): the old path, nvtt does the whole chain on planar floats
+        f32 nvtt_ms = 0.0f;
+        {
+            timer t;
+            timer_init(&t);
+
+            std::vector<u8> bgra(rgba.size());
+            for (u64 i = 0; i < rgba.size(); i += 4) {
+                bgra[i + 0] = rgba[i + 2];
+                bgra[i + 1] = rgba[i + 1];
+                bgra[i + 2] = rgba[i + 0];
+                bgra[i + 3] = rgba[i + 3];
+            }
+
+            nvtt::Surface image;
+            image.setImage(nvtt::InputFormat_BGRA_8UB, size, size, 1, bgra.data());
+            while (image.canMakeNextMipmap()) {
+                image.toLinearFromSrgb();
+                image.premultiplyAlpha();
+                image.buildNextMipmap(filter == MipFilter_Kaiser ? nvtt::MipmapFilter_Kaiser : nvtt::MipmapFilter_Box);
+                image.demultiplyAlpha();
+                image.toSrgb();
+            }
+            nvtt_ms = timer_elasped(&t);
+        }
+
+        f32 times[3] = {};
+        mip_isa isas[3] = { MipIsa_Scalar, MipIsa_SSE4, MipIsa_AVX2 };
+        bool supported[3] = { true, features.sse41, features.avx2 };
+        for (i32 i = 0; i < 3; i++) {
+            if (!supported[i]) {
+                continue;
+            }
+
+            timer t;
+            timer_init(&t);
+
+            mip_chain chain;
+            mip_chain_build(&chain, rgba.data(), size, size, filter, true, isas[i]);
+            times[i] = timer_elasped(&t);
+        }
+
+        log("[bench] %dx%d %s mips: nvtt %.2f ms | scalar %.2f ms | SSE4 %.2f ms | AVX2 %.2f ms (x%.2f vs nvtt)", size, size, filter == MipFilter_Kaiser ? "kaiser" : "box", nvtt_ms, times[0], times[1], times[2], nvtt_ms / (features.avx2 ? times[2] : (features.sse41 ? times[1] : times[0])));
+    }
+}
+
+/// @note(ame): bench_uploader [textures] [size] [budget_kb] [ring_mb]
+/// Headless: runs the streaming uploader on the null backend with a 2 ms simulated GPU latency, one update per frame.
+void bench_uploader(std::vector<std::string> args)
+{
+    u32 count = bench_arg(args, 1, 256);
+    u32 size = bench_arg(args, 2, 1024);
+    u64 budget = u64(bench_arg(args, 3, 32768)) * 1024;
+    u64 ring_size = u64(bench_arg(args, 4, 128)) * 1024 * 1024;
+
+    null_copy_backend backend;
+    backend.latency_ms = 2.0f;
+    backend.alignment = 512;
+
+    uploader_ctx ctx;
+    uploader_ctx_init(&ctx, &backend, ring_size);
+
+    u64 texture_bytes = u64(size) * size * 4 * 4 / 3;
+    for (u32 i = 0; i < count; i++) {
+        upload_request *request = new upload_request;
+        request->output_tex = nullptr;
+        request->ready = nullptr;
+        request->bitmap.width = size;
+        request->bitmap.height = size;
+        request->bitmap.pixels.resize(texture_bytes, (u8)i);
+        uploader_ctx_push(&ctx, request);
+    }
+
+    timer t;
+    timer_init(&t);
+    f32 worst_frame_ms = 0.0f;
+    while (ctx.outstanding > 0) {
+        timer frame;
+        timer_init(&frame);
+        uploader_ctx_update(&ctx, budget);
+        worst_frame_ms = std::max(worst_frame_ms, timer_elasped(&frame));
+    }
+    backend.wait(ctx.last_fence);
+    f32 total_ms = timer_elasped(&t);
+
+    uploader_stats *stats = &ctx.stats;
+    log("[bench] uploader: %u textures (%ux%u), %.2f MB in %llu frames, %.2f ms (%.2f MB/s)", count, size, size, stats->bytes / (1024.0 * 1024.0), stats->frames, total_ms, (stats->bytes / (1024.0 * 1024.0)) / TIMER_SECONDS(total_ms));
+    log("[bench] uploader: avg %.2f MB/frame, max %.2f MB/frame, worst update %.2f ms, budget stalls %llu, ring stalls %llu, dedicated %llu", (stats->bytes / (1024.0 * 1024.0)) / std::max(stats->frames, 1ull), stats->max_frame_bytes / (1024.0 * 1024.0), worst_frame_ms, stats->budget_stalls, stats->ring_stalls, stats->dedicated);
+
+    uploader_ctx_exit(&ctx);
+}
+
+/// @note(ame): bench_fs <path> [runs], copy into a vector vs hash straight from the mapping
+void bench_fs(std::vector<std::string> args)
+{
+    if (args.size() < 2) {
+        log("[bench] usage: bench_fs <path> [runs]");
+        return;
+    }
+    const std::string& path = args[1];
+    u32 runs = bench_arg(args, 2, 10);
+
+    u64 size = fs_filesize(path);
+    u64 check = 0;
+
+    timer t;
+    timer_init(&t);
+    for (u32 i = 0; i < runs; i++) {
+        std::vector<u8> bytes = fs_readbytes(path);
+        check ^= wn_hash(bytes.data(), bytes.size(), 1000);
+    }
+    f32 copy_ms = timer_elasped(&t) / runs;
+
+    timer_restart(&t);
+    for (u32 i = 0; i < runs; i++) {
+        fs_mapped_file file;
+        if (!fs_map(&file, path)) {
+            log("[bench] failed to map %s", path.c_str());
+            return;
+        }
+        check ^= wn_hash(file.data, file.size, 1000);
+        fs_unmap(&file);
+    }
+    f32 map_ms = timer_elasped(&t) / runs;
+
+    f64 mb = size / (1024.0 * 1024.0);
+    log("[bench] %s (%.2f MB): read + hash %.2f ms (%.0f MB/s) | map + hash %.2f ms (%.0f MB/s) [%llx]", path.c_str(), mb, copy_ms, mb / TIMER_SECONDS(copy_ms), map_ms, mb / TIMER_SECONDS(map_ms), check);
+}
+
+f32 bench_pak_read(const std::vector<std::string>& files, u32 runs, u64 *check)
+{
+    timer t;
+    timer_init(&t);
+    for (u32 i = 0; i < runs; i++) {
+        for (auto& path : files) {
+            fs_mapped_file file;
+            if (fs_map(&file, path)) {
+                *check ^= wn_hash(file.data, file.size, 1000);
+                fs_unmap(&file);
+            }
+        }
+    }
+    return timer_elasped(&t) / runs;
+}
+
+/// @note(ame): bench_pak <directory> [runs] -- loose files vs the same files packed raw and compressed
+void bench_pak(std::vector<std::string> args)
+{
+    if (args.size() < 2 || !fs_isdir(args[1])) {
+        log("[bench] usage: bench_pak <directory> [runs]");
+        return;
+    }
+    const std::string& directory = args[1];
+    u32 runs = bench_arg(args, 2, 3);
+
+    std::vector<std::string> files;
+    u64 total = 0;
+    for (const auto& dir_entry : std::filesystem::recursive_directory_iterator(directory)) {
+        if (dir_entry.is_regular_file()) {
+            files.push_back(dir_entry.path().string());
+            total += dir_entry.file_size();
+        }
+    }
+    f64 mb = total / (1024.0 * 1024.0);
+    u64 check = 0;
+
+    f32 loose_ms = bench_pak_read(files, runs, &check);
+    log("[bench] %s: %d files, %.2f MB | loose %.2f ms (%.0f MB/s)", directory.c_str(), (u32)files.size(), mb, loose_ms, mb / TIMER_SECONDS(loose_ms));
+
+    for (bool compress : { false, true }) {
+        std::string archive = ASSET_CACHE_DIRECTORY "bench.wnpak";
+
+        timer t;
+        timer_init(&t);
+        if (!pak_build(directory, archive, compress) || !pak_mount(archive)) {
+            return;
+        }
+        f32 build_ms = timer_elasped(&t);
+        u64 archive_size = fs_filesize(archive);
+
+        f32 packed_ms = bench_pak_read(files, runs, &check);
+        pak_unmount(archive);
+        fs_delete(archive);
+
+        log("[bench] %s: %.2f MB on disk (%.1f%%), built in %.2f ms | read %.2f ms (%.0f MB/s)", compress ? "compressed" : "raw", archive_size / (1024.0 * 1024.0), archive_size * 100.0 / std::max<u64>(total, 1), build_ms, packed_ms, mb / TIMER_SECONDS(packed_ms));
+    }
+    log("[bench] [%llx]", check);
+}
+
+u64 bench_resource_cache_referenced()
+{
+    u64 referenced = 0;
+    for (auto& shard : global_cache.shards) {
+        std::unique_lock<std::mutex> lock(shard.lock);
+        for (auto& res : shard.resources) {
+            referenced += res.second->ref_count > 0 ? 1 : 0;
+        }
+    }
+    return referenced;
+}
+
+/// @note(ame): bench_resource_cache <texture directory> [workers] [iterations] -- every worker randomly requests and gives back
+/// textures from a small set while the main thread keeps ticking the cache, so loads, hits and frees all race each other
+void bench_resource_cache(std::vector<std::string> args)
+{
+    if (args.size() < 2 || !fs_isdir(args[1])) {
+        log("[bench] usage: bench_resource_cache <texture directory> [workers] [iterations]");
+        return;
+    }
+    u32 workers = bench_arg(args, 2, job_system_thread_count());
+    u32 iterations = bench_arg(args, 3, 100000);
+
+    std::vector<std::string> paths;
+    for (const auto& dir_entry : std::filesystem::recursive_directory_iterator(args[1])) {
+        std::string extension = dir_entry.path().extension().string();
+        if (dir_entry.is_regular_file() && (extension == ".png" || extension == ".jpg" || extension == ".jpeg")) {
+            std::string path = dir_entry.path().string();
+            std::replace(path.begin(), path.end(), '\\', '/');
+            paths.push_back(path);
+        }
+        if (paths.size() == 32) {
+            break;
+        }
+    }
+    if (paths.empty()) {
+        log("[bench] no textures under %s", args[1].c_str());
+        return;
+    }
+
+    u64 referenced = bench_resource_cache_referenced();
+    u64 requests = global_cache.stats.requests;
+    u64 hits = global_cache.stats.hits;
+    u64 loads = global_cache.stats.loads;
+    u64 discarded = global_cache.stats.discarded;
+    u64 revived = global_cache.stats.revived;
+    u64 evictions = global_cache.stats.evictions;
+
+    timer t;
+    timer_init(&t);
+
+    job_counter counter;
+    for (u32 w = 0; w < workers; w++) {
+        job_push([&paths, iterations, w]() {
+            std::mt19937 rng(w);
+            std::vector<resource*> held;
+            for (u32 i = 0; i < iterations; i++) {
+                if (held.size() < 8 && (rng() & 1)) {
+                    held.push_back(resource_cache_request(paths[rng() % paths.size()], ResourceType_Texture, false));
+                } else if (!held.empty()) {
+                    u32 index = rng() % held.size();
+                    resource_cache_give_back(held[index]);
+                    held[index] = held.back();
+                    held.pop_back();
+                }
+            }
+            for (resource *res : held) {
+                resource_cache_give_back(res);
+            }
+        }, &counter);
+    }
+
+    /// @note(ame): don't help with the jobs, the main thread has its own part to play
+    u32 ticks = 0;
+    while (counter.pending > 0) {
+        resource_cache_update();
+        ticks++;
+        std::this_thread::yield();
+    }
+    resource_cache_update();
+    f32 ms = timer_elasped(&t);
+
+    u64 ops = u64(workers) * iterations;
+    u64 leaked = bench_resource_cache_referenced() - referenced;
+    log("[bench] resource cache: %u workers x %u ops on %u textures in %.2f ms (%.2f Mops/s), %u main thread ticks", workers, iterations, (u32)paths.size(), ms, ops / (ms * 1000.0), ticks);
+    log("[bench]   %llu requests, %llu hits (%llu from the LRU), %llu loads, %llu discarded, %llu evictions, %llu leaked%s",
+        global_cache.stats.requests - requests, global_cache.stats.hits - hits, global_cache.stats.revived - revived, global_cache.stats.loads - loads,
+        global_cache.stats.discarded - discarded, global_cache.stats.evictions - evictions, leaked, leaked ? " -- REF COUNT BUG" : "");
+}
+
+/// @note(ame): a `grid` x `grid` hilly terrain, 1 meter per cell
+void bench_make_terrain(geometry_streams *streams, u32 grid)
+{
+    geometry_resize(streams, u64(grid) * grid, u64(grid - 1) * (grid - 1) * 6);
+    for (u32 z = 0; z < grid; z++) {
+        for (u32 x = 0; x < grid; x++) {
+            streams->x[z * grid + x] = (f32)x;
+            streams->y[z * grid + x] = 4.0f * std::sin(x * 0.05f) * std::cos(z * 0.07f);
+            streams->z[z * grid + x] = (f32)z;
+        }
+    }
+    u32 *indices = streams->indices.data();
+    for (u32 z = 0; z < grid - 1; z++) {
+        for (u32 x = 0; x < grid - 1; x++) {
+            u32 v = z * grid + x;
+            u32 quad[] = { v, v + grid, v + 1, v + 1, v + grid, v + grid + 1 };
+            memcpy(indices, quad, sizeof(quad));
+            indices += 6;
+        }
+    }
+}
+
+/// @note(ame): bench_navmesh [level.gltf | grid] [obstacles] -- bake time of the flattened level geometry against tile size and
+/// thread count, then a cold and a warm navmesh_init, then obstacle rebuilds. Without a level it bakes a `grid` x `grid` hilly
+/// terrain, 1 meter per cell.
+void bench_navmesh(std::vector<std::string> args)
+{
+    /// @note(ame): the import's streams outlive the discard, the navmesh reads them in place
+    gltf_model model = {};
+    bool from_level = args.size() > 1 && !std::isdigit((u8)args[1][0]);
+    if (from_level) {
+        gltf_load_state state;
+        gltf_model_import(&model, &state, args[1], false);
+        gltf_model_discard(&model, &state);
+    } else {
+        bench_make_terrain(&model.geometry, bench_arg(args, 1, 512));
+    }
+    navmesh_build_info info;
+    info.geometry = geometry_get_view(model.geometry);
+
+    u32 all_threads = job_system_thread_count() + 1;
+    log("[bench] navmesh: %s, %u triangles, %u threads", from_level ? args[1].c_str() : "synthetic terrain", (u32)info.geometry.index_count / 3, all_threads);
+
+    navmesh_settings settings = navmesh_get_settings();
+    for (u32 tile_size : { 32u, 64u, 128u, 256u }) {
+        settings.tile_size = tile_size;
+
+        f32 single_ms = 0.0f;
+        for (u32 threads : { 1u, 2u, 4u, all_threads }) {
+            navmesh mesh = {};
+            timer t;
+            timer_init(&t);
+            navmesh_bake(&mesh, info, settings, threads);
+            f32 ms = timer_elasped(&t);
+            if (threads == 1) {
+                single_ms = ms;
+            }
+
+            log("[bench]   tile %3u cells, %2u threads: %9.2f ms (x%.1f) | %u tiles, %u polys", tile_size, threads, ms, single_ms / ms, mesh.tile_count, mesh.poly_count);
+            navmesh_free(&mesh);
+        }
+    }
+
+    /// @note(ame): a fresh content hash so the cold run can't hit the cache of an earlier bench
+    info.content_hash = bench_cold_seed();
+    navmesh mesh = {};
+    f32 timings[2];
+    for (u32 run = 0; run < 2; run++) {
+        navmesh_free(&mesh);
+        timer t;
+        timer_init(&t);
+        navmesh_init(&mesh, info);
+        timings[run] = timer_elasped(&t);
+    }
+    log("[bench]   navmesh_init: cold %.2f ms | warm %.2f ms (x%.1f)", timings[0], timings[1], timings[0] / timings[1]);
+
+    /// @note(ame): crates as tall as the level, all carved at once, then all moved and rebuilt a budget at a time
+    u32 obstacle_count = bench_arg(args, 2, 64);
+    glm::vec3 min = glm::make_vec3(mesh.config.bmin);
+    glm::vec3 max = glm::make_vec3(mesh.config.bmax);
+    std::mt19937 rng(4321);
+    std::uniform_real_distribution<f32> across_x(min.x, max.x);
+    std::uniform_real_distribution<f32> across_z(min.z, max.z);
+
+    std::vector<u32> obstacles(obstacle_count);
+    std::vector<glm::vec3> centers(obstacle_count);
+    for (u32 i = 0; i < obstacle_count; i++) {
+        centers[i] = glm::vec3(across_x(rng), 0.0f, across_z(rng));
+        obstacles[i] = navmesh_obstacle_add(&mesh, glm::vec3(centers[i].x - 1.0f, min.y - 1.0f, centers[i].z - 1.0f), glm::vec3(centers[i].x + 1.0f, max.y + 1.0f, centers[i].z + 1.0f));
+    }
+
+    u64 tiles = mesh.rebuild_stats.tiles;
+    timer t;
+    timer_init(&t);
+    navmesh_flush(&mesh);
+    f32 flush_ms = timer_elasped(&t);
+    log("[bench]   %u obstacles: %llu tiles rebuilt in %.2f ms, %u polys left", obstacle_count, mesh.rebuild_stats.tiles - tiles, flush_ms, mesh.poly_count);
+
+    /// @note(ame): one update per frame, the frame waits on the round as if it took longer than the rebuild
+    for (u32 i = 0; i < obstacle_count; i++) {
+        centers[i] += glm::vec3(2.0f, 0.0f, 0.0f);
+        navmesh_obstacle_move(&mesh, obstacles[i], glm::vec3(centers[i].x - 1.0f, min.y - 1.0f, centers[i].z - 1.0f), glm::vec3(centers[i].x + 1.0f, max.y + 1.0f, centers[i].z + 1.0f));
+    }
+
+    tiles = mesh.rebuild_stats.tiles;
+    mesh.rebuild_stats.worst_ms = 0.0f;
+    u32 frames = 0;
+    timer_restart(&t);
+    while (mesh.rebuild || !mesh.dirty_tiles.empty()) {
+        navmesh_update(&mesh);
+        if (mesh.rebuild) {
+            job_wait(&mesh.rebuild->counter);
+        }
+        frames++;
+    }
+    log("[bench]   moved them: %llu tiles over %u frames in %.2f ms, worst round %.2f ms",
+        mesh.rebuild_stats.tiles - tiles, frames, timer_elasped(&t), mesh.rebuild_stats.worst_ms);
+
+    navmesh_free(&mesh);
+}
+
+/// @note(ame): a flat `size` x `size` floor with a 2x2 pillar every `spacing` meters, 1 meter per cell
+void bench_make_pillar_level(geometry_streams *streams, u32 size, u32 spacing)
+{
+    u32 grid = size + 1;
+    for (u32 z = 0; z < grid; z++) {
+        for (u32 x = 0; x < grid; x++) {
+            streams->x.push_back((f32)x);
+            streams->y.push_back(0.0f);
+            streams->z.push_back((f32)z);
+        }
+    }
+    for (u32 z = 0; z < size; z++) {
+        for (u32 x = 0; x < size; x++) {
+            u32 v = z * grid + x;
+            streams->indices.insert(streams->indices.end(), { v, v + grid, v + 1, v + 1, v + grid, v + grid + 1 });
+        }
+    }
+
+    /// @note(ame): top and four sides, no bottom
+    static const u32 box_indices[] = {
+        4, 7, 6, 4, 6, 5,
+        0, 4, 7, 0, 7, 3,
+        1, 2, 6, 1, 6, 5,
+        0, 1, 5, 0, 5, 4,
+        3, 7, 6, 3, 6, 2,
+    };
+    for (u32 z = spacing / 2; z + 2 < size; z += spacing) {
+        for (u32 x = spacing / 2; x + 2 < size; x += spacing) {
+            u32 base = streams->x.size();
+            for (u32 corner = 0; corner < 8; corner++) {
+                streams->x.push_back(x + ((corner == 1 || corner == 2 || corner == 5 || corner == 6) ? 2.0f : 0.0f));
+                streams->y.push_back(corner >= 4 ? 3.0f : 0.0f);
+                streams->z.push_back(z + ((corner == 2 || corner == 3 || corner == 6 || corner == 7) ? 2.0f : 0.0f));
+            }
+            for (u32 index : box_indices) {
+                streams->indices.push_back(base + index);
+            }
+        }
+    }
+}
+
+/// @note(ame): bench_crowd [max agents] [steps] -- one crowd step (what a fixed physics step costs the crowd job) against the
+/// agent count, 10 up to `max agents`, on a generated pillar level. Every agent runs to a random target and gets a new one
+/// every second. Headless, no characters, only the dtCrowd update the job runs during render.
+void bench_crowd(std::vector<std::string> args)
+{
+    u32 max_agents = bench_arg(args, 1, 2000);
+    u32 steps = bench_arg(args, 2, 900);
+    const f32 dt = 1.0f / PHYSICS_STEP_HZ;
+
+    geometry_streams level;
+    bench_make_pillar_level(&level, 128, 8);
+    navmesh_build_info info;
+    info.geometry = geometry_get_view(level);
+    navmesh mesh = {};
+    navmesh_bake(&mesh, info, navmesh_get_settings());
+    log("[bench] crowd: %u triangles, %u tiles, %u polys, %u steps of %.2f ms", (u32)level.indices.size() / 3, mesh.tile_count, mesh.poly_count, steps, dt * 1000.0f);
+
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<f32> across(1.0f, 127.0f);
+    for (u32 count : { 10u, 100u, 500u, 1000u, 2000u }) {
+        if (count > max_agents) {
+            break;
+        }
+
+        crowd_init(&mesh, count);
+        std::vector<i32> agents;
+        while (agents.size() < count) {
+            i32 agent = crowd_agent_add(&mesh, glm::vec3(across(rng), 0.0f, across(rng)), ENEMY_RADIUS, ENEMY_HEIGHT + ENEMY_RADIUS * 2.0f, ENEMY_SPEED);
+            if (agent < 0) {
+                continue; /// @note(ame): landed in a pillar
+            }
+            agents.push_back(agent);
+        }
+
+        f32 total_ms = 0.0f;
+        f32 worst_ms = 0.0f;
+        for (u32 step = 0; step < steps; step++) {
+            if (step % PHYSICS_STEP_HZ == 0) {
+                for (i32 agent : agents) {
+                    crowd_agent_set_target(&mesh, agent, glm::vec3(across(rng), 0.0f, across(rng)));
+                }
+            }
+
+            timer t;
+            timer_init(&t);
+            crowd_update_async(&mesh, 1, dt);
+            crowd_wait(&mesh);
+            f32 ms = timer_elasped(&t);
+            total_ms += ms;
+            worst_ms = std::max(worst_ms, ms);
+        }
+
+        f32 average_ms = total_ms / steps;
+        log("[bench]   %4u agents: %7.3f ms/step avg (%.2f us/agent), worst %7.3f ms, %5.1f%% of a step",
+            count, average_ms, average_ms * 1000.0f / count, worst_ms, average_ms / (dt * 1000.0f) * 100.0f);
+        crowd_free(&mesh);
+    }
+
+    navmesh_free(&mesh);
+}
+
+/// @note(ame): bench_pathfind [requests] [workers] -- `requests` random paths across a generated pillar level, one blocking
+/// findPath after the other, then all through the pathfinder a frame at a time, then the same ones again out of the cache.
+void bench_pathfind(std::vector<std::string> args)
+{
+    u32 count = bench_arg(args, 1, 2000);
+    u32 workers = bench_arg(args, 2, 0);
+
+    geometry_streams level;
+    bench_make_pillar_level(&level, 256, 8);
+    navmesh_build_info info;
+    info.geometry = geometry_get_view(level);
+    navmesh mesh = {};
+    navmesh_bake(&mesh, info, navmesh_get_settings());
+
+    std::mt19937 rng(5678);
+    std::uniform_real_distribution<f32> across(1.0f, 255.0f);
+    std::vector<glm::vec3> starts(count);
+    std::vector<glm::vec3> goals(count);
+    for (u32 i = 0; i < count; i++) {
+        starts[i] = glm::vec3(across(rng), 0.0f, across(rng));
+        goals[i] = glm::vec3(across(rng), 0.0f, across(rng));
+    }
+
+    pathfind_init(&mesh, workers);
+    pathfinder *paths = mesh.paths;
+    paths->cache_size = count; /// @note(ame): big enough for the second pass to hit on every pair
+    log("[bench] pathfind: %u requests, %u tiles, %u polys, %u workers", count, mesh.tile_count, mesh.poly_count, (u32)paths->workers.size());
+
+    /// @note(ame): what one findPath per enemy per frame would cost
+    dtNavMeshQuery *query = dtAllocNavMeshQuery();
+    query->init(mesh.mesh, PATHFIND_QUERY_NODES);
+    const f32 extents[3] = { 2.0f, 4.0f, 2.0f };
+    u32 found = 0;
+    timer t;
+    timer_init(&t);
+    for (u32 i = 0; i < count; i++) {
+        dtPolyRef start_ref = 0;
+        dtPolyRef goal_ref = 0;
+        f32 start[3];
+        f32 goal[3];
+        query->findNearestPoly(glm::value_ptr(starts[i]), extents, &paths->filter, &start_ref, start);
+        query->findNearestPoly(glm::value_ptr(goals[i]), extents, &paths->filter, &goal_ref, goal);
+
+        dtPolyRef corridor[PATHFIND_MAX_POLYS];
+        i32 polys = 0;
+        if (start_ref && goal_ref && dtStatusSucceed(query->findPath(start_ref, goal_ref, start, goal, &paths->filter, corridor, &polys, PATHFIND_MAX_POLYS))) {
+            f32 points[PATHFIND_MAX_POLYS * 3];
+            i32 point_count = 0;
+            query->findStraightPath(start, goal, corridor, polys, points, nullptr, nullptr, &point_count, PATHFIND_MAX_POLYS);
+            found++;
+        }
+    }
+    f32 blocking_ms = timer_elasped(&t);
+    dtFreeNavMeshQuery(query);
+    log("[bench]   blocking: %.2f ms (%.1f us/path), %u found", blocking_ms, blocking_ms * 1000.0f / count, found);
+
+    /// @note(ame): a frame is the update then the wait, as if the render took exactly as long as the workers did
+    for (const char *pass : { "cold", "cached" }) {
+        pathfinder_stats before = paths->stats;
+        paths->stats.worst_ms = 0.0f;
+
+        std::vector<path_ticket> tickets(count);
+        timer_restart(&t);
+        for (u32 i = 0; i < count; i++) {
+            tickets[i] = pathfind_request(&mesh, starts[i], goals[i]);
+        }
+        f32 request_ms = timer_elasped(&t);
+
+        u32 frames = 0;
+        f32 main_ms = 0.0f;
+        u32 pending = count;
+        while (pending) {
+            timer frame;
+            timer_init(&frame);
+            pathfind_update(&mesh);
+            main_ms = std::max(main_ms, timer_elasped(&frame));
+            pathfind_wait(&mesh);
+            frames++;
+
+            pending = 0;
+            for (path_ticket& ticket : tickets) {
+                if (ticket && pathfind_poll(&mesh, ticket) == PathStatus_Pending) {
+                    pending++;
+                } else {
+                    ticket = 0;
+                }
+            }
+        }
+        f32 ms = timer_elasped(&t);
+
+        log("[bench]   %s: %.2f ms over %u frames, %.2f ms to request | worst worker slice %.2f ms, worst main thread %.2f ms",
+            pass, ms, frames, request_ms, paths->stats.worst_ms, main_ms);
+        log("[bench]     %llu completed, %llu failed, %llu cache hits, %llu A* iterations",
+            paths->stats.completed - before.completed, paths->stats.failed - before.failed, paths->stats.cache_hits - before.cache_hits,
+            paths->stats.iterations - before.iterations);
+    }
+
+    navmesh_free(&mesh);
+}
+
+/// @note(ame): bench_geometry [triangles] -- what the navmesh bake has to go through before it gets to the tiles, on a terrain of
+/// about `triangles` triangles. "copied" is how it used to go: the level kept full gltf_vertex arrays around, the world copied
+/// them into navmesh_build_info, the bake flattened that into f32/i32 arrays and classified every triangle one at a time.
+/// "view" is the position streams read in place. Memory is every buffer alive at the peak of each.
+void bench_geometry(std::vector<std::string> args)
+{
+    u32 triangles = bench_arg(args, 1, 5000000);
+    u32 grid = (u32)std::sqrt(triangles / 2.0) + 1;
+    const f32 max_slope = navmesh_get_settings().agent_max_slope;
+
+    geometry_streams streams;
+    bench_make_terrain(&streams, grid);
+    geometry_view view = geometry_get_view(streams);
+    u64 vertex_count = view.vertex_count;
+    u64 triangle_count = view.index_count / 3;
+    log("[bench] geometry: %llu vertices, %llu triangles", vertex_count, triangle_count);
+
+    /// @note(ame): copied
+    f32 copied_ms[3];
+    u64 copied_bytes;
+    {
+        std::vector<gltf_vertex> level_vertices(vertex_count);
+        for (u64 i = 0; i < vertex_count; i++) {
+            level_vertices[i].Position = geometry_position(view, i);
+        }
+        std::vector<u32> level_indices(streams.indices);
+
+        timer t;
+        timer_init(&t);
+        std::vector<gltf_vertex> info_vertices = level_vertices;
+        std::vector<u32> info_indices = level_indices;
+        copied_ms[0] = timer_elasped(&t);
+
+        timer_restart(&t);
+        std::vector<f32> vertices;
+        std::vector<i32> indices;
+        for (auto& vertex : info_vertices) {
+            vertices.push_back(vertex.Position.x);
+            vertices.push_back(vertex.Position.y);
+            vertices.push_back(vertex.Position.z);
+        }
+        for (u32 index : info_indices) {
+            indices.push_back(index);
+        }
+        copied_ms[1] = timer_elasped(&t);
+
+        timer_restart(&t);
+        const f32 threshold = std::cos(glm::radians(max_slope));
+        std::vector<u8> areas(triangle_count);
+        for (u64 i = 0; i < triangle_count; i++) {
+            glm::vec3 a = glm::make_vec3(vertices.data() + indices[i * 3 + 0] * 3);
+            glm::vec3 b = glm::make_vec3(vertices.data() + indices[i * 3 + 1] * 3);
+            glm::vec3 c = glm::make_vec3(vertices.data() + indices[i * 3 + 2] * 3);
+            glm::vec3 normal = glm::cross(b - a, c - a);
+            f32 length = glm::length(normal);
+            areas[i] = (length > 0.0f && normal.y / length > threshold) ? RC_WALKABLE_AREA : RC_NULL_AREA;
+        }
+        copied_ms[2] = timer_elasped(&t);
+
+        copied_bytes = (level_vertices.capacity() + info_vertices.capacity()) * sizeof(gltf_vertex)
+                     + (level_indices.capacity() + info_indices.capacity()) * sizeof(u32)
+                     + vertices.capacity() * sizeof(f32) + indices.capacity() * sizeof(i32) + areas.capacity();
+    }
+
+    /// @note(ame): view
+    f32 view_ms[2];
+    u64 view_bytes;
+    {
+        timer t;
+        timer_init(&t);
+        std::vector<u8> areas(triangle_count);
+        geometry_classify_slopes(view, max_slope, RC_WALKABLE_AREA, 0, triangle_count, areas.data());
+        view_ms[0] = timer_elasped(&t);
+
+        timer_restart(&t);
+        const u32 chunk = 16384;
+        job_parallel_for((u32)((triangle_count + chunk - 1) / chunk), [&](u32 block) {
+            u64 first = u64(block) * chunk;
+            geometry_classify_slopes(view, max_slope, RC_WALKABLE_AREA, first, std::min<u64>(chunk, triangle_count - first), areas.data() + first);
+        });
+        view_ms[1] = timer_elasped(&t);
+
+        view_bytes = geometry_memory(streams) + areas.capacity();
+    }
+
+    f32 copied_total = copied_ms[0] + copied_ms[1] + copied_ms[2];
+    log("[bench]   copied: %.2f ms (build info copy %.2f, flatten %.2f, classify %.2f), %.1f MB",
+        copied_total, copied_ms[0], copied_ms[1], copied_ms[2], copied_bytes / (1024.0 * 1024.0));
+    log("[bench]   view:   %.2f ms classify (%s), %.2f ms on every thread, %.1f MB | x%.1f faster, x%.1f less memory",
+        view_ms[0], wn_cpu_features().avx2 ? "AVX2" : "SSE", view_ms[1], view_bytes / (1024.0 * 1024.0), copied_total / view_ms[0], (f64)copied_bytes / view_bytes);
+
+    /// @note(ame): the whole bake for scale, the tiles read the streams in place
+    navmesh_build_info info;
+    info.geometry = view;
+    navmesh mesh = {};
+    timer t;
+    timer_init(&t);
+    navmesh_bake(&mesh, info, navmesh_get_settings());
+    log("[bench]   full bake: %.2f ms, %u tiles, %u polys", timer_elasped(&t), mesh.tile_count, mesh.poly_count);
+    navmesh_free(&mesh);
+}
+
+void bench_init()
+{
+    dev_console_add_command("bench_gltf_import", bench_gltf_import);
+    dev_console_add_command("bench_gltf_accessors", bench_gltf_accessors);
+    dev_console_add_command("bench_gltf_load", bench_gltf_load);
+    dev_console_add_command("bench_mips", bench_mips);
+    dev_console_add_command("bench_uploader", bench_uploader);
+    dev_console_add_command("bench_fs", bench_fs);
+    dev_console_add_command("bench_pak", bench_pak);
+    dev_console_add_command("bench_resource_cache", bench_resource_cache);
+    dev_console_add_command("bench_collision", bench_collision);
+    dev_console_add_command("bench_static_bodies", bench_static_bodies);
+    dev_console_add_command("bench_characters", bench_characters);
+    dev_console_add_command("bench_triggers", bench_triggers);
+    dev_console_add_command("bench_queries", bench_queries);
+    dev_console_add_command("bench_navmesh", bench_navmesh);
+    dev_console_add_command("bench_crowd", bench_crowd);
+    dev_console_add_command("bench_pathfind", bench_pathfind);
+    dev_console_add_command("bench_geometry", bench_geometry);
+}
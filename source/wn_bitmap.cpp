@@ -8,11 +8,17 @@
 #include <nvtt/nvtt.h>
 #include <filesystem>
 #include <sstream>
+#include <atomic>
 
 #include "wn_bitmap.h"
 #include "wn_output.h"
 #include "wn_filesystem.h"
 #include "wn_util.h"
+#include "wn_asset_cache.h"
+#include "wn_timer.h"
+#include "wn_job.h"
+#include "wn_mipmap.h"
+#include "wn_cvar.h"
 
 class nvtt_error_handler : nvtt::ErrorHandler
 {
@@ -58,34 +64,50 @@ public:
 class texture_writer : nvtt::OutputHandler
 {
 public:
-    texture_writer(const std::string& path, int width, int height, int mipCount, int mode) {
+    texture_writer(const std::string& path, int width, int height, int mipCount, bitmap_format format) {
         f = fopen(path.c_str(), "wb+");
         if (!f) {
             log("[nvtt] failed to fopen file %s", path.c_str());
+            return;
         }
 
         bitmap_header header;
         header.width = width;
         header.height = height;
         header.levels = mipCount;
-        
-        fwrite(&header, sizeof(header), 1, f);
+        header.format = format;
+
+        written = fwrite(&header, sizeof(header), 1, f) == 1;
     }
 
     ~texture_writer() {
-        fclose(f);
+        close();
+    }
+
+    bool valid() const {
+        return f != nullptr;
+    }
+
+    /// @note(ame): false if any write came up short, the file can't be committed then
+    bool close() {
+        if (f) {
+            written = fclose(f) == 0 && written;
+            f = nullptr;
+        }
+        return written;
     }
 
     virtual void beginImage(int size, int width, int height, int depth, int face, int miplevel) override {}
     virtual void endImage() override {}
 
     virtual bool writeData(const void * data, int size) override {
-        fwrite(data, size, 1, f);
-        return true;
+        written = written && fwrite(data, size, 1, f) == 1;
+        return written;
     }
 
 private:
     FILE *f;
+    bool written = false;
 };
 
 bool is_valid_extension(const std::string& extension)
@@ -96,92 +118,292 @@ bool is_valid_extension(const std::string& extension)
         return true;
     if (extension == ".jpeg")
         return true;
+    if (extension == ".hdr")
+        return true;
 
     return false;
 }
 
-std::string get_cached_path(const std::string& path)
+void bitmap_init()
+{
+    cvar_register_unsigned("tex_mip_filter", MipFilter_Box);
+}
+
+/// @note(ame): bake jobs and uploader threads read this, the cvar has to be registered by bitmap_init beforehand
+mip_filter bitmap_mip_filter()
 {
-    std::stringstream path_ss;
+    static console_var *filter = cvar_get("tex_mip_filter");
+    return (mip_filter)filter->as.u;
+}
 
-    const char *key = path.c_str();
-    uint64_t hash = wn_hash(key, path.length(), 1000);
-    path_ss << ".cache/" << hash << ".wnt";
+u64 bitmap_settings_hash()
+{
+    /// @note(ame): anything that changes the baked bytes goes in here
+    u32 settings[] = { nvtt::Format::Format_BC7, nvtt::Format::Format_BC6U, (u32)bitmap_mip_filter(), 1 /* srgb */ };
+    return wn_hash(settings, sizeof(settings), 1000);
+}
 
-    return path_ss.str();
+u64 bitmap_cache_key(const std::string& path)
+{
+    return asset_cache_key(path, "bitmap", BITMAP_IMPORTER_VERSION, bitmap_settings_hash());
 }
 
-void bitmap_compress_recursive(const std::string& directory)
+struct bitmap_bake_item
+{
+    std::string path;
+    u64 size;
+    u64 key;
+};
+
+struct bitmap_bake_progress
+{
+    std::atomic<u32> done = 0;
+    std::atomic<u32> baked = 0;
+    std::atomic<u32> failed = 0;
+    std::atomic<u64> pixels = 0;
+    std::atomic<u64> input_bytes = 0;
+    std::atomic<u64> output_bytes = 0;
+};
+
+/// @note(ame): 8-bit sources go through our own mip generator. HDR and 16-bit ones stay as the floats nvtt decoded them
+/// to and get their mips from nvtt, quantizing them to RGBA8 first would throw away exactly what they're there for.
+bool bitmap_bake_wide(nvtt::Context *context, const bitmap_bake_item& item, nvtt::Surface& image, bool hdr, const nvtt::OutputOptions& output_options)
 {
-    if (!fs_exists(".cache")) {
-        fs_createdir(".cache/");
+    nvtt::CompressionOptions compression_options;
+    compression_options.setFormat(hdr ? nvtt::Format::Format_BC6U : nvtt::Format::Format_BC7);
+
+    nvtt::MipmapFilter filter = bitmap_mip_filter() == MipFilter_Kaiser ? nvtt::MipmapFilter_Kaiser : nvtt::MipmapFilter_Box;
+    i32 levels = mip_level_count(image.width(), image.height());
+
+    /// @note(ame): same rules as mip_chain_build, filter in linear space with premultiplied alpha. HDR is linear already
+    /// and BC6H drops alpha anyway.
+    if (!hdr) {
+        image.toLinearFromSrgb();
+        image.premultiplyAlpha();
     }
-    
-    nvtt_error_handler error_handler;
-    nvtt::Context context;
-    context.enableCudaAcceleration(true);
-    
-    if (context.isCudaAccelerationEnabled()) {
-        log("[bitmap_compressor] Compressing with CUDA");
-    } else {
-        log("[bitmap_compressor] Compressing without CUDA");
+    for (i32 i = 0; i < levels; i++) {
+        nvtt::Surface level = image;
+        if (!hdr) {
+            level.demultiplyAlpha();
+            level.toSrgb();
+        }
+        if (!context->compress(level, 0, i, compression_options, output_options)) {
+            log("[bitmap_compressor] failed to compress texture %s!", item.path.c_str());
+            return false;
+        }
+        if (i + 1 < levels) {
+            image.buildNextMipmap(filter);
+        }
     }
+    return true;
+}
 
+bool bitmap_bake_one(nvtt::Context *context, const bitmap_bake_item& item, u64 *pixels, u64 *output_bytes)
+{
+    nvtt_error_handler error_handler;
     nvtt::CompressionOptions compression_options;
     compression_options.setFormat(nvtt::Format::Format_BC7);
 
+    nvtt::Surface image;
+    if (!image.load(item.path.c_str())) {
+        log("[nvtt] Failed to load texture %s", item.path.c_str());
+        return false;
+    }
+
+    bool hdr = stbi_is_hdr(item.path.c_str()) != 0;
+    bool wide = hdr || stbi_is_16_bit(item.path.c_str());
+    u64 pixel_count = u64(image.width()) * image.height();
+    *pixels = pixel_count;
+
+    std::string temp = asset_cache_temp_path(item.key);
+    texture_writer *writer = new texture_writer(temp, image.width(), image.height(), mip_level_count(image.width(), image.height()), hdr ? BitmapFormat_BC6H : BitmapFormat_BC7);
+    if (!writer->valid()) {
+        delete writer;
+        return false;
+    }
+
+    nvtt::OutputOptions output_options;
+    output_options.setErrorHandler(reinterpret_cast<nvtt::ErrorHandler*>(&error_handler));
+    output_options.setOutputHandler(reinterpret_cast<nvtt::OutputHandler*>(writer));
+
+    bool success = true;
+    if (wide) {
+        success = bitmap_bake_wide(context, item, image, hdr, output_options);
+    } else {
+        /// @note(ame): nvtt decodes to planar floats, back to RGBA8 for the mip generator
+        std::vector<u8> rgba(pixel_count * 4);
+        for (i32 c = 0; c < 4; c++) {
+            const f32 *channel = image.channel(c);
+            for (u64 i = 0; i < pixel_count; i++) {
+                rgba[i * 4 + c] = (u8)(std::clamp(channel[i], 0.0f, 1.0f) * 255.0f + 0.5f);
+            }
+        }
+
+        mip_chain chain;
+        mip_chain_build(&chain, rgba.data(), image.width(), image.height(), bitmap_mip_filter(), true);
+
+        std::vector<u8> bgra;
+        for (i32 i = 0; i < chain.levels; i++) {
+            i32 width = mip_level_width(&chain, i);
+            i32 height = mip_level_height(&chain, i);
+            const u8 *level = mip_level_data(&chain, i);
+
+            bgra.resize(u64(width) * height * 4);
+            for (u64 j = 0; j < bgra.size(); j += 4) {
+                bgra[j + 0] = level[j + 2];
+                bgra[j + 1] = level[j + 1];
+                bgra[j + 2] = level[j + 0];
+                bgra[j + 3] = level[j + 3];
+            }
+
+            nvtt::Surface surface;
+            surface.setImage(nvtt::InputFormat_BGRA_8UB, width, height, 1, bgra.data());
+            if (!context->compress(surface, 0, i, compression_options, output_options)) {
+                log("[bitmap_compressor] failed to compress texture %s!", item.path.c_str());
+                success = false;
+                break;
+            }
+        }
+    }
+
+    /// @note(ame): the writer has to close the file before it can be moved into the cache
+    if (success && !writer->close()) {
+        log("[bitmap_compressor] failed to write %s", temp.c_str());
+        success = false;
+    }
+    delete writer;
+    if (!success) {
+        asset_cache_discard(temp);
+        return false;
+    }
+    *output_bytes = fs_filesize(temp);
+    return !asset_cache_commit(item.key, temp, ".wnt").empty();
+}
+
+bitmap_bake_stats bitmap_compress_recursive(const std::string& directory)
+{
+    bitmap_bake_stats stats = {};
+
+    timer bake_timer;
+    timer_init(&bake_timer);
+
+    /// @note(ame): the directory listing already has sizes and write times, so the stamp costs no extra IO.
+    /// If it matches the one from the last complete bake, every texture is already in the cache.
+    std::vector<bitmap_bake_item> items;
+    u32 version = BITMAP_IMPORTER_VERSION;
+    u64 stamp = wn_hash(&version, sizeof(version), bitmap_settings_hash());
     for (const auto& dir_entry : std::filesystem::recursive_directory_iterator(directory)) {
         std::string entry_path = dir_entry.path().string();
         std::replace(entry_path.begin(), entry_path.end(), '\\', '/');
         
-        std::string cached = get_cached_path(entry_path);
-        
-        if (!is_valid_extension(fs_getextension(entry_path))) {
+        if (!dir_entry.is_regular_file() || !is_valid_extension(fs_getextension(entry_path))) {
             continue;
         }
 
-        if (fs_exists(cached)) {
-            log("[bitmap_compressor] %s already compressed -- skipping.", entry_path.c_str());
-            continue;
-        }
+        bitmap_bake_item item = {};
+        item.path = entry_path;
+        item.size = dir_entry.file_size();
+        items.push_back(item);
 
-        nvtt::Surface image;
-        if (!image.load(entry_path.c_str())) {
-            log("[nvtt] Failed to load texture");
-        }
+        u64 write_time = dir_entry.last_write_time().time_since_epoch().count();
+        stamp = wn_hash(entry_path.c_str(), entry_path.size(), stamp);
+        stamp = wn_hash(&item.size, sizeof(item.size), stamp);
+        stamp = wn_hash(&write_time, sizeof(write_time), stamp);
+    }
+    stats.scanned = items.size();
+
+    std::string stamp_name = "bitmap:" + directory;
+    if (asset_cache_get_stamp(stamp_name) == stamp) {
+        stats.up_to_date = stats.scanned;
+        stats.seconds = TIMER_SECONDS(timer_elasped(&bake_timer));
+        log("[bitmap_compressor] %d textures in %s are up to date -- skipping bake (%.2f ms)", stats.scanned, directory.c_str(), timer_elasped(&bake_timer));
+        return stats;
+    }
 
-        i32 mip_count = image.countMipmaps();
-        texture_writer writer(cached, image.width(), image.height(), mip_count, 7);
+    /// @note(ame): content hashing reads every source, spread it too
+    job_parallel_for(items.size(), [&](u32 i) {
+        items[i].key = bitmap_cache_key(items[i].path);
+    });
 
-        nvtt::OutputOptions output_options;
-        output_options.setErrorHandler(reinterpret_cast<nvtt::ErrorHandler*>(&error_handler));
-        output_options.setOutputHandler(reinterpret_cast<nvtt::OutputHandler*>(&writer));
+    std::vector<bitmap_bake_item*> pending;
+    for (auto& item : items) {
+        if (!asset_cache_lookup(item.key, ".wnt", nullptr)) {
+            pending.push_back(&item);
+        }
+    }
+    stats.up_to_date = stats.scanned - pending.size();
 
-        for (i32 i = 0; i < mip_count; i++) {
-            if (!context.compress(image, 0, i, compression_options, output_options)) {
-                log("[bitmap_compressor] failed to compress texture!");
+    if (!pending.empty()) {
+        nvtt::Context probe;
+        probe.enableCudaAcceleration(true);
+        
+        u32 worker_count = std::min<u32>(job_system_thread_count(), pending.size());
+        log("[bitmap_compressor] Compressing %d textures on %d threads %s CUDA", (i32)pending.size(), worker_count, probe.isCudaAccelerationEnabled() ? "with" : "without");
+
+        bitmap_bake_progress progress;
+        std::atomic<u32> next = 0;
+
+        /// @note(ame): nvtt contexts aren't thread safe, every worker gets its own and pulls textures until the list is empty
+        auto worker = [&]() {
+            nvtt::Context context;
+            context.enableCudaAcceleration(true);
+
+            for (u32 i = next.fetch_add(1); i < pending.size(); i = next.fetch_add(1)) {
+                const bitmap_bake_item& item = *pending[i];
+
+                timer item_timer;
+                timer_init(&item_timer);
+
+                u64 pixels = 0;
+                u64 output_bytes = 0;
+                bool success = bitmap_bake_one(&context, item, &pixels, &output_bytes);
+                if (success) {
+                    progress.baked++;
+                    progress.pixels += pixels;
+                    progress.input_bytes += item.size;
+                    progress.output_bytes += output_bytes;
+                } else {
+                    progress.failed++;
+                }
+
+                u32 done = ++progress.done;
+                log("[bitmap_compressor] [%d/%d] %s %s (%.1f ms)", done, (i32)pending.size(), success ? "compressed" : "FAILED", item.path.c_str(), timer_elasped(&item_timer));
             }
+        };
 
-            if (i == mip_count - 1) break;
-
-            // Prepare the next mip:
-            image.toLinearFromSrgb();
-            image.premultiplyAlpha();
-
-            image.buildNextMipmap(nvtt::MipmapFilter_Box);
-        
-            image.demultiplyAlpha();
-            image.toSrgb();
+        job_counter counter;
+        for (u32 i = 0; i < worker_count - 1; i++) {
+            job_push(worker, &counter);
         }
+        worker();
+        job_wait(&counter);
+
+        stats.baked = progress.baked;
+        stats.failed = progress.failed;
+        stats.pixels = progress.pixels;
+        stats.input_bytes = progress.input_bytes;
+        stats.output_bytes = progress.output_bytes;
+    }
 
-        log("[bitmap_compressor] compressed %s to %s", entry_path.c_str(), cached.c_str());
+    stats.seconds = TIMER_SECONDS(timer_elasped(&bake_timer));
+    if (stats.baked) {
+        f64 megapixels = stats.pixels / 1000000.0;
+        log("[bitmap_compressor] baked %d textures (%d up to date, %d failed) in %.2f s", stats.baked, stats.up_to_date, stats.failed, stats.seconds);
+        log("[bitmap_compressor] %.2f MB in, %.2f MB out, %.2f MP/s", stats.input_bytes / (1024.0 * 1024.0), stats.output_bytes / (1024.0 * 1024.0), megapixels / stats.seconds);
     }
+
+    /// @note(ame): only stamp complete bakes, failed textures get retried next startup
+    if (stats.failed == 0) {
+        asset_cache_set_stamp(stamp_name, stamp);
+    }
+    return stats;
 }
 
 void uncompressed_bitmap_load(uncompressed_bitmap *bitmap, const std::string& path)
 {
-    std::string cached = get_cached_path(path);
-    if (!fs_exists(cached)) {
+    std::string cached;
+    u64 key = bitmap_cache_key(path);
+    if (!asset_cache_acquire(key, ".wnt", &cached)) {
         stbi_set_flip_vertically_on_load(true);
 
         i32 channels = 0;
@@ -191,25 +413,51 @@ void uncompressed_bitmap_load(uncompressed_bitmap *bitmap, const std::string& pa
             throw_error("Failed to load bitmap");
         }
 
-        bitmap->pixels.resize(bitmap->width * bitmap->height * 4);
-        bitmap->levels = 1;
-        memcpy(bitmap->pixels.data(), buffer, bitmap->pixels.size());
-        delete buffer;   
+        /// @note(ame): same mips as the baked path, so uncompressed textures don't alias at a distance
+        mip_chain chain;
+        mip_chain_build(&chain, buffer, bitmap->width, bitmap->height, bitmap_mip_filter(), true);
+        stbi_image_free(buffer);
+
+        bitmap->pixels = std::move(chain.pixels);
+        bitmap->levels = chain.levels;
     } else {
-        u64 size = fs_filesize(cached);
-        u64 buffer_size = size - sizeof(bitmap_header);
-        bitmap->pixels.resize(buffer_size);
+        bitmap->cache_key = key;
+        if (!fs_map(&bitmap->mapped, cached) || bitmap->mapped.size < sizeof(bitmap_header)) {
+            log("[bitmap] failed to map cached bitmap %s", cached.c_str());
+            throw_error("Failed to load bitmap");
+        }
 
-        bitmap_header header;
+        const bitmap_header *header = reinterpret_cast<const bitmap_header*>(bitmap->mapped.data);
+        bitmap->width = header->width;
+        bitmap->height = header->height;
+        bitmap->levels = header->levels;
+        bitmap->format = (bitmap_format)header->format;
+    }
+}
+
+void uncompressed_bitmap_free(uncompressed_bitmap *bitmap)
+{
+    fs_unmap(&bitmap->mapped);
+    if (bitmap->cache_key) {
+        asset_cache_release(bitmap->cache_key);
+        bitmap->cache_key = 0;
+    }
+    bitmap->pixels.clear();
+    bitmap->pixels.shrink_to_fit();
+}
 
-        FILE* f = fopen(cached.c_str(), "rb+");
-        fread(&header, sizeof(header), 1, f);
-        fread(bitmap->pixels.data(), bitmap->pixels.size(), 1, f);
-        fclose(f);
+const u8 *uncompressed_bitmap_data(const uncompressed_bitmap *bitmap)
+{
+    if (bitmap->mapped.data) {
+        return bitmap->mapped.data + sizeof(bitmap_header);
+    }
+    return bitmap->pixels.data();
+}
 
-        bitmap->width = header.width;
-        bitmap->height = header.height;
-        bitmap->levels = header.levels;
-        bitmap->compressed = true;
+u64 uncompressed_bitmap_size(const uncompressed_bitmap *bitmap)
+{
+    if (bitmap->mapped.data) {
+        return bitmap->mapped.size - sizeof(bitmap_header);
     }
+    return bitmap->pixels.size();
 }
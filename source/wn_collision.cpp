@@ -0,0 +1,344 @@
+//
+// $Notice: Xander Studios @ 2024
+// $Author: Amélie Heinrich
+// $Create Time: 2024-11-23 19:14:02
+//
+
+#include <algorithm>
+#include <numeric>
+#include <sstream>
+
+#include "wn_collision.h"
+#include "wn_asset_cache.h"
+#include "wn_dev_console.h"
+#include "wn_filesystem.h"
+#include "wn_gltf.h"
+#include "wn_cvar.h"
+#include "wn_job.h"
+#include "wn_util.h"
+
+void collision_init()
+{
+    cvar_register_unsigned("collision_mode", CollisionMode_Mesh);
+    cvar_register_unsigned("collision_decompose_depth", 3);
+    cvar_register_unsigned("collision_decompose_min_triangles", 32);
+
+    /// @note(ame): collision_cook <model.gltf> -- cooks (and caches) a model's collision ahead of time
+    dev_console_add_command("collision_cook", [](std::vector<std::string> args) {
+        if (args.size() < 2) {
+            log("[collision] usage: collision_cook <model.gltf>");
+            return;
+        }
+
+        gltf_model model = {};
+        gltf_load_state state;
+        gltf_model_import(&model, &state, args[1], true);
+        gltf_model_discard(&model, &state);
+    });
+}
+
+collision_settings collision_get_settings()
+{
+    static console_var *mode = cvar_get("collision_mode");
+    static console_var *depth = cvar_get("collision_decompose_depth");
+    static console_var *min_triangles = cvar_get("collision_decompose_min_triangles");
+
+    collision_settings settings = {};
+    settings.mode = mode->as.u <= CollisionMode_Decompose ? (collision_mode)mode->as.u : CollisionMode_Mesh;
+    settings.decompose_depth = std::min<u32>(depth->as.u, 8);
+    settings.decompose_min_triangles = std::max<u32>(min_triangles->as.u, 1);
+    return settings;
+}
+
+u64 collision_settings_hash(const collision_settings& settings)
+{
+    u32 values[] = { (u32)settings.mode, settings.decompose_depth, settings.decompose_min_triangles };
+    if (settings.mode != CollisionMode_Decompose) {
+        values[1] = values[2] = 0;
+    }
+    return wn_hash(values, sizeof(values), 1000);
+}
+
+/// @note(ame): straight off the streams, nothing gets interleaved just to be hashed
+u64 collision_source_hash(const collision_source *source, const collision_settings& settings)
+{
+    u64 hash = collision_settings_hash(settings);
+    hash = wn_hash(&source->transform, sizeof(source->transform), hash);
+    return geometry_hash(source->geometry, hash);
+}
+
+/// @note(ame): COOKING
+
+JPH::VertexList collision_vertices(const collision_source *source)
+{
+    JPH::VertexList vertices;
+    vertices.reserve(source->geometry.vertex_count);
+    for (u64 i = 0; i < source->geometry.vertex_count; i++) {
+        glm::vec4 point = source->transform * glm::vec4(geometry_position(source->geometry, i), 1.0f);
+        vertices.push_back(JPH::Float3(point.x, point.y, point.z));
+    }
+    return vertices;
+}
+
+struct collision_decompose_ctx
+{
+    const JPH::VertexList *vertices;
+    const u32 *indices;
+    const collision_settings *settings;
+    std::vector<glm::vec3> centroids;
+    std::vector<JPH::Ref<JPH::Shape>> parts;
+};
+
+/// @note(ame): a hull over the part, or the part's triangles as a mesh if the hull can't be built (flat or degenerate)
+void collision_decompose_leaf(collision_decompose_ctx *ctx, const u32 *triangles, u32 count)
+{
+    std::vector<u32> used;
+    used.reserve(count * 3);
+    for (u32 i = 0; i < count; i++) {
+        for (u32 j = 0; j < 3; j++) {
+            used.push_back(ctx->indices[triangles[i] * 3 + j]);
+        }
+    }
+    std::sort(used.begin(), used.end());
+    used.erase(std::unique(used.begin(), used.end()), used.end());
+
+    JPH::Array<JPH::Vec3> points;
+    points.reserve(used.size());
+    for (u32 index : used) {
+        const JPH::Float3& v = (*ctx->vertices)[index];
+        points.push_back(JPH::Vec3(v.x, v.y, v.z));
+    }
+
+    JPH::ConvexHullShapeSettings hull(points, 0.05f, physics_materials::LevelMaterial);
+    JPH::ShapeSettings::ShapeResult result = hull.Create();
+    if (!result.HasError()) {
+        ctx->parts.push_back(result.Get());
+        return;
+    }
+
+    JPH::IndexedTriangleList list;
+    list.reserve(count);
+    for (u32 i = 0; i < count; i++) {
+        const u32 *tri = ctx->indices + triangles[i] * 3;
+        list.push_back(JPH::IndexedTriangle(tri[0], tri[1], tri[2], 0));
+    }
+    JPH::MeshShapeSettings mesh(*ctx->vertices, list, { physics_materials::LevelMaterial });
+    result = mesh.Create();
+    if (!result.HasError()) {
+        ctx->parts.push_back(result.Get());
+    }
+}
+
+/// @note(ame): median split of the triangles along the longest axis of their centroids
+void collision_decompose_split(collision_decompose_ctx *ctx, u32 *triangles, u32 count, u32 depth)
+{
+    if (depth == 0 || count <= ctx->settings->decompose_min_triangles) {
+        collision_decompose_leaf(ctx, triangles, count);
+        return;
+    }
+
+    glm::vec3 min = ctx->centroids[triangles[0]];
+    glm::vec3 max = min;
+    for (u32 i = 1; i < count; i++) {
+        min = glm::min(min, ctx->centroids[triangles[i]]);
+        max = glm::max(max, ctx->centroids[triangles[i]]);
+    }
+    glm::vec3 extent = max - min;
+    u32 axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+
+    u32 half = count / 2;
+    std::nth_element(triangles, triangles + half, triangles + count, [ctx, axis](u32 a, u32 b) {
+        return ctx->centroids[a][axis] < ctx->centroids[b][axis];
+    });
+    collision_decompose_split(ctx, triangles, half, depth - 1);
+    collision_decompose_split(ctx, triangles + half, count - half, depth - 1);
+}
+
+physics_shape *collision_cook(const collision_source *source, const collision_settings& settings)
+{
+    JPH::VertexList vertices = collision_vertices(source);
+    u32 triangle_count = (u32)source->geometry.index_count / 3;
+
+    /// @note(ame): no triangles to speak of, a hull over the points is all we can do
+    collision_mode mode = triangle_count > 0 ? settings.mode : CollisionMode_ConvexHull;
+    switch (mode) {
+        case CollisionMode_Mesh: {
+            JPH::IndexedTriangleList triangles;
+            triangles.reserve(triangle_count);
+            for (u32 i = 0; i < triangle_count; i++) {
+                const u32 *tri = source->geometry.indices + i * 3;
+                triangles.push_back(JPH::IndexedTriangle(tri[0], tri[1], tri[2], 0));
+            }
+            return new mesh_shape(vertices, triangles, physics_materials::LevelMaterial);
+        }
+        case CollisionMode_Decompose: {
+            collision_decompose_ctx ctx;
+            ctx.vertices = &vertices;
+            ctx.indices = source->geometry.indices;
+            ctx.settings = &settings;
+            ctx.centroids.resize(triangle_count);
+            for (u32 i = 0; i < triangle_count; i++) {
+                const u32 *tri = source->geometry.indices + i * 3;
+                const JPH::Float3& a = vertices[tri[0]];
+                const JPH::Float3& b = vertices[tri[1]];
+                const JPH::Float3& c = vertices[tri[2]];
+                ctx.centroids[i] = glm::vec3(a.x + b.x + c.x, a.y + b.y + c.y, a.z + b.z + c.z) / 3.0f;
+            }
+
+            std::vector<u32> triangles(triangle_count);
+            std::iota(triangles.begin(), triangles.end(), 0);
+            collision_decompose_split(&ctx, triangles.data(), triangle_count, settings.decompose_depth);
+            if (!ctx.parts.empty()) {
+                return new compound_shape(ctx.parts, physics_materials::LevelMaterial);
+            }
+            log("[collision] convex decomposition failed, falling back to a hull");
+            break;
+        }
+        default: {
+            break;
+        }
+    }
+
+    JPH::Array<JPH::Vec3> points;
+    points.reserve(vertices.size());
+    for (auto& v : vertices) {
+        points.push_back(JPH::Vec3(v.x, v.y, v.z));
+    }
+    return new convex_hull_shape(points, physics_materials::LevelMaterial);
+}
+
+/// @note(ame): BATCHES
+
+bool collision_load_batch(const std::string& path, std::vector<collision_source>& sources, u32 max_threads)
+{
+    fs_mapped_file file;
+    if (!fs_map(&file, path)) {
+        return false;
+    }
+
+    const wnp_header *header = reinterpret_cast<const wnp_header*>(file.data);
+    bool valid = file.size >= sizeof(wnp_header)
+              && header->magic == WNP_MAGIC
+              && header->version == WNP_VERSION
+              && sizeof(wnp_header) + u64(header->shape_count) * sizeof(wnp_entry) <= file.size;
+    if (!valid) {
+        log("[collision] %s is stale or corrupted, recooking", path.c_str());
+        fs_unmap(&file);
+        return false;
+    }
+
+    const wnp_entry *begin = reinterpret_cast<const wnp_entry*>(file.data + sizeof(wnp_header));
+    const wnp_entry *end = begin + header->shape_count;
+
+    /// @note(ame): match every source to its entry before creating anything
+    std::vector<const wnp_entry*> matches(sources.size());
+    for (u64 i = 0; i < sources.size(); i++) {
+        const wnp_entry *entry = std::lower_bound(begin, end, sources[i].hash, [](const wnp_entry& e, u64 hash) {
+            return e.hash < hash;
+        });
+        if (entry == end || entry->hash != sources[i].hash || entry->offset + entry->size > file.size) {
+            log("[collision] %s is missing a shape, recooking", path.c_str());
+            fs_unmap(&file);
+            return false;
+        }
+        matches[i] = entry;
+    }
+
+    job_parallel_for(sources.size(), [&](u32 i) {
+        JPH::Shape::IDToMaterialMap materials = { physics_materials::LevelMaterial };
+        sources[i].shape = new cached_shape(file.data + matches[i]->offset, matches[i]->size, (RigidbodyType)matches[i]->rb_type, materials, physics_materials::LevelMaterial);
+    }, max_threads);
+
+    fs_unmap(&file);
+    return true;
+}
+
+void collision_save_batch(u64 key, std::vector<collision_source>& sources, u32 max_threads)
+{
+    /// @note(ame): identical sources share an entry
+    std::vector<collision_source*> unique;
+    for (auto& source : sources) {
+        unique.push_back(&source);
+    }
+    std::sort(unique.begin(), unique.end(), [](collision_source *a, collision_source *b) {
+        return a->hash < b->hash;
+    });
+    unique.erase(std::unique(unique.begin(), unique.end(), [](collision_source *a, collision_source *b) {
+        return a->hash == b->hash;
+    }), unique.end());
+
+    std::vector<std::string> blobs(unique.size());
+    job_parallel_for(unique.size(), [&](u32 i) {
+        std::stringstream stream;
+        JPH::StreamOutWrapper stream_out(stream);
+
+        /// @note(ame): LevelMaterial is id 0 so loading maps it back to the shared material instead of a copy
+        JPH::Shape::ShapeToIDMap shapes;
+        JPH::Shape::MaterialToIDMap materials;
+        materials[physics_materials::LevelMaterial.GetPtr()] = 0;
+        unique[i]->shape->get_shape()->SaveWithChildren(stream_out, shapes, materials);
+        blobs[i] = stream.str();
+    }, max_threads);
+
+    u64 offset = sizeof(wnp_header) + unique.size() * sizeof(wnp_entry);
+    std::vector<wnp_entry> entries(unique.size());
+    for (u64 i = 0; i < unique.size(); i++) {
+        offset = (offset + WNP_ALIGNMENT - 1) & ~u64(WNP_ALIGNMENT - 1);
+        entries[i].hash = unique[i]->hash;
+        entries[i].offset = offset;
+        entries[i].size = blobs[i].size();
+        entries[i].rb_type = unique[i]->shape->rb_type;
+        offset += blobs[i].size();
+    }
+
+    std::vector<u8> data(offset, 0);
+    wnp_header *header = reinterpret_cast<wnp_header*>(data.data());
+    header->magic = WNP_MAGIC;
+    header->version = WNP_VERSION;
+    header->shape_count = (u32)entries.size();
+    memcpy(data.data() + sizeof(wnp_header), entries.data(), entries.size() * sizeof(wnp_entry));
+    for (u64 i = 0; i < entries.size(); i++) {
+        memcpy(data.data() + entries[i].offset, blobs[i].data(), blobs[i].size());
+    }
+
+    asset_cache_store(key, data.data(), data.size(), ".wnp");
+}
+
+void collision_cook_batch(std::vector<collision_source>& sources, const collision_settings& settings, bool cache, u32 max_threads)
+{
+    timer t;
+    timer_init(&t);
+
+    job_parallel_for(sources.size(), [&](u32 i) {
+        sources[i].hash = collision_source_hash(&sources[i], settings);
+    }, max_threads);
+
+    u64 key = 0;
+    if (cache) {
+        /// @note(ame): sorted, so the batch key doesn't care about primitive order either
+        std::vector<u64> hashes;
+        for (auto& source : sources) {
+            hashes.push_back(source.hash);
+        }
+        std::sort(hashes.begin(), hashes.end());
+        u64 content_hash = wn_hash(hashes.data(), hashes.size() * sizeof(u64), 1000);
+        key = asset_cache_key_from_hash(content_hash, "collision_batch", WNP_VERSION, collision_settings_hash(settings));
+
+        std::string cached;
+        if (asset_cache_lookup(key, ".wnp", &cached) && collision_load_batch(cached, sources, max_threads)) {
+            log("[collision] loaded %u shapes from %s in %.2f ms", (u32)sources.size(), cached.c_str(), timer_elasped(&t));
+            return;
+        }
+    }
+
+    job_parallel_for(sources.size(), [&](u32 i) {
+        sources[i].shape = collision_cook(&sources[i], settings);
+    }, max_threads);
+
+    if (cache) {
+        collision_save_batch(key, sources, max_threads);
+    }
+
+    const char *mode_names[] = { "mesh", "convex hull", "convex decomposition" };
+    log("[collision] cooked %u shapes (%s) in %.2f ms", (u32)sources.size(), mode_names[settings.mode], timer_elasped(&t));
+}
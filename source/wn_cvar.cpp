@@ -46,6 +46,33 @@ console_var* cvar_get(const std::string& cvar_name)
     return &cvars.vars[cvar_name];
 }
 
+console_var* cvar_register_unsigned(const std::string& cvar_name, u32 value)
+{
+    if (cvars.vars.count(cvar_name) == 0) {
+        cvars.vars[cvar_name].type = ConsoleVarType_Unsigned;
+        cvars.vars[cvar_name].as.u = value;
+    }
+    return &cvars.vars[cvar_name];
+}
+
+console_var* cvar_register_float(const std::string& cvar_name, f32 value)
+{
+    if (cvars.vars.count(cvar_name) == 0) {
+        cvars.vars[cvar_name].type = ConsoleVarType_Float;
+        cvars.vars[cvar_name].as.f = value;
+    }
+    return &cvars.vars[cvar_name];
+}
+
+console_var* cvar_register_bool(const std::string& cvar_name, bool value)
+{
+    if (cvars.vars.count(cvar_name) == 0) {
+        cvars.vars[cvar_name].type = ConsoleVarType_Boolean;
+        cvars.vars[cvar_name].as.b = value;
+    }
+    return &cvars.vars[cvar_name];
+}
+
 void cvar_save(const std::string& registry_path)
 {
     nlohmann::json root;
@@ -490,7 +490,7 @@ void command_buffer_copy_texture_to_texture(command_buffer *buf, texture *dst, t
 }
 
 /// Courtesy to Dihara Wijetunga's Wolfenstein PT
-void command_buffer_copy_buffer_to_texture(command_buffer *buf, texture *dst, buffer *src, u32 mip_count)
+void command_buffer_copy_buffer_to_texture(command_buffer *buf, texture *dst, buffer *src, u32 mip_count, u64 src_offset)
 {
     D3D12_RESOURCE_DESC desc = dst->resource.resource->GetDesc();
 
@@ -499,7 +499,7 @@ void command_buffer_copy_buffer_to_texture(command_buffer *buf, texture *dst, bu
     std::vector<u64> row_sizes(dst->levels);
     u64 total_size = 0;
 
-    video.device->GetCopyableFootprints(&desc, 0, dst->levels, 0, footprints.data(), num_rows.data(), row_sizes.data(), &total_size);
+    video.device->GetCopyableFootprints(&desc, 0, dst->levels, src_offset, footprints.data(), num_rows.data(), row_sizes.data(), &total_size);
 
     for (uint32_t i = 0; i < dst->levels; i++) {
         D3D12_TEXTURE_COPY_LOCATION src_copy = {};
@@ -5,17 +5,30 @@
 //
 
 #include <sys/stat.h>
+#if defined(_WIN32)
 #include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 #include <filesystem>
 #include <sstream>
 #include <fstream>
+#include <cstdio>
 
 #include "wn_filesystem.h"
 #include "wn_output.h"
 #include "wn_util.h"
+#include "wn_pak.h"
 
 bool fs_exists(const std::string& path)
 {
+    pak_entry entry;
+    if (pak_stat(path, &entry)) {
+        return true;
+    }
+
     struct stat s;
     if (stat(path.c_str(), &s) == -1)
         return false;
@@ -32,19 +45,53 @@ bool fs_isdir(const std::string& path)
 
 void fs_create(const std::string& path)
 {
+#if defined(_WIN32)
     HANDLE handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
-    if (!handle) {
+    if (handle == INVALID_HANDLE_VALUE) {
         throw_error("Error when creating file");
         return;
     }
     CloseHandle(handle);
+#else
+    i32 fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        throw_error("Error when creating file");
+        return;
+    }
+    close(fd);
+#endif
 }
 
 void fs_createdir(const std::string& path)
 {
+#if defined(_WIN32)
     if (!CreateDirectoryA(path.c_str(), nullptr)) {
         throw_error("Error when creating directory");
     }
+#else
+    if (mkdir(path.c_str(), 0755) == -1) {
+        throw_error("Error when creating directory");
+    }
+#endif
+}
+
+bool fs_rename(const std::string& from, const std::string& to)
+{
+#if defined(_WIN32)
+    return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+#else
+    /// @note(ame): rename(2) replaces the destination atomically already
+    return rename(from.c_str(), to.c_str()) == 0;
+#endif
+}
+
+bool fs_delete(const std::string& path)
+{
+#if defined(_WIN32)
+    return DeleteFileA(path.c_str());
+#else
+    return unlink(path.c_str()) == 0;
+#endif
 }
 
 std::string fs_getextension(const std::string& path)
@@ -53,72 +100,195 @@ std::string fs_getextension(const std::string& path)
     return fs_path.extension().string();
 }
 
-std::string fs_cachepath(const std::string& path)
+u64 fs_filesize(const std::string& path)
 {
-    std::stringstream ss;
-    ss << ".cache/" << wn_hash(path.c_str(), path.length(), 1000);
-    return ss.str();
-}
+    pak_entry entry;
+    if (pak_stat(path, &entry)) {
+        return entry.size;
+    }
 
-i32 fs_filesize(const std::string& path)
-{
+#if defined(_WIN32)
+    struct _stat64 s;
+    if (_stat64(path.c_str(), &s) == -1)
+        return 0;
+#else
     struct stat s;
     if (stat(path.c_str(), &s) == -1)
         return 0;
+#endif
     return s.st_size;
 }
 
+bool fs_map(fs_mapped_file *file, const std::string& path)
+{
+    *file = {};
+
+    /// @note(ame): a corrupted packed entry falls through to the loose file, if there is one
+    bool mapped = false;
+    if (pak_open(path, file, &mapped) && mapped) {
+        return true;
+    }
+
+#if defined(_WIN32)
+    HANDLE handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (handle == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(handle, &size)) {
+        CloseHandle(handle);
+        return false;
+    }
+    file->file = handle;
+    file->size = size.QuadPart;
+
+    /// @note(ame): CreateFileMapping refuses empty files
+    if (file->size == 0) {
+        return true;
+    }
+
+    HANDLE mapping = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapping) {
+        CloseHandle(handle);
+        *file = {};
+        return false;
+    }
+    file->mapping = mapping;
+    file->data = reinterpret_cast<const u8*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    if (!file->data) {
+        fs_unmap(file);
+        return false;
+    }
+#else
+    i32 fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1) {
+        return false;
+    }
+
+    struct stat s;
+    if (fstat(fd, &s) == -1) {
+        close(fd);
+        return false;
+    }
+    file->fd = fd;
+    file->size = s.st_size;
+
+    if (file->size == 0) {
+        return true;
+    }
+
+    void *data = mmap(nullptr, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        fs_unmap(file);
+        return false;
+    }
+    madvise(data, file->size, MADV_SEQUENTIAL);
+    file->data = reinterpret_cast<const u8*>(data);
+#endif
+    return true;
+}
+
+void fs_unmap(fs_mapped_file *file)
+{
+    if (file->packed) {
+        delete[] file->owned;
+        *file = {};
+        return;
+    }
+
+#if defined(_WIN32)
+    if (file->data) {
+        UnmapViewOfFile(file->data);
+    }
+    if (file->mapping) {
+        CloseHandle(file->mapping);
+    }
+    if (file->file) {
+        CloseHandle(file->file);
+    }
+#else
+    if (file->data) {
+        munmap(const_cast<u8*>(file->data), file->size);
+    }
+    if (file->fd != -1) {
+        close(file->fd);
+    }
+#endif
+    *file = {};
+}
+
 std::string fs_readtext(const std::string& path)
 {
-    std::ifstream stream(path);
-    if (!stream.is_open())
+    fs_mapped_file file;
+    if (!fs_map(&file, path))
         return "";
-    
-    std::stringstream ss;
-    ss << stream.rdbuf();
-    stream.close();
-    return ss.str();
+
+    std::string result(reinterpret_cast<const char*>(file.data), file.size);
+    fs_unmap(&file);
+    return result;
 }
 
 std::vector<uint8_t> fs_readbytes(const std::string& path)
 {
-    std::vector<uint8_t> result;
-
-    HANDLE handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
-    if (!handle) {
+    fs_mapped_file file;
+    if (!fs_map(&file, path)) {
         throw_error("File does not exist!");
         return {};
     }
 
-    i32 size = fs_filesize(path);
-    result.resize(size);
-
-    DWORD bytes_read = 0;
-    ::ReadFile(handle, reinterpret_cast<LPVOID>(result.data()), result.size(), &bytes_read, nullptr);
-    CloseHandle(handle);
+    std::vector<uint8_t> result(file.data, file.data + file.size);
+    fs_unmap(&file);
     return result;
 }
 
 void fs_getfiletime(const std::string& path, u32& low, u32& high)
 {
+    /// @note(ame): archives don't keep times, the content hash changes whenever the file does
+    pak_entry entry;
+    if (pak_stat(path, &entry)) {
+        low = (u32)entry.content_hash;
+        high = (u32)(entry.content_hash >> 32);
+        return;
+    }
+
+    low = 0;
+    high = 0;
+#if defined(_WIN32)
     HANDLE handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (handle == INVALID_HANDLE_VALUE) {
+        return;
+    }
     FILETIME temp;
-    GetFileTime(handle, nullptr, nullptr, &temp);
+    if (GetFileTime(handle, nullptr, nullptr, &temp)) {
+        low = temp.dwLowDateTime;
+        high = temp.dwHighDateTime;
+    }
     CloseHandle(handle);
-
-    low = temp.dwLowDateTime;
-    high = temp.dwHighDateTime;
+#else
+    struct stat s;
+    if (stat(path.c_str(), &s) == -1) {
+        return;
+    }
+#if defined(__APPLE__)
+    u64 time = u64(s.st_mtimespec.tv_sec) * 1000000000ull + s.st_mtimespec.tv_nsec;
+#else
+    u64 time = u64(s.st_mtim.tv_sec) * 1000000000ull + s.st_mtim.tv_nsec;
+#endif
+    low = (u32)time;
+    high = (u32)(time >> 32);
+#endif
 }
 
 nlohmann::json fs_loadjson(const std::string& path)
 {
-    std::ifstream stream(path);
-    if (!stream.is_open()) {
-        log("Failed to load json file {}", path.c_str());
+    fs_mapped_file file;
+    if (!fs_map(&file, path)) {
+        log("Failed to load json file %s", path.c_str());
         return nlohmann::json::parse("{}");
     }
-    nlohmann::json document = nlohmann::json::parse(stream);
-    stream.close();
+    nlohmann::json document = nlohmann::json::parse(file.data, file.data + file.size);
+    fs_unmap(&file);
     return document;
 }
 
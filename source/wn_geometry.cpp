@@ -0,0 +1,199 @@
+//
+// $Notice: Xander Studios @ 2024
+// $Author: Amélie Heinrich
+// $Create Time: 2024-11-28 18:41:15
+//
+
+#include <cfloat>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <immintrin.h>
+
+#include "wn_geometry.h"
+#include "wn_util.h"
+
+void geometry_resize(geometry_streams *streams, u64 vertex_count, u64 index_count)
+{
+    streams->x.resize(vertex_count);
+    streams->y.resize(vertex_count);
+    streams->z.resize(vertex_count);
+    streams->indices.resize(index_count);
+}
+
+u64 geometry_memory(const geometry_streams& streams)
+{
+    return (streams.x.capacity() + streams.y.capacity() + streams.z.capacity()) * sizeof(f32) + streams.indices.capacity() * sizeof(u32);
+}
+
+geometry_view geometry_get_view(const geometry_streams& streams)
+{
+    geometry_view view;
+    view.x = streams.x.data();
+    view.y = streams.y.data();
+    view.z = streams.z.data();
+    view.vertex_count = streams.x.size();
+    view.indices = streams.indices.data();
+    view.index_count = streams.indices.size();
+    return view;
+}
+
+geometry_view geometry_subview(const geometry_view& view, u64 first_vertex, u64 vertex_count, const u32 *indices, u64 index_count)
+{
+    geometry_view sub;
+    sub.x = view.x + first_vertex;
+    sub.y = view.y + first_vertex;
+    sub.z = view.z + first_vertex;
+    sub.vertex_count = vertex_count;
+    sub.indices = indices;
+    sub.index_count = index_count;
+    return sub;
+}
+
+void geometry_scatter_positions(geometry_streams *streams, u64 offset, const u8 *positions, u64 stride, u64 count)
+{
+    f32 *x = streams->x.data() + offset;
+    f32 *y = streams->y.data() + offset;
+    f32 *z = streams->z.data() + offset;
+    for (u64 i = 0; i < count; i++) {
+        f32 position[3];
+        memcpy(position, positions + i * stride, sizeof(position));
+        x[i] = position[0];
+        y[i] = position[1];
+        z[i] = position[2];
+    }
+}
+
+void geometry_stream_range(const f32 *stream, u64 count, f32 *min, f32 *max)
+{
+    __m128 lo = _mm_set1_ps(FLT_MAX);
+    __m128 hi = _mm_set1_ps(-FLT_MAX);
+    u64 i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 v = _mm_loadu_ps(stream + i);
+        lo = _mm_min_ps(lo, v);
+        hi = _mm_max_ps(hi, v);
+    }
+
+    f32 lanes_lo[4];
+    f32 lanes_hi[4];
+    _mm_storeu_ps(lanes_lo, lo);
+    _mm_storeu_ps(lanes_hi, hi);
+    *min = std::min(std::min(lanes_lo[0], lanes_lo[1]), std::min(lanes_lo[2], lanes_lo[3]));
+    *max = std::max(std::max(lanes_hi[0], lanes_hi[1]), std::max(lanes_hi[2], lanes_hi[3]));
+    for (; i < count; i++) {
+        *min = std::min(*min, stream[i]);
+        *max = std::max(*max, stream[i]);
+    }
+}
+
+void geometry_bounds(const geometry_view& view, glm::vec3 *min, glm::vec3 *max)
+{
+    geometry_stream_range(view.x, view.vertex_count, &min->x, &max->x);
+    geometry_stream_range(view.y, view.vertex_count, &min->y, &max->y);
+    geometry_stream_range(view.z, view.vertex_count, &min->z, &max->z);
+}
+
+u64 geometry_hash(const geometry_view& view, u64 seed)
+{
+    u64 hash = wn_hash(view.x, view.vertex_count * sizeof(f32), seed);
+    hash = wn_hash(view.y, view.vertex_count * sizeof(f32), hash);
+    hash = wn_hash(view.z, view.vertex_count * sizeof(f32), hash);
+    return wn_hash(view.indices, view.index_count * sizeof(u32), hash);
+}
+
+/// @note(ame): SLOPES
+/// The face normal is cross(b - a, c - a), walkable when normal.y > cos(max_slope) * |normal|. Same test on every path,
+/// the wide ones just do it for a few triangles at once.
+
+inline u8 geometry_classify_triangle(const geometry_view& view, const u32 *tri, f32 threshold, u8 walkable)
+{
+    glm::vec3 a = geometry_position(view, tri[0]);
+    glm::vec3 b = geometry_position(view, tri[1]);
+    glm::vec3 c = geometry_position(view, tri[2]);
+    glm::vec3 normal = glm::cross(b - a, c - a);
+    f32 length = glm::length(normal);
+    return (length > 0.0f && normal.y > threshold * length) ? walkable : 0;
+}
+
+inline void geometry_store_mask(u8 *out, i32 mask, u32 lanes, u8 walkable)
+{
+    for (u32 k = 0; k < lanes; k++) {
+        out[k] = (mask >> k) & 1 ? walkable : 0;
+    }
+}
+
+/// @note(ame): corner `c` of four consecutive triangles
+inline __m128 geometry_gather4(const f32 *stream, const u32 *tri, u32 c)
+{
+    return _mm_set_ps(stream[tri[9 + c]], stream[tri[6 + c]], stream[tri[3 + c]], stream[tri[c]]);
+}
+
+void geometry_classify_slopes_avx2(const geometry_view& view, f32 threshold, u8 walkable, u64& t, u64 end, u8 *out);
+
+void geometry_classify_slopes(const geometry_view& view, f32 max_slope, u8 walkable, u64 first_triangle, u64 triangle_count, u8 *out)
+{
+    const f32 threshold = std::cos(glm::radians(max_slope));
+    u64 t = first_triangle;
+    u64 end = first_triangle + triangle_count;
+    out -= first_triangle;
+
+    if (wn_cpu_features().avx2) {
+        geometry_classify_slopes_avx2(view, threshold, walkable, t, end, out);
+    }
+
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 limit = _mm_set1_ps(threshold);
+    for (; t + 4 <= end; t += 4) {
+        const u32 *tri = view.indices + t * 3;
+        __m128 ax = geometry_gather4(view.x, tri, 0), ay = geometry_gather4(view.y, tri, 0), az = geometry_gather4(view.z, tri, 0);
+        __m128 e1x = _mm_sub_ps(geometry_gather4(view.x, tri, 1), ax);
+        __m128 e1y = _mm_sub_ps(geometry_gather4(view.y, tri, 1), ay);
+        __m128 e1z = _mm_sub_ps(geometry_gather4(view.z, tri, 1), az);
+        __m128 e2x = _mm_sub_ps(geometry_gather4(view.x, tri, 2), ax);
+        __m128 e2y = _mm_sub_ps(geometry_gather4(view.y, tri, 2), ay);
+        __m128 e2z = _mm_sub_ps(geometry_gather4(view.z, tri, 2), az);
+
+        __m128 nx = _mm_sub_ps(_mm_mul_ps(e1y, e2z), _mm_mul_ps(e1z, e2y));
+        __m128 ny = _mm_sub_ps(_mm_mul_ps(e1z, e2x), _mm_mul_ps(e1x, e2z));
+        __m128 nz = _mm_sub_ps(_mm_mul_ps(e1x, e2y), _mm_mul_ps(e1y, e2x));
+        __m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, nx), _mm_mul_ps(ny, ny)), _mm_mul_ps(nz, nz)));
+
+        __m128 flat = _mm_and_ps(_mm_cmpgt_ps(length, zero), _mm_cmpgt_ps(ny, _mm_mul_ps(limit, length)));
+        geometry_store_mask(out + t, _mm_movemask_ps(flat), 4, walkable);
+    }
+    for (; t < end; t++) {
+        out[t] = geometry_classify_triangle(view, view.indices + t * 3, threshold, walkable);
+    }
+}
+
+/// @note(ame): kept out of line so the compiler doesn't hoist AVX2 instructions into the SSE path. The streams being SoA
+/// is what makes this one work, every corner is three gathers off the indices.
+void geometry_classify_slopes_avx2(const geometry_view& view, f32 threshold, u8 walkable, u64& t, u64 end, u8 *out)
+{
+    const __m256i corners = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 limit = _mm256_set1_ps(threshold);
+    for (; t + 8 <= end; t += 8) {
+        const i32 *tri = reinterpret_cast<const i32*>(view.indices + t * 3);
+        __m256i ia = _mm256_i32gather_epi32(tri + 0, corners, 4);
+        __m256i ib = _mm256_i32gather_epi32(tri + 1, corners, 4);
+        __m256i ic = _mm256_i32gather_epi32(tri + 2, corners, 4);
+
+        __m256 ax = _mm256_i32gather_ps(view.x, ia, 4), ay = _mm256_i32gather_ps(view.y, ia, 4), az = _mm256_i32gather_ps(view.z, ia, 4);
+        __m256 e1x = _mm256_sub_ps(_mm256_i32gather_ps(view.x, ib, 4), ax);
+        __m256 e1y = _mm256_sub_ps(_mm256_i32gather_ps(view.y, ib, 4), ay);
+        __m256 e1z = _mm256_sub_ps(_mm256_i32gather_ps(view.z, ib, 4), az);
+        __m256 e2x = _mm256_sub_ps(_mm256_i32gather_ps(view.x, ic, 4), ax);
+        __m256 e2y = _mm256_sub_ps(_mm256_i32gather_ps(view.y, ic, 4), ay);
+        __m256 e2z = _mm256_sub_ps(_mm256_i32gather_ps(view.z, ic, 4), az);
+
+        __m256 nx = _mm256_sub_ps(_mm256_mul_ps(e1y, e2z), _mm256_mul_ps(e1z, e2y));
+        __m256 ny = _mm256_sub_ps(_mm256_mul_ps(e1z, e2x), _mm256_mul_ps(e1x, e2z));
+        __m256 nz = _mm256_sub_ps(_mm256_mul_ps(e1x, e2y), _mm256_mul_ps(e1y, e2x));
+        __m256 length = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, nx), _mm256_mul_ps(ny, ny)), _mm256_mul_ps(nz, nz)));
+
+        __m256 flat = _mm256_and_ps(_mm256_cmp_ps(length, zero, _CMP_GT_OQ), _mm256_cmp_ps(ny, _mm256_mul_ps(limit, length), _CMP_GT_OQ));
+        geometry_store_mask(out + t, _mm256_movemask_ps(flat), 8, walkable);
+    }
+}
@@ -5,6 +5,9 @@
 //
 
 #include <sstream>
+#include <algorithm>
+#include <functional>
+#include <immintrin.h>
 
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtx/quaternion.hpp>
@@ -16,16 +19,250 @@
 #include "wn_resource_cache.h"
 #include "wn_util.h"
 #include "wn_ai.h"
+#include "wn_job.h"
+#include "wn_timer.h"
+#include "wn_asset_cache.h"
+#include "wn_collision.h"
 
 #define CACHE_PHYSICS 1
+#define GLTF_PARALLEL_IMPORT 1
+#define GLTF_BUFFERS_VERSION 1
 
-void gltf_process_primitive(gltf_model *model, cgltf_primitive *primitive, gltf_node *node)
+/// @note(ame): BULK ACCESSOR DECODING
+/// cgltf_accessor_read_float re-resolves the view, stride and component type on every call. These resolve it once per stream
+/// and then run tight (mostly SSE) loops straight into the gltf_vertex array.
+
+const u8* gltf_accessor_data(const cgltf_accessor *accessor)
+{
+    const cgltf_buffer_view *view = accessor->buffer_view;
+    if (!view) {
+        return nullptr;
+    }
+
+    const u8 *base = view->data ? reinterpret_cast<const u8*>(view->data) : reinterpret_cast<const u8*>(view->buffer->data);
+    if (!base) {
+        return nullptr;
+    }
+    if (!view->data) {
+        base += view->offset;
+    }
+    return base + accessor->offset;
+}
+
+inline void gltf_store_floats(f32 *dst, __m128 v, u32 count)
+{
+    switch (count) {
+        case 4: _mm_storeu_ps(dst, v); break;
+        case 3: _mm_storel_pi(reinterpret_cast<__m64*>(dst), v); _mm_store_ss(dst + 2, _mm_movehl_ps(v, v)); break;
+        case 2: _mm_storel_pi(reinterpret_cast<__m64*>(dst), v); break;
+        case 1: _mm_store_ss(dst, v); break;
+    }
+}
+
+/// @note(ame): widens up to 4 u8 or u16 components into 4 i32 lanes. Only reads what the element owns.
+inline __m128i gltf_widen_components(const u8 *src, cgltf_component_type type, u32 count)
+{
+    const __m128i zero = _mm_setzero_si128();
+    if (type == cgltf_component_type_r_8u) {
+        u32 packed = 0;
+        memcpy(&packed, src, count);
+        __m128i v = _mm_cvtsi32_si128(packed);
+        v = _mm_unpacklo_epi8(v, zero);
+        return _mm_unpacklo_epi16(v, zero);
+    }
+
+    u64 packed = 0;
+    memcpy(&packed, src, count * sizeof(u16));
+    __m128i v = _mm_cvtsi64_si128(packed);
+    return _mm_unpacklo_epi16(v, zero);
+}
+
+void gltf_accessor_unpack_floats_slow(const cgltf_accessor *accessor, f32 *out, u32 components, u64 out_stride)
 {
-    if (primitive->type != cgltf_primitive_type_triangles) {
+    u8 *dst = reinterpret_cast<u8*>(out);
+    for (cgltf_size i = 0; i < accessor->count; i++) {
+        f32 temp[16] = {};
+        cgltf_accessor_read_float(accessor, i, temp, 16);
+        memcpy(dst + i * out_stride, temp, components * sizeof(f32));
+    }
+}
+
+void gltf_accessor_unpack_floats(const cgltf_accessor *accessor, f32 *out, u32 components, u64 out_stride)
+{
+    const u8 *src = gltf_accessor_data(accessor);
+    u32 src_components = cgltf_num_components(accessor->type);
+    if (!src || accessor->is_sparse || src_components > 4) {
+        gltf_accessor_unpack_floats_slow(accessor, out, components, out_stride);
         return;
     }
 
-    gltf_primitive out;
+    u32 count = std::min(components, src_components);
+    u64 src_stride = accessor->stride;
+    u64 element_count = accessor->count;
+    u8 *dst = reinterpret_cast<u8*>(out);
+
+    switch (accessor->component_type) {
+        case cgltf_component_type_r_32f: {
+            /// @note(ame): a full 16 byte load is fine as long as it ends inside the accessor. With tightly packed scalars or
+            /// vec2s that rules out the last few elements, those (and whatever didn't fit) get copied.
+            u64 i = 0;
+            u64 end = element_count ? (element_count - 1) * src_stride + src_components * sizeof(f32) : 0;
+            if (src_stride >= count * sizeof(f32)) {
+                for (; i < element_count && i * src_stride + sizeof(__m128) <= end; i++) {
+                    __m128 v = _mm_loadu_ps(reinterpret_cast<const f32*>(src + i * src_stride));
+                    gltf_store_floats(reinterpret_cast<f32*>(dst + i * out_stride), v, count);
+                }
+            }
+            for (; i < element_count; i++) {
+                memcpy(dst + i * out_stride, src + i * src_stride, count * sizeof(f32));
+            }
+            break;
+        }
+        case cgltf_component_type_r_8u:
+        case cgltf_component_type_r_16u: {
+            f32 max_value = accessor->component_type == cgltf_component_type_r_8u ? 255.0f : 65535.0f;
+            __m128 scale = _mm_set1_ps(accessor->normalized ? 1.0f / max_value : 1.0f);
+            for (u64 i = 0; i < element_count; i++) {
+                __m128i wide = gltf_widen_components(src + i * src_stride, accessor->component_type, count);
+                __m128 v = _mm_mul_ps(_mm_cvtepi32_ps(wide), scale);
+                gltf_store_floats(reinterpret_cast<f32*>(dst + i * out_stride), v, count);
+            }
+            break;
+        }
+        default: {
+            gltf_accessor_unpack_floats_slow(accessor, out, components, out_stride);
+            break;
+        }
+    }
+}
+
+void gltf_accessor_unpack_joints(const cgltf_accessor *accessor, i32 *out, u64 out_stride)
+{
+    static_assert(MAX_BONE_WEIGHTS == 4, "the fast path widens into a single 128 bit store");
+
+    const u8 *src = gltf_accessor_data(accessor);
+    u32 count = std::min<u32>(cgltf_num_components(accessor->type), MAX_BONE_WEIGHTS);
+    u8 *dst = reinterpret_cast<u8*>(out);
+
+    bool fast = src && !accessor->is_sparse && (accessor->component_type == cgltf_component_type_r_8u || accessor->component_type == cgltf_component_type_r_16u);
+    for (cgltf_size i = 0; i < accessor->count; i++) {
+        if (fast) {
+            __m128i wide = gltf_widen_components(src + i * accessor->stride, accessor->component_type, count);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * out_stride), wide);
+        } else {
+            cgltf_uint ids[4] = {};
+            cgltf_accessor_read_uint(accessor, i, ids, 4);
+            i32 *joints = reinterpret_cast<i32*>(dst + i * out_stride);
+            for (u32 j = 0; j < MAX_BONE_WEIGHTS; j++) {
+                joints[j] = static_cast<i32>(ids[j]);
+            }
+        }
+    }
+}
+
+void gltf_unpack_indices_u16_avx2(const u16 *src, u32 *out, u64 count, u32 base_vertex, u64& i);
+void gltf_unpack_indices_u32_avx2(const u32 *src, u32 *out, u64 count, u32 base_vertex, u64& i);
+
+void gltf_offset_indices(const u32 *src, u32 *out, u64 count, u32 base_vertex)
+{
+    u64 i = 0;
+    if (wn_cpu_features().avx2) {
+        gltf_unpack_indices_u32_avx2(src, out, count, base_vertex, i);
+    }
+
+    const __m128i base = _mm_set1_epi32(base_vertex);
+    for (; i + 4 <= count; i += 4) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_add_epi32(v, base));
+    }
+    for (; i < count; i++) {
+        out[i] = src[i] + base_vertex;
+    }
+}
+
+void gltf_accessor_unpack_indices(const cgltf_accessor *accessor, u32 *out, u32 base_vertex)
+{
+    const u8 *src = gltf_accessor_data(accessor);
+    u64 count = accessor->count;
+    u64 component_size = cgltf_component_size(accessor->component_type);
+    if (!src || accessor->is_sparse || accessor->stride != component_size) {
+        for (u64 i = 0; i < count; i++) {
+            out[i] = cgltf_accessor_read_index(accessor, i) + base_vertex;
+        }
+        return;
+    }
+
+    const bool avx2 = wn_cpu_features().avx2;
+    const __m128i base = _mm_set1_epi32(base_vertex);
+    const __m128i zero = _mm_setzero_si128();
+    u64 i = 0;
+
+    switch (accessor->component_type) {
+        case cgltf_component_type_r_32u: {
+            gltf_offset_indices(reinterpret_cast<const u32*>(src), out, count, base_vertex);
+            break;
+        }
+        case cgltf_component_type_r_16u: {
+            const u16 *indices = reinterpret_cast<const u16*>(src);
+            if (avx2) {
+                gltf_unpack_indices_u16_avx2(indices, out, count, base_vertex, i);
+            }
+            for (; i + 8 <= count; i += 8) {
+                __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(indices + i));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_add_epi32(_mm_unpacklo_epi16(v, zero), base));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i + 4), _mm_add_epi32(_mm_unpackhi_epi16(v, zero), base));
+            }
+            for (; i < count; i++) {
+                out[i] = indices[i] + base_vertex;
+            }
+            break;
+        }
+        case cgltf_component_type_r_8u: {
+            for (; i + 16 <= count; i += 16) {
+                __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+                __m128i lo = _mm_unpacklo_epi8(v, zero);
+                __m128i hi = _mm_unpackhi_epi8(v, zero);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_add_epi32(_mm_unpacklo_epi16(lo, zero), base));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i + 4), _mm_add_epi32(_mm_unpackhi_epi16(lo, zero), base));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i + 8), _mm_add_epi32(_mm_unpacklo_epi16(hi, zero), base));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i + 12), _mm_add_epi32(_mm_unpackhi_epi16(hi, zero), base));
+            }
+            for (; i < count; i++) {
+                out[i] = src[i] + base_vertex;
+            }
+            break;
+        }
+        default: {
+            for (; i < count; i++) {
+                out[i] = cgltf_accessor_read_index(accessor, i) + base_vertex;
+            }
+            break;
+        }
+    }
+}
+
+/// @note(ame): kept out of line so the compiler doesn't hoist AVX2 instructions into the SSE paths
+void gltf_unpack_indices_u16_avx2(const u16 *src, u32 *out, u64 count, u32 base_vertex, u64& i)
+{
+    const __m256i base = _mm256_set1_epi32(base_vertex);
+    for (; i + 8 <= count; i += 8) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_add_epi32(_mm256_cvtepu16_epi32(v), base));
+    }
+}
+
+void gltf_unpack_indices_u32_avx2(const u32 *src, u32 *out, u64 count, u32 base_vertex, u64& i)
+{
+    const __m256i base = _mm256_set1_epi32(base_vertex);
+    for (; i + 8 <= count; i += 8) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_add_epi32(v, base));
+    }
+}
+
+void gltf_decode_primitive(gltf_model *model, gltf_primitive_import *prim)
+{
+    cgltf_primitive *primitive = prim->primitive;
 
     cgltf_attribute* pos_attribute = nullptr;
     cgltf_attribute* uv_attribute = nullptr;
@@ -54,75 +291,103 @@ void gltf_process_primitive(gltf_model *model, cgltf_primitive *primitive, gltf_
     i32 vertex_count = pos_attribute->data->count;
     i32 index_count = primitive->indices->count;
 
-    std::vector<gltf_vertex> vertices = {};
-    JPH::Array<JPH::Vec3> points = {};
-    std::vector<glm::vec3> glm_points = {};
-    std::vector<u32> indices = {};
+    prim->vertices.resize(vertex_count);
+    prim->indices.resize(index_count);
 
-    for (i32 i = 0; i < vertex_count; i++) {
-        gltf_vertex vertex = {};
-
-        //u32 ids[4];
+    gltf_vertex *first = prim->vertices.data();
+    gltf_accessor_unpack_floats(pos_attribute->data, glm::value_ptr(first->Position), 3, sizeof(gltf_vertex));
+    if (uv_attribute) {
+        gltf_accessor_unpack_floats(uv_attribute->data, glm::value_ptr(first->UV), 2, sizeof(gltf_vertex));
+    }
+    if (norm_attribute) {
+        gltf_accessor_unpack_floats(norm_attribute->data, glm::value_ptr(first->Normals), 3, sizeof(gltf_vertex));
+    }
+    if (joint_attribute) {
+        gltf_accessor_unpack_joints(joint_attribute->data, first->MaxBoneInfluence, sizeof(gltf_vertex));
+    }
+    if (weight_attribute) {
+        gltf_accessor_unpack_floats(weight_attribute->data, first->Weights, MAX_BONE_WEIGHTS, sizeof(gltf_vertex));
+    }
+    gltf_accessor_unpack_indices(primitive->indices, prim->indices.data());
 
-        if (!cgltf_accessor_read_float(pos_attribute->data, i, glm::value_ptr(vertex.Position), 4)) {
-        }
-        if (!cgltf_accessor_read_float(uv_attribute->data, i, glm::value_ptr(vertex.UV), 4)) {
-        }
-        if (!cgltf_accessor_read_float(norm_attribute->data, i, glm::value_ptr(vertex.Normals), 4)) {
-        }
-        //if (!cgltf_accessor_read_uint(joint_attribute->data, i, ids, 4)) {
-        //}
-        //if (!cgltf_accessor_read_float(weight_attribute->data, i, vertex.Weights, 4)) {
-        //}
+    prim->vertex_data = prim->vertices.data();
+    prim->index_data = prim->indices.data();
+    prim->vertex_count = vertex_count;
+    prim->index_count = index_count;
+}
 
-        //for (u32 i = 0; i < MAX_BONE_WEIGHTS; i++)
-        //    vertex.MaxBoneInfluence[i] = static_cast<i32>(ids[i]);
+/// @note(ame): one batch per model, so a model's shapes come from (or go to) a single .wnp
+void gltf_cook_collisions(gltf_model *model, std::vector<gltf_primitive_import>& imports, u32 max_threads)
+{
+    if (!model->gen_collisions) {
+        return;
+    }
 
-        glm::vec4 untransformed_point = node->transform * glm::vec4(vertex.Position, 1.0f);
+    /// @note(ame): the primitives' slices of the streams, with their own (not rebased) indices
+    geometry_view view = geometry_get_view(model->geometry);
+    std::vector<collision_source> sources(imports.size());
+    for (u64 i = 0; i < imports.size(); i++) {
+        const gltf_primitive_import& prim = imports[i];
+        sources[i].transform = prim.node->transform;
+        sources[i].geometry = geometry_subview(view, prim.vertex_offset, prim.vertex_count, prim.index_data, prim.index_count);
+    }
 
-        points.push_back(JPH::Vec3(untransformed_point.x, untransformed_point.y, untransformed_point.z));
-        glm_points.push_back(glm::vec3(untransformed_point));
-        vertices.push_back(vertex);
+    collision_cook_batch(sources, collision_get_settings(), CACHE_PHYSICS && model->cache_collisions, max_threads);
+    for (u64 i = 0; i < imports.size(); i++) {
+        imports[i].shape = sources[i].shape;
     }
+}
+
+void gltf_import_primitives(gltf_model *model, std::vector<gltf_primitive_import>& imports, u32 max_threads)
+{
+    /// @note(ame): decode every primitive on the job system. Baked primitives are already decoded.
+    job_parallel_for(imports.size(), [&](u32 i) {
+        if (imports[i].primitive) {
+            gltf_decode_primitive(model, &imports[i]);
+        }
+    }, max_threads);
 
-    for (int i = 0; i < index_count; i++) {
-        indices.push_back(cgltf_accessor_read_index(primitive->indices, i));
+    /// @note(ame): precompute where each primitive lands so the merge is deterministic whatever the thread count
+    u64 vertex_offset = model->geometry.x.size();
+    u64 index_offset = model->geometry.indices.size();
+    for (auto& prim : imports) {
+        prim.vertex_offset = vertex_offset;
+        prim.index_offset = index_offset;
+        vertex_offset += prim.vertex_count;
+        index_offset += prim.index_count;
     }
+    geometry_resize(&model->geometry, vertex_offset, index_offset);
 
-    out.vtx_count = vertex_count;
-    out.idx_count = index_count;
+    /// @note(ame): positions only, the full vertices stay with the import until they're uploaded
+    job_parallel_for(imports.size(), [&](u32 i) {
+        gltf_primitive_import& prim = imports[i];
 
-    if (model->gen_collisions) {
-#if CACHE_PHYSICS
-        /// @todo(ame): le physics
-        std::stringstream ss;
-        ss << ".cache/" << wn_hash(model->path.c_str(), model->path.size(), 1000) << "_" << std::to_string(model->physics_counter) << ".wnp";
-        if (fs_exists(ss.str())) {
-            log("[physics] loading cached collider %s", ss.str().c_str());
-            physics_body_init(&out.body, new cached_shape(ss.str(), physics_materials::LevelMaterial), glm::vec3(0.0f), true);
-        } else {
-            fs_create(ss.str());
-            log("[physics] caching %s", ss.str().c_str());
-            physics_shape* shape = new convex_hull_shape(points, physics_materials::LevelMaterial);
-            shape->save_shape(ss.str());
-            physics_body_init(&out.body, shape, glm::vec3(0.0f), true);
+        if (prim.vertex_data) {
+            geometry_scatter_positions(&model->geometry, prim.vertex_offset, reinterpret_cast<const u8*>(&prim.vertex_data->Position), sizeof(gltf_vertex), prim.vertex_count);
         }
-#else
-        physics_shape* shape = new convex_hull_shape(points, physics_materials::LevelMaterial);
-        physics_body_init(&out.body, shape, glm::vec3(0.0f), true);
-#endif
-    }
-    model->physics_counter++;
+        /// @note(ame): the indices were decoded once already (or came baked), they only need rebasing
+        gltf_offset_indices(prim.index_data, model->geometry.indices.data() + prim.index_offset, prim.index_count, prim.vertex_offset);
+    }, max_threads);
+
+    /// @note(ame): cooked off the streams, as a batch
+    gltf_cook_collisions(model, imports, max_threads);
+}
+
+void gltf_upload_primitive(gltf_model *model, gltf_primitive_import *prim, physics_body_batch *bodies)
+{
+    gltf_primitive out;
+    gltf_node *node = prim->node;
 
-    i32 vertex_offset = model->flattened_vertices.size(); // Assuming 3 components per vertex
-    model->flattened_vertices.insert(model->flattened_vertices.end(), vertices.begin(), vertices.end());
-    for (i32 index : indices) {
-        model->flattened_indices.push_back(index + vertex_offset);
+    out.vtx_count = prim->vertex_count;
+    out.idx_count = prim->index_count;
+
+    if (model->gen_collisions) {
+        physics_body_batch_add(bodies, &out.body, prim->shape);
     }
 
     /// @note(ame): create buffers
-    buffer_init(&out.vertex_buffer, vertices.size() * sizeof(gltf_vertex), sizeof(gltf_vertex), BufferType_Vertex, false, node->name + " Vertex Buffer");
-    buffer_init(&out.index_buffer, indices.size() * sizeof(u32), sizeof(u32), BufferType_Index, false, node->name + " Index Buffer");
+    buffer_init(&out.vertex_buffer, out.vtx_count * sizeof(gltf_vertex), sizeof(gltf_vertex), BufferType_Vertex, false, node->name + " Vertex Buffer");
+    buffer_init(&out.index_buffer, out.idx_count * sizeof(u32), sizeof(u32), BufferType_Index, false, node->name + " Index Buffer");
 
     buffer* vertex_staging = new buffer;
     buffer_init(vertex_staging, out.vertex_buffer.size, 0, BufferType_Copy, false, node->name + " Staging Vertex");
@@ -130,24 +395,23 @@ void gltf_process_primitive(gltf_model *model, cgltf_primitive *primitive, gltf_
     buffer* index_staging = new buffer;
     buffer_init(index_staging, out.index_buffer.size, 0, BufferType_Copy, false, node->name + " Staging Index");
     /// @note(ame): create textures
-    cgltf_material *material = primitive->material;
     gltf_material out_material = {};
     out.material_index = model->materials.size();
 
     /// @note(ame): loading + uploading
     void *data;
     buffer_map(vertex_staging, 0, 0, &data);
-    memcpy(data, vertices.data(), out.vertex_buffer.size);
+    memcpy(data, prim->vertex_data, out.vertex_buffer.size);
     command_buffer_copy_buffer_to_buffer(&model->model_cmd, &out.vertex_buffer, vertex_staging);
     buffer_unmap(vertex_staging);
 
     buffer_map(index_staging, 0, 0, &data);
-    memcpy(data, indices.data(), out.index_buffer.size);
+    memcpy(data, prim->index_data, out.index_buffer.size);
     command_buffer_copy_buffer_to_buffer(&model->model_cmd, &out.index_buffer, index_staging);
     buffer_unmap(index_staging);
 
-    if (material && material->pbr_metallic_roughness.base_color_texture.texture) {
-        std::string path = model->directory + '/' + std::string(material->pbr_metallic_roughness.base_color_texture.texture->image->uri);
+    if (!prim->albedo_path.empty()) {
+        const std::string& path = prim->albedo_path;
         if (model->textures.count(path) > 0) {
             out_material.albedo = &model->textures[path];
             out_material.has_albedo = true;
@@ -171,7 +435,7 @@ void gltf_process_primitive(gltf_model *model, cgltf_primitive *primitive, gltf_
     node->primitives.push_back(out);
 }
 
-void gltf_process_node(gltf_model *model, cgltf_node *node, gltf_node *mnode)
+void gltf_process_node(gltf_model *model, cgltf_node *node, gltf_node *mnode, std::vector<gltf_primitive_import>& imports)
 {
     glm::mat4 local_transform(1.0f);
     glm::mat4 translation_matrix(1.0f);
@@ -202,13 +466,21 @@ void gltf_process_node(gltf_model *model, cgltf_node *node, gltf_node *mnode)
 
     if (node->mesh) {
         for (i32 i = 0; i < node->mesh->primitives_count; i++) {
-            gltf_process_primitive(model, &node->mesh->primitives[i], mnode);
-        }
-    }
+            if (node->mesh->primitives[i].type != cgltf_primitive_type_triangles) {
+                continue;
+            }
 
-    for (i32 i = 0; i < FRAMES_IN_FLIGHT; i++) {
-        buffer_init(&mnode->model_buffer[i], 512, 0, BufferType_Constant, false, node->name + std::string(" CBV") + std::to_string(i));
-        buffer_build_constant(&mnode->model_buffer[i]);
+            gltf_primitive_import prim;
+            prim.primitive = &node->mesh->primitives[i];
+            prim.node = mnode;
+            prim.physics_index = model->physics_counter++;
+
+            cgltf_material *material = prim.primitive->material;
+            if (material && material->pbr_metallic_roughness.base_color_texture.texture) {
+                prim.albedo_path = model->directory + '/' + std::string(material->pbr_metallic_roughness.base_color_texture.texture->image->uri);
+            }
+            imports.push_back(prim);
+        }
     }
 
     mnode->children.resize(node->children_count);
@@ -216,46 +488,420 @@ void gltf_process_node(gltf_model *model, cgltf_node *node, gltf_node *mnode)
         mnode->children[i] = new gltf_node;
         mnode->children[i]->parent = mnode;
 
-        gltf_process_node(model, node->children[i], mnode->children[i]);
+        gltf_process_node(model, node->children[i], mnode->children[i], imports);
     }
 }
 
-void gltf_model_load(gltf_model *model, const std::string& path, bool generate_collisions)
+/// @note(ame): BAKED MESHES
+
+u64 wnm_align(u64 offset)
 {
+    return (offset + 15) & ~15ull;
+}
+
+/// @note(ame): the external buffers a glTF references. Only editing the .gltf can change them, so the list is cached
+/// (.wnb, one uri per line under a "WNB1" line) against its hash and a warm start doesn't parse anything.
+std::vector<std::string> gltf_buffer_uris(const std::string& path, u64 gltf_hash)
+{
+    std::vector<std::string> uris;
+    u64 key = asset_cache_key_from_hash(gltf_hash, "gltf_buffers", GLTF_BUFFERS_VERSION);
+
+    std::string cached;
+    fs_mapped_file file;
+    if (asset_cache_lookup(key, ".wnb", &cached) && fs_map(&file, cached)) {
+        std::string list(reinterpret_cast<const char*>(file.data), file.size);
+        fs_unmap(&file);
+
+        std::istringstream stream(list);
+        std::string line;
+        if (std::getline(stream, line) && line == "WNB1") {
+            while (std::getline(stream, line)) {
+                if (!line.empty()) {
+                    uris.push_back(line);
+                }
+            }
+            return uris;
+        }
+    }
+
+    cgltf_options options = {};
+    cgltf_data *data = nullptr;
+    if (cgltf_parse_file(&options, path.c_str(), &data) != cgltf_result_success) {
+        return uris;
+    }
+    std::string list = "WNB1\n";
+    for (cgltf_size i = 0; i < data->buffers_count; i++) {
+        const char *uri = data->buffers[i].uri;
+        if (uri && strncmp(uri, "data:", 5) != 0 && !strstr(uri, "://")) {
+            uris.push_back(uri);
+            list += std::string(uri) + "\n";
+        }
+    }
+    cgltf_free(data);
+
+    asset_cache_store(key, list.data(), list.size(), ".wnb");
+    return uris;
+}
+
+u64 gltf_source_hash(const std::string& path)
+{
+    u64 gltf_hash = asset_cache_source_hash(path);
+
+    /// @note(ame): every external buffer the glTF references, not just the .bin next to it. Their hashes are cached
+    /// against their file times like the .gltf's, so an untouched model only stats its files.
+    u64 hash = wn_hash(&gltf_hash, sizeof(gltf_hash), 1000);
+    std::string directory = path.substr(0, path.find_last_of('/') + 1);
+    for (auto& uri : gltf_buffer_uris(path, gltf_hash)) {
+        u64 content = asset_cache_source_hash(directory + uri);
+        hash = wn_hash(&content, sizeof(content), hash);
+    }
+    return hash;
+}
+
+u64 gltf_baked_key(u64 source_hash)
+{
+    return asset_cache_key_from_hash(source_hash, "gltf_mesh", WNM_VERSION);
+}
+
+void gltf_bake(gltf_model *model, const std::vector<gltf_primitive_import>& imports)
+{
+    /// @note(ame): flatten the hierarchy depth first
+    std::vector<gltf_node*> nodes;
+    std::unordered_map<gltf_node*, i32> node_indices;
+    std::function<void(gltf_node*)> flatten = [&](gltf_node *node) {
+        node_indices[node] = nodes.size();
+        nodes.push_back(node);
+        for (gltf_node *child : node->children) {
+            flatten(child);
+        }
+    };
+    flatten(model->root);
+
+    std::unordered_map<gltf_node*, std::vector<u32>> node_primitives;
+    for (u32 i = 0; i < imports.size(); i++) {
+        node_primitives[imports[i].node].push_back(i);
+    }
+
+    std::string strings;
+    auto push_string = [&](const std::string& str) {
+        u32 offset = strings.size();
+        strings.append(str);
+        strings.push_back('\0');
+        return offset;
+    };
+
+    std::vector<wnm_node> out_nodes;
+    std::vector<wnm_primitive> out_primitives;
+    std::vector<wnm_material> out_materials;
+    std::unordered_map<std::string, i32> material_indices;
+    u64 vertex_count = 0;
+    u64 index_count = 0;
+
+    for (gltf_node *node : nodes) {
+        wnm_node out = {};
+        out.transform = node->transform;
+        out.parent = node->parent ? node_indices[node->parent] : -1;
+        out.name = push_string(node->name);
+        out.first_primitive = out_primitives.size();
+
+        for (u32 index : node_primitives[node]) {
+            const gltf_primitive_import& prim = imports[index];
+
+            wnm_primitive out_prim = {};
+            out_prim.vertex_offset = vertex_count;
+            out_prim.index_offset = index_count;
+            out_prim.vertex_count = prim.vertex_count;
+            out_prim.index_count = prim.index_count;
+            out_prim.physics_index = prim.physics_index;
+            out_prim.material = -1;
+            if (!prim.albedo_path.empty()) {
+                if (material_indices.count(prim.albedo_path) == 0) {
+                    material_indices[prim.albedo_path] = out_materials.size();
+                    out_materials.push_back({ (i32)push_string(prim.albedo_path) });
+                }
+                out_prim.material = material_indices[prim.albedo_path];
+            }
+
+            vertex_count += prim.vertex_count;
+            index_count += prim.index_count;
+            out_primitives.push_back(out_prim);
+        }
+
+        out.primitive_count = out_primitives.size() - out.first_primitive;
+        out_nodes.push_back(out);
+    }
+
+    wnm_header header = {};
+    header.magic = WNM_MAGIC;
+    header.version = WNM_VERSION;
+    header.node_count = out_nodes.size();
+    header.primitive_count = out_primitives.size();
+    header.material_count = out_materials.size();
+    header.string_size = strings.size();
+    header.vertex_count = vertex_count;
+    header.index_count = index_count;
+
+    header.nodes_offset = wnm_align(sizeof(wnm_header));
+    header.primitives_offset = wnm_align(header.nodes_offset + out_nodes.size() * sizeof(wnm_node));
+    header.materials_offset = wnm_align(header.primitives_offset + out_primitives.size() * sizeof(wnm_primitive));
+    header.strings_offset = wnm_align(header.materials_offset + out_materials.size() * sizeof(wnm_material));
+    header.vertices_offset = wnm_align(header.strings_offset + strings.size());
+    header.indices_offset = wnm_align(header.vertices_offset + vertex_count * sizeof(gltf_vertex));
+
+    u64 key = gltf_baked_key(model->source_hash);
+    std::string temp = asset_cache_temp_path(key);
+    FILE *f = fopen(temp.c_str(), "wb+");
+    if (!f) {
+        log("[gltf] failed to open %s for baking", temp.c_str());
+        return;
+    }
+
+    /// @note(ame): any short write and the temp file is thrown away, a truncated .wnm must never be committed
+    bool written = true;
+    auto write = [&](const void *data, u64 size) {
+        if (size && written) {
+            written = fwrite(data, size, 1, f) == 1;
+        }
+    };
+    auto write_at = [&](u64 offset, const void *data, u64 size) {
+        static const u8 padding[16] = {};
+        long position = ftell(f);
+        if (position < 0) {
+            written = false;
+            return;
+        }
+        if (offset > u64(position)) {
+            write(padding, offset - position);
+        }
+        write(data, size);
+    };
+
+    write_at(0, &header, sizeof(header));
+    write_at(header.nodes_offset, out_nodes.data(), out_nodes.size() * sizeof(wnm_node));
+    write_at(header.primitives_offset, out_primitives.data(), out_primitives.size() * sizeof(wnm_primitive));
+    write_at(header.materials_offset, out_materials.data(), out_materials.size() * sizeof(wnm_material));
+    write_at(header.strings_offset, strings.data(), strings.size());
+    write_at(header.vertices_offset, nullptr, 0);
+    for (gltf_node *node : nodes) {
+        for (u32 index : node_primitives[node]) {
+            write(imports[index].vertex_data, imports[index].vertex_count * sizeof(gltf_vertex));
+        }
+    }
+    write_at(header.indices_offset, nullptr, 0);
+    for (gltf_node *node : nodes) {
+        for (u32 index : node_primitives[node]) {
+            write(imports[index].index_data, imports[index].index_count * sizeof(u32));
+        }
+    }
+    written = fclose(f) == 0 && written;
+    if (!written) {
+        log("[gltf] failed to write %s, not caching %s", temp.c_str(), model->path.c_str());
+        asset_cache_discard(temp);
+        return;
+    }
+
+    std::string cached = asset_cache_commit(key, temp, ".wnm");
+    log("[gltf] baked %s to %s", model->path.c_str(), cached.c_str());
+}
+
+bool gltf_baked_open(gltf_baked_mesh *baked, u64 source_hash)
+{
+    std::string cached;
+    u64 key = gltf_baked_key(source_hash);
+    if (!asset_cache_acquire(key, ".wnm", &cached)) {
+        return false;
+    }
+    baked->key = key;
+
+    /// @note(ame): the blobs are used in place, the mapping lives as long as the load does
+    if (!fs_map(&baked->file, cached)) {
+        gltf_baked_close(baked);
+        return false;
+    }
+    if (baked->file.size < sizeof(wnm_header)) {
+        gltf_baked_close(baked);
+        return false;
+    }
+
+    baked->header = reinterpret_cast<const wnm_header*>(baked->file.data);
+    if (baked->header->magic != WNM_MAGIC || baked->header->version != WNM_VERSION) {
+        log("[gltf] %s has an outdated format -- rebaking", cached.c_str());
+        gltf_baked_close(baked);
+        return false;
+    }
+
+    if (baked->header->indices_offset + baked->header->index_count * sizeof(u32) > baked->file.size) {
+        log("[gltf] %s is truncated -- rebaking", cached.c_str());
+        gltf_baked_close(baked);
+        return false;
+    }
+
+    const u8 *base = baked->file.data;
+    baked->nodes = reinterpret_cast<const wnm_node*>(base + baked->header->nodes_offset);
+    baked->primitives = reinterpret_cast<const wnm_primitive*>(base + baked->header->primitives_offset);
+    baked->materials = reinterpret_cast<const wnm_material*>(base + baked->header->materials_offset);
+    baked->strings = reinterpret_cast<const char*>(base + baked->header->strings_offset);
+    baked->vertices = reinterpret_cast<const gltf_vertex*>(base + baked->header->vertices_offset);
+    baked->indices = reinterpret_cast<const u32*>(base + baked->header->indices_offset);
+    return true;
+}
+
+void gltf_baked_close(gltf_baked_mesh *baked)
+{
+    fs_unmap(&baked->file);
+    baked->header = nullptr;
+    if (baked->key) {
+        asset_cache_release(baked->key);
+        baked->key = 0;
+    }
+}
+
+void gltf_load_baked(gltf_model *model, gltf_baked_mesh *baked, std::vector<gltf_primitive_import>& imports)
+{
+    std::vector<gltf_node*> nodes(baked->header->node_count);
+    for (u32 i = 0; i < baked->header->node_count; i++) {
+        const wnm_node& src = baked->nodes[i];
+
+        gltf_node *node = new gltf_node;
+        node->name = baked->strings + src.name;
+        node->transform = src.transform;
+        node->parent = src.parent >= 0 ? nodes[src.parent] : nullptr;
+        if (node->parent) {
+            node->parent->children.push_back(node);
+        }
+        nodes[i] = node;
+
+        for (u32 j = 0; j < src.primitive_count; j++) {
+            const wnm_primitive& src_prim = baked->primitives[src.first_primitive + j];
+
+            gltf_primitive_import prim;
+            prim.node = node;
+            prim.physics_index = src_prim.physics_index;
+            if (src_prim.material >= 0) {
+                prim.albedo_path = baked->strings + baked->materials[src_prim.material].albedo;
+            }
+            prim.vertex_data = baked->vertices + src_prim.vertex_offset;
+            prim.index_data = baked->indices + src_prim.index_offset;
+            prim.vertex_count = src_prim.vertex_count;
+            prim.index_count = src_prim.index_count;
+            imports.push_back(prim);
+        }
+    }
+
+    model->root = nodes[0];
+    model->physics_counter = baked->header->primitive_count;
+}
+
+/// @note(ame): every node but the root gets its constant buffers. Done in the upload half, descriptor allocation isn't thread safe.
+void gltf_create_node_buffers(gltf_node *node)
+{
+    if (node->parent) {
+        for (i32 i = 0; i < FRAMES_IN_FLIGHT; i++) {
+            buffer_init(&node->model_buffer[i], 512, 0, BufferType_Constant, false, node->name + std::string(" CBV") + std::to_string(i));
+            buffer_build_constant(&node->model_buffer[i]);
+        }
+    }
+    for (gltf_node *child : node->children) {
+        gltf_create_node_buffers(child);
+    }
+}
+
+void gltf_model_import(gltf_model *model, gltf_load_state *state, const std::string& path, bool generate_collisions)
+{
+    if (!gltf_model_try_import(model, state, path, generate_collisions)) {
+        throw_error("Failed to load GLTF!");
+    }
+}
+
+bool gltf_model_try_import(gltf_model *model, gltf_load_state *state, const std::string& path, bool generate_collisions, const std::atomic<bool> *cancelled)
+{
+    auto stop = [cancelled]() { return cancelled && cancelled->load(); };
+
     model->path = path;
+    model->source_hash = gltf_source_hash(path);
     model->gen_collisions = generate_collisions;
+    model->vtx_count = 0;
+    model->idx_count = 0;
+    model->physics_counter = 0;
     model->directory = path.substr(0, path.find_last_of('/'));
 
-    cgltf_options options = {};
-    cgltf_data* data = nullptr;
+    timer import_timer;
+    timer_init(&import_timer);
 
-    if (cgltf_parse_file(&options, path.c_str(), &data) != cgltf_result_success) {
-        throw_error("Failed to load GLTF!");
+    /// @note(ame): both paths below only fill `imports`, the state stays alive until the upload is done
+    if (gltf_baked_open(&state->baked, model->source_hash)) {
+        gltf_load_baked(model, &state->baked, state->imports);
+    } else {
+        cgltf_options options = {};
+
+        if (cgltf_parse_file(&options, path.c_str(), &state->data) != cgltf_result_success) {
+            log("[gltf] Failed to parse %s", path.c_str());
+            return false;
+        }
+        if (cgltf_load_buffers(&options, state->data, path.c_str()) != cgltf_result_success) {
+            log("[gltf] Failed to load the buffers of %s", path.c_str());
+            return false;
+        }
+        cgltf_scene *scene = state->data->scene;
+        if (!scene) {
+            log("[gltf] %s has no scene", path.c_str());
+            return false;
+        }
+        if (stop()) {
+            return false;
+        }
+
+        /// @note(ame): Process animations
+        /// @todo(ame): Process animations
+
+        /// @note(ame): Process geometry
+        model->root = new gltf_node;
+        model->root->name = "RootNode";
+        model->root->parent = nullptr;
+        model->root->transform = glm::mat4(1.0f);
+        model->root->children.resize(scene->nodes_count);
+
+        for (i32 i = 0; i < scene->nodes_count; i++) {
+            model->root->children[i] = new gltf_node;
+            model->root->children[i]->parent = model->root;
+
+            gltf_process_node(model, scene->nodes[i], model->root->children[i], state->imports);
+        }
     }
-    if (cgltf_load_buffers(&options, data, path.c_str()) != cgltf_result_success) {
-        throw_error("Failed to load GLTF buffers!");
+    if (stop()) {
+        return false;
     }
-    cgltf_scene *scene = data->scene;
 
-    command_buffer_init(&model->model_cmd, D3D12_COMMAND_LIST_TYPE_DIRECT, false);
-    command_buffer_begin(&model->model_cmd, false);
+#if GLTF_PARALLEL_IMPORT
+    gltf_import_primitives(model, state->imports, 0);
+#else
+    gltf_import_primitives(model, state->imports, 1);
+#endif
+    log("[gltf] %s %d primitives of %s in %f seconds", state->data ? "imported" : "loaded baked", (i32)state->imports.size(), path.c_str(), TIMER_SECONDS(timer_elasped(&import_timer)));
+
+    if (stop()) {
+        return false;
+    }
 
-    /// @note(ame): Process animations
-    /// @todo(ame): Process animations
+    if (state->data) {
+        gltf_bake(model, state->imports);
+    }
+    return true;
+}
 
-    /// @note(ame): Process geometry
-    model->root = new gltf_node;
-    model->root->name = "RootNode";
-    model->root->parent = nullptr;
-    model->root->transform = glm::mat4(1.0f);
-    model->root->children.resize(scene->nodes_count);
+void gltf_model_upload(gltf_model *model, gltf_load_state *state)
+{
+    command_buffer_init(&model->model_cmd, D3D12_COMMAND_LIST_TYPE_DIRECT, false);
+    command_buffer_begin(&model->model_cmd, false);
 
-    for (i32 i = 0; i < scene->nodes_count; i++) {
-        model->root->children[i] = new gltf_node;
-        model->root->children[i]->parent = model->root;
+    gltf_create_node_buffers(model->root);
 
-        gltf_process_node(model, scene->nodes[i], model->root->children[i]);
+    /// @note(ame): GPU work stays on this thread, in primitive order. The level bodies go in the broadphase together.
+    physics_body_batch bodies;
+    for (auto& prim : state->imports) {
+        gltf_upload_primitive(model, &prim, &bodies);
     }
+    physics_body_batch_commit(&bodies);
     
     command_buffer_end(&model->model_cmd);
     command_queue_submit(&video.graphics_queue, { &model->model_cmd });
@@ -265,9 +911,48 @@ void gltf_model_load(gltf_model *model, const std::string& path, bool generate_c
         buffer_free(buffer);
         delete buffer;
     }
+    model->staging.clear();
     command_buffer_free(&model->model_cmd);
     
-    cgltf_free(data);
+    if (state->data) {
+        cgltf_free(state->data);
+        state->data = nullptr;
+    }
+    state->imports.clear();
+    gltf_baked_close(&state->baked);
+}
+
+void gltf_delete_nodes(gltf_node *node)
+{
+    for (gltf_node *child : node->children) {
+        gltf_delete_nodes(child);
+    }
+    delete node;
+}
+
+void gltf_model_discard(gltf_model *model, gltf_load_state *state)
+{
+    /// @note(ame): nothing but CPU memory and the cooked shapes exist before the upload
+    for (auto& prim : state->imports) {
+        delete prim.shape;
+    }
+    if (model->root) {
+        gltf_delete_nodes(model->root);
+        model->root = nullptr;
+    }
+    if (state->data) {
+        cgltf_free(state->data);
+        state->data = nullptr;
+    }
+    state->imports.clear();
+    gltf_baked_close(&state->baked);
+}
+
+void gltf_model_load(gltf_model *model, const std::string& path, bool generate_collisions)
+{
+    gltf_load_state state;
+    gltf_model_import(model, &state, path, generate_collisions);
+    gltf_model_upload(model, &state);
 }
 
 void gltf_free_nodes(gltf_model *model, gltf_node *node)
@@ -277,9 +962,6 @@ void gltf_free_nodes(gltf_model *model, gltf_node *node)
     }
 
     for (auto& primitive : node->primitives) {
-        if (model->gen_collisions) {
-            physics_body_free(&primitive.body);
-        }
         buffer_free(&primitive.index_buffer);
         buffer_free(&primitive.vertex_buffer);
     }
@@ -297,8 +979,42 @@ void gltf_free_nodes(gltf_model *model, gltf_node *node)
     delete node;
 }
 
+void gltf_gather_bodies(gltf_node *node, std::vector<physics_body*>& bodies)
+{
+    if (!node) {
+        return;
+    }
+
+    for (auto& primitive : node->primitives) {
+        bodies.push_back(&primitive.body);
+    }
+    for (gltf_node *child : node->children) {
+        gltf_gather_bodies(child, bodies);
+    }
+}
+
+void gltf_model_set_collisions(gltf_model *model, bool enabled)
+{
+    if (!model->gen_collisions) {
+        return;
+    }
+
+    std::vector<physics_body*> bodies;
+    gltf_gather_bodies(model->root, bodies);
+    if (enabled) {
+        physics_bodies_add(bodies);
+    } else {
+        physics_bodies_remove(bodies);
+    }
+}
+
 void gltf_model_free(gltf_model *model)
 {
+    if (model->gen_collisions) {
+        std::vector<physics_body*> bodies;
+        gltf_gather_bodies(model->root, bodies);
+        physics_bodies_free(bodies);
+    }
     gltf_free_nodes(model, model->root);
 
     model->materials.clear();
@@ -0,0 +1,149 @@
+//
+// $Notice: Xander Studios @ 2024
+// $Author: Amélie Heinrich
+// $Create Time: 2024-11-22 14:09:40
+//
+
+#include <algorithm>
+
+#include "wn_job.h"
+#include "wn_output.h"
+
+job_system jobs;
+
+/// @note(ame): only ever picks up jobs of `counter`. Helping with whatever is in front of the queue could have the main
+/// thread run a level import while it waits on a 1ms crowd step.
+bool job_try_run_one(job_counter *counter)
+{
+    job_entry entry;
+    {
+        std::unique_lock<std::mutex> lock(jobs.lock);
+        auto it = std::find_if(jobs.queue.begin(), jobs.queue.end(), [counter](const job_entry& e) { return e.counter == counter; });
+        if (it == jobs.queue.end()) {
+            return false;
+        }
+        entry = std::move(*it);
+        jobs.queue.erase(it);
+    }
+
+    entry.fn();
+    if (entry.counter) {
+        entry.counter->pending.fetch_sub(1);
+    }
+    return true;
+}
+
+void job_worker_main()
+{
+    while (true) {
+        job_entry entry;
+        {
+            std::unique_lock<std::mutex> lock(jobs.lock);
+            jobs.wake.wait(lock, []() { return jobs.quit || !jobs.queue.empty(); });
+            if (jobs.quit && jobs.queue.empty()) {
+                return;
+            }
+            entry = std::move(jobs.queue.front());
+            jobs.queue.pop_front();
+        }
+
+        entry.fn();
+        if (entry.counter) {
+            entry.counter->pending.fetch_sub(1);
+        }
+    }
+}
+
+void job_system_init(u32 thread_count)
+{
+    if (thread_count == 0) {
+        thread_count = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+    }
+
+    jobs.quit = false;
+    for (u32 i = 0; i < thread_count; i++) {
+        jobs.workers.emplace_back(job_worker_main);
+    }
+
+    log("[jobs] initialized job system with %d workers", thread_count);
+}
+
+void job_system_exit()
+{
+    {
+        std::unique_lock<std::mutex> lock(jobs.lock);
+        jobs.quit = true;
+    }
+    jobs.wake.notify_all();
+
+    for (auto& worker : jobs.workers) {
+        worker.join();
+    }
+    jobs.workers.clear();
+}
+
+u32 job_system_thread_count()
+{
+    return jobs.workers.size() + 1;
+}
+
+void job_push(const std::function<void()>& fn, job_counter *counter)
+{
+    if (counter) {
+        counter->pending.fetch_add(1);
+    }
+
+    /// @note(ame): no workers (job system not up yet), just run it inline
+    if (jobs.workers.empty()) {
+        fn();
+        if (counter) {
+            counter->pending.fetch_sub(1);
+        }
+        return;
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(jobs.lock);
+        jobs.queue.push_back({ fn, counter });
+    }
+    jobs.wake.notify_one();
+}
+
+void job_wait(job_counter *counter)
+{
+    while (counter->pending.load() > 0) {
+        if (!job_try_run_one(counter)) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+void job_parallel_for(u32 count, const std::function<void(u32)>& fn, u32 max_threads)
+{
+    u32 thread_count = job_system_thread_count();
+    if (max_threads > 0) {
+        thread_count = std::min(thread_count, max_threads);
+    }
+    thread_count = std::min(thread_count, count);
+
+    if (thread_count <= 1) {
+        for (u32 i = 0; i < count; i++) {
+            fn(i);
+        }
+        return;
+    }
+
+    std::atomic<u32> next = 0;
+    job_counter counter;
+    auto task = [&]() {
+        for (u32 i = next.fetch_add(1); i < count; i = next.fetch_add(1)) {
+            fn(i);
+        }
+    };
+
+    for (u32 i = 0; i < thread_count - 1; i++) {
+        job_push(task, &counter);
+    }
+    task();
+    job_wait(&counter);
+}
@@ -36,6 +36,10 @@
 #include "wn_discord.h"
 #include "wn_dev_console.h"
 #include "wn_cvar.h"
+#include "wn_job.h"
+#include "wn_bench.h"
+#include "wn_asset_cache.h"
+#include "wn_pak.h"
 
 #define WINDOW_WIDTH 1600
 #define WINDOW_HEIGHT 900
@@ -55,17 +59,29 @@ int main(void)
 
     /// @note(ame): initialize system
     steam_init();
-    bitmap_compress_recursive("assets/");
+    job_system_init();
     cvar_load("assets/cvars.json");
+    pak_mount_directory("./");
+    pak_init();
+    asset_cache_init();
+    bitmap_init();
+    /// @note(ame): packed builds don't ship the loose sources
+    if (fs_isdir("assets/")) {
+        bitmap_compress_recursive("assets/");
+    }
     discord_init();
     video_init(window);
+    uploader_init();
     resource_cache_init();
     audio_init();
     physics_init();
+    navmesh_system_init();
+    game_world_preload_init();
     script_system_init();
     game_renderer_init(WINDOW_WIDTH, WINDOW_HEIGHT);
     input_init();
     dev_console_init();
+    bench_init();
 
     /// @note(ame): init mappings
     input_add_mapping_binding_key("Forward", SDLK_Z);
@@ -84,6 +100,7 @@ int main(void)
     /// @note(ame): asset loading
     game_world world;
     game_world_load(&world, "assets/levels/corridor_0.json");
+    game_world_enter(&world);
     uploader_ctx_flush();
 
     debug_camera camera;
@@ -134,6 +151,7 @@ int main(void)
             audio_update();
             physics_update();
             game_world_update(&world, dt);
+            game_world_preload_update(&world);
             view_to_use = world.main_camera_view;
         } else {
             if (!io.WantCaptureMouse && editor_mode)
@@ -144,10 +162,12 @@ int main(void)
         player_debug_draw(&world.player);
 
         // render world
+        resource_cache_update();
+        uploader_update();
         video_frame frame = video_begin();
         command_buffer_begin(frame.cmd_buffer);
 
-        glm::vec3 player_pos = physics_character_get_position(&world.player.character);
+        glm::vec3 player_pos = physics_character_get_render_position(&world.player.character);
         game_render_info render_info = {
             view_to_use, 
             camera.projection,
@@ -214,11 +234,12 @@ int main(void)
                     case NotificationType_LevelChange: {
                         audio_source_play(&audio.door_open);
                         
+                        /// @note(ame): no flush here, textures stream in over the next frames
                         game_world temp;
-                        game_world_load(&temp, noti.level_change.level_path);
+                        game_world_load_preloaded(&temp, noti.level_change.level_path);
                         game_world_free(&world);
-                        uploader_ctx_flush();
                         world = temp;
+                        game_world_enter(&world);
                         
                         /// @note(ame): reset editor
                         editor_reset();
@@ -238,6 +259,7 @@ int main(void)
     }
 
     video_wait();
+    game_world_preload_exit();
     game_world_free(&world);
     
     dev_console_shutdown();
@@ -247,9 +269,13 @@ int main(void)
     physics_exit();
     audio_exit();
     resource_cache_free();
+    uploader_exit();
     video_exit();
     discord_exit();
+    asset_cache_exit();
+    pak_unmount_all();
     cvar_save("assets/cvars.json");
+    job_system_exit();
     steam_exit();
 
     SDL_DestroyWindow(window);
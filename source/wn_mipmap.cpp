@@ -0,0 +1,502 @@
+//
+// $Notice: Xander Studios @ 2024
+// $Author: Amélie Heinrich
+// $Create Time: 2024-11-23 10:31:08
+//
+
+#define _USE_MATH_DEFINES
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <immintrin.h>
+
+#include "wn_mipmap.h"
+#include "wn_util.h"
+
+#define MIP_KAISER_TAPS 8
+#define MIP_KAISER_ALPHA 4.0
+#define MIP_KAISER_WIDTH 2.0
+
+/// @note(ame): decode tables are 512 wide, [0, 256) for color and [256, 512) for alpha, which is always linear.
+/// That way the AVX2 decoder can fetch all four channels of two pixels with a single gather.
+struct mip_tables
+{
+    f32 srgb_decode[512];
+    f32 unorm_decode[512];
+    u8 srgb_encode[4096]; /// @note(ame): indexed with round(linear * 4095)
+    u8 unorm_encode[4096];
+    f32 kaiser[MIP_KAISER_TAPS];
+};
+
+f64 mip_bessel_i0(f64 x)
+{
+    f64 sum = 1.0;
+    f64 term = 1.0;
+    for (i32 k = 1; k < 32; k++) {
+        term *= (x / (2.0 * k));
+        sum += term * term;
+    }
+    return sum;
+}
+
+const mip_tables& mip_get_tables()
+{
+    static mip_tables tables = []() {
+        mip_tables result;
+
+        for (i32 i = 0; i < 256; i++) {
+            f64 c = i / 255.0;
+            f64 linear = c <= 0.04045 ? c / 12.92 : pow((c + 0.055) / 1.055, 2.4);
+            result.srgb_decode[i] = (f32)linear;
+            result.unorm_decode[i] = (f32)c;
+            result.srgb_decode[256 + i] = (f32)c;
+            result.unorm_decode[256 + i] = (f32)c;
+        }
+        for (i32 i = 0; i < 4096; i++) {
+            f64 linear = i / 4095.0;
+            f64 srgb = linear <= 0.0031308 ? linear * 12.92 : 1.055 * pow(linear, 1.0 / 2.4) - 0.055;
+            result.srgb_encode[i] = (u8)std::clamp(srgb * 255.0 + 0.5, 0.0, 255.0);
+            result.unorm_encode[i] = (u8)std::clamp(linear * 255.0 + 0.5, 0.0, 255.0);
+        }
+
+        /// @note(ame): Kaiser windowed sinc, sampled at the 8 source pixels around each destination pixel center.
+        /// Positions are in destination pixels, so the source taps sit at +-0.25, +-0.75, +-1.25, +-1.75.
+        f64 sum = 0.0;
+        f64 weights[MIP_KAISER_TAPS];
+        for (i32 k = 0; k < MIP_KAISER_TAPS; k++) {
+            f64 x = (k - (MIP_KAISER_TAPS - 1) * 0.5) * 0.5;
+            f64 sinc = sin(M_PI * x) / (M_PI * x);
+            f64 t = x / MIP_KAISER_WIDTH;
+            f64 window = mip_bessel_i0(MIP_KAISER_ALPHA * sqrt(1.0 - t * t)) / mip_bessel_i0(MIP_KAISER_ALPHA);
+            weights[k] = sinc * window;
+            sum += weights[k];
+        }
+        for (i32 k = 0; k < MIP_KAISER_TAPS; k++) {
+            result.kaiser[k] = (f32)(weights[k] / sum);
+        }
+        return result;
+    }();
+    return tables;
+}
+
+/// @note(ame): SCALAR
+
+void mip_decode_scalar(const u8 *src, f32 *dst, u64 count, const f32 *table)
+{
+    for (u64 i = 0; i < count; i++) {
+        f32 a = table[256 + src[i * 4 + 3]];
+        dst[i * 4 + 0] = table[src[i * 4 + 0]] * a;
+        dst[i * 4 + 1] = table[src[i * 4 + 1]] * a;
+        dst[i * 4 + 2] = table[src[i * 4 + 2]] * a;
+        dst[i * 4 + 3] = a;
+    }
+}
+
+void mip_encode_scalar(const f32 *src, u8 *dst, u64 count, const u8 *table)
+{
+    for (u64 i = 0; i < count; i++) {
+        f32 a = src[i * 4 + 3];
+        f32 inv = a > 0.0f ? 1.0f / a : 0.0f;
+        for (i32 c = 0; c < 3; c++) {
+            f32 value = std::clamp(src[i * 4 + c] * inv, 0.0f, 1.0f);
+            dst[i * 4 + c] = table[(i32)(value * 4095.0f + 0.5f)];
+        }
+        dst[i * 4 + 3] = (u8)(std::clamp(a, 0.0f, 1.0f) * 255.0f + 0.5f);
+    }
+}
+
+void mip_box_scalar(const f32 *src, i32 sw, i32 sh, f32 *dst, i32 dw, i32 dh)
+{
+    for (i32 y = 0; y < dh; y++) {
+        const f32 *row0 = src + u64(y * 2) * sw * 4;
+        const f32 *row1 = src + u64(std::min(y * 2 + 1, sh - 1)) * sw * 4;
+        f32 *out = dst + u64(y) * dw * 4;
+
+        for (i32 x = 0; x < dw; x++) {
+            i32 x0 = x * 2 * 4;
+            i32 x1 = std::min(x * 2 + 1, sw - 1) * 4;
+            for (i32 c = 0; c < 4; c++) {
+                out[x * 4 + c] = (row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c]) * 0.25f;
+            }
+        }
+    }
+}
+
+void mip_kaiser_h_scalar(const f32 *src, i32 sw, i32 sh, f32 *dst, i32 dw)
+{
+    const f32 *weights = mip_get_tables().kaiser;
+    for (i32 y = 0; y < sh; y++) {
+        const f32 *row = src + u64(y) * sw * 4;
+        f32 *out = dst + u64(y) * dw * 4;
+
+        for (i32 x = 0; x < dw; x++) {
+            f32 acc[4] = {};
+            for (i32 k = 0; k < MIP_KAISER_TAPS; k++) {
+                i32 sx = std::clamp(x * 2 - 3 + k, 0, sw - 1);
+                for (i32 c = 0; c < 4; c++) {
+                    acc[c] += weights[k] * row[sx * 4 + c];
+                }
+            }
+            memcpy(out + x * 4, acc, sizeof(acc));
+        }
+    }
+}
+
+void mip_kaiser_v_scalar(const f32 *src, i32 w, i32 sh, f32 *dst, i32 dh)
+{
+    const f32 *weights = mip_get_tables().kaiser;
+    u64 row_floats = u64(w) * 4;
+    for (i32 y = 0; y < dh; y++) {
+        f32 *out = dst + y * row_floats;
+        memset(out, 0, row_floats * sizeof(f32));
+
+        for (i32 k = 0; k < MIP_KAISER_TAPS; k++) {
+            const f32 *row = src + std::clamp(y * 2 - 3 + k, 0, sh - 1) * row_floats;
+            for (u64 i = 0; i < row_floats; i++) {
+                out[i] += weights[k] * row[i];
+            }
+        }
+    }
+}
+
+/// @note(ame): SSE4. One RGBA pixel is exactly one __m128.
+
+void mip_decode_sse4(const u8 *src, f32 *dst, u64 count, const f32 *table)
+{
+    for (u64 i = 0; i < count; i++) {
+        const u8 *p = src + i * 4;
+        __m128 v = _mm_setr_ps(table[p[0]], table[p[1]], table[p[2]], table[256 + p[3]]);
+        __m128 premultiplied = _mm_mul_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 3, 3)));
+        _mm_storeu_ps(dst + i * 4, _mm_blend_ps(premultiplied, v, 0x8));
+    }
+}
+
+void mip_encode_sse4(const f32 *src, u8 *dst, u64 count, const u8 *table)
+{
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 scale = _mm_setr_ps(4095.0f, 4095.0f, 4095.0f, 255.0f);
+
+    alignas(16) i32 q[4];
+    for (u64 i = 0; i < count; i++) {
+        __m128 v = _mm_loadu_ps(src + i * 4);
+        __m128 a = _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 3, 3));
+        __m128 color = _mm_and_ps(_mm_div_ps(v, a), _mm_cmpgt_ps(a, zero));
+        color = _mm_blend_ps(color, v, 0x8);
+        color = _mm_min_ps(_mm_max_ps(color, zero), one);
+        _mm_store_si128(reinterpret_cast<__m128i*>(q), _mm_cvtps_epi32(_mm_mul_ps(color, scale)));
+
+        u8 *out = dst + i * 4;
+        out[0] = table[q[0]];
+        out[1] = table[q[1]];
+        out[2] = table[q[2]];
+        out[3] = (u8)q[3];
+    }
+}
+
+void mip_box_sse4_row(const f32 *row0, const f32 *row1, i32 sw, f32 *out, i32 begin, i32 end)
+{
+    const __m128 quarter = _mm_set1_ps(0.25f);
+    for (i32 x = begin; x < end; x++) {
+        i32 x0 = x * 2 * 4;
+        i32 x1 = std::min(x * 2 + 1, sw - 1) * 4;
+        __m128 sum = _mm_add_ps(_mm_add_ps(_mm_loadu_ps(row0 + x0), _mm_loadu_ps(row0 + x1)), _mm_add_ps(_mm_loadu_ps(row1 + x0), _mm_loadu_ps(row1 + x1)));
+        _mm_storeu_ps(out + x * 4, _mm_mul_ps(sum, quarter));
+    }
+}
+
+void mip_box_sse4(const f32 *src, i32 sw, i32 sh, f32 *dst, i32 dw, i32 dh)
+{
+    for (i32 y = 0; y < dh; y++) {
+        const f32 *row0 = src + u64(y * 2) * sw * 4;
+        const f32 *row1 = src + u64(std::min(y * 2 + 1, sh - 1)) * sw * 4;
+        mip_box_sse4_row(row0, row1, sw, dst + u64(y) * dw * 4, 0, dw);
+    }
+}
+
+void mip_kaiser_h_sse4_range(const f32 *row, i32 sw, f32 *out, i32 begin, i32 end)
+{
+    const f32 *weights = mip_get_tables().kaiser;
+    for (i32 x = begin; x < end; x++) {
+        __m128 acc = _mm_setzero_ps();
+        for (i32 k = 0; k < MIP_KAISER_TAPS; k++) {
+            i32 sx = std::clamp(x * 2 - 3 + k, 0, sw - 1);
+            acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(weights[k]), _mm_loadu_ps(row + sx * 4)));
+        }
+        _mm_storeu_ps(out + x * 4, acc);
+    }
+}
+
+void mip_kaiser_h_sse4(const f32 *src, i32 sw, i32 sh, f32 *dst, i32 dw)
+{
+    for (i32 y = 0; y < sh; y++) {
+        mip_kaiser_h_sse4_range(src + u64(y) * sw * 4, sw, dst + u64(y) * dw * 4, 0, dw);
+    }
+}
+
+void mip_kaiser_v_sse4(const f32 *src, i32 w, i32 sh, f32 *dst, i32 dh)
+{
+    const f32 *weights = mip_get_tables().kaiser;
+    u64 row_floats = u64(w) * 4;
+    for (i32 y = 0; y < dh; y++) {
+        const f32 *rows[MIP_KAISER_TAPS];
+        for (i32 k = 0; k < MIP_KAISER_TAPS; k++) {
+            rows[k] = src + std::clamp(y * 2 - 3 + k, 0, sh - 1) * row_floats;
+        }
+
+        /// @note(ame): rows are whole pixels, so always a multiple of 4 floats
+        f32 *out = dst + y * row_floats;
+        for (u64 i = 0; i < row_floats; i += 4) {
+            __m128 acc = _mm_setzero_ps();
+            for (i32 k = 0; k < MIP_KAISER_TAPS; k++) {
+                acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(weights[k]), _mm_loadu_ps(rows[k] + i)));
+            }
+            _mm_storeu_ps(out + i, acc);
+        }
+    }
+}
+
+/// @note(ame): AVX2. Two RGBA pixels per __m256. Kept out of line like the gltf index decoders.
+
+void mip_decode_avx2(const u8 *src, f32 *dst, u64 count, const f32 *table)
+{
+    const __m256i alpha_offset = _mm256_setr_epi32(0, 0, 0, 256, 0, 0, 0, 256);
+
+    u64 i = 0;
+    for (; i + 2 <= count; i += 2) {
+        __m256i indices = _mm256_add_epi32(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + i * 4))), alpha_offset);
+        __m256 v = _mm256_i32gather_ps(table, indices, 4);
+        __m256 premultiplied = _mm256_mul_ps(v, _mm256_permute_ps(v, _MM_SHUFFLE(3, 3, 3, 3)));
+        _mm256_storeu_ps(dst + i * 4, _mm256_blend_ps(premultiplied, v, 0x88));
+    }
+    mip_decode_sse4(src + i * 4, dst + i * 4, count - i, table);
+}
+
+void mip_encode_avx2(const f32 *src, u8 *dst, u64 count, const u8 *table)
+{
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 scale = _mm256_setr_ps(4095.0f, 4095.0f, 4095.0f, 255.0f, 4095.0f, 4095.0f, 4095.0f, 255.0f);
+
+    alignas(32) i32 q[8];
+    u64 i = 0;
+    for (; i + 2 <= count; i += 2) {
+        __m256 v = _mm256_loadu_ps(src + i * 4);
+        __m256 a = _mm256_permute_ps(v, _MM_SHUFFLE(3, 3, 3, 3));
+        __m256 color = _mm256_and_ps(_mm256_div_ps(v, a), _mm256_cmp_ps(a, zero, _CMP_GT_OQ));
+        color = _mm256_blend_ps(color, v, 0x88);
+        color = _mm256_min_ps(_mm256_max_ps(color, zero), one);
+        _mm256_store_si256(reinterpret_cast<__m256i*>(q), _mm256_cvtps_epi32(_mm256_mul_ps(color, scale)));
+
+        u8 *out = dst + i * 4;
+        out[0] = table[q[0]];
+        out[1] = table[q[1]];
+        out[2] = table[q[2]];
+        out[3] = (u8)q[3];
+        out[4] = table[q[4]];
+        out[5] = table[q[5]];
+        out[6] = table[q[6]];
+        out[7] = (u8)q[7];
+    }
+    mip_encode_sse4(src + i * 4, dst + i * 4, count - i, table);
+}
+
+void mip_box_avx2(const f32 *src, i32 sw, i32 sh, f32 *dst, i32 dw, i32 dh)
+{
+    const __m256 quarter = _mm256_set1_ps(0.25f);
+    for (i32 y = 0; y < dh; y++) {
+        const f32 *row0 = src + u64(y * 2) * sw * 4;
+        const f32 *row1 = src + u64(std::min(y * 2 + 1, sh - 1)) * sw * 4;
+        f32 *out = dst + u64(y) * dw * 4;
+
+        /// @note(ame): two destination pixels read four source pixels per row, the odd column at the edge goes through SSE
+        i32 x = 0;
+        for (; x + 1 < dw && x * 2 + 3 < sw; x += 2) {
+            __m256 a = _mm256_add_ps(_mm256_loadu_ps(row0 + x * 8), _mm256_loadu_ps(row1 + x * 8));
+            __m256 b = _mm256_add_ps(_mm256_loadu_ps(row0 + x * 8 + 8), _mm256_loadu_ps(row1 + x * 8 + 8));
+            __m256 sum = _mm256_add_ps(_mm256_permute2f128_ps(a, b, 0x20), _mm256_permute2f128_ps(a, b, 0x31));
+            _mm256_storeu_ps(out + x * 4, _mm256_mul_ps(sum, quarter));
+        }
+        mip_box_sse4_row(row0, row1, sw, out, x, dw);
+    }
+}
+
+void mip_kaiser_h_avx2(const f32 *src, i32 sw, i32 sh, f32 *dst, i32 dw)
+{
+    const f32 *weights = mip_get_tables().kaiser;
+    for (i32 y = 0; y < sh; y++) {
+        const f32 *row = src + u64(y) * sw * 4;
+        f32 *out = dst + u64(y) * dw * 4;
+
+        /// @note(ame): the left edge needs clamping, so does anything reading past sw - 1
+        i32 begin = std::min(2, dw);
+        mip_kaiser_h_sse4_range(row, sw, out, 0, begin);
+
+        i32 x = begin;
+        for (; x + 1 < dw && x * 2 + 6 < sw; x += 2) {
+            __m256 acc = _mm256_setzero_ps();
+            for (i32 k = 0; k < MIP_KAISER_TAPS; k++) {
+                i32 sx = x * 2 - 3 + k;
+                __m256 v = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(row + sx * 4)), _mm_loadu_ps(row + (sx + 2) * 4), 1);
+                acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_set1_ps(weights[k]), v));
+            }
+            _mm256_storeu_ps(out + x * 4, acc);
+        }
+        mip_kaiser_h_sse4_range(row, sw, out, x, dw);
+    }
+}
+
+void mip_kaiser_v_avx2(const f32 *src, i32 w, i32 sh, f32 *dst, i32 dh)
+{
+    const f32 *weights = mip_get_tables().kaiser;
+    u64 row_floats = u64(w) * 4;
+    for (i32 y = 0; y < dh; y++) {
+        const f32 *rows[MIP_KAISER_TAPS];
+        for (i32 k = 0; k < MIP_KAISER_TAPS; k++) {
+            rows[k] = src + std::clamp(y * 2 - 3 + k, 0, sh - 1) * row_floats;
+        }
+
+        f32 *out = dst + y * row_floats;
+        u64 i = 0;
+        for (; i + 8 <= row_floats; i += 8) {
+            __m256 acc = _mm256_setzero_ps();
+            for (i32 k = 0; k < MIP_KAISER_TAPS; k++) {
+                acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_set1_ps(weights[k]), _mm256_loadu_ps(rows[k] + i)));
+            }
+            _mm256_storeu_ps(out + i, acc);
+        }
+        if (i < row_floats) {
+            __m128 acc = _mm_setzero_ps();
+            for (i32 k = 0; k < MIP_KAISER_TAPS; k++) {
+                acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(weights[k]), _mm_loadu_ps(rows[k] + i)));
+            }
+            _mm_storeu_ps(out + i, acc);
+        }
+    }
+}
+
+struct mip_kernels
+{
+    void (*decode)(const u8*, f32*, u64, const f32*);
+    void (*encode)(const f32*, u8*, u64, const u8*);
+    void (*box)(const f32*, i32, i32, f32*, i32, i32);
+    void (*kaiser_h)(const f32*, i32, i32, f32*, i32);
+    void (*kaiser_v)(const f32*, i32, i32, f32*, i32);
+};
+
+mip_kernels mip_select_kernels(mip_isa isa)
+{
+    if (isa == MipIsa_Auto) {
+        const cpu_features& features = wn_cpu_features();
+        isa = features.avx2 ? MipIsa_AVX2 : (features.sse41 ? MipIsa_SSE4 : MipIsa_Scalar);
+    }
+
+    switch (isa) {
+        case MipIsa_AVX2: {
+            return { mip_decode_avx2, mip_encode_avx2, mip_box_avx2, mip_kaiser_h_avx2, mip_kaiser_v_avx2 };
+        }
+        case MipIsa_SSE4: {
+            return { mip_decode_sse4, mip_encode_sse4, mip_box_sse4, mip_kaiser_h_sse4, mip_kaiser_v_sse4 };
+        }
+        default: {
+            return { mip_decode_scalar, mip_encode_scalar, mip_box_scalar, mip_kaiser_h_scalar, mip_kaiser_v_scalar };
+        }
+    }
+}
+
+i32 mip_level_count(i32 width, i32 height)
+{
+    i32 levels = 1;
+    i32 size = std::max(width, height);
+    while (size > 1) {
+        size >>= 1;
+        levels++;
+    }
+    return levels;
+}
+
+i32 mip_level_width(const mip_chain *chain, i32 level)
+{
+    return std::max(chain->width >> level, 1);
+}
+
+i32 mip_level_height(const mip_chain *chain, i32 level)
+{
+    return std::max(chain->height >> level, 1);
+}
+
+const u8 *mip_level_data(const mip_chain *chain, i32 level)
+{
+    return chain->pixels.data() + chain->offsets[level];
+}
+
+void mip_chain_build(mip_chain *chain, const u8 *rgba, i32 width, i32 height, mip_filter filter, bool srgb, mip_isa isa)
+{
+    const mip_tables& tables = mip_get_tables();
+    const f32 *decode_table = srgb ? tables.srgb_decode : tables.unorm_decode;
+    const u8 *encode_table = srgb ? tables.srgb_encode : tables.unorm_encode;
+    mip_kernels kernels = mip_select_kernels(isa);
+
+    chain->width = width;
+    chain->height = height;
+    chain->levels = mip_level_count(width, height);
+    chain->offsets.resize(chain->levels);
+
+    u64 total = 0;
+    for (i32 i = 0; i < chain->levels; i++) {
+        chain->offsets[i] = total;
+        total += u64(mip_level_width(chain, i)) * mip_level_height(chain, i) * 4;
+    }
+    chain->pixels.resize(total);
+    memcpy(chain->pixels.data(), rgba, u64(width) * height * 4);
+
+    if (chain->levels == 1) {
+        return;
+    }
+
+    /// @note(ame): the chain is filtered in linear premultiplied floats, and only goes back to 8 bits for storage.
+    /// Level 0 is never converted as a whole: at 4K that's 256MB of floats, and building it costs more than the filtering.
+    /// Source rows are decoded a few at a time and fed straight to the first downsample.
+    std::vector<f32> current;
+    std::vector<f32> next;
+    std::vector<f32> scratch;
+    std::vector<f32> rows(u64(width) * 2 * 4);
+
+    i32 sw = mip_level_width(chain, 1);
+    i32 sh = mip_level_height(chain, 1);
+    current.resize(u64(sw) * sh * 4);
+    if (filter == MipFilter_Kaiser) {
+        scratch.resize(u64(sw) * height * 4);
+        for (i32 y = 0; y < height; y++) {
+            kernels.decode(rgba + u64(y) * width * 4, rows.data(), width, decode_table);
+            kernels.kaiser_h(rows.data(), width, 1, scratch.data() + u64(y) * sw * 4, sw);
+        }
+        kernels.kaiser_v(scratch.data(), sw, height, current.data(), sh);
+    } else {
+        for (i32 y = 0; y < sh; y++) {
+            i32 row_count = std::min(2, height - y * 2);
+            kernels.decode(rgba + u64(y * 2) * width * 4, rows.data(), u64(width) * row_count, decode_table);
+            kernels.box(rows.data(), width, row_count, current.data() + u64(y) * sw * 4, sw, 1);
+        }
+    }
+    kernels.encode(current.data(), chain->pixels.data() + chain->offsets[1], u64(sw) * sh, encode_table);
+
+    for (i32 level = 2; level < chain->levels; level++) {
+        i32 dw = mip_level_width(chain, level);
+        i32 dh = mip_level_height(chain, level);
+        next.resize(u64(dw) * dh * 4);
+
+        if (filter == MipFilter_Kaiser) {
+            scratch.resize(u64(dw) * sh * 4);
+            kernels.kaiser_h(current.data(), sw, sh, scratch.data(), dw);
+            kernels.kaiser_v(scratch.data(), dw, sh, next.data(), dh);
+        } else {
+            kernels.box(current.data(), sw, sh, next.data(), dw, dh);
+        }
+        kernels.encode(next.data(), chain->pixels.data() + chain->offsets[level], u64(dw) * dh, encode_table);
+
+        std::swap(current, next);
+        sw = dw;
+        sh = dh;
+    }
+}
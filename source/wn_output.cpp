@@ -12,9 +12,13 @@
 #include <ctime>
 #include <iostream>
 #include <cstdarg>
+#include <mutex>
 
 #include <Windows.h>
 
+/// @note(ame): jobs log from worker threads, and the console stream isn't thread safe
+std::mutex log_lock;
+
 void throw_error(const std::string& message)
 {
     MessageBoxA(nullptr, message.c_str(), "WHITE NOISE ERROR", MB_OK | MB_ICONERROR);
@@ -31,6 +35,8 @@ void log(const char* msg, ...)
     vsnprintf(buf, sizeof(buf), msg, vl);
     va_end(vl);
     ss << buf << std::endl;
+
+    std::unique_lock<std::mutex> lock(log_lock);
     std::cout << ss.str();
 
     dev_console_add_log(ss.str().c_str());
@@ -0,0 +1,690 @@
+//
+// $Notice: Xander Studios @ 2024
+// $Author: Amélie Heinrich
+// $Create Time: 2024-11-23 17:44:30
+//
+
+#include <filesystem>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+
+#include "wn_pak.h"
+#include "wn_asset_cache.h"
+#include "wn_dev_console.h"
+#include "wn_output.h"
+#include "wn_timer.h"
+#include "wn_util.h"
+#include "wn_job.h"
+
+#define PAK_HASH_LOG 12
+#define PAK_MIN_MATCH 4
+#define PAK_LAST_LITERALS 5
+#define PAK_MF_LIMIT 12
+#define PAK_MAX_OFFSET 65535
+#define PAK_BUILD_BATCH 64
+
+pak_registry paks;
+
+std::string pak_normalize(const std::string& path)
+{
+    std::string result = path;
+    std::replace(result.begin(), result.end(), '\\', '/');
+    while (result.compare(0, 2, "./") == 0) {
+        result.erase(0, 2);
+    }
+    return result;
+}
+
+u64 pak_hash(const std::string& path)
+{
+    std::string normalized = pak_normalize(path);
+    return wn_hash(normalized.data(), normalized.size(), 1000);
+}
+
+/// @note(ame): COMPRESSION
+/// Greedy LZ4 block format: [token][literal length+][literals][offset:u16][match length+], repeat, the last
+/// sequence is literals only. A single hash table of the previous position of every 4 byte sequence, no chains.
+
+u32 pak_read32(const u8 *p)
+{
+    u32 value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+u8 *pak_write_length(u8 *op, u64 length)
+{
+    while (length >= 255) {
+        *op++ = 255;
+        length -= 255;
+    }
+    *op++ = (u8)length;
+    return op;
+}
+
+u64 pak_compress(const u8 *src, u64 size, u8 *dst, u64 capacity)
+{
+    u32 table[1 << PAK_HASH_LOG] = {};
+
+    const u8 *ip = src;
+    const u8 *anchor = src;
+    const u8 *end = src + size;
+    u8 *op = dst;
+    u8 *oend = dst + capacity;
+
+    if (size > PAK_MF_LIMIT) {
+        const u8 *match_limit = end - PAK_LAST_LITERALS;
+        const u8 *input_limit = end - PAK_MF_LIMIT;
+
+        while (ip < input_limit) {
+            u32 sequence = pak_read32(ip);
+            u32 h = (sequence * 2654435761u) >> (32 - PAK_HASH_LOG);
+            const u8 *ref = src + table[h];
+            table[h] = (u32)(ip - src);
+
+            if (ref >= ip || ip - ref > PAK_MAX_OFFSET || pak_read32(ref) != sequence) {
+                ip++;
+                continue;
+            }
+
+            /// @note(ame): grow the match backwards into the pending literals
+            while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+
+            const u8 *match = ip + PAK_MIN_MATCH;
+            const u8 *match_ref = ref + PAK_MIN_MATCH;
+            while (match < match_limit && *match == *match_ref) {
+                match++;
+                match_ref++;
+            }
+
+            u64 literals = ip - anchor;
+            u64 match_length = match - ip - PAK_MIN_MATCH;
+            if ((u64)(oend - op) < 1 + literals + literals / 255 + 1 + 2 + match_length / 255 + 1) {
+                return 0;
+            }
+
+            u8 *token = op++;
+            if (literals >= 15) {
+                *token = 15 << 4;
+                op = pak_write_length(op, literals - 15);
+            } else {
+                *token = (u8)(literals << 4);
+            }
+            memcpy(op, anchor, literals);
+            op += literals;
+
+            u64 offset = ip - ref;
+            op[0] = (u8)(offset & 0xFF);
+            op[1] = (u8)(offset >> 8);
+            op += 2;
+
+            if (match_length >= 15) {
+                *token |= 15;
+                op = pak_write_length(op, match_length - 15);
+            } else {
+                *token |= (u8)match_length;
+            }
+
+            ip = match;
+            anchor = ip;
+        }
+    }
+
+    u64 literals = end - anchor;
+    if ((u64)(oend - op) < 1 + literals + literals / 255 + 1) {
+        return 0;
+    }
+    u8 *token = op++;
+    if (literals >= 15) {
+        *token = 15 << 4;
+        op = pak_write_length(op, literals - 15);
+    } else {
+        *token = (u8)(literals << 4);
+    }
+    if (literals) {
+        memcpy(op, anchor, literals);
+        op += literals;
+    }
+
+    return op - dst;
+}
+
+bool pak_decompress(const u8 *src, u64 size, u8 *dst, u64 dst_size)
+{
+    const u8 *ip = src;
+    const u8 *iend = src + size;
+    u8 *op = dst;
+    u8 *oend = dst + dst_size;
+
+    while (ip < iend) {
+        u8 token = *ip++;
+
+        u64 literals = token >> 4;
+        if (literals == 15) {
+            u8 b;
+            do {
+                if (ip >= iend) {
+                    return false;
+                }
+                b = *ip++;
+                literals += b;
+            } while (b == 255);
+        }
+        if (literals > (u64)(iend - ip) || literals > (u64)(oend - op)) {
+            return false;
+        }
+        if (literals) {
+            memcpy(op, ip, literals);
+            op += literals;
+            ip += literals;
+        }
+
+        /// @note(ame): the last sequence has no match
+        if (ip >= iend) {
+            break;
+        }
+
+        if (iend - ip < 2) {
+            return false;
+        }
+        u64 offset = ip[0] | (u64(ip[1]) << 8);
+        ip += 2;
+        if (offset == 0 || offset > (u64)(op - dst)) {
+            return false;
+        }
+
+        u64 match_length = token & 15;
+        if (match_length == 15) {
+            u8 b;
+            do {
+                if (ip >= iend) {
+                    return false;
+                }
+                b = *ip++;
+                match_length += b;
+            } while (b == 255);
+        }
+        match_length += PAK_MIN_MATCH;
+        if (match_length > (u64)(oend - op)) {
+            return false;
+        }
+
+        const u8 *match = op - offset;
+        if (offset >= match_length) {
+            memcpy(op, match, match_length);
+            op += match_length;
+        } else {
+            /// @note(ame): overlapping copy, repeats the last `offset` bytes
+            for (u64 i = 0; i < match_length; i++) {
+                *op++ = *match++;
+            }
+        }
+    }
+    return op == oend;
+}
+
+/// @note(ame): MOUNTING
+
+bool pak_mount(const std::string& path)
+{
+    pak_archive *archive = new pak_archive;
+    archive->path = path;
+    if (!fs_map(&archive->file, path)) {
+        log("[pak] failed to open %s", path.c_str());
+        delete archive;
+        return false;
+    }
+
+    const fs_mapped_file& file = archive->file;
+    archive->header = reinterpret_cast<const pak_header*>(file.data);
+    bool valid = file.size >= sizeof(pak_header)
+              && archive->header->magic == PAK_MAGIC
+              && archive->header->version == PAK_VERSION
+              && archive->header->chunks_offset + u64(archive->header->chunk_count) * sizeof(pak_chunk) <= file.size
+              && archive->header->entries_offset + u64(archive->header->entry_count) * sizeof(pak_entry) <= file.size
+              && archive->header->strings_offset + archive->header->string_size <= file.size;
+    if (!valid) {
+        log("[pak] %s is not a valid v%d archive", path.c_str(), PAK_VERSION);
+        fs_unmap(&archive->file);
+        delete archive;
+        return false;
+    }
+
+    archive->chunks = reinterpret_cast<const pak_chunk*>(file.data + archive->header->chunks_offset);
+    archive->entries = reinterpret_cast<const pak_entry*>(file.data + archive->header->entries_offset);
+    archive->strings = reinterpret_cast<const char*>(file.data + archive->header->strings_offset);
+
+    {
+        std::unique_lock<std::shared_mutex> lock(paks.lock);
+        paks.mounts.push_back(archive);
+    }
+
+    log("[pak] mounted %s (%u entries, %.2f MB)", path.c_str(), archive->header->entry_count, file.size / (1024.0 * 1024.0));
+    return true;
+}
+
+void pak_mount_directory(const std::string& directory)
+{
+    if (!fs_isdir(directory)) {
+        return;
+    }
+
+    std::vector<std::string> found;
+    for (const auto& dir_entry : std::filesystem::directory_iterator(directory)) {
+        if (dir_entry.is_regular_file() && dir_entry.path().extension() == ".wnpak") {
+            found.push_back(pak_normalize(dir_entry.path().string()));
+        }
+    }
+
+    /// @note(ame): mount in name order so patches (later names) override the base archives
+    std::sort(found.begin(), found.end());
+    for (auto& path : found) {
+        pak_mount(path);
+    }
+}
+
+bool pak_unmount(const std::string& path)
+{
+    std::unique_lock<std::shared_mutex> lock(paks.lock);
+    for (auto it = paks.mounts.begin(); it != paks.mounts.end(); ++it) {
+        if ((*it)->path == path) {
+            fs_unmap(&(*it)->file);
+            delete *it;
+            paks.mounts.erase(it);
+            return true;
+        }
+    }
+    return false;
+}
+
+void pak_unmount_all()
+{
+    std::unique_lock<std::shared_mutex> lock(paks.lock);
+    for (auto *archive : paks.mounts) {
+        fs_unmap(&archive->file);
+        delete archive;
+    }
+    paks.mounts.clear();
+}
+
+/// @note(ame): caller holds the lock
+const pak_entry *pak_find_locked(const std::string& path, pak_archive **archive)
+{
+    if (paks.mounts.empty()) {
+        return nullptr;
+    }
+
+    std::string normalized = pak_normalize(path);
+    u64 hash = wn_hash(normalized.data(), normalized.size(), 1000);
+
+    for (auto it = paks.mounts.rbegin(); it != paks.mounts.rend(); ++it) {
+        pak_archive *mount = *it;
+        const pak_entry *begin = mount->entries;
+        const pak_entry *end = mount->entries + mount->header->entry_count;
+
+        const pak_entry *entry = std::lower_bound(begin, end, hash, [](const pak_entry& e, u64 h) {
+            return e.hash < h;
+        });
+        for (; entry != end && entry->hash == hash; entry++) {
+            if (normalized == mount->strings + entry->name) {
+                *archive = mount;
+                return entry;
+            }
+        }
+    }
+    return nullptr;
+}
+
+const pak_entry *pak_find(const std::string& path, pak_archive **archive)
+{
+    std::shared_lock<std::shared_mutex> lock(paks.lock);
+    return pak_find_locked(path, archive);
+}
+
+bool pak_stat(const std::string& path, pak_entry *out)
+{
+    std::shared_lock<std::shared_mutex> lock(paks.lock);
+    pak_archive *archive;
+    const pak_entry *entry = pak_find_locked(path, &archive);
+    if (!entry) {
+        return false;
+    }
+    *out = *entry;
+    return true;
+}
+
+bool pak_open(const std::string& path, fs_mapped_file *file, bool *mapped)
+{
+    /// @note(ame): decompressed entries are copies, raw ones are views and pak_unmount already wants those gone first
+    std::shared_lock<std::shared_mutex> lock(paks.lock);
+    pak_archive *archive;
+    const pak_entry *entry = pak_find_locked(path, &archive);
+    if (!entry) {
+        return false;
+    }
+    *mapped = pak_map(archive, entry, file);
+    return true;
+}
+
+bool pak_read(pak_archive *archive, const pak_entry *entry, u64 offset, u64 size, u8 *out)
+{
+    if (offset + size > entry->size) {
+        return false;
+    }
+
+    const u8 *base = archive->file.data;
+    if (!(entry->flags & PakFlag_Compressed)) {
+        memcpy(out, base + entry->offset + offset, size);
+        return true;
+    }
+
+    thread_local std::vector<u8> scratch(PAK_CHUNK_SIZE);
+
+    /// @note(ame): only the chunks overlapping [offset, offset + size) get decoded
+    u64 chunk_size = archive->header->chunk_size;
+    u64 first = offset / chunk_size;
+    u64 last = size ? (offset + size - 1) / chunk_size : first;
+    for (u64 i = first; i <= last && size > 0; i++) {
+        const pak_chunk& chunk = archive->chunks[entry->first_chunk + i];
+        u64 chunk_start = i * chunk_size;
+        u64 chunk_bytes = std::min(chunk_size, entry->size - chunk_start);
+
+        u64 from = std::max(offset, chunk_start) - chunk_start;
+        u64 to = std::min(offset + size, chunk_start + chunk_bytes) - chunk_start;
+        u8 *dst = out + (chunk_start + from - offset);
+
+        if (!(chunk.flags & PakFlag_Compressed)) {
+            memcpy(dst, base + chunk.offset + from, to - from);
+            continue;
+        }
+
+        /// @note(ame): whole chunk wanted, decode in place
+        if (from == 0 && to == chunk_bytes) {
+            if (!pak_decompress(base + chunk.offset, chunk.stored_size, dst, chunk_bytes)) {
+                return false;
+            }
+            continue;
+        }
+
+        if (scratch.size() < chunk_bytes) {
+            scratch.resize(chunk_bytes);
+        }
+        if (!pak_decompress(base + chunk.offset, chunk.stored_size, scratch.data(), chunk_bytes)) {
+            return false;
+        }
+        memcpy(dst, scratch.data() + from, to - from);
+    }
+    return true;
+}
+
+bool pak_map(pak_archive *archive, const pak_entry *entry, fs_mapped_file *file)
+{
+    *file = {};
+    file->packed = true;
+    file->size = entry->size;
+    if (entry->size == 0) {
+        return true;
+    }
+
+    if (!(entry->flags & PakFlag_Compressed)) {
+        file->data = archive->file.data + entry->offset;
+        return true;
+    }
+
+    file->owned = new u8[entry->size];
+    if (!pak_read(archive, entry, 0, entry->size, file->owned)) {
+        log("[pak] %s: corrupted entry %s", archive->path.c_str(), archive->strings + entry->name);
+        delete[] file->owned;
+        *file = {};
+        return false;
+    }
+    file->data = file->owned;
+    return true;
+}
+
+/// @note(ame): PACKER
+
+struct pak_build_item
+{
+    std::string path;
+    u64 hash;
+
+    std::vector<u8> raw;
+    std::vector<u8> stored; /// @note(ame): compressed chunks back to back, empty when stored raw
+    std::vector<u32> chunk_sizes;
+    std::vector<u32> chunk_flags;
+    bool failed;
+};
+
+/// @note(ame): straight from disk, the archive being rebuilt may well be mounted
+bool pak_read_loose(const std::string& path, std::vector<u8> *out)
+{
+    FILE *f = fopen(path.c_str(), "rb");
+    if (!f) {
+        return false;
+    }
+    out->resize(std::filesystem::file_size(path));
+    bool ok = out->empty() || fread(out->data(), out->size(), 1, f) == 1;
+    fclose(f);
+    return ok;
+}
+
+void pak_build_compress(pak_build_item *item)
+{
+    u64 size = item->raw.size();
+    u64 chunk_count = (size + PAK_CHUNK_SIZE - 1) / PAK_CHUNK_SIZE;
+
+    std::vector<u8> buffer(PAK_CHUNK_SIZE);
+    item->stored.reserve(size);
+    for (u64 i = 0; i < chunk_count; i++) {
+        const u8 *chunk = item->raw.data() + i * PAK_CHUNK_SIZE;
+        u64 chunk_bytes = std::min<u64>(PAK_CHUNK_SIZE, size - i * PAK_CHUNK_SIZE);
+
+        /// @note(ame): only keep the compressed chunk if it saves something, pak_read copies raw chunks
+        u64 compressed = pak_compress(chunk, chunk_bytes, buffer.data(), chunk_bytes - 1);
+        if (compressed) {
+            item->stored.insert(item->stored.end(), buffer.data(), buffer.data() + compressed);
+            item->chunk_sizes.push_back((u32)compressed);
+            item->chunk_flags.push_back(PakFlag_Compressed);
+        } else {
+            item->stored.insert(item->stored.end(), chunk, chunk + chunk_bytes);
+            item->chunk_sizes.push_back((u32)chunk_bytes);
+            item->chunk_flags.push_back(0);
+        }
+    }
+
+    /// @note(ame): not worth it under ~10%, store raw so the file can be mapped in place
+    if (item->stored.size() * 10 > size * 9) {
+        item->stored.clear();
+        item->chunk_sizes.clear();
+        item->chunk_flags.clear();
+    }
+}
+
+u64 pak_write_padding(FILE *f, u64 offset, u64 alignment)
+{
+    static const u8 zeroes[std::max(PAK_RAW_ALIGNMENT, PAK_CHUNK_ALIGNMENT)] = {};
+
+    u64 aligned = (offset + alignment - 1) & ~(alignment - 1);
+    if (aligned != offset) {
+        fwrite(zeroes, aligned - offset, 1, f);
+    }
+    return aligned;
+}
+
+bool pak_build(const std::string& directory, const std::string& output, bool compress)
+{
+    timer t;
+    timer_init(&t);
+
+    std::vector<std::string> files;
+    for (const auto& dir_entry : std::filesystem::recursive_directory_iterator(directory)) {
+        if (!dir_entry.is_regular_file()) {
+            continue;
+        }
+
+        std::string path = pak_normalize(dir_entry.path().string());
+        std::string extension = dir_entry.path().extension().string();
+        /// @note(ame): writable state and half written files stay loose
+        if (extension == ".tmp" || extension == ".wnpak" || path == ASSET_CACHE_MANIFEST) {
+            continue;
+        }
+        files.push_back(path);
+    }
+    /// @note(ame): data goes in path order so files of the same folder end up next to each other
+    std::sort(files.begin(), files.end());
+
+    std::string temp = output + ".tmp";
+    FILE *f = fopen(temp.c_str(), "wb");
+    if (!f) {
+        log("[pak] failed to create %s", temp.c_str());
+        return false;
+    }
+
+    pak_header header = {};
+    fwrite(&header, sizeof(header), 1, f);
+    u64 offset = sizeof(header);
+
+    std::vector<pak_entry> entries;
+    std::vector<pak_chunk> chunks;
+    std::string strings;
+    u64 raw_bytes = 0;
+    u64 failed = 0;
+
+    /// @note(ame): read + compress a batch on the job system, then append it in order
+    for (u64 batch = 0; batch < files.size(); batch += PAK_BUILD_BATCH) {
+        u64 count = std::min<u64>(PAK_BUILD_BATCH, files.size() - batch);
+        std::vector<pak_build_item> items(count);
+
+        job_parallel_for((u32)count, [&](u32 i) {
+            pak_build_item *item = &items[i];
+            item->path = files[batch + i];
+            item->hash = pak_hash(item->path);
+            item->failed = !pak_read_loose(item->path, &item->raw);
+            if (!item->failed && compress) {
+                pak_build_compress(item);
+            }
+        });
+
+        for (auto& item : items) {
+            if (item.failed) {
+                log("[pak] failed to read %s, skipping", item.path.c_str());
+                failed++;
+                continue;
+            }
+
+            pak_entry entry = {};
+            entry.hash = item.hash;
+            entry.content_hash = wn_hash(item.raw.data(), item.raw.size(), 1000);
+            entry.size = item.raw.size();
+            entry.name = (u32)strings.size();
+            strings.append(item.path);
+            strings.push_back('\0');
+
+            if (!item.stored.empty()) {
+                offset = pak_write_padding(f, offset, PAK_CHUNK_ALIGNMENT);
+                entry.flags = PakFlag_Compressed;
+                entry.first_chunk = (u32)chunks.size();
+                entry.chunk_count = (u32)item.chunk_sizes.size();
+
+                u64 chunk_offset = offset;
+                for (u64 i = 0; i < item.chunk_sizes.size(); i++) {
+                    chunks.push_back({ chunk_offset, item.chunk_sizes[i], item.chunk_flags[i] });
+                    chunk_offset += item.chunk_sizes[i];
+                }
+                fwrite(item.stored.data(), item.stored.size(), 1, f);
+                offset += item.stored.size();
+            } else {
+                offset = pak_write_padding(f, offset, PAK_RAW_ALIGNMENT);
+                entry.offset = offset;
+                if (!item.raw.empty()) {
+                    fwrite(item.raw.data(), item.raw.size(), 1, f);
+                }
+                offset += item.raw.size();
+            }
+
+            raw_bytes += item.raw.size();
+            entries.push_back(entry);
+        }
+    }
+
+    std::sort(entries.begin(), entries.end(), [](const pak_entry& a, const pak_entry& b) {
+        return a.hash < b.hash;
+    });
+
+    offset = pak_write_padding(f, offset, PAK_CHUNK_ALIGNMENT);
+    header.chunks_offset = offset;
+    fwrite(chunks.data(), sizeof(pak_chunk), chunks.size(), f);
+    offset += chunks.size() * sizeof(pak_chunk);
+
+    offset = pak_write_padding(f, offset, PAK_CHUNK_ALIGNMENT);
+    header.entries_offset = offset;
+    fwrite(entries.data(), sizeof(pak_entry), entries.size(), f);
+    offset += entries.size() * sizeof(pak_entry);
+
+    header.strings_offset = offset;
+    fwrite(strings.data(), strings.size(), 1, f);
+    offset += strings.size();
+
+    header.magic = PAK_MAGIC;
+    header.version = PAK_VERSION;
+    header.entry_count = (u32)entries.size();
+    header.chunk_count = (u32)chunks.size();
+    header.chunk_size = PAK_CHUNK_SIZE;
+    header.string_size = (u32)strings.size();
+    fseek(f, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, f);
+
+    /// @note(ame): a full disk shows up as a short fwrite or a failed fclose, don't let that replace a good archive
+    bool written = ferror(f) == 0;
+    written = fclose(f) == 0 && written;
+    if (!written) {
+        log("[pak] failed to write %s", temp.c_str());
+        fs_delete(temp);
+        return false;
+    }
+
+    if (!fs_rename(temp, output)) {
+        log("[pak] failed to write %s", output.c_str());
+        fs_delete(temp);
+        return false;
+    }
+
+    log("[pak] packed %u files of %s into %s: %.2f MB -> %.2f MB (%.1f%%), %llu failed, %.2f s", (u32)entries.size(), directory.c_str(), output.c_str(), raw_bytes / (1024.0 * 1024.0), offset / (1024.0 * 1024.0), raw_bytes ? offset * 100.0 / raw_bytes : 100.0, failed, TIMER_SECONDS(timer_elasped(&t)));
+    return true;
+}
+
+void pak_init()
+{
+    /// @note(ame): pak_build <directory> <output.wnpak> [raw]
+    dev_console_add_command("pak_build", [](std::vector<std::string> args) {
+        if (args.size() < 3) {
+            log("[pak] usage: pak_build <directory> <output.wnpak> [raw]");
+            return;
+        }
+        pak_build(args[1], args[2], !(args.size() > 3 && args[3] == "raw"));
+    });
+
+    dev_console_add_command("pak_mount", [](std::vector<std::string> args) {
+        if (args.size() < 2) {
+            log("[pak] usage: pak_mount <path.wnpak>");
+            return;
+        }
+        pak_mount(args[1]);
+    });
+
+    dev_console_add_command("pak_list", [](std::vector<std::string> args) {
+        std::shared_lock<std::shared_mutex> lock(paks.lock);
+        for (auto *archive : paks.mounts) {
+            u32 compressed = 0;
+            for (u32 i = 0; i < archive->header->entry_count; i++) {
+                compressed += (archive->entries[i].flags & PakFlag_Compressed) ? 1 : 0;
+            }
+            log("[pak] %s: %u entries (%u compressed, %u chunks), %.2f MB", archive->path.c_str(), archive->header->entry_count, compressed, archive->header->chunk_count, archive->file.size / (1024.0 * 1024.0));
+        }
+    });
+}
@@ -4,9 +4,18 @@
 // $Create Time: 2024-10-30 21:02:24
 //
 
+#include <algorithm>
+#include <random>
+
 #include "wn_physics.h"
 #include "wn_output.h"
 #include "wn_world.h"
+#include "wn_collision.h"
+#include "wn_cvar.h"
+#include "wn_dev_console.h"
+#include "wn_util.h"
+#include "wn_pak.h"
+#include "wn_physics_profiler.h"
 
 namespace Layers
 {
@@ -78,6 +87,8 @@ public:
             return inLayer2 == BroadPhaseLayers::MOVING;
         case Layers::MOVING:
             return true;
+        case Layers::CHARACTER:
+            return true;
         case Layers::TRIGGER:
             return inLayer2 == BroadPhaseLayers::MOVING;
         default:
@@ -109,6 +120,21 @@ public:
     }
 };
 
+u64 physics_pair_key(JPH::BodyID a, JPH::BodyID b)
+{
+    u64 x = a.GetIndexAndSequenceNumber();
+    u64 y = b.GetIndexAndSequenceNumber();
+    return x < y ? (x << 32) | y : (y << 32) | x;
+}
+
+void physics_contact_push(const physics_contact_event& event)
+{
+    if (!mpmc_queue_push(&physics.contact_queue.events, event)) {
+        physics.contact_queue.stats.dropped++;
+    }
+}
+
+/// @note(ame): called from the Jolt workers, see physics_contact_queue
 class MyContactListener : public JPH::ContactListener
 {
 public:
@@ -122,65 +148,37 @@ public:
 
     virtual void OnContactAdded(const JPH::Body& inBody1, const JPH::Body& inBody2, const JPH::ContactManifold& inManifold, JPH::ContactSettings& ioSettings) override
     {
-        if (inBody1.GetObjectLayer() == Layers::TRIGGER && inBody2.GetObjectLayer() == Layers::CHARACTER_GHOST) {
-            entity* ptr1 = reinterpret_cast<entity*>(inBody1.GetUserData());
-            entity* ptr2 = reinterpret_cast<entity*>(inBody2.GetUserData());
-
-            if (!ptr1 || !ptr2)
-                return;
-
-            if (ptr1->trigger.on_trigger_enter) {
-                ptr1->trigger.on_trigger_enter(ptr1, ptr2);
-            }
-        }
-
-        if (inBody1.GetObjectLayer() == Layers::CHARACTER_GHOST && inBody2.GetObjectLayer() == Layers::TRIGGER) {
-            entity* ptr1 = reinterpret_cast<entity*>(inBody1.GetUserData());
-            entity* ptr2 = reinterpret_cast<entity*>(inBody2.GetUserData());
-
-            if (!ptr1 || !ptr2)
-                return;
-
-            if (ptr2->trigger.on_trigger_enter) {
-                ptr2->trigger.on_trigger_enter(ptr2, ptr1);
-            }
-        }
+        physics_profile.contacts_added.fetch_add(1, std::memory_order_relaxed);
+        push_trigger_event(inBody1, inBody2, PhysicsContact_Enter);
     }
 
     virtual void OnContactPersisted(const JPH::Body& inBody1, const JPH::Body& inBody2, const JPH::ContactManifold& inManifold, JPH::ContactSettings& ioSettings) override
 	{
-		if (inBody1.GetObjectLayer() == Layers::TRIGGER && inBody2.GetObjectLayer() == Layers::CHARACTER_GHOST) {
-            entity* ptr1 = reinterpret_cast<entity*>(inBody1.GetUserData());
-            entity* ptr2 = reinterpret_cast<entity*>(inBody2.GetUserData());
+        physics_profile.contacts_persisted.fetch_add(1, std::memory_order_relaxed);
+        push_trigger_event(inBody1, inBody2, PhysicsContact_Stay);
+	}
 
-            if (!ptr1 || !ptr2)
-                return;
+    /// @note(ame): the bodies can't be touched from here, but only pairs we know are triggers get through
+    virtual void OnContactRemoved(const JPH::SubShapeIDPair &inSubShapePair) override
+    {
+        physics_profile.contacts_removed.fetch_add(1, std::memory_order_relaxed);
 
-            if (ptr1->trigger.on_trigger_stay) {
-                ptr1->trigger.on_trigger_stay(ptr1, ptr2);
-            }
+        JPH::BodyID body1 = inSubShapePair.GetBody1ID();
+        JPH::BodyID body2 = inSubShapePair.GetBody2ID();
+        if (physics.contact_queue.pairs.count(physics_pair_key(body1, body2))) {
+            physics_contact_push({ body1, body2, PhysicsContact_Exit });
         }
+    }
 
+private:
+    void push_trigger_event(const JPH::Body& inBody1, const JPH::Body& inBody2, physics_contact_type type)
+    {
+        if (inBody1.GetObjectLayer() == Layers::TRIGGER && inBody2.GetObjectLayer() == Layers::CHARACTER_GHOST) {
+            physics_contact_push({ inBody1.GetID(), inBody2.GetID(), type });
+        }
         if (inBody1.GetObjectLayer() == Layers::CHARACTER_GHOST && inBody2.GetObjectLayer() == Layers::TRIGGER) {
-            entity* ptr1 = reinterpret_cast<entity*>(inBody1.GetUserData());
-            entity* ptr2 = reinterpret_cast<entity*>(inBody2.GetUserData());
-
-            if (!ptr1 || !ptr2)
-                return;
-
-            if (ptr2->trigger.on_trigger_stay) {
-                ptr2->trigger.on_trigger_stay(ptr2, ptr1);
-            }
+            physics_contact_push({ inBody2.GetID(), inBody1.GetID(), type });
         }
-	}
-
-    /// @todo(ame): on contact removed
-    virtual void OnContactRemoved(const JPH::SubShapeIDPair &inSubShapePair) override
-    {
-        physics.contact_queue.events.push_back({
-            inSubShapePair.GetBody1ID(),
-            inSubShapePair.GetBody2ID()
-        });
     }
 };
 
@@ -194,6 +192,354 @@ JPH::Ref<JPH::PhysicsMaterial> physics_materials::TriggerMaterial;
 
 physics_system physics;
 
+/// @note(ame): SNAPSHOTS
+
+void physics_snapshot_save(physics_snapshot *snapshot)
+{
+    JPH::StateRecorderImpl recorder;
+
+    /// @note(ame): counts first, so a restore can refuse before touching anything
+    u32 character_count = physics.characters.size();
+    u32 body_count = physics.system->GetNumBodies();
+    recorder.Write(character_count);
+    recorder.Write(body_count);
+
+    physics.system->SaveState(recorder);
+    for (physics_character *character : physics.characters) {
+        character->character->SaveState(recorder);
+    }
+
+    /// @note(ame): sorted, the same pairs always give the same bytes
+    std::vector<std::pair<u64, physics_trigger_pair>> pairs(physics.contact_queue.pairs.begin(), physics.contact_queue.pairs.end());
+    std::sort(pairs.begin(), pairs.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+    u32 pair_count = pairs.size();
+    recorder.Write(pair_count);
+    for (auto& pair : pairs) {
+        recorder.Write(pair.first);
+        recorder.Write(pair.second.trigger.GetIndexAndSequenceNumber());
+        recorder.Write(pair.second.other.GetIndexAndSequenceNumber());
+        recorder.Write(pair.second.contacts);
+    }
+
+    recorder.Write(physics.clock.accumulator);
+    recorder.Write(physics.clock.steps);
+
+    snapshot->data = recorder.GetData();
+}
+
+bool physics_snapshot_restore(const physics_snapshot *snapshot)
+{
+    JPH::StateRecorderImpl recorder;
+    recorder.WriteBytes(snapshot->data.data(), snapshot->data.size());
+    recorder.Rewind();
+
+    u32 character_count = 0;
+    u32 body_count = 0;
+    recorder.Read(character_count);
+    recorder.Read(body_count);
+    if (recorder.IsFailed() || character_count != physics.characters.size() || body_count != physics.system->GetNumBodies()) {
+        log("[physics] snapshot is for %d characters and %d bodies, the world has %d and %d", character_count, body_count, (i32)physics.characters.size(), (i32)physics.system->GetNumBodies());
+        return false;
+    }
+
+    if (!physics.system->RestoreState(recorder)) {
+        log("[physics] snapshot doesn't match the bodies in the world");
+        return false;
+    }
+    for (physics_character *character : physics.characters) {
+        character->character->RestoreState(recorder);
+
+        JPH::RVec3 position = character->character->GetPosition();
+        JPH::Quat rotation = character->character->GetRotation();
+        character->position = character->prev_position = glm::vec3(position.GetX(), position.GetY(), position.GetZ());
+        character->rotation = character->prev_rotation = glm::quat(rotation.GetW(), rotation.GetX(), rotation.GetY(), rotation.GetZ());
+    }
+    for (physics_body *body : physics.dynamic_bodies) {
+        JPH::RVec3 position;
+        JPH::Quat rotation;
+        physics.body_interface->GetPositionAndRotation(body->body->GetID(), position, rotation);
+        body->position = body->prev_position = glm::vec3(position.GetX(), position.GetY(), position.GetZ());
+        body->rotation = body->prev_rotation = glm::quat(rotation.GetW(), rotation.GetX(), rotation.GetY(), rotation.GetZ());
+    }
+
+    /// @note(ame): events of the old timeline mean nothing anymore
+    physics_contact_event event;
+    while (mpmc_queue_pop(&physics.contact_queue.events, &event)) {
+    }
+
+    u32 pair_count = 0;
+    recorder.Read(pair_count);
+    physics.contact_queue.pairs.clear();
+    for (u32 i = 0; i < pair_count; i++) {
+        u64 key;
+        u32 trigger;
+        u32 other;
+        physics_trigger_pair pair;
+        recorder.Read(key);
+        recorder.Read(trigger);
+        recorder.Read(other);
+        recorder.Read(pair.contacts);
+        pair.trigger = JPH::BodyID(trigger);
+        pair.other = JPH::BodyID(other);
+        physics.contact_queue.pairs[key] = pair;
+    }
+
+    recorder.Read(physics.clock.accumulator);
+    recorder.Read(physics.clock.steps);
+    if (recorder.IsFailed()) {
+        log("[physics] snapshot is truncated");
+        return false;
+    }
+    return true;
+}
+
+void physics_snapshot_delta_encode(const physics_snapshot *base, const physics_snapshot *snapshot, physics_snapshot_delta *delta)
+{
+    /// @note(ame): bytes past the end of the base XOR against zero
+    u64 size = snapshot->data.size();
+    u64 overlap = std::min(size, (u64)base->data.size());
+    std::vector<u8> xored(size);
+    for (u64 i = 0; i < overlap; i++) {
+        xored[i] = snapshot->data[i] ^ base->data[i];
+    }
+    memcpy(xored.data() + overlap, snapshot->data.data() + overlap, size - overlap);
+
+    delta->size = size;
+    delta->bytes.resize(size);
+    u64 compressed = pak_compress(xored.data(), size, delta->bytes.data(), size);
+    delta->compressed = compressed > 0;
+    if (delta->compressed) {
+        delta->bytes.resize(compressed);
+    } else {
+        delta->bytes = std::move(xored);
+    }
+}
+
+bool physics_snapshot_delta_decode(const physics_snapshot *base, const physics_snapshot_delta *delta, physics_snapshot *out)
+{
+    std::vector<u8> xored(delta->size);
+    if (delta->compressed) {
+        if (!pak_decompress(delta->bytes.data(), delta->bytes.size(), xored.data(), xored.size())) {
+            return false;
+        }
+    } else {
+        if (delta->bytes.size() != delta->size) {
+            return false;
+        }
+        memcpy(xored.data(), delta->bytes.data(), delta->size);
+    }
+
+    out->data.resize(delta->size);
+    u64 overlap = std::min(delta->size, (u64)base->data.size());
+    for (u64 i = 0; i < overlap; i++) {
+        out->data[i] = xored[i] ^ base->data[i];
+    }
+    memcpy(out->data.data() + overlap, xored.data() + overlap, delta->size - overlap);
+    return true;
+}
+
+/// @note(ame): physics_snapshot save|restore|delete|list [slot]
+void physics_snapshot_command(std::vector<std::string> args)
+{
+    std::string action = args.size() > 1 ? args[1] : "list";
+    std::string slot = args.size() > 2 ? args[2] : "quick";
+
+    timer t;
+    timer_init(&t);
+    if (action == "save") {
+        physics_snapshot_save(&physics.snapshots[slot]);
+        log("[physics] saved snapshot '%s': %.1f KB in %.3f ms", slot.c_str(), physics.snapshots[slot].data.size() / 1024.0f, timer_elasped(&t));
+    } else if (action == "restore") {
+        auto it = physics.snapshots.find(slot);
+        if (it == physics.snapshots.end()) {
+            log("[physics] no snapshot '%s'", slot.c_str());
+            return;
+        }
+        bool restored = physics_snapshot_restore(&it->second);
+        log("[physics] %s snapshot '%s' (%.1f KB) in %.3f ms", restored ? "restored" : "failed to restore", slot.c_str(), it->second.data.size() / 1024.0f, timer_elasped(&t));
+    } else if (action == "delete") {
+        physics.snapshots.erase(slot);
+    } else {
+        for (auto& snapshot : physics.snapshots) {
+            log("[physics] snapshot '%s': %.1f KB", snapshot.first.c_str(), snapshot.second.data.size() / 1024.0f);
+        }
+    }
+}
+
+/// @note(ame): physics_reload -- puts the level back the way it was when it finished loading
+void physics_reload(std::vector<std::string> args)
+{
+    physics_snapshot_command({ "physics_snapshot", "restore", "level" });
+}
+
+/// @note(ame): physics_rollback_check [steps] -- steps the live world, rewinds, steps again and compares every step.
+/// Trigger callbacks do run twice.
+void physics_rollback_check(std::vector<std::string> args)
+{
+    u32 steps = args.size() > 1 ? std::stoul(args[1]) : 120;
+    f32 dt = (f32)physics.clock.step;
+
+    timer t;
+    f32 save_ms = 0.0f;
+    f32 restore_ms = 0.0f;
+    u64 full_bytes = 0;
+    u64 delta_bytes = 0;
+    bool deltas_ok = true;
+
+    physics_snapshot start;
+    timer_init(&t);
+    physics_snapshot_save(&start);
+    save_ms += timer_elasped(&t);
+
+    std::vector<u64> hashes;
+    physics_snapshot previous = start;
+    for (u32 i = 0; i < steps; i++) {
+        physics_step(dt);
+
+        physics_snapshot snapshot;
+        timer_init(&t);
+        physics_snapshot_save(&snapshot);
+        save_ms += timer_elasped(&t);
+        hashes.push_back(wn_hash(snapshot.data.data(), snapshot.data.size(), 0));
+
+        physics_snapshot_delta delta;
+        physics_snapshot decoded;
+        physics_snapshot_delta_encode(&previous, &snapshot, &delta);
+        deltas_ok &= physics_snapshot_delta_decode(&previous, &delta, &decoded) && decoded.data == snapshot.data;
+        full_bytes += snapshot.data.size();
+        delta_bytes += delta.bytes.size();
+        previous = std::move(snapshot);
+    }
+
+    timer_init(&t);
+    if (!physics_snapshot_restore(&start)) {
+        log("[physics] rollback check: couldn't restore the start snapshot");
+        return;
+    }
+    restore_ms = timer_elasped(&t);
+
+    u32 first_mismatch = steps;
+    for (u32 i = 0; i < steps; i++) {
+        physics_step(dt);
+
+        physics_snapshot snapshot;
+        physics_snapshot_save(&snapshot);
+        if (first_mismatch == steps && wn_hash(snapshot.data.data(), snapshot.data.size(), 0) != hashes[i]) {
+            first_mismatch = i;
+        }
+    }
+
+    log("[physics] rollback check: %d steps, snapshot %.1f KB, save %.3f ms, restore %.3f ms", steps, start.data.size() / 1024.0f, save_ms / (steps + 1), restore_ms);
+    log("[physics]   deltas: %.1f KB per step (%.1f%% of a full snapshot), round trip %s", delta_bytes / 1024.0f / steps, full_bytes ? 100.0f * delta_bytes / full_bytes : 0.0f, deltas_ok ? "ok" : "FAILED");
+    if (first_mismatch == steps) {
+        log("[physics]   replay after rollback: ok");
+    } else {
+        log("[physics]   replay after rollback: FAILED, diverged at step %d", first_mismatch);
+    }
+}
+
+/// @note(ame): REPLAY CHECK
+/// A stack of falling boxes in the live world, driven exactly like physics_update drives it: frame times into a
+/// physics_clock, physics_step for every step it hands out. Every run starts from the same snapshot and hashes a full
+/// snapshot after each step. The same frame times must give the same steps and bit identical states, and so must a
+/// completely different frame rate, step for step.
+struct physics_replay
+{
+    std::vector<f64> frames;
+    std::vector<u64> hashes; /// @note(ame): one per step, over the whole snapshot
+    physics_clock clock;
+};
+
+bool physics_replay_run(physics_replay *replay, const physics_snapshot *start, u32 max_steps)
+{
+    if (!physics_snapshot_restore(start)) {
+        return false;
+    }
+
+    replay->clock = {};
+    replay->clock.step = physics.clock.step;
+    replay->clock.max_steps = max_steps;
+    for (f64 frame : replay->frames) {
+        u32 steps = physics_clock_advance(&replay->clock, frame);
+        for (u32 i = 0; i < steps; i++) {
+            physics_step((f32)replay->clock.step);
+
+            physics_snapshot snapshot;
+            physics_snapshot_save(&snapshot);
+            replay->hashes.push_back(wn_hash(snapshot.data.data(), snapshot.data.size(), 0));
+        }
+    }
+    return true;
+}
+
+/// @note(ame): physics_replay_check [frames] [boxes] [seed] -- the world is put back the way it was afterwards. Trigger
+/// callbacks do run once per replay.
+void physics_replay_check(std::vector<std::string> args)
+{
+    u32 frame_count = args.size() > 1 ? std::stoul(args[1]) : 600;
+    u32 body_count = args.size() > 2 ? std::stoul(args[2]) : 50;
+    u32 seed = args.size() > 3 ? std::stoul(args[3]) : 1234;
+
+    /// @note(ame): jittery frames with the odd hitch, long enough to hit the step cap
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<f64> jitter(0.002, 0.05);
+
+    physics_replay recorded;
+    f64 total = 0.0;
+    for (u32 i = 0; i < frame_count; i++) {
+        f64 frame = (i % 97 == 96) ? 0.25 : jitter(rng);
+        recorded.frames.push_back(frame);
+        total += frame;
+    }
+
+    /// @note(ame): far above the level so nothing of it gets in the way
+    const glm::vec3 origin(0.0f, 7000.0f, 0.0f);
+    physics_body floor;
+    physics_body_init(&floor, new box_shape(glm::vec3(50.0f, 1.0f, 50.0f), physics_materials::LevelMaterial), origin - glm::vec3(0.0f, 1.0f, 0.0f), true);
+    std::vector<physics_body> boxes(body_count);
+    for (u32 i = 0; i < body_count; i++) {
+        glm::vec3 position((i % 5) * 1.1f - 2.2f, 1.0f + (i / 5) * 1.2f, (i % 3) * 0.3f);
+        physics_body_init(&boxes[i], new box_shape(glm::vec3(0.5f), physics_materials::LevelMaterial), origin + position);
+    }
+
+    physics_snapshot start;
+    physics_snapshot_save(&start);
+
+    physics_replay replayed;
+    replayed.frames = recorded.frames;
+
+    /// @note(ame): steady 60 Hz, never capped, until it has done at least as many steps
+    physics_replay steady;
+
+    bool restored = physics_replay_run(&recorded, &start, 8) && physics_replay_run(&replayed, &start, 8);
+    if (restored) {
+        u32 steady_frames = (u32)(recorded.hashes.size() * 60 / PHYSICS_STEP_HZ) + 2;
+        steady.frames.assign(steady_frames, 1.0 / 60.0);
+        restored = physics_replay_run(&steady, &start, UINT32_MAX) && physics_snapshot_restore(&start);
+    }
+
+    for (auto& box : boxes) {
+        physics_body_free(&box);
+    }
+    physics_body_free(&floor);
+
+    if (!restored) {
+        log("[physics] replay check: couldn't restore the start snapshot");
+        return;
+    }
+
+    /// @note(ame): every bit of frame time is either stepped, dropped or still in the accumulator
+    f64 accounted = (recorded.clock.steps + recorded.clock.dropped) * recorded.clock.step + recorded.clock.accumulator;
+    bool time_ok = std::abs(accounted - total) < 1e-6;
+    bool replay_ok = recorded.hashes == replayed.hashes && recorded.clock.dropped == replayed.clock.dropped;
+    bool rate_ok = steady.hashes.size() >= recorded.hashes.size() && std::equal(recorded.hashes.begin(), recorded.hashes.end(), steady.hashes.begin());
+
+    log("[physics] replay check: %d frames, %.2f s, %d steps, %d dropped, %d boxes", frame_count, total, (i32)recorded.clock.steps, (i32)recorded.clock.dropped, body_count);
+    log("[physics]   time accounted:     %s (%.9f s off)", time_ok ? "ok" : "FAILED", std::abs(accounted - total));
+    log("[physics]   same frames replay: %s", replay_ok ? "ok" : "FAILED");
+    log("[physics]   steady 60 Hz:       %s", rate_ok ? "ok" : "FAILED");
+}
+
 void physics_init()
 {
     JPH::RegisterDefaultAllocator();
@@ -201,7 +547,8 @@ void physics_init()
 
     JPH::RegisterTypes();
 
-    const u32 max_bodies = 4096;
+    /// @note(ame): every primitive of a level is a body
+    const u32 max_bodies = 65536;
     const u32 num_body_mutexes = 0;
     const u32 max_body_pairs = 2048;
     const u32 max_contact_contraints = 2048;
@@ -223,7 +570,20 @@ void physics_init()
     const u32 available_threads = std::thread::hardware_concurrency() - 1;
     physics.job_system = new JPH::JobSystemThreadPool(JPH::cMaxPhysicsJobs, JPH::cMaxPhysicsBarriers, available_threads);
 
+    /// @note(ame): one arena for every step instead of a malloc per allocation
+    physics.temp_allocator = new JPH::TempAllocatorImpl(cvar_register_unsigned("physics_temp_mb", 16)->as.u * 1024 * 1024);
+    cvar_register_unsigned("physics_max_steps", 8);
+    cvar_register_bool("physics_parallel_characters", true);
+    mpmc_queue_init(&physics.contact_queue.events, cvar_register_unsigned("physics_contact_events", 16384)->as.u);
+
+    /// @note(ame): TempAllocatorImpl isn't thread safe, every character job gets its own
+    u32 character_temp_size = cvar_register_unsigned("physics_character_temp_kb", 512)->as.u * 1024;
+    for (i32 i = 0; i < physics.job_system->GetMaxConcurrency(); i++) {
+        physics.character_allocators.push_back(new JPH::TempAllocatorImpl(character_temp_size));
+    }
+
     timer_init(&physics.physics_timer);
+    physics.clock = {};
 
     /// @note(ame): Initialize all the materials
     physics_materials::LevelMaterial = JPH::Ref<JPH::PhysicsMaterial>(new JPH::PhysicsMaterialSimple("Level", JPH::Color::sWhite));
@@ -232,6 +592,14 @@ void physics_init()
 
     JPH::PhysicsMaterial::sDefault = physics_materials::LevelMaterial;
 
+    collision_init();
+    physics_profiler_init();
+
+    dev_console_add_command("physics_replay_check", physics_replay_check);
+    dev_console_add_command("physics_snapshot", physics_snapshot_command);
+    dev_console_add_command("physics_reload", physics_reload);
+    dev_console_add_command("physics_rollback_check", physics_rollback_check);
+
     log("[physics] initialized physics");
 }
 
@@ -248,18 +616,223 @@ void physics_draw()
     physics.system->DrawBodies(settings, JPH::DebugRenderer::sInstance);
 }
 
+glm::mat4 physics_interpolate(glm::vec3 prev_position, glm::quat prev_rotation, glm::vec3 position, glm::quat rotation)
+{
+    f32 alpha = physics_clock_alpha(&physics.clock);
+    return glm::translate(glm::mat4(1.0f), glm::mix(prev_position, position, alpha))
+         * glm::mat4_cast(glm::slerp(prev_rotation, rotation, alpha));
+}
+
+u32 physics_clock_advance(physics_clock *clock, f64 elapsed)
+{
+    clock->accumulator += elapsed;
+
+    u64 due = (u64)(clock->accumulator / clock->step);
+    clock->accumulator = std::max(clock->accumulator - due * clock->step, 0.0);
+
+    u64 steps = std::min(due, (u64)clock->max_steps);
+    clock->dropped += due - steps;
+    clock->steps += steps;
+    return (u32)steps;
+}
+
+f32 physics_clock_alpha(const physics_clock *clock)
+{
+    return (f32)std::min(clock->accumulator / clock->step, 1.0);
+}
+
 void physics_update()
 {
-    i32 collision_steps = 1;
-    // Run simulation at 90 FPS
-    constexpr f32 min_step_duration = 1.0f / 90.0f;
-    constexpr i32 max_step_count = 32;
+    static console_var *max_steps = cvar_get("physics_max_steps");
+
+    f64 elapsed = TIMER_SECONDS(timer_elasped(&physics.physics_timer));
+    timer_restart(&physics.physics_timer);
 
-    if (TIMER_SECONDS(timer_elasped(&physics.physics_timer)) > min_step_duration) {
+    physics.clock.max_steps = std::max(max_steps->as.u, 1u);
+    u64 dropped = physics.clock.dropped;
+    u32 steps = physics_clock_advance(&physics.clock, elapsed);
+    if (physics.clock.dropped != dropped) {
+        log("[physics] frame took %.2f ms, dropped %d steps", elapsed * 1000.0, (i32)(physics.clock.dropped - dropped));
+    }
+
+    for (u32 i = 0; i < steps; i++) {
         try {
-            /// @note(ame): update physics
-            auto allocator = std::make_shared<JPH::TempAllocatorMalloc>();
-            auto error = physics.system->Update(min_step_duration, collision_steps, allocator.get(), physics.job_system);
+            physics_step((f32)physics.clock.step);
+        } catch (...) {
+            log("[jolt] somehow failed to update physics");
+        }
+    }
+}
+
+void physics_update_character(physics_character *character, f32 dt, JPH::TempAllocator *allocator)
+{
+    const auto& bplf = physics.system->GetDefaultBroadPhaseLayerFilter(Layers::CHARACTER);
+    const auto& layer_filter = physics.system->GetDefaultLayerFilter(Layers::CHARACTER);
+
+    JPH::CharacterVirtual::ExtendedUpdateSettings update_settings = {};
+    update_settings.mWalkStairsStepUp = JPH::Vec3(0.0f, 0.2f, 0.0f);
+    update_settings.mWalkStairsStepDownExtra = JPH::Vec3(0.0f, -0.2f, 0.0f);
+
+    character->character->ExtendedUpdate(dt,
+                                         physics.system->GetGravity(),
+                                         update_settings,
+                                         bplf,
+                                         layer_filter,
+                                         {},
+                                         {},
+                                         *allocator);
+
+    JPH::RVec3 position = character->character->GetPosition();
+    JPH::Quat rotation = character->character->GetRotation();
+    physics.body_interface->MoveKinematic(character->body_index, position, rotation, dt);
+
+    character->position = glm::vec3(position.GetX(), position.GetY(), position.GetZ());
+    character->rotation = glm::quat(rotation.GetW(), rotation.GetX(), rotation.GetY(), rotation.GetZ());
+}
+
+void physics_step_characters(f32 dt)
+{
+    static console_var *parallel = cvar_get("physics_parallel_characters");
+
+    u32 count = physics.characters.size();
+    u32 jobs = std::min((count + PHYSICS_CHARACTERS_PER_JOB - 1) / PHYSICS_CHARACTERS_PER_JOB, (u32)physics.character_allocators.size());
+    if (!parallel->as.b || jobs <= 1) {
+        for (physics_character *character : physics.characters) {
+            physics_update_character(character, dt, physics.temp_allocator);
+        }
+        return;
+    }
+
+    /// @note(ame): contiguous ranges, one temp allocator each. The main thread runs jobs too while it waits on the barrier.
+    std::vector<JPH::JobHandle> handles(jobs);
+    for (u32 i = 0; i < jobs; i++) {
+        u32 begin = count * i / jobs;
+        u32 end = count * (i + 1) / jobs;
+        JPH::TempAllocator *allocator = physics.character_allocators[i];
+
+        handles[i] = physics.job_system->CreateJob("Characters", JPH::Color::sGreen, [begin, end, dt, allocator]() {
+            for (u32 j = begin; j < end; j++) {
+                physics_update_character(physics.characters[j], dt, allocator);
+            }
+        });
+    }
+
+    JPH::JobSystem::Barrier *barrier = physics.job_system->CreateBarrier();
+    barrier->AddJobs(handles.data(), handles.size());
+    physics.job_system->WaitForJobs(barrier);
+    physics.job_system->DestroyBarrier(barrier);
+}
+
+void physics_fire_trigger(const physics_trigger_pair& pair, physics_contact_type type)
+{
+    /// @note(ame): zero once a body is gone
+    entity* trigger = reinterpret_cast<entity*>(physics.body_interface->GetUserData(pair.trigger));
+    entity* other = reinterpret_cast<entity*>(physics.body_interface->GetUserData(pair.other));
+    if (!trigger || !other) {
+        return;
+    }
+
+    switch (type) {
+        case PhysicsContact_Enter:
+            physics.contact_queue.stats.enters++;
+            if (trigger->trigger.on_trigger_enter) {
+                trigger->trigger.on_trigger_enter(trigger, other);
+            }
+            break;
+        case PhysicsContact_Stay:
+            physics.contact_queue.stats.stays++;
+            if (trigger->trigger.on_trigger_stay) {
+                trigger->trigger.on_trigger_stay(trigger, other);
+            }
+            break;
+        case PhysicsContact_Exit:
+            physics.contact_queue.stats.exits++;
+            if (trigger->trigger.on_trigger_exit) {
+                trigger->trigger.on_trigger_exit(trigger, other);
+            }
+            break;
+    }
+}
+
+void physics_dispatch_contacts()
+{
+    timer t;
+    timer_init(&t);
+
+    physics_contact_queue& queue = physics.contact_queue;
+    queue.stayed.clear();
+
+    physics_contact_event event;
+    while (mpmc_queue_pop(&queue.events, &event)) {
+        queue.stats.events++;
+
+        u64 key = physics_pair_key(event.trigger, event.other);
+        switch (event.type) {
+            case PhysicsContact_Enter: {
+                physics_trigger_pair& pair = queue.pairs[key];
+                if (pair.contacts++ > 0) {
+                    queue.stats.duplicates++;
+                    break;
+                }
+                pair.trigger = event.trigger;
+                pair.other = event.other;
+                physics_fire_trigger(pair, PhysicsContact_Enter);
+                break;
+            }
+            case PhysicsContact_Stay: {
+                auto it = queue.pairs.find(key);
+                if (it == queue.pairs.end() || !queue.stayed.insert(key).second) {
+                    queue.stats.duplicates++;
+                    break;
+                }
+                physics_fire_trigger(it->second, PhysicsContact_Stay);
+                break;
+            }
+            case PhysicsContact_Exit: {
+                auto it = queue.pairs.find(key);
+                if (it == queue.pairs.end() || --it->second.contacts > 0) {
+                    queue.stats.duplicates++;
+                    break;
+                }
+                physics_trigger_pair pair = it->second;
+                queue.pairs.erase(it);
+                physics_fire_trigger(pair, PhysicsContact_Exit);
+                break;
+            }
+        }
+    }
+
+    static u64 reported = 0;
+    u64 dropped = queue.stats.dropped.load();
+    if (dropped != reported) {
+        log("[physics] contact event ring full, dropped %d events (physics_contact_events)", (i32)(dropped - reported));
+        reported = dropped;
+    }
+    queue.stats.dispatch_ms = timer_elasped(&t);
+}
+
+void physics_step(f32 dt)
+{
+    i32 collision_steps = 1;
+    u64 trigger_events = physics.contact_queue.stats.events;
+
+    physics_profiler_begin_step();
+    {
+        physics_profile_scope step_scope(PhysicsPhase_Step);
+
+        for (physics_character* character : physics.characters) {
+            character->prev_position = character->position;
+            character->prev_rotation = character->rotation;
+        }
+        for (physics_body* body : physics.dynamic_bodies) {
+            body->prev_position = body->position;
+            body->prev_rotation = body->rotation;
+        }
+
+        /// @note(ame): update physics
+        {
+            physics_profile_scope scope(PhysicsPhase_Jolt);
+            auto error = physics.system->Update(dt, collision_steps, physics.temp_allocator, physics.job_system);
             if (error != JPH::EPhysicsUpdateError::None) {
                 const char* err_msg = "";
                 switch (error) {
@@ -275,87 +848,49 @@ void physics_update()
                 }
                 log("[jolt] error: %s", err_msg);
             }
+        }
 
-            /// @note(ame): update characters
-            {
-                const auto& bplf = physics.system->GetDefaultBroadPhaseLayerFilter(Layers::NON_MOVING);
-                const auto& layer_filter = physics.system->GetDefaultLayerFilter(Layers::CHARACTER);
-                const auto& gravity = physics.system->GetGravity();
-                auto& temp_allocator_ptr = *(allocator);
-
-                for (physics_character* character : physics.characters) {
-                    JPH::CharacterVirtual::ExtendedUpdateSettings update_settings = {};
-                    update_settings.mWalkStairsStepUp = JPH::Vec3(0.0f, 0.2f, 0.0f);
-                    update_settings.mWalkStairsStepDownExtra = JPH::Vec3(0.0f, -0.2f, 0.0f);
-
-                    character->character->ExtendedUpdate(min_step_duration,
-                                                         gravity,
-                                                         update_settings,
-                                                         bplf,
-                                                         layer_filter,
-                                                         {},
-                                                         {},
-                                                         temp_allocator_ptr);
-                    
-                    JPH::Mat44 jolt_transform = character->character->GetWorldTransform();
-                    const auto body_rotation = character->character->GetRotation();
-                    glm::mat4 transform = glm::mat4(
-                        jolt_transform(0, 0), jolt_transform(1, 0), jolt_transform(2, 0), jolt_transform(3, 0),
-                        jolt_transform(0, 1), jolt_transform(1, 1), jolt_transform(2, 1), jolt_transform(3, 1),
-                        jolt_transform(0, 2), jolt_transform(1, 2), jolt_transform(2, 2), jolt_transform(3, 2),
-                        jolt_transform(0, 3), jolt_transform(1, 3), jolt_transform(2, 3), jolt_transform(3, 3)
-                    );
-
-                    glm::vec3 scale = glm::vec3();
-                    glm::quat rotation = glm::quat();
-                    glm::vec3 pos = glm::vec3();
-                    glm::vec3 skew = glm::vec3();
-                    glm::vec4 pesp = glm::vec4();
-                    glm::decompose(transform, scale, rotation, pos, skew, pesp);
-                
-                    physics.body_interface->MoveKinematic(character->body_index, JPH::Vec3{ pos.x, pos.y, pos.z }, { rotation.x, rotation.y, rotation.z, rotation.w }, min_step_duration);
-                }
-
-                /// @note(ame): Update contat queue
-                if (!physics.contact_queue.events.empty()) {
-                    for (auto& contact : physics.contact_queue.events) {
-                        JPH::ObjectLayer layer1 = physics.body_interface->GetObjectLayer(contact.body1);
-                        JPH::ObjectLayer layer2 = physics.body_interface->GetObjectLayer(contact.body2);
-                        void* user_data1 = (void*)physics.body_interface->GetUserData(contact.body1);
-                        void* user_data2 = (void*)physics.body_interface->GetUserData(contact.body2);
-
-                        if (layer1 == Layers::TRIGGER && layer2 == Layers::CHARACTER_GHOST) {
-                            entity* ptr1 = reinterpret_cast<entity*>(user_data1);
-                            entity* ptr2 = reinterpret_cast<entity*>(user_data2);
-                            if (!ptr1 || !ptr2)
-                                return;
-                            if (ptr1->trigger.on_trigger_exit) {
-                                ptr1->trigger.on_trigger_exit(ptr1, ptr2);
-                            }
-                        }
-                        if (layer1 == Layers::CHARACTER_GHOST && layer2 == Layers::TRIGGER) {
-                            entity* ptr1 = reinterpret_cast<entity*>(user_data1);
-                            entity* ptr2 = reinterpret_cast<entity*>(user_data2);
-                            if (!ptr1 || !ptr2)
-                                return;
-                            if (ptr2->trigger.on_trigger_exit) {
-                                ptr2->trigger.on_trigger_exit(ptr2, ptr1);
-                            }
-                        }
-                    }
-                    physics.contact_queue.events.clear();
-                }
-            }
-        } catch (...) {
-            log("[jolt] somehow failed to update physics");
+        {
+            physics_profile_scope scope(PhysicsPhase_Contacts);
+            physics_dispatch_contacts();
+        }
+        {
+            physics_profile_scope scope(PhysicsPhase_Characters);
+            physics_step_characters(dt);
         }
 
-        timer_restart(&physics.physics_timer);
+        physics_profile_scope scope(PhysicsPhase_Sync);
+        for (physics_body* body : physics.dynamic_bodies) {
+            JPH::Vec3 position;
+            JPH::Quat rotation;
+            physics.body_interface->GetPositionAndRotation(body->body->GetID(), position, rotation);
+            body->position = glm::vec3(position.GetX(), position.GetY(), position.GetZ());
+            body->rotation = glm::quat(rotation.GetW(), rotation.GetX(), rotation.GetY(), rotation.GetZ());
+        }
     }
+    physics_profiler_end_step(physics.system->GetNumBodies(),
+                              physics.system->GetNumActiveBodies(JPH::EBodyType::RigidBody),
+                              physics.characters.size(),
+                              physics.contact_queue.stats.events - trigger_events,
+                              physics.contact_queue.pairs.size());
+}
+
+void physics_optimize_broadphase()
+{
+    timer t;
+    timer_init(&t);
+
+    physics.system->OptimizeBroadPhase();
+    log("[physics] optimized broadphase with %d bodies in %.2f ms", (i32)physics.system->GetNumBodies(), timer_elasped(&t));
 }
 
 void physics_exit()
 {
+    for (JPH::TempAllocatorImpl *allocator : physics.character_allocators) {
+        delete allocator;
+    }
+    physics.character_allocators.clear();
+    delete physics.temp_allocator;
     delete physics.job_system;
     delete physics.contact_listener;
     delete physics.activation_listener;
@@ -381,7 +916,7 @@ void physics_body_init(physics_body *body, physics_shape *shape, glm::vec3 posit
                                        JPH::Vec3(position.x, position.y, position.z),
                                        JPH::Quat::sIdentity(),
                                        is_static ? JPH::EMotionType::Static : JPH::EMotionType::Dynamic,
-                                       Layers::MOVING);
+                                       is_static ? Layers::NON_MOVING : Layers::MOVING);
     
     if (body->shape->rb_type == RigidbodyType_Mesh) {
         settings.mMassPropertiesOverride.mMass = 1.0f;
@@ -389,9 +924,95 @@ void physics_body_init(physics_body *body, physics_shape *shape, glm::vec3 posit
     }
 
     body->body = physics.body_interface->CreateBody(settings);
-    physics.body_interface->AddBody(body->body->GetID(), JPH::EActivation::Activate);
+    if (!body->body) {
+        throw_error("Ran out of Jolt bodies!");
+    }
+    physics.body_interface->AddBody(body->body->GetID(), is_static ? JPH::EActivation::DontActivate : JPH::EActivation::Activate);
 
     body->body->SetUserData(reinterpret_cast<u64>(user_data));
+
+    body->position = body->prev_position = position;
+    body->rotation = body->prev_rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+    if (!is_static) {
+        physics.dynamic_bodies.push_back(body);
+    }
+}
+
+void physics_body_batch_add(physics_body_batch *batch, physics_body *body, physics_shape *shape, glm::vec3 position, void *user_data)
+{
+    body->shape = shape;
+    body->is_static = true;
+
+    JPH::BodyCreationSettings settings(body->shape->get_shape(),
+                                       JPH::Vec3(position.x, position.y, position.z),
+                                       JPH::Quat::sIdentity(),
+                                       JPH::EMotionType::Static,
+                                       Layers::NON_MOVING);
+    settings.mUserData = reinterpret_cast<u64>(user_data);
+
+    body->body = physics.body_interface->CreateBody(settings);
+    if (!body->body) {
+        throw_error("Ran out of Jolt bodies!");
+    }
+    batch->ids.push_back(body->body->GetID());
+}
+
+void physics_body_batch_commit(physics_body_batch *batch)
+{
+    if (batch->ids.empty()) {
+        return;
+    }
+
+    /// @note(ame): prepare builds one subtree per layer out of the batch, finalize links them into the broadphase under a single lock
+    JPH::BodyInterface::AddState state = physics.body_interface->AddBodiesPrepare(batch->ids.data(), (i32)batch->ids.size());
+    physics.body_interface->AddBodiesFinalize(batch->ids.data(), (i32)batch->ids.size(), state, JPH::EActivation::DontActivate);
+    batch->ids.clear();
+}
+
+void physics_bodies_add(const std::vector<physics_body*>& bodies)
+{
+    physics_body_batch batch;
+    for (physics_body *body : bodies) {
+        JPH::BodyID id = body->body->GetID();
+        if (!physics.body_interface->IsAdded(id)) {
+            batch.ids.push_back(id);
+        }
+    }
+    physics_body_batch_commit(&batch);
+}
+
+void physics_bodies_remove(const std::vector<physics_body*>& bodies)
+{
+    std::vector<JPH::BodyID> ids;
+    for (physics_body *body : bodies) {
+        JPH::BodyID id = body->body->GetID();
+        if (physics.body_interface->IsAdded(id)) {
+            ids.push_back(id);
+        }
+    }
+    if (!ids.empty()) {
+        physics.body_interface->RemoveBodies(ids.data(), (i32)ids.size());
+    }
+}
+
+void physics_bodies_free(const std::vector<physics_body*>& bodies)
+{
+    if (bodies.empty()) {
+        return;
+    }
+
+    physics_bodies_remove(bodies);
+
+    std::vector<JPH::BodyID> ids(bodies.size());
+    for (u64 i = 0; i < bodies.size(); i++) {
+        ids[i] = bodies[i]->body->GetID();
+    }
+    physics.body_interface->DestroyBodies(ids.data(), (i32)ids.size());
+    for (physics_body *body : bodies) {
+        body->body = nullptr;
+        delete body->shape;
+        body->shape = nullptr;
+    }
 }
 
 glm::mat4 physics_body_get_transform(physics_body *body)
@@ -403,9 +1024,28 @@ glm::mat4 physics_body_get_transform(physics_body *body)
          * glm::mat4_cast(glm::quat(rotation.GetW(), rotation.GetX(), rotation.GetY(), rotation.GetZ()));
 }
 
+glm::mat4 physics_body_get_render_transform(physics_body *body)
+{
+    if (body->is_static) {
+        return physics_body_get_transform(body);
+    }
+    return physics_interpolate(body->prev_position, body->prev_rotation, body->position, body->rotation);
+}
+
+void physics_body_get_bounds(physics_body *body, glm::vec3 *min, glm::vec3 *max)
+{
+    JPH::AABox bounds = body->body->GetWorldSpaceBounds();
+    *min = glm::vec3(bounds.mMin.GetX(), bounds.mMin.GetY(), bounds.mMin.GetZ());
+    *max = glm::vec3(bounds.mMax.GetX(), bounds.mMax.GetY(), bounds.mMax.GetZ());
+}
+
 void physics_body_free(physics_body *body)
 {
+    if (!body->is_static) {
+        physics.dynamic_bodies.erase(std::remove(physics.dynamic_bodies.begin(), physics.dynamic_bodies.end(), body), physics.dynamic_bodies.end());
+    }
     physics.body_interface->RemoveBody(body->body->GetID());
+    physics.body_interface->DestroyBody(body->body->GetID());
     delete body->shape;
 }
 
@@ -466,6 +1106,7 @@ void physics_trigger_set_rotation(physics_trigger *trigger, glm::vec3 euler)
 void physics_trigger_free(physics_trigger *trigger)
 {
     physics.body_interface->RemoveBody(trigger->body->GetID());
+    physics.body_interface->DestroyBody(trigger->body->GetID());
 }
 
 void physics_character_init(physics_character *c, physics_shape *shape, glm::vec3 position, void *user_data)
@@ -485,6 +1126,8 @@ void physics_character_init(physics_character *c, physics_shape *shape, glm::vec
     c->body_index = physics.body_interface->CreateAndAddBody(body_settings, JPH::EActivation::Activate);
     physics.body_interface->SetUserData(c->body_index, reinterpret_cast<u64>(user_data));
 
+    c->position = c->prev_position = position;
+    c->rotation = c->prev_rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
     physics.characters.push_back(c);
 }
 
@@ -516,11 +1159,27 @@ void physics_character_set_position(physics_character *c, glm::vec3 p)
 {
     physics.body_interface->SetPosition(c->body_index, JPH::Vec3(p.x, p.y, p.z), JPH::EActivation::Activate);
     c->character->SetPosition(JPH::Vec3(p.x, p.y, p.z));
+
+    /// @note(ame): a teleport, don't blend from where we were
+    c->position = c->prev_position = p;
+}
+
+glm::mat4 physics_character_get_render_transform(physics_character *c)
+{
+    return physics_interpolate(c->prev_position, c->prev_rotation, c->position, c->rotation);
+}
+
+glm::vec3 physics_character_get_render_position(physics_character *c)
+{
+    return glm::mix(c->prev_position, c->position, physics_clock_alpha(&physics.clock));
 }
 
 void physics_character_free(physics_character *c)
 {
+    physics.characters.erase(std::remove(physics.characters.begin(), physics.characters.end(), c), physics.characters.end());
     physics.body_interface->RemoveBody(c->body_index);
+    physics.body_interface->DestroyBody(c->body_index);
+    delete c->character;
     delete c->shape;
 }
 
@@ -530,17 +1189,165 @@ ray_result physics_body_trace_ray(physics_body *body, glm::vec3 start, glm::vec3
 
     glm::vec3 direction = end - start;
 
-    JPH::RayCast ray;
-    ray.mOrigin = JPH::Vec3(start.x, start.y, start.z);
-    ray.mDirection = JPH::Vec3(direction.x, start.y, start.z);
+    /// @note(ame): in world space, the shape alone is relative to the body's center of mass
+    JPH::RRayCast ray(JPH::RVec3(start.x, start.y, start.z), JPH::Vec3(direction.x, direction.y, direction.z));
+    JPH::TransformedShape shape = physics.body_interface->GetTransformedShape(body->body->GetID());
 
     JPH::RayCastResult hit;
-    result.hit = body->shape->get_shape()->CastRay(ray, JPH::SubShapeIDCreator(), hit);
-    result.point = start + hit.mFraction * (end - start);
-    result.t = hit.mFraction;
+    result.hit = shape.CastRay(ray, hit);
+    result.t = result.hit ? hit.mFraction : 1.0f;
+    result.point = start + result.t * direction;
     return result;
 }
 
+/// @note(ame): BATCHED QUERIES
+
+static_assert(PhysicsQueryLayer_Static == 1 << Layers::NON_MOVING && PhysicsQueryLayer_Dynamic == 1 << Layers::MOVING, "query bits out of sync");
+static_assert(PhysicsQueryLayer_Character == 1 << Layers::CHARACTER && PhysicsQueryLayer_CharacterGhost == 1 << Layers::CHARACTER_GHOST, "query bits out of sync");
+static_assert(PhysicsQueryLayer_Trigger == 1 << Layers::TRIGGER, "query bits out of sync");
+
+struct query_layer_filter : JPH::ObjectLayerFilter
+{
+    u32 layers;
+
+    bool ShouldCollide(JPH::ObjectLayer inLayer) const override
+    {
+        return (layers >> inLayer) & 1;
+    }
+};
+
+void physics_query_batch_add(physics_query_batch *batch, glm::vec3 origin, glm::vec3 direction)
+{
+    batch->origins.push_back(origin);
+    batch->directions.push_back(direction);
+}
+
+void physics_query_batch_clear(physics_query_batch *batch)
+{
+    batch->origins.clear();
+    batch->directions.clear();
+}
+
+glm::vec3 physics_surface_normal(JPH::BodyID body, JPH::SubShapeID sub_shape, JPH::RVec3Arg point)
+{
+    JPH::BodyLockRead lock(physics.system->GetBodyLockInterface(), body);
+    if (!lock.Succeeded()) {
+        return glm::vec3(0.0f, 1.0f, 0.0f);
+    }
+    JPH::Vec3 normal = lock.GetBody().GetWorldSpaceSurfaceNormal(sub_shape, point);
+    return glm::vec3(normal.GetX(), normal.GetY(), normal.GetZ());
+}
+
+void physics_query_range(physics_query_batch *batch, const JPH::Shape *shape, u32 begin, u32 end)
+{
+    const JPH::NarrowPhaseQuery& query = physics.system->GetNarrowPhaseQuery();
+    query_layer_filter filter;
+    filter.layers = batch->layers;
+
+    for (u32 i = begin; i < end; i++) {
+        JPH::RVec3 origin(batch->origins[i].x, batch->origins[i].y, batch->origins[i].z);
+        JPH::Vec3 direction(batch->directions[i].x, batch->directions[i].y, batch->directions[i].z);
+
+        batch->hits[i] = false;
+        batch->fractions[i] = 1.0f;
+        batch->points[i] = batch->origins[i] + batch->directions[i];
+        batch->normals[i] = glm::vec3(0.0f);
+        batch->bodies[i] = JPH::BodyID();
+
+        if (!shape) {
+            JPH::RRayCast ray(origin, direction);
+            JPH::ClosestHitCollisionCollector<JPH::CastRayCollector> collector;
+            query.CastRay(ray, JPH::RayCastSettings(), collector, {}, filter);
+            if (collector.HadHit()) {
+                JPH::RVec3 point = ray.GetPointOnRay(collector.mHit.mFraction);
+
+                batch->hits[i] = true;
+                batch->fractions[i] = collector.mHit.mFraction;
+                batch->points[i] = glm::vec3(point.GetX(), point.GetY(), point.GetZ());
+                batch->normals[i] = physics_surface_normal(collector.mHit.mBodyID, collector.mHit.mSubShapeID2, point);
+                batch->bodies[i] = collector.mHit.mBodyID;
+            }
+        } else {
+            JPH::RShapeCast cast = JPH::RShapeCast::sFromWorldTransform(shape, JPH::Vec3::sReplicate(1.0f), JPH::RMat44::sTranslation(origin), direction);
+            JPH::ClosestHitCollisionCollector<JPH::CastShapeCollector> collector;
+            query.CastShape(cast, JPH::ShapeCastSettings(), origin, collector, {}, filter);
+            if (collector.HadHit()) {
+                const JPH::ShapeCastResult& hit = collector.mHit;
+                JPH::RVec3 point = origin + hit.mContactPointOn2;
+                JPH::Vec3 normal = -hit.mPenetrationAxis.NormalizedOr(JPH::Vec3::sZero());
+
+                batch->hits[i] = true;
+                batch->fractions[i] = hit.mFraction;
+                batch->points[i] = glm::vec3(point.GetX(), point.GetY(), point.GetZ());
+                batch->normals[i] = glm::vec3(normal.GetX(), normal.GetY(), normal.GetZ());
+                batch->bodies[i] = hit.mBodyID2;
+            }
+        }
+    }
+}
+
+void physics_query_batch_run(physics_query_batch *batch, u32 max_jobs)
+{
+    u32 count = batch->origins.size();
+    batch->hits.resize(count);
+    batch->fractions.resize(count);
+    batch->points.resize(count);
+    batch->normals.resize(count);
+    batch->bodies.resize(count);
+
+    /// @note(ame): a degenerate sweep shape is a caller bug, every query misses instead of tripping Jolt
+    bool degenerate = (batch->shape != PhysicsQuery_Ray && !(batch->radius > 0.0f))
+                   || (batch->shape == PhysicsQuery_Capsule && !(batch->half_height > 0.0f));
+    if (degenerate) {
+        log("[physics] query batch with radius %.3f, half height %.3f -- skipped", batch->radius, batch->half_height);
+        for (u32 i = 0; i < count; i++) {
+            batch->hits[i] = false;
+            batch->fractions[i] = 1.0f;
+            batch->points[i] = batch->origins[i] + batch->directions[i];
+            batch->normals[i] = glm::vec3(0.0f);
+            batch->bodies[i] = JPH::BodyID();
+        }
+        return;
+    }
+
+    JPH::Ref<JPH::Shape> shape;
+    switch (batch->shape) {
+        case PhysicsQuery_Ray:
+            break;
+        case PhysicsQuery_Sphere:
+            shape = new JPH::SphereShape(batch->radius);
+            break;
+        case PhysicsQuery_Capsule:
+            shape = new JPH::CapsuleShape(batch->half_height, batch->radius);
+            break;
+    }
+
+    /// @note(ame): a few jobs per worker so uneven queries even out, each one a contiguous range
+    u32 jobs = (count + PHYSICS_QUERIES_PER_JOB - 1) / PHYSICS_QUERIES_PER_JOB;
+    u32 max = max_jobs ? max_jobs : physics.job_system->GetMaxConcurrency() * 4;
+    jobs = std::min(jobs, max);
+    if (jobs <= 1) {
+        physics_query_range(batch, shape.GetPtr(), 0, count);
+        return;
+    }
+
+    std::vector<JPH::JobHandle> handles(jobs);
+    for (u32 i = 0; i < jobs; i++) {
+        u32 begin = (u64)count * i / jobs;
+        u32 end = (u64)count * (i + 1) / jobs;
+        const JPH::Shape *query_shape = shape.GetPtr();
+
+        handles[i] = physics.job_system->CreateJob("Queries", JPH::Color::sCyan, [batch, query_shape, begin, end]() {
+            physics_query_range(batch, query_shape, begin, end);
+        });
+    }
+
+    JPH::JobSystem::Barrier *barrier = physics.job_system->CreateBarrier();
+    barrier->AddJobs(handles.data(), handles.size());
+    physics.job_system->WaitForJobs(barrier);
+    physics.job_system->DestroyBarrier(barrier);
+}
+
 struct skip_character_filter : JPH::ObjectLayerFilter
 {
 public:
@@ -0,0 +1,188 @@
+//
+// $Notice: Xander Studios @ 2024
+// $Author: Amélie Heinrich
+// $Create Time: 2024-11-23 21:36:40
+//
+
+#include <algorithm>
+#include <json/json.hpp>
+
+#include "wn_physics_profiler.h"
+#include "wn_output.h"
+#include "wn_cvar.h"
+#include "wn_dev_console.h"
+#include "wn_filesystem.h"
+
+physics_profiler physics_profile;
+
+static const char *phase_names[PhysicsPhase_Max] = { "Step", "Jolt", "Contacts", "Characters", "Sync" };
+
+physics_profile_scope::physics_profile_scope(physics_phase p)
+    : phase(p)
+{
+    begin = physics_profile.enabled ? timer_elasped_us(&physics_profile.epoch) : 0.0;
+}
+
+physics_profile_scope::~physics_profile_scope()
+{
+    if (!physics_profile.enabled) {
+        return;
+    }
+
+    physics_profile.current.begin_us[phase] = begin;
+    physics_profile.current.ms[phase] = (timer_elasped_us(&physics_profile.epoch) - begin) / 1000.0;
+}
+
+/// @note(ame): physics_profile [summary|export|clear|on|off] [steps or path]
+void physics_profile_command(std::vector<std::string> args)
+{
+    std::string action = args.size() > 1 ? args[1] : "summary";
+    if (action == "export") {
+        std::string path = args.size() > 2 ? args[2] : "physics_trace.json";
+        physics_profiler_export(path);
+        log("[physics_profile] wrote %s", path.c_str());
+    } else if (action == "clear") {
+        physics_profiler_clear();
+    } else if (action == "on" || action == "off") {
+        physics_profile.enabled = action == "on";
+        cvar_get("physics_profile")->as.b = physics_profile.enabled;
+    } else {
+        physics_profiler_summary(args.size() > 2 ? std::stoul(args[2]) : 0);
+    }
+}
+
+void physics_profiler_init()
+{
+    physics_profile.enabled = cvar_register_bool("physics_profile", true)->as.b;
+    physics_profile.history.resize(std::max(cvar_register_unsigned("physics_profile_history", 1024)->as.u, 1u));
+    physics_profile.steps = 0;
+    physics_profile.recorded = 0;
+    timer_init(&physics_profile.epoch);
+
+    dev_console_add_command("physics_profile", physics_profile_command);
+}
+
+/// @note(ame): keeps the newest steps that still fit, in order
+void physics_profiler_resize(u32 size)
+{
+    std::vector<physics_step_profile> kept = physics_profiler_history(size);
+    physics_profile.history.assign(size, {});
+    std::copy(kept.begin(), kept.end(), physics_profile.history.begin());
+    physics_profile.recorded = kept.size();
+}
+
+void physics_profiler_begin_step()
+{
+    /// @note(ame): both cvars can change from the console at any time, pick them up at the start of a step
+    static console_var *enabled = cvar_get("physics_profile");
+    static console_var *history = cvar_get("physics_profile_history");
+    physics_profile.enabled = enabled->as.b;
+    u32 history_size = std::max(history->as.u, 1u);
+    if (history_size != physics_profile.history.size()) {
+        physics_profiler_resize(history_size);
+    }
+
+    physics_profile.current = {};
+    physics_profile.current.step = physics_profile.steps++;
+}
+
+void physics_profiler_end_step(u32 bodies, u32 active_bodies, u32 characters, u32 trigger_events, u32 trigger_pairs)
+{
+    physics_step_profile& current = physics_profile.current;
+    current.contacts_added = physics_profile.contacts_added.exchange(0, std::memory_order_relaxed);
+    current.contacts_persisted = physics_profile.contacts_persisted.exchange(0, std::memory_order_relaxed);
+    current.contacts_removed = physics_profile.contacts_removed.exchange(0, std::memory_order_relaxed);
+    if (!physics_profile.enabled) {
+        return;
+    }
+
+    current.bodies = bodies;
+    current.active_bodies = active_bodies;
+    current.characters = characters;
+    current.trigger_events = trigger_events;
+    current.trigger_pairs = trigger_pairs;
+
+    physics_profile.history[physics_profile.recorded % physics_profile.history.size()] = current;
+    physics_profile.recorded++;
+}
+
+void physics_profiler_clear()
+{
+    physics_profile.recorded = 0;
+}
+
+std::vector<physics_step_profile> physics_profiler_history(u32 count)
+{
+    u64 available = std::min(physics_profile.recorded, (u64)physics_profile.history.size());
+    if (count == 0 || count > available) {
+        count = available;
+    }
+
+    std::vector<physics_step_profile> out(count);
+    for (u32 i = 0; i < count; i++) {
+        u64 index = physics_profile.recorded - count + i;
+        out[i] = physics_profile.history[index % physics_profile.history.size()];
+    }
+    return out;
+}
+
+void physics_profiler_summary(u32 count)
+{
+    std::vector<physics_step_profile> steps = physics_profiler_history(count);
+    if (steps.empty()) {
+        log("[physics_profile] nothing recorded");
+        return;
+    }
+
+    log("[physics_profile] last %d steps (%llu to %llu)", (i32)steps.size(), steps.front().step, steps.back().step);
+    for (u32 phase = 0; phase < PhysicsPhase_Max; phase++) {
+        f32 total = 0.0f;
+        f32 worst = 0.0f;
+        u64 worst_step = 0;
+        for (auto& step : steps) {
+            total += step.ms[phase];
+            if (step.ms[phase] > worst) {
+                worst = step.ms[phase];
+                worst_step = step.step;
+            }
+        }
+        log("[physics_profile]   %-10s avg %7.3f ms | worst %7.3f ms (step %llu)", phase_names[phase], total / steps.size(), worst, worst_step);
+    }
+
+    const physics_step_profile& last = steps.back();
+    log("[physics_profile]   %d bodies (%d active), %d characters", last.bodies, last.active_bodies, last.characters);
+    log("[physics_profile]   contacts +%d ~%d -%d, %d trigger events, %d trigger pairs", last.contacts_added, last.contacts_persisted, last.contacts_removed, last.trigger_events, last.trigger_pairs);
+}
+
+void physics_profiler_export(const std::string& path, u32 count)
+{
+    std::vector<physics_step_profile> steps = physics_profiler_history(count);
+
+    /// @note(ame): one complete event per phase, nested by time on a single track, and counter tracks for the world
+    nlohmann::json events = nlohmann::json::array();
+    for (auto& step : steps) {
+        for (u32 phase = 0; phase < PhysicsPhase_Max; phase++) {
+            events.push_back({
+                { "name", phase_names[phase] },
+                { "cat", "physics" },
+                { "ph", "X" },
+                { "ts", step.begin_us[phase] },
+                { "dur", step.ms[phase] * 1000.0 },
+                { "pid", 0 },
+                { "tid", 0 },
+                { "args", { { "step", step.step } } }
+            });
+        }
+
+        f64 ts = step.begin_us[PhysicsPhase_Step];
+        events.push_back({ { "name", "bodies" }, { "ph", "C" }, { "ts", ts }, { "pid", 0 }, { "args", { { "total", step.bodies }, { "active", step.active_bodies } } } });
+        events.push_back({ { "name", "characters" }, { "ph", "C" }, { "ts", ts }, { "pid", 0 }, { "args", { { "count", step.characters } } } });
+        events.push_back({ { "name", "contacts" }, { "ph", "C" }, { "ts", ts }, { "pid", 0 }, { "args", { { "added", step.contacts_added }, { "persisted", step.contacts_persisted }, { "removed", step.contacts_removed } } } });
+        events.push_back({ { "name", "triggers" }, { "ph", "C" }, { "ts", ts }, { "pid", 0 }, { "args", { { "events", step.trigger_events }, { "pairs", step.trigger_pairs } } } });
+    }
+
+    nlohmann::json root;
+    root["traceEvents"] = events;
+    root["displayTimeUnit"] = "ms";
+    fs_writejson(path, root);
+}
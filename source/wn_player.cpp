@@ -26,7 +26,7 @@ void player_init(entity *p, glm::vec3 start_pos)
     p->name = "Player";
 
     p->has_model = true;
-    p->model = resource_cache_get("assets/gltfs/player/untitled.gltf", ResourceType_GLTF, false);
+    p->model = resource_cache_get(PLAYER_MODEL_PATH, ResourceType_GLTF, false);
 
     p->has_physics_character = true;
     physics_character_init(&p->character, new capsule_shape(0.5f, 1.5, physics_materials::CharacterMaterial), start_pos, reinterpret_cast<void*>(p));
@@ -36,7 +36,8 @@ void player_init(entity *p, glm::vec3 start_pos)
 
 void player_update(entity *p, f32 dt)
 {
-    glm::vec3 position = physics_character_get_position(&p->character);
+    /// @note(ame): the camera follows what gets drawn, not the last physics step
+    glm::vec3 position = physics_character_get_render_position(&p->character);
 
     f32 h_distance = -3.0f * std::cos(glm::radians(p_data.pitch));
     f32 v_distance = -3.0f * std::sin(glm::radians(p_data.pitch));
@@ -226,7 +226,8 @@ void forward_render(game_render_info *info)
 
             for (auto& primitive : node->primitives) {
                 gltf_material& mat = model->materials[primitive.material_index];
-                texture_view* alb_view = mat.has_albedo
+                /// @note(ame): streamed textures show up white until the uploader submitted their copy
+                texture_view* alb_view = mat.has_albedo && mat.albedo->handle->ready
                                        ? &tvc_get_entry(&mat.albedo->handle->tex, TextureViewType_ShaderResource, TEXTURE_ALL_MIPS)->view
                                        : &tvc_get_entry(&renderer.forward.white_texture, TextureViewType_ShaderResource)->view;
                 
@@ -245,8 +246,23 @@ void forward_render(game_render_info *info)
             }
     };
     if (info->render_meshes) {
-        draw_node(frame, info->world->player.model->model.root, &info->world->player.model->model, physics_character_get_transform(&info->world->player.character));
+        draw_node(frame, info->world->player.model->model.root, &info->world->player.model->model, physics_character_get_render_transform(&info->world->player.character));
         draw_node(frame, info->world->level->model.root, &info->world->level->model, glm::mat4(1.0f));
+
+        /// @note(ame): props and enemies move on the fixed step, draw them where they are between the last two
+        for (entity *e : info->world->entities) {
+            if (!e->has_model || e->model->state != ResourceState_Ready) {
+                continue;
+            }
+
+            glm::mat4 transform = glm::mat4(1.0f);
+            if (e->has_physics_body) {
+                transform = physics_body_get_render_transform(&e->physics_body);
+            } else if (e->has_physics_character) {
+                transform = physics_character_get_render_transform(&e->character);
+            }
+            draw_node(frame, e->model->model.root, &e->model->model, transform);
+        }
     }
 }
 
@@ -4,70 +4,499 @@
 // $Create Time: 2024-11-05 16:45:47
 //
 
+#include <algorithm>
+
 #include "wn_resource_cache.h"
 #include "wn_uploader.h"
+#include "wn_dev_console.h"
+#include "wn_util.h"
+#include "wn_cvar.h"
 
 resource_cache global_cache;
 
-void resource_cache_init()
+bool resource_cache_on_main_thread()
 {
-    global_cache.resources = {};
-    log("[resource_cache] intialized resource cache");
+    return std::this_thread::get_id() == global_cache.main_thread;
 }
 
-resource *resource_cache_get(const std::string& path, resource_type type, bool gen_collisions)
+resource_cache_shard *resource_cache_shard_of(const std::string& path)
 {
-    if (global_cache.resources.count(path) > 0) {
-        log("[resource_cache] reusing asset %s", path.c_str());
-        global_cache.resources[path]->ref_count += 1;
-        return global_cache.resources[path];
+    u64 hash = wn_hash(path.data(), path.size(), 1000);
+    return &global_cache.shards[hash % RESOURCE_CACHE_SHARDS];
+}
+
+void resource_cache_queue_push(mpmc_queue<resource*> *queue, resource *res)
+{
+    /// @note(ame): only spins if thousands of resources are waiting, the main thread drains them
+    while (!mpmc_queue_push(queue, res)) {
+        std::this_thread::yield();
+    }
+}
+
+/// @note(ame): LRU, lru_lock held
+
+void resource_cache_lru_push(resource *res)
+{
+    res->lru_prev = nullptr;
+    res->lru_next = global_cache.lru_head;
+    if (global_cache.lru_head) {
+        global_cache.lru_head->lru_prev = res;
     } else {
-        resource* res = new resource;
-        res->ref_count++;
-        res->type = type;
-        res->path = path;
+        global_cache.lru_tail = res;
+    }
+    global_cache.lru_head = res;
+    global_cache.lru_count++;
+    res->in_lru = true;
+}
 
-        switch (type) {
-            case ResourceType_GLTF: {
-                gltf_model_load(&res->model, path, gen_collisions);
-                log("[resource_cache::gltf] Loaded GLTF %s", path.c_str());
-                break;
-            }
-            case ResourceType_Texture: {
-                uploader_ctx_enqueue(path, &res->tex);
-                break;
+void resource_cache_lru_unlink(resource *res)
+{
+    if (res->lru_prev) {
+        res->lru_prev->lru_next = res->lru_next;
+    } else {
+        global_cache.lru_head = res->lru_next;
+    }
+    if (res->lru_next) {
+        res->lru_next->lru_prev = res->lru_prev;
+    } else {
+        global_cache.lru_tail = res->lru_prev;
+    }
+    res->lru_prev = nullptr;
+    res->lru_next = nullptr;
+    global_cache.lru_count--;
+    res->in_lru = false;
+}
+
+/// @note(ame): shard lock held. In the map with 0 references means it is on the LRU list.
+void resource_cache_acquire(resource *res)
+{
+    if (res->ref_count++ == 0) {
+        std::unique_lock<std::mutex> lock(global_cache.lru_lock);
+        resource_cache_lru_unlink(res);
+        global_cache.stats.revived++;
+    }
+    global_cache.stats.hits++;
+}
+
+/// @note(ame): RESIDENCY, main thread
+
+void resource_cache_measure_node(gltf_node *node, u64 *bytes)
+{
+    if (!node) {
+        return;
+    }
+
+    for (auto& primitive : node->primitives) {
+        *bytes += primitive.vertex_buffer.size + primitive.index_buffer.size;
+    }
+    for (auto& model_buffer : node->model_buffer) {
+        *bytes += model_buffer.size;
+    }
+    for (gltf_node *child : node->children) {
+        resource_cache_measure_node(child, bytes);
+    }
+}
+
+/// @note(ame): returns false while a texture is still streaming in, its size isn't known yet
+bool resource_cache_measure(resource *res)
+{
+    switch (res->type) {
+        case ResourceType_GLTF: {
+            res->cpu_bytes = geometry_memory(res->model.geometry);
+            resource_cache_measure_node(res->model.root, &res->gpu_bytes);
+            break;
+        }
+        case ResourceType_Texture: {
+            if (!res->ready) {
+                return false;
             }
+            res->gpu_bytes = texture_get_size(&res->tex);
+            break;
         }
+    }
+
+    resource_residency& residency = global_cache.residency;
+    residency.cpu_bytes[res->type] += res->cpu_bytes;
+    residency.gpu_bytes[res->type] += res->gpu_bytes;
+    residency.cpu_total += res->cpu_bytes;
+    residency.gpu_total += res->gpu_bytes;
+    res->measured = true;
+    return true;
+}
+
+/// @note(ame): main thread, the CPU side must be done
+void resource_cache_create(resource *res)
+{
+    if (res->created) {
+        return;
+    }
+
+    switch (res->type) {
+        case ResourceType_GLTF: {
+            gltf_model_upload(&res->model, &res->import);
+            log("[resource_cache::gltf] Loaded GLTF %s", res->path.c_str());
+            break;
+        }
+        case ResourceType_Texture: {
+            uploader_ctx_enqueue(res->path, &res->tex, &res->ready);
+            break;
+        }
+    }
 
-        global_cache.resources[path] = res;
-        return global_cache.resources[path];
+    res->created = true;
+    res->state = ResourceState_Ready;
+
+    global_cache.residency.count[res->type]++;
+    if (!resource_cache_measure(res)) {
+        global_cache.residency.unmeasured.push_back(res);
     }
 }
 
-void resource_cache_give_back(resource *res)
+/// @note(ame): main thread, the resource is out of the map already
+void resource_cache_destroy(resource *res)
 {
-    res->ref_count--;
-    if (res->ref_count == 0) {
-        log("[resource_cache] Resource %s reached ref_count 0 -- deallocating.", res->path.c_str());
+    job_wait(&res->loading);
+
+    if (res->created) {
+        log("[resource_cache] Evicting %s", res->path.c_str());
+
+        resource_residency& residency = global_cache.residency;
+        residency.count[res->type]--;
+        if (res->measured) {
+            residency.cpu_bytes[res->type] -= res->cpu_bytes;
+            residency.gpu_bytes[res->type] -= res->gpu_bytes;
+            residency.cpu_total -= res->cpu_bytes;
+            residency.gpu_total -= res->gpu_bytes;
+        } else {
+            residency.unmeasured.erase(std::find(residency.unmeasured.begin(), residency.unmeasured.end(), res));
+        }
+
         switch (res->type) {
             case ResourceType_Texture:
-                texture_free(&res->tex);
+                /// @note(ame): a texture that never got created has nothing to free
+                if (res->ready || !uploader_ctx_cancel(&res->tex)) {
+                    texture_free(&res->tex);
+                }
                 break;
             case ResourceType_GLTF:
                 gltf_model_free(&res->model);
                 break;
         }
-        global_cache.resources.erase(res->path);
-        delete res;
+    } else {
+        if (res->type == ResourceType_GLTF) {
+            gltf_model_discard(&res->model, &res->import);
+        }
+        global_cache.stats.discarded++;
+    }
+
+    global_cache.stats.freed++;
+    delete res;
+}
+
+const char *resource_type_names[ResourceType_Max] = { "gltf", "texture", "skybox", "audio", "navmesh", "script" };
+
+void resource_cache_stats_command(std::vector<std::string> args)
+{
+    u64 resident = 0;
+    for (auto& shard : global_cache.shards) {
+        std::unique_lock<std::mutex> lock(shard.lock);
+        resident += shard.resources.size();
+    }
+    u64 unreferenced;
+    {
+        std::unique_lock<std::mutex> lock(global_cache.lru_lock);
+        unreferenced = global_cache.lru_count;
+    }
+
+    const resource_cache_stats& stats = global_cache.stats;
+    const resource_residency& residency = global_cache.residency;
+    log("[resource_cache] %llu resident (%llu unreferenced) | %.2f MB CPU / %u MB, %.2f MB GPU / %u MB", resident, unreferenced,
+        residency.cpu_total / (1024.0 * 1024.0), cvar_get("resource_cpu_mb")->as.u, residency.gpu_total / (1024.0 * 1024.0), cvar_get("resource_gpu_mb")->as.u);
+    for (u32 i = 0; i < ResourceType_Max; i++) {
+        if (residency.count[i]) {
+            log("[resource_cache]   %-8s %5llu | %.2f MB CPU, %.2f MB GPU", resource_type_names[i], residency.count[i], residency.cpu_bytes[i] / (1024.0 * 1024.0), residency.gpu_bytes[i] / (1024.0 * 1024.0));
+        }
+    }
+    log("[resource_cache] %llu requests, %llu hits (%llu from the LRU), %llu misses, %llu discarded | %llu evictions (%.2f MB) | %llu waiting on the main thread",
+        stats.requests.load(), stats.hits.load(), stats.revived.load(), stats.loads.load(), stats.discarded.load(), stats.evictions.load(), stats.evicted_bytes / (1024.0 * 1024.0), mpmc_queue_size(&global_cache.loaded));
+}
+
+void resource_cache_init()
+{
+    for (auto& shard : global_cache.shards) {
+        shard.resources = {};
     }
+    mpmc_queue_init(&global_cache.loaded, RESOURCE_CACHE_QUEUE_CAPACITY);
+    global_cache.main_thread = std::this_thread::get_id();
+
+    cvar_register_unsigned("resource_cpu_mb", 1024);
+    cvar_register_unsigned("resource_gpu_mb", 2048);
+
+    dev_console_add_command("resource_cache_stats", resource_cache_stats_command);
+    dev_console_add_command("resource_cache_trim", [](std::vector<std::string> args) {
+        resource_cache_evict(0, 0);
+    });
+    log("[resource_cache] intialized resource cache");
+}
+
+resource *resource_cache_request(const std::string& path, resource_type type, bool gen_collisions)
+{
+    global_cache.stats.requests++;
+
+    /// @note(ame): textures requested from the main thread get enqueued right away, everything else goes through the loaded queue
+    bool queued = type == ResourceType_GLTF || !resource_cache_on_main_thread();
+
+    resource *res;
+    resource_cache_shard *shard = resource_cache_shard_of(path);
+    {
+        std::unique_lock<std::mutex> lock(shard->lock);
+        auto [it, inserted] = shard->resources.try_emplace(path, nullptr);
+        if (!inserted) {
+            resource_cache_acquire(it->second);
+            return it->second;
+        }
+
+        res = new resource;
+        res->path = path;
+        res->type = type;
+        res->gen_collisions = gen_collisions;
+        res->ready = type != ResourceType_Texture;
+        res->ref_count = queued ? 2 : 1;
+        it->second = res;
+    }
+    global_cache.stats.loads++;
+
+    switch (type) {
+        case ResourceType_GLTF: {
+            job_push([res]() {
+                gltf_model_import(&res->model, &res->import, res->path, res->gen_collisions);
+                resource_cache_queue_push(&global_cache.loaded, res);
+            }, &res->loading);
+            break;
+        }
+        case ResourceType_Texture: {
+            if (queued) {
+                resource_cache_queue_push(&global_cache.loaded, res);
+            } else {
+                resource_cache_create(res);
+            }
+            break;
+        }
+    }
+    return res;
+}
+
+void resource_cache_wait(resource *res)
+{
+    if (res->state == ResourceState_Ready) {
+        return;
+    }
+
+    job_wait(&res->loading);
+    if (resource_cache_on_main_thread()) {
+        resource_cache_create(res);
+        return;
+    }
+
+    /// @note(ame): the GPU side is up to resource_cache_update
+    while (res->state != ResourceState_Ready) {
+        std::this_thread::yield();
+    }
+}
+
+void resource_cache_wait_all(const std::vector<resource*>& set)
+{
+    /// @note(ame): every CPU side first, they were all pushed before we got here so they already overlap
+    for (resource *res : set) {
+        job_wait(&res->loading);
+    }
+    for (resource *res : set) {
+        resource_cache_wait(res);
+    }
+}
+
+resource *resource_cache_get(const std::string& path, resource_type type, bool gen_collisions)
+{
+    resource *res = resource_cache_request(path, type, gen_collisions);
+    resource_cache_wait(res);
+    return res;
+}
+
+resource *resource_cache_get_imported(const std::string& path, gltf_model *model, gltf_load_state *state)
+{
+    resource *res;
+    bool inserted;
+    resource_cache_shard *shard = resource_cache_shard_of(path);
+    {
+        std::unique_lock<std::mutex> lock(shard->lock);
+        auto it = shard->resources.try_emplace(path, nullptr);
+        inserted = it.second;
+        if (!inserted) {
+            res = it.first->second;
+            resource_cache_acquire(res);
+        } else {
+            res = new resource;
+            res->path = path;
+            res->type = ResourceType_GLTF;
+            res->gen_collisions = model->gen_collisions;
+            res->ref_count = 1;
+            it.first->second = res;
+        }
+    }
+    global_cache.stats.requests++;
+
+    if (!inserted) {
+        log("[resource_cache] reusing asset %s, dropping its import", path.c_str());
+        gltf_model_discard(model, state);
+        resource_cache_wait(res);
+        return res;
+    }
+
+    res->model = std::move(*model);
+    gltf_model_upload(&res->model, state);
+    res->created = true;
+    res->state = ResourceState_Ready;
+    global_cache.stats.loads++;
+    log("[resource_cache::gltf] Uploaded imported GLTF %s", path.c_str());
+    return res;
+}
+
+void resource_cache_give_back(resource *res)
+{
+    /// @note(ame): lock free unless this might be the last reference
+    u32 count = res->ref_count.load();
+    while (count > 1) {
+        if (res->ref_count.compare_exchange_weak(count, count - 1)) {
+            return;
+        }
+    }
+
+    resource_cache_shard *shard = resource_cache_shard_of(res->path);
+    std::unique_lock<std::mutex> lock(shard->lock);
+    /// @note(ame): a request may have picked it up while we were taking the lock
+    if (--res->ref_count > 0) {
+        return;
+    }
+
+    /// @note(ame): stays in the map, resource_cache_evict decides when it actually goes
+    std::unique_lock<std::mutex> lru(global_cache.lru_lock);
+    resource_cache_lru_push(res);
+}
+
+/// @note(ame): returns false once the LRU list is empty
+bool resource_cache_evict_one()
+{
+    std::string path;
+    {
+        std::unique_lock<std::mutex> lock(global_cache.lru_lock);
+        if (!global_cache.lru_tail) {
+            return false;
+        }
+        path = global_cache.lru_tail->path;
+    }
+
+    /// @note(ame): lock order is shard first, so look again, it may have been requested in between
+    resource *victim = nullptr;
+    {
+        resource_cache_shard *shard = resource_cache_shard_of(path);
+        std::unique_lock<std::mutex> lock(shard->lock);
+        std::unique_lock<std::mutex> lru(global_cache.lru_lock);
+        auto it = shard->resources.find(path);
+        if (it != shard->resources.end() && it->second->in_lru) {
+            victim = it->second;
+            resource_cache_lru_unlink(victim);
+            shard->resources.erase(it);
+        }
+    }
+
+    if (victim) {
+        global_cache.stats.evictions++;
+        global_cache.stats.evicted_bytes += victim->cpu_bytes + victim->gpu_bytes;
+        resource_cache_destroy(victim);
+    }
+    return true;
+}
+
+void resource_cache_evict(u64 cpu_budget, u64 gpu_budget)
+{
+    const resource_residency& residency = global_cache.residency;
+    while (residency.cpu_total > cpu_budget || residency.gpu_total > gpu_budget) {
+        if (!resource_cache_evict_one()) {
+            break;
+        }
+    }
+}
+
+void resource_cache_update()
+{
+    resource *res;
+    while (mpmc_queue_pop(&global_cache.loaded, &res)) {
+        /// @note(ame): if the queue holds the last reference, drop it without ever creating the GPU side
+        bool wanted = true;
+        {
+            resource_cache_shard *shard = resource_cache_shard_of(res->path);
+            std::unique_lock<std::mutex> lock(shard->lock);
+            if (res->ref_count == 1) {
+                wanted = false;
+                res->ref_count = 0;
+                shard->resources.erase(res->path);
+            }
+        }
+
+        if (wanted) {
+            resource_cache_create(res);
+            resource_cache_give_back(res);
+        } else {
+            resource_cache_destroy(res);
+        }
+    }
+
+    /// @note(ame): textures only get a size once they are done streaming
+    std::vector<resource*>& unmeasured = global_cache.residency.unmeasured;
+    for (u64 i = 0; i < unmeasured.size();) {
+        if (resource_cache_measure(unmeasured[i])) {
+            unmeasured[i] = unmeasured.back();
+            unmeasured.pop_back();
+        } else {
+            i++;
+        }
+    }
+
+    static console_var *cpu_budget = cvar_get("resource_cpu_mb");
+    static console_var *gpu_budget = cvar_get("resource_gpu_mb");
+    resource_cache_evict(u64(cpu_budget->as.u) * 1024 * 1024, u64(gpu_budget->as.u) * 1024 * 1024);
 }
 
 void resource_cache_free()
 {
-    for (auto& res : global_cache.resources) {
-        if (res.second->ref_count > 0) {
-            log("[resource_cache] forgot to free resource %s, ref_count: %d", res.first.c_str(), res.second->ref_count);
-            resource_cache_give_back(res.second);
+    std::vector<resource*> remaining;
+    for (auto& shard : global_cache.shards) {
+        std::unique_lock<std::mutex> lock(shard.lock);
+        for (auto& res : shard.resources) {
+            remaining.push_back(res.second);
+        }
+    }
+
+    /// @note(ame): nothing can be left running on the job system
+    for (resource *res : remaining) {
+        job_wait(&res->loading);
+    }
+    resource_cache_update();
+
+    remaining.clear();
+    for (auto& shard : global_cache.shards) {
+        std::unique_lock<std::mutex> lock(shard.lock);
+        for (auto& res : shard.resources) {
+            remaining.push_back(res.second);
         }
     }
+    for (resource *res : remaining) {
+        if (res->ref_count > 0) {
+            log("[resource_cache] forgot to free resource %s, ref_count: %d", res->path.c_str(), res->ref_count.load());
+            resource_cache_give_back(res);
+        }
+    }
+
+    /// @note(ame): evicting a model gives back its textures, keep going until the list stays empty
+    while (resource_cache_evict_one());
 }
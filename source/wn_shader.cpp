@@ -7,12 +7,15 @@
 #include <atlbase.h>
 #include <dxcapi.h>
 #include <wrl/client.h>
-#include <sstream>
+#include <algorithm>
 
 #include "wn_shader.h"
 #include "wn_filesystem.h"
 #include "wn_output.h"
 #include "wn_util.h"
+#include "wn_asset_cache.h"
+
+#define SHADER_DEBUG_INFO 1
 
 const char *GetProfileFromType(shader_type type)
 {
@@ -30,40 +33,69 @@ const char *GetProfileFromType(shader_type type)
     return "???";
 }
 
+/// @note(ame): the file plus everything it #includes, transitively. Quoted includes are looked up next to the including
+/// file first, then from the working directory, same as DXC's default include handler.
+void shader_collect_sources(const std::string& path, std::vector<std::string>& sources)
+{
+    if (std::find(sources.begin(), sources.end(), path) != sources.end()) {
+        return;
+    }
+    sources.push_back(path);
+
+    std::string directory = path.substr(0, path.find_last_of('/') + 1);
+    std::string source = fs_readtext(path);
+
+    u64 cursor = 0;
+    while ((cursor = source.find("#include", cursor)) != std::string::npos) {
+        u64 open = source.find_first_of("\"<\n", cursor);
+        cursor += 8;
+        if (open == std::string::npos || source[open] == '\n') {
+            continue;
+        }
+        u64 close = source.find_first_of(source[open] == '<' ? ">\n" : "\"\n", open + 1);
+        if (close == std::string::npos || source[close] == '\n') {
+            continue;
+        }
+
+        std::string name = source.substr(open + 1, close - open - 1);
+        if (fs_exists(directory + name)) {
+            shader_collect_sources(directory + name, sources);
+        } else if (fs_exists(name)) {
+            shader_collect_sources(name, sources);
+        }
+    }
+}
+
 compiled_shader shader_compile(const std::string& path, shader_type type)
 {
     compiled_shader shader = {};
     bool compile = false;
 
-    if (!fs_exists(".cache")) {
-        fs_createdir(".cache/");
-    }
-
-    /// @note(ame): Check if the thingy is not already in cache
-    std::stringstream ss;
-    ss << ".cache/" << wn_hash(path.c_str(), path.size(), 1000) << ".wns";
-    if (fs_exists(ss.str())) {
-        /// @note(ame): exists, load the bitch in and thats it
-        shader_header header;
+    /// @note(ame): keyed on the source bytes of the shader and its includes, the stage and the compiler arguments below
+    std::vector<std::string> sources;
+    shader_collect_sources(path, sources);
+
+    u32 settings[] = { (u32)type, SHADER_DEBUG_INFO };
+    u64 key = asset_cache_key(sources, "shader", SHADER_IMPORTER_VERSION, wn_hash(settings, sizeof(settings), 1000));
+
+    std::string cached;
+    fs_mapped_file file;
+    if (asset_cache_lookup(key, ".wns", &cached) && fs_map(&file, cached)) {
+        const shader_header *header = reinterpret_cast<const shader_header*>(file.data);
+        bool valid = file.size >= sizeof(shader_header) && header->size <= file.size - sizeof(shader_header);
+        if (valid) {
+            const u8 *bytecode = file.data + sizeof(shader_header);
+            shader.bytes.assign(bytecode, bytecode + header->size);
+        }
+        fs_unmap(&file);
 
-        FILE* f = fopen(ss.str().c_str(), "rb");
-        fread(&header, sizeof(shader_header), 1, f);
-        
-        /// @note(ame): compare filetimes
-        u32 uncached_low, uncached_high;
-        fs_getfiletime(path, uncached_low, uncached_high);
-        if (uncached_low == header.low_time && uncached_high == header.high_time) {
-            shader.bytes.resize(header.size);
-            fread(shader.bytes.data(), header.size, 1, f);
+        if (valid) {
             log("[shader] Loaded cached shader %s", path.c_str());
             return shader;
-        } else {
-            log("[shader] Shader %s was modified -- recompiling", path.c_str());
-            compile = true;
         }
-    } else {
-        compile = true;
+        log("[shader] Cached shader %s is truncated -- recompiling", cached.c_str());
     }
+    compile = true;
 
     if (compile) {
         using namespace Microsoft::WRL;
@@ -95,10 +127,12 @@ compiled_shader shader_compile(const std::string& path, shader_type type)
         }
 
         LPCWSTR args[] = {
+#if SHADER_DEBUG_INFO
             L"-Zi",
             L"-Fd",
             L"-Fre",
             L"-Qembed_debug", /// @todo(ame): remove
+#endif
             L"-Wno-payload-access-perf",
             L"-Wno-payload-access-shader"
         };
@@ -124,19 +158,26 @@ compiled_shader shader_compile(const std::string& path, shader_type type)
         shader.bytes.resize(shader_blob->GetBufferSize());
         memcpy(shader.bytes.data(), shader_blob->GetBufferPointer(), shader.bytes.size());
     
-        u32 uncached_low, uncached_high;
-        fs_getfiletime(path, uncached_low, uncached_high);
+        /// @note(ame): don't cache broken shaders, hot reload would keep serving them
+        if (shader.errors) {
+            return shader;
+        }
 
         shader_header header;
-        header.high_time = uncached_high;
-        header.low_time = uncached_low;
         header.type = type;
         header.size = shader.bytes.size();
 
-        FILE* f = fopen(ss.str().c_str(), "wb+");
-        fwrite(&header, sizeof(header), 1, f);
-        fwrite(shader.bytes.data(), shader.bytes.size(), 1, f);
-        fclose(f);
+        std::string temp = asset_cache_temp_path(key);
+        FILE* f = fopen(temp.c_str(), "wb+");
+        bool written = f && fwrite(&header, sizeof(header), 1, f) == 1;
+        written = written && (shader.bytes.empty() || fwrite(shader.bytes.data(), shader.bytes.size(), 1, f) == 1);
+        written = f && fclose(f) == 0 && written;
+        if (!written) {
+            log("[shader] Failed to cache shader %s", path.c_str());
+            asset_cache_discard(temp);
+            return shader;
+        }
+        asset_cache_commit(key, temp, ".wns");
 
         log("[shader] Compiled and cached shader %s", path.c_str());
     }
@@ -19,6 +19,13 @@ f32 timer_elasped(timer *t)
     return (end.QuadPart - t->start.QuadPart) * 1000.0 / t->frequency.QuadPart;
 }
 
+f64 timer_elasped_us(timer *t)
+{
+    LARGE_INTEGER end;
+    QueryPerformanceCounter(&end);
+    return (end.QuadPart - t->start.QuadPart) * 1000000.0 / t->frequency.QuadPart;
+}
+
 void timer_restart(timer *t)
 {
     QueryPerformanceCounter(&t->start);
@@ -4,80 +4,576 @@
 // $Create Time: 2024-11-05 17:14:53
 //
 
+#include <thread>
+#include <algorithm>
+
 #include "wn_uploader.h"
 #include "wn_video.h"
-#include "wn_timer.h"
+#include "wn_cvar.h"
+#include "wn_dev_console.h"
+
+#define UPLOADER_QUEUE_CAPACITY 65536
 
 uploader_ctx uploader;
 
-void uploader_ctx_enqueue(const std::string& path, texture *out)
+/// @note(ame): ring
+
+void upload_ring_init(upload_ring *ring, u8 *memory, u64 size)
 {
-    upload_job job;
-    job.path = path;
-    uncompressed_bitmap_load(&job.bitmap, path);
-    job.output_tex = out;
-    uploader.jobs.push_back(job);
+    ring->memory = memory;
+    ring->size = size;
+    ring->head = 0;
+    ring->tail = 0;
+    ring->used = 0;
+    ring->in_flight.clear();
+    ring->unsubmitted = 0;
+}
 
-    log("[uploader::texture] Enqueued texture %s", path.c_str());
+bool upload_ring_alloc(upload_ring *ring, u64 size, u64 alignment, u64 *offset)
+{
+    if (size > ring->size) {
+        return false;
+    }
+    if (ring->used == 0) {
+        ring->head = 0;
+        ring->tail = 0;
+    }
+
+    u64 begin = ring->head;
+    u64 aligned = (begin + alignment - 1) & ~(alignment - 1);
+    u64 start = 0;
+    if (ring->head >= ring->tail && ring->used < ring->size) {
+        /// @note(ame): free space is [head, size) + [0, tail)
+        if (aligned + size <= ring->size) {
+            start = aligned;
+        } else if (size <= ring->tail) {
+            start = 0; /// @note(ame): wrap, the end of the ring is wasted until this region retires
+        } else {
+            return false;
+        }
+    } else {
+        /// @note(ame): free space is [head, tail)
+        if (aligned + size <= ring->tail) {
+            start = aligned;
+        } else {
+            return false;
+        }
+    }
+
+    u64 end = start + size;
+    u64 bytes = start >= begin ? end - begin : (ring->size - begin) + end;
+
+    ring->head = end;
+    ring->used += bytes;
+    ring->in_flight.push_back({ bytes, end, 0 });
+    ring->unsubmitted++;
+
+    *offset = start;
+    return true;
 }
 
-void uploader_ctx_flush()
+void upload_ring_submit(upload_ring *ring, u64 fence_value)
 {
-    timer t;
-    timer_init(&t);
+    for (u64 i = ring->in_flight.size() - ring->unsubmitted; i < ring->in_flight.size(); i++) {
+        ring->in_flight[i].fence_value = fence_value;
+    }
+    ring->unsubmitted = 0;
+}
+
+void upload_ring_retire(upload_ring *ring, u64 completed_value)
+{
+    u64 submitted = ring->in_flight.size() - ring->unsubmitted;
+    while (submitted > 0 && ring->in_flight.front().fence_value <= completed_value) {
+        ring->tail = ring->in_flight.front().end;
+        ring->used -= ring->in_flight.front().bytes;
+        ring->in_flight.pop_front();
+        submitted--;
+    }
+}
+
+/// @note(ame): null backend
+
+null_copy_backend::null_copy_backend()
+{
+    timer_init(&clock);
+}
+
+u8 *null_copy_backend::create_ring(u64 size)
+{
+    ring.resize(size);
+    return ring.data();
+}
+
+void null_copy_backend::destroy_ring()
+{
+    ring.clear();
+    ring.shrink_to_fit();
+    dedicated.clear();
+}
+
+u64 null_copy_backend::prepare(upload_request *request)
+{
+    return uncompressed_bitmap_size(&request->bitmap);
+}
+
+void null_copy_backend::record(upload_request *request, u8 *staging, u64 ring_offset)
+{
+    memcpy(staging, uncompressed_bitmap_data(&request->bitmap), uncompressed_bitmap_size(&request->bitmap));
+    recorded++;
+}
+
+void null_copy_backend::record_dedicated(upload_request *request)
+{
+    const u8 *pixels = uncompressed_bitmap_data(&request->bitmap);
+    dedicated.push_back({ 0, std::vector<u8>(pixels, pixels + uncompressed_bitmap_size(&request->bitmap)) });
+    pending_dedicated++;
+    recorded++;
+}
+
+u64 null_copy_backend::submit()
+{
+    fence_value++;
+    submits.push_back({ fence_value, timer_elasped(&clock) });
+    for (auto& staging : dedicated) {
+        if (staging.first == 0) {
+            staging.first = fence_value;
+        }
+    }
+    pending_dedicated = 0;
+    return fence_value;
+}
+
+u64 null_copy_backend::completed_value()
+{
+    f64 now = timer_elasped(&clock);
+    while (!submits.empty() && submits.front().second + latency_ms <= now) {
+        completed = submits.front().first;
+        submits.pop_front();
+    }
+    return completed;
+}
+
+void null_copy_backend::retire(u64 completed_value)
+{
+    dedicated.erase(std::remove_if(dedicated.begin(), dedicated.end(), [&](const std::pair<u64, std::vector<u8>>& staging) {
+        return staging.first != 0 && staging.first <= completed_value;
+    }), dedicated.end());
+}
+
+void null_copy_backend::wait(u64 value)
+{
+    while (!submits.empty() && submits.front().first <= value) {
+        f64 remaining = submits.front().second + latency_ms - timer_elasped(&clock);
+        if (remaining > 0.0) {
+            std::this_thread::sleep_for(std::chrono::microseconds((i64)(remaining * 1000.0)));
+        }
+        completed = submits.front().first;
+        submits.pop_front();
+    }
+}
+
+/// @note(ame): D3D12 backend. One persistently mapped upload buffer for the ring, copies go on the graphics queue
+/// but get their own fence so the uploader never waits on a whole frame.
+
+struct d3d12_upload_cmd
+{
+    command_buffer cmd;
+    u64 fence_value;
+};
+
+struct d3d12_copy_backend : public copy_backend
+{
+    buffer ring_buffer = {};
+    u8 *ring_mapped = nullptr;
+    fence upload_fence;
 
-    std::vector<buffer> temporary_buffers;
+    std::vector<d3d12_upload_cmd*> cmds;
+    d3d12_upload_cmd *recording = nullptr;
+    std::vector<std::pair<u64, buffer*>> dedicated; /// @note(ame): fence value 0 means not submitted yet
 
-    command_buffer cmd_buf = {};
-    command_buffer_init(&cmd_buf, D3D12_COMMAND_LIST_TYPE_DIRECT, false);
-    command_buffer_begin(&cmd_buf, false);
+    d3d12_copy_backend()
+    {
+        alignment = D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT;
+        fence_init(&upload_fence);
+    }
+
+    ~d3d12_copy_backend()
+    {
+        fence_free(&upload_fence);
+    }
 
-    for (auto& job : uploader.jobs) {
-        buffer staging = {};
+    void begin_recording()
+    {
+        if (recording) {
+            return;
+        }
 
-        texture_init(job.output_tex, job.bitmap.width, job.bitmap.height, job.bitmap.compressed ? DXGI_FORMAT_BC7_UNORM : DXGI_FORMAT_R8G8B8A8_UNORM_SRGB, 0, job.bitmap.levels, false, job.path);
-        u64 texture_size = texture_get_size(job.output_tex);
-        
-        /// @note(ame): this is very ugly and i should not have any D3D12 code in here, but bare with me, it works, so I'm just not gonna touch it lol
-        D3D12_RESOURCE_DESC desc = job.output_tex->resource.resource->GetDesc();
+        /// @note(ame): the fence only moves forward, so any list whose submit passed can be reset
+        u64 done = fence_completed_value(&upload_fence);
+        for (auto *upload : cmds) {
+            if (upload->fence_value <= done) {
+                recording = upload;
+                command_buffer_begin(&recording->cmd, true);
+                return;
+            }
+        }
+
+        recording = new d3d12_upload_cmd;
+        recording->fence_value = 0;
+        command_buffer_init(&recording->cmd, D3D12_COMMAND_LIST_TYPE_DIRECT, false);
+        command_buffer_begin(&recording->cmd, false);
+        cmds.push_back(recording);
+    }
+
+    void write_rows(upload_request *request, u8 *mapped, u64 base_offset)
+    {
+        D3D12_RESOURCE_DESC desc = request->output_tex->resource.resource->GetDesc();
         std::vector<D3D12_PLACED_SUBRESOURCE_FOOTPRINT> footprints(desc.MipLevels);
         std::vector<u32> num_rows(desc.MipLevels);
         std::vector<u64> row_sizes(desc.MipLevels);
-        uint64_t totalSize = 0;
+        u64 total_size = 0;
 
-        video.device->GetCopyableFootprints(&desc, 0, desc.MipLevels, 0, footprints.data(), num_rows.data(), row_sizes.data(), &totalSize);
+        video.device->GetCopyableFootprints(&desc, 0, desc.MipLevels, base_offset, footprints.data(), num_rows.data(), row_sizes.data(), &total_size);
 
-        u8 *data;
-        u8 *pixels = reinterpret_cast<u8*>(job.bitmap.pixels.data());
-        buffer_init(&staging, texture_size, 0, BufferType_Copy, false, job.path + " Staging");
-        buffer_map(&staging, 0, 0, reinterpret_cast<void**>(&data));
-        memset(data, 0, texture_size);
+        const u8 *pixels = uncompressed_bitmap_data(&request->bitmap);
         for (i32 i = 0; i < desc.MipLevels; i++) {
-            for (i32 j = 0; j < num_rows[i]; j++) {
+            /// @note(ame): every subresource starts on its own aligned offset, not right after the previous one
+            u8 *data = mapped + footprints[i].Offset;
+            for (u32 j = 0; j < num_rows[i]; j++) {
                 memcpy(data, pixels, row_sizes[i]);
 
                 data += footprints[i].Footprint.RowPitch;
                 pixels += row_sizes[i];
             }
         }
-        buffer_unmap(&staging);
-        command_buffer_copy_buffer_to_texture(&cmd_buf, job.output_tex, &staging, job.bitmap.levels);
-        
-        temporary_buffers.push_back(staging);
     }
 
-    command_buffer_end(&cmd_buf);
-    command_queue_submit(&video.graphics_queue, { &cmd_buf });
-    video_wait();
+    u8 *create_ring(u64 size) override
+    {
+        buffer_init(&ring_buffer, size, 0, BufferType_Copy, false, "Upload Ring");
+        buffer_map(&ring_buffer, 0, 0, reinterpret_cast<void**>(&ring_mapped));
+        return ring_mapped;
+    }
+
+    void destroy_ring() override
+    {
+        fence_wait(&upload_fence, upload_fence.value);
+        retire(upload_fence.value);
+
+        buffer_unmap(&ring_buffer);
+        buffer_free(&ring_buffer);
+        ring_mapped = nullptr;
+
+        for (auto *upload : cmds) {
+            command_buffer_free(&upload->cmd);
+            delete upload;
+        }
+        cmds.clear();
+    }
+
+    u64 prepare(upload_request *request) override
+    {
+        uncompressed_bitmap *bitmap = &request->bitmap;
+        DXGI_FORMAT format = DXGI_FORMAT_R8G8B8A8_UNORM_SRGB;
+        if (bitmap->format == BitmapFormat_BC7) {
+            format = DXGI_FORMAT_BC7_UNORM;
+        } else if (bitmap->format == BitmapFormat_BC6H) {
+            format = DXGI_FORMAT_BC6H_UF16;
+        }
+        texture_init(request->output_tex, bitmap->width, bitmap->height, format, 0, bitmap->levels, false, request->path);
+        return texture_get_size(request->output_tex);
+    }
+
+    void record(upload_request *request, u8 *staging, u64 ring_offset) override
+    {
+        /// @note(ame): footprints come back relative to the start of the buffer, so write from the ring base
+        write_rows(request, ring_mapped, ring_offset);
+
+        begin_recording();
+        command_buffer_copy_buffer_to_texture(&recording->cmd, request->output_tex, &ring_buffer, request->bitmap.levels, ring_offset);
+    }
+
+    void record_dedicated(upload_request *request) override
+    {
+        buffer *staging = new buffer;
+        u8 *mapped = nullptr;
+
+        buffer_init(staging, request->staging_size, 0, BufferType_Copy, false, request->path + " Staging");
+        buffer_map(staging, 0, 0, reinterpret_cast<void**>(&mapped));
+        write_rows(request, mapped, 0);
+        buffer_unmap(staging);
+
+        begin_recording();
+        command_buffer_copy_buffer_to_texture(&recording->cmd, request->output_tex, staging, request->bitmap.levels);
+        dedicated.push_back({ 0, staging });
+    }
+
+    u64 submit() override
+    {
+        command_buffer_end(&recording->cmd);
+        command_queue_submit(&video.graphics_queue, { &recording->cmd });
+        u64 value = fence_signal(&upload_fence, &video.graphics_queue);
+
+        recording->fence_value = value;
+        recording = nullptr;
+        for (auto& staging : dedicated) {
+            if (staging.first == 0) {
+                staging.first = value;
+            }
+        }
+        return value;
+    }
+
+    u64 completed_value() override
+    {
+        return fence_completed_value(&upload_fence);
+    }
+
+    void retire(u64 completed) override
+    {
+        for (auto it = dedicated.begin(); it != dedicated.end();) {
+            if (it->first != 0 && it->first <= completed) {
+                buffer_free(it->second);
+                delete it->second;
+                it = dedicated.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    void wait(u64 value) override
+    {
+        fence_wait(&upload_fence, value);
+    }
+};
+
+/// @note(ame): context
+
+void upload_request_free(upload_request *request)
+{
+    /// @note(ame): unmaps cached textures, their pixels were read straight from the file
+    uncompressed_bitmap_free(&request->bitmap);
+    delete request;
+}
+
+void uploader_ctx_init(uploader_ctx *ctx, copy_backend *backend, u64 ring_size)
+{
+    ctx->backend = backend;
+    mpmc_queue_init(&ctx->decoded, UPLOADER_QUEUE_CAPACITY);
+    upload_ring_init(&ctx->ring, backend->create_ring(ring_size), ring_size);
+
+    ctx->stalled = nullptr;
+    ctx->pending.clear();
+    ctx->outstanding = 0;
+    ctx->last_fence = 0;
+    ctx->stats = {};
+}
+
+void uploader_ctx_exit(uploader_ctx *ctx)
+{
+    /// @note(ame): nothing gets uploaded anymore, let the decodes finish and throw them away
+    for (auto& request : ctx->pending) {
+        request.second->cancelled = true;
+    }
+    job_wait(&ctx->decoding);
+
+    upload_request *request = ctx->stalled;
+    ctx->stalled = nullptr;
+    while (request || mpmc_queue_pop(&ctx->decoded, &request)) {
+        upload_request_free(request);
+        request = nullptr;
+    }
+    ctx->pending.clear();
+    ctx->outstanding = 0;
+
+    ctx->backend->wait(ctx->last_fence);
+    ctx->backend->destroy_ring();
+}
+
+void uploader_ctx_push(uploader_ctx *ctx, upload_request *request)
+{
+    if (request->output_tex) {
+        ctx->pending[request->output_tex] = request;
+    }
+    ctx->outstanding++;
+    while (!mpmc_queue_push(&ctx->decoded, request)) {
+        std::this_thread::yield();
+    }
+}
+
+void uploader_ctx_update(uploader_ctx *ctx, u64 budget)
+{
+    u64 completed = ctx->backend->completed_value();
+    upload_ring_retire(&ctx->ring, completed);
+    ctx->backend->retire(completed);
+
+    std::vector<upload_request*> recorded;
+    u64 frame_bytes = 0;
+    while (true) {
+        upload_request *request = ctx->stalled;
+        ctx->stalled = nullptr;
+        if (!request && !mpmc_queue_pop(&ctx->decoded, &request)) {
+            break;
+        }
+
+        if (request->cancelled) {
+            upload_request_free(request);
+            ctx->outstanding--;
+            continue;
+        }
+
+        if (!request->prepared) {
+            request->staging_size = ctx->backend->prepare(request);
+            request->prepared = true;
+        }
+
+        /// @note(ame): the first request of a frame always goes through, or anything bigger than the budget would never upload
+        if (frame_bytes > 0 && frame_bytes + request->staging_size > budget) {
+            ctx->stalled = request;
+            ctx->stats.budget_stalls++;
+            break;
+        }
+
+        if (request->staging_size > ctx->ring.size) {
+            ctx->backend->record_dedicated(request);
+            ctx->stats.dedicated++;
+        } else {
+            u64 offset = 0;
+            if (!upload_ring_alloc(&ctx->ring, request->staging_size, ctx->backend->alignment, &offset)) {
+                ctx->stalled = request;
+                ctx->stats.ring_stalls++;
+                break;
+            }
+            ctx->backend->record(request, ctx->ring.memory + offset, offset);
+        }
+
+        frame_bytes += request->staging_size;
+        recorded.push_back(request);
+    }
+
+    if (!recorded.empty()) {
+        ctx->last_fence = ctx->backend->submit();
+        upload_ring_submit(&ctx->ring, ctx->last_fence);
+
+        for (auto *request : recorded) {
+            if (request->ready) {
+                *request->ready = true;
+            }
+            if (request->output_tex) {
+                ctx->pending.erase(request->output_tex);
+            }
+            upload_request_free(request);
+        }
+        ctx->outstanding -= recorded.size();
+        ctx->stats.textures += recorded.size();
+    }
+
+    ctx->stats.frames++;
+    ctx->stats.bytes += frame_bytes;
+    ctx->stats.max_frame_bytes = std::max(ctx->stats.max_frame_bytes, frame_bytes);
+}
+
+void uploader_ctx_drain(uploader_ctx *ctx)
+{
+    timer t;
+    timer_init(&t);
 
-    /// @note(ame): free staging
-    for (auto& staging : temporary_buffers) {
-        buffer_free(&staging);
+    /// @note(ame): once this returns every outstanding request is sitting in the queue
+    job_wait(&ctx->decoding);
+    while (ctx->outstanding > 0) {
+        uploader_ctx_update(ctx, UINT64_MAX);
+        if (ctx->stalled && !ctx->ring.in_flight.empty()) {
+            /// @note(ame): ring is full, wait for the oldest submit to hand its space back
+            ctx->backend->wait(ctx->ring.in_flight.front().fence_value);
+        }
     }
-    temporary_buffers.clear();
+
+    ctx->stats.flush_wait_ms += timer_elasped(&t);
+}
+
+/// @note(ame): global uploader
+
+void uploader_stats_command(std::vector<std::string> args)
+{
+    uploader_stats *stats = &uploader.stats;
+    log("[uploader] frames: %llu, textures: %llu, uploaded: %.2f MB, max frame: %.2f MB", stats->frames, stats->textures, stats->bytes / (1024.0 * 1024.0), stats->max_frame_bytes / (1024.0 * 1024.0));
+    log("[uploader] budget stalls: %llu, ring stalls: %llu, dedicated: %llu, flush wait: %.2f ms", stats->budget_stalls, stats->ring_stalls, stats->dedicated, stats->flush_wait_ms);
+    log("[uploader] outstanding: %llu, ring: %.2f / %.2f MB", uploader.outstanding, uploader.ring.used / (1024.0 * 1024.0), uploader.ring.size / (1024.0 * 1024.0));
+}
+
+void uploader_init()
+{
+    u64 ring_size = u64(cvar_register_unsigned("upload_ring_mb", 128)->as.u) * 1024 * 1024;
+    cvar_register_unsigned("upload_budget_kb", 32768);
+
+    uploader_ctx_init(&uploader, new d3d12_copy_backend, ring_size);
+    dev_console_add_command("uploader_stats", uploader_stats_command);
+
+    log("[uploader] initialized with a %llu MB staging ring", ring_size / (1024 * 1024));
+}
+
+void uploader_exit()
+{
+    uploader_ctx_exit(&uploader);
+    delete uploader.backend;
+    uploader.backend = nullptr;
+}
+
+void uploader_ctx_enqueue(const std::string& path, texture *out, bool *ready)
+{
+    upload_request *request = new upload_request;
+    request->path = path;
+    request->output_tex = out;
+    request->ready = ready;
+    if (ready) {
+        *ready = false;
+    }
+
+    uploader.pending[out] = request;
+    uploader.outstanding++;
+    job_push([request]() {
+        if (!request->cancelled) {
+            uncompressed_bitmap_load(&request->bitmap, request->path);
+        }
+        /// @note(ame): only spins if tens of thousands of decoded textures are waiting, the main thread drains them
+        while (!mpmc_queue_push(&uploader.decoded, request)) {
+            std::this_thread::yield();
+        }
+    }, &uploader.decoding);
+
+    log("[uploader::texture] Enqueued texture %s", path.c_str());
+}
+
+bool uploader_ctx_cancel(texture *out)
+{
+    auto it = uploader.pending.find(out);
+    if (it == uploader.pending.end()) {
+        return false;
+    }
+
+    upload_request *request = it->second;
+    uploader.pending.erase(it);
+    request->cancelled = true;
+    request->ready = nullptr;
+
+    /// @note(ame): prepare only runs on the main thread, so this can't race with texture_init
+    return !request->prepared;
+}
+
+void uploader_ctx_flush()
+{
+    timer t;
+    timer_init(&t);
+
+    uploader_ctx_drain(&uploader);
 
     f32 secs = TIMER_SECONDS(timer_elasped(&t));
     log("[uploader::texture] Uploader flush took %f seconds", secs);
+}
 
-    uploader.jobs.clear();
+void uploader_update()
+{
+    static console_var *budget = cvar_get("upload_budget_kb");
+    uploader_ctx_update(&uploader, u64(budget->as.u) * 1024);
 }
@@ -7,10 +7,11 @@
 #define _USE_MATH_DEFINES
 #include <cstdlib>
 #include <cmath>
+#include <intrin.h>
 
 #include "wn_util.h"
 
-u64 wn_hash(const void *key, u32 len, u64 seed)
+u64 wn_hash(const void *key, u64 len, u64 seed)
 {
     const u64 m = 0xc6a4a7935bd1e995ULL;
     const u32 r = 47;
@@ -50,3 +51,25 @@ u64 wn_uuid()
 {
     return std::rand();
 }
+
+const cpu_features& wn_cpu_features()
+{
+    static cpu_features features = []() {
+        cpu_features result = {};
+
+        i32 info[4];
+        __cpuid(info, 0);
+        i32 max_leaf = info[0];
+
+        __cpuid(info, 1);
+        result.sse41 = (info[2] & (1 << 19)) != 0;
+        bool os_saves_ymm = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && ((_xgetbv(0) & 6) == 6);
+
+        if (max_leaf >= 7) {
+            __cpuidex(info, 7, 0);
+            result.avx2 = os_saves_ymm && (info[1] & (1 << 5)) != 0;
+        }
+        return result;
+    }();
+    return features;
+}
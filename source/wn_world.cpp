@@ -4,6 +4,8 @@
 // $Create Time: 2024-11-02 16:20:21
 //
 
+#include <cfloat>
+#include <algorithm>
 #include <json/json.hpp>
 
 #include "wn_world.h"
@@ -12,24 +14,77 @@
 #include "wn_util.h"
 #include "wn_notification.h"
 #include "wn_input.h"
+#include "wn_cvar.h"
+#include "wn_timer.h"
+
+game_world_preloader preloader;
 
 void game_world_init(game_world *world, game_world_info *info)
 {
-    /// @note(ame): initialize level
-    world->level = resource_cache_get(info->level_path, ResourceType_GLTF, true);
+    /// @note(ame): import the level and the player together, player_init then finds its model ready
+    world->level = resource_cache_request(info->level_path, ResourceType_GLTF, true);
+    resource *player_model = resource_cache_request(PLAYER_MODEL_PATH, ResourceType_GLTF, false);
+    resource_cache_wait_all({ world->level, player_model });
+    gltf_model_set_collisions(&world->level->model, true);
 
     /// @note(ame): initialize player
     player_init(&world->player, info->start_pos);
+    resource_cache_give_back(player_model);
 
     /// @note(ame): initialize entities
 
+    physics_optimize_broadphase();
+
     log("[world] Loaded world");
 }
 
-void game_world_load(game_world *world, const std::string& path)
+void game_world_enter(game_world *world)
 {
-    nlohmann::json root = fs_loadjson(path);
+    /// @note(ame): snapshots of the previous level don't fit this one, and "level" is only right once the previous
+    /// level's bodies are out of the physics system
+    physics.snapshots.clear();
+    physics_snapshot_save(&physics.snapshots["level"]);
+}
+
+/// @note(ame): navmesh, crowd and pathfinder of a level. Also runs on the preload job, it only touches `mesh`.
+void game_world_navmesh_init(navmesh *mesh, glm::vec3 min, glm::vec3 max, const gltf_model *level)
+{
+    static console_var *max_agents = cvar_get("crowd_max_agents");
 
+    /// @note(ame): baked tiles come straight from the cache
+    navmesh_build_info info;
+    info.min = min;
+    info.max = max;
+    info.geometry = geometry_get_view(level->geometry);
+    info.content_hash = level->source_hash;
+    navmesh_init(mesh, info);
+    crowd_init(mesh, max_agents->as.u);
+    pathfind_init(mesh);
+}
+
+/// @note(ame): same obstacles, give or take the float error of the physics bounds
+bool game_world_same_obstacles(const std::unordered_map<u32, navmesh_obstacle>& a, const std::unordered_map<u32, navmesh_obstacle>& b)
+{
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (auto& [id, obstacle] : a) {
+        auto it = b.find(id);
+        if (it == b.end()) {
+            return false;
+        }
+        glm::vec3 error = glm::max(glm::abs(it->second.min - obstacle.min), glm::abs(it->second.max - obstacle.max));
+        if (glm::any(glm::greaterThan(error, glm::vec3(0.01f)))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/// @note(ame): everything but the JSON read and the level geometry, both come from the caller. `preloaded` is a navmesh
+/// game_world_preload_run already set up for this level, taken over as is.
+void game_world_load_root(game_world *world, const std::string& path, nlohmann::json& root, resource *level, navmesh *preloaded)
+{
     /// @note(ame): load levels
     world->name = root["name"];
     world->serialization_path = path;
@@ -46,16 +101,18 @@ void game_world_load(game_world *world, const std::string& path)
         world->bbox_max.z = root["bbox_max"][2].template get<float>();
     }
 
-    /// @note(ame): Load level geometry
-    world->level = resource_cache_get(root["level_model"], ResourceType_GLTF, true);
+    /// @note(ame): Load level geometry. It might be a resident level we left earlier, with its bodies taken out.
+    world->level = level;
+    gltf_model_set_collisions(&world->level->model, true);
     
     /// @note(ame): Create level navmesh
-    navmesh_build_info info;
-    info.min = world->bbox_min;
-    info.max = world->bbox_max;
-    info.vertices = world->level->model.flattened_vertices;
-    info.indices = world->level->model.flattened_indices;
-    //navmesh_init(&world->world_navmesh, info);
+    if (preloaded) {
+        world->world_navmesh = std::move(*preloaded);
+        *preloaded = navmesh();
+    } else {
+        game_world_navmesh_init(&world->world_navmesh, world->bbox_min, world->bbox_max, &world->level->model);
+    }
+    world->crowd_steps = physics.clock.steps;
 
     /// @note(ame): Load start position and player
     world->start_position.x = root["start_pos"][0].template get<float>();
@@ -110,12 +167,83 @@ void game_world_load(game_world *world, const std::string& path)
         }
     }
 
+    /// @note(ame): a preloaded navmesh has the obstacles carved already, under the ids the props are about to get again
+    std::unordered_map<u32, navmesh_obstacle> carved;
+    if (preloaded) {
+        carved.swap(world->world_navmesh.obstacles);
+        world->world_navmesh.next_obstacle = 1;
+    }
+
+    /// @note(ame): Load bodies
+    if (root.contains("bodies")) {
+        for (auto& body : root["bodies"]) {
+            glm::vec3 body_position;
+            body_position.x = body["position"][0].template get<float>();
+            body_position.y = body["position"][1].template get<float>();
+            body_position.z = body["position"][2].template get<float>();
+
+            glm::vec3 body_size;
+            body_size.x = body["size"][0].template get<float>();
+            body_size.y = body["size"][1].template get<float>();
+            body_size.z = body["size"][2].template get<float>();
+
+            bool dynamic = body.value("dynamic", true);
+            bool obstacle = body.value("navmesh_obstacle", false);
+            entity *prop = game_world_add_body(world, body_position, body_size, dynamic, obstacle);
+
+            /// @note(ame): streams in, the prop shows up once it's there
+            if (body.contains("model")) {
+                prop->model = resource_cache_request(body["model"].template get<std::string>(), ResourceType_GLTF, false);
+                prop->has_model = true;
+            }
+        }
+    }
+
+    /// @note(ame): the obstacles the level starts with are carved right away, the AI shouldn't see through them for a frame
+    if (preloaded) {
+        if (game_world_same_obstacles(carved, world->world_navmesh.obstacles)) {
+            world->world_navmesh.dirty_tiles.clear();
+        } else {
+            for (auto& [id, obstacle] : carved) {
+                navmesh_dirty_bounds(&world->world_navmesh, obstacle.min, obstacle.max);
+            }
+        }
+    }
+    navmesh_flush(&world->world_navmesh);
+
+    /// @note(ame): Load enemies, after the flush so they get placed on the carved navmesh
+    if (root.contains("enemies")) {
+        for (auto& enemy : root["enemies"]) {
+            glm::vec3 enemy_position;
+            enemy_position.x = enemy["position"][0].template get<float>();
+            enemy_position.y = enemy["position"][1].template get<float>();
+            enemy_position.z = enemy["position"][2].template get<float>();
+            game_world_add_enemy(world, enemy_position);
+        }
+    }
+
     world->main_camera_view = player_get_view(&world->player);
 
+    /// @note(ame): no physics_optimize_broadphase, that's a hitch on every transition. The level bodies went in as one
+    /// batch, which already builds them a tree of their own, and the few props and triggers don't need one.
+
     /// @note(ame): Done!
     log("[world] Loaded world %s", path.c_str());
 }
 
+void game_world_load(game_world *world, const std::string& path)
+{
+    nlohmann::json root = fs_loadjson(path);
+
+    /// @note(ame): same as game_world_init, everything in flight at once
+    resource *level = resource_cache_request(root["level_model"], ResourceType_GLTF, true);
+    resource *player_model = resource_cache_request(PLAYER_MODEL_PATH, ResourceType_GLTF, false);
+    resource_cache_wait_all({ level, player_model });
+
+    game_world_load_root(world, path, root, level, nullptr);
+    resource_cache_give_back(player_model);
+}
+
 void game_world_remove_entity(game_world *world, entity* e)
 {
     for (u64 i = 0; i < world->entities.size(); i++) {
@@ -125,6 +253,17 @@ void game_world_remove_entity(game_world *world, entity* e)
             if (e->has_trigger) {
                 physics_trigger_free(&e->trigger);
             }
+            if (e->has_model) {
+                resource_cache_give_back(e->model);
+            }
+            if (e->type == EntityType_Prop) {
+                navmesh_obstacle_remove(&world->world_navmesh, e->navmesh_obstacle);
+                physics_body_free(&e->physics_body);
+            }
+            if (e->type == EntityType_Enemy) {
+                crowd_agent_remove(&world->world_navmesh, e->crowd_agent);
+                physics_character_free(&e->character);
+            }
             delete e;
         }
     }
@@ -159,8 +298,7 @@ entity* game_world_add_trigger(game_world *world, glm::vec3 position, glm::vec3
     /// @note(ame): for camera triggers
     {
         auto enter_function = [&](entity* trigger, entity *e) {
-            if (e->has_physics_character && trigger->t_type == TriggerType_Camera) {
-                /// @note(ame): Assume that this is a player
+            if (e == &trigger->parent_world->player && trigger->t_type == TriggerType_Camera) {
 
                 /// @note(ame): I might change this to not recompute the view matrix on enter, but it is what it is
                 trigger->view_matrix = glm::lookAt(trigger->point_position, trigger->point_position + glm::normalize(trigger->point_forward), glm::vec3(0, 1, 0));
@@ -173,7 +311,7 @@ entity* game_world_add_trigger(game_world *world, glm::vec3 position, glm::vec3
         new_entity->trigger.on_trigger_enter = world->on_enter_callbacks.back();
 
         auto exit_function = [&](entity* trigger, entity *e) {
-            if (e->has_physics_character && trigger->t_type == TriggerType_Camera) {
+            if (e == &trigger->parent_world->player && trigger->t_type == TriggerType_Camera) {
                 trigger->parent_world->main_camera_view = player_get_view(&trigger->parent_world->player);
                 trigger->parent_world->using_player_cam = true;
             }
@@ -187,6 +325,57 @@ entity* game_world_add_trigger(game_world *world, glm::vec3 position, glm::vec3
     return new_entity;
 }
 
+entity* game_world_add_body(game_world *world, glm::vec3 position, glm::vec3 size, bool dynamic, bool navmesh_obstacle)
+{
+    entity* new_entity = new entity;
+    new_entity->type = EntityType_Prop;
+    new_entity->id = wn_uuid();
+    new_entity->has_trigger = false;
+    new_entity->has_physics_body = true;
+    new_entity->has_physics_character = false;
+    new_entity->parent_world = world;
+
+    physics_body_init(&new_entity->physics_body, new box_shape(size, physics_materials::LevelMaterial), position, !dynamic, new_entity);
+    new_entity->spawn_position = position;
+    new_entity->spawn_size = size;
+
+    if (navmesh_obstacle) {
+        glm::vec3 min, max;
+        physics_body_get_bounds(&new_entity->physics_body, &min, &max);
+        new_entity->navmesh_obstacle = navmesh_obstacle_add(&world->world_navmesh, min, max);
+    }
+
+    world->entities.push_back(new_entity);
+    return new_entity;
+}
+
+entity* game_world_add_enemy(game_world *world, glm::vec3 position)
+{
+    entity* new_entity = new entity;
+    new_entity->type = EntityType_Enemy;
+    new_entity->name = "Enemy";
+    new_entity->id = wn_uuid();
+    new_entity->has_model = false;
+    new_entity->has_trigger = false;
+    new_entity->has_physics_body = false;
+    new_entity->has_physics_character = true;
+    new_entity->has_scripts = false;
+    new_entity->parent_world = world;
+    new_entity->spawn_position = position;
+
+    glm::vec3 center = position + glm::vec3(0.0f, ENEMY_HEIGHT * 0.5f + ENEMY_RADIUS, 0.0f);
+    physics_character_init(&new_entity->character, new capsule_shape(ENEMY_RADIUS, ENEMY_HEIGHT, physics_materials::CharacterMaterial), center, new_entity);
+
+    /// @note(ame): no agent just means it stands still, ie. it was placed off the navmesh
+    new_entity->crowd_agent = crowd_agent_add(&world->world_navmesh, position, ENEMY_RADIUS, ENEMY_HEIGHT + ENEMY_RADIUS * 2.0f, ENEMY_SPEED);
+    if (new_entity->crowd_agent < 0) {
+        log("[world] Enemy at (%.1f, %.1f, %.1f) didn't get a crowd agent", position.x, position.y, position.z);
+    }
+
+    world->entities.push_back(new_entity);
+    return new_entity;
+}
+
 void game_world_save(game_world *world, const std::string& path)
 {
     std::string save_path = path;
@@ -241,12 +430,117 @@ void game_world_save(game_world *world, const std::string& path)
         }
     }
 
+    /// @note(ame): Bodies
+    root["bodies"] = nlohmann::json::array();
+    for (auto& entity : world->entities) {
+        if (entity->type == EntityType_Prop) {
+            nlohmann::json entity_root;
+
+            entity_root["position"][0] = entity->spawn_position.x;
+            entity_root["position"][1] = entity->spawn_position.y;
+            entity_root["position"][2] = entity->spawn_position.z;
+
+            entity_root["size"][0] = entity->spawn_size.x;
+            entity_root["size"][1] = entity->spawn_size.y;
+            entity_root["size"][2] = entity->spawn_size.z;
+
+            entity_root["dynamic"] = !entity->physics_body.is_static;
+            entity_root["navmesh_obstacle"] = entity->navmesh_obstacle != 0;
+            if (entity->has_model) {
+                entity_root["model"] = entity->model->path;
+            }
+
+            root["bodies"].push_back(entity_root);
+        }
+    }
+
+    /// @note(ame): Enemies
+    root["enemies"] = nlohmann::json::array();
+    for (auto& entity : world->entities) {
+        if (entity->type == EntityType_Enemy) {
+            nlohmann::json entity_root;
+
+            entity_root["position"][0] = entity->spawn_position.x;
+            entity_root["position"][1] = entity->spawn_position.y;
+            entity_root["position"][2] = entity->spawn_position.z;
+
+            root["enemies"].push_back(entity_root);
+        }
+    }
+
     fs_writejson(save_path, root);    
 }
 
+/// @note(ame): obstacles follow their body once it has moved far enough to matter, the tiles get rebuilt in the background
+void game_world_update_obstacles(game_world *world)
+{
+    static console_var *threshold = cvar_get("navmesh_obstacle_threshold");
+
+    navmesh *mesh = &world->world_navmesh;
+    for (entity *e : world->entities) {
+        if (e->type != EntityType_Prop || !e->navmesh_obstacle) {
+            continue;
+        }
+
+        auto it = mesh->obstacles.find(e->navmesh_obstacle);
+        if (it == mesh->obstacles.end()) {
+            continue;
+        }
+
+        glm::vec3 min, max;
+        physics_body_get_bounds(&e->physics_body, &min, &max);
+        glm::vec3 moved = glm::max(glm::abs(min - it->second.min), glm::abs(max - it->second.max));
+        if (glm::max(moved.x, glm::max(moved.y, moved.z)) > threshold->as.f) {
+            navmesh_obstacle_move(mesh, e->navmesh_obstacle, min, max);
+        }
+    }
+    navmesh_update(mesh);
+}
+
+/// @note(ame): the crowd step kicked last frame ran while that frame rendered. Its velocities go to the characters for
+/// the next physics steps, the agents get put back where the characters actually ended up, then the crowd goes again.
+void game_world_update_enemies(game_world *world)
+{
+    static console_var *retarget = cvar_get("crowd_retarget_distance");
+
+    navmesh *mesh = &world->world_navmesh;
+    if (!mesh->agent_manager) {
+        return;
+    }
+    crowd_wait(mesh);
+
+    glm::vec3 target = world->player.character.position;
+    for (entity *e : world->entities) {
+        if (e->type != EntityType_Enemy || e->crowd_agent < 0) {
+            continue;
+        }
+
+        glm::vec3 feet = e->character.position - glm::vec3(0.0f, ENEMY_HEIGHT * 0.5f + ENEMY_RADIUS, 0.0f);
+        crowd_agent_set_position(mesh, e->crowd_agent, feet);
+
+        /// @note(ame): the crowd only steers on the ground plane, gravity is the character's business
+        glm::vec3 velocity = crowd_agent_get_velocity(mesh, e->crowd_agent);
+        physics_character_move(&e->character, glm::vec3(velocity.x, 0.0f, velocity.z));
+
+        /// @note(ame): replanning every frame would flood the path queue, so only once the player got far enough away
+        if (glm::distance(target, e->crowd_target) > retarget->as.f) {
+            if (crowd_agent_set_target(mesh, e->crowd_agent, target)) {
+                e->crowd_target = target;
+            }
+        }
+    }
+
+    u32 steps = physics.clock.steps - world->crowd_steps;
+    world->crowd_steps = physics.clock.steps;
+    crowd_update_async(mesh, steps, physics.clock.step);
+}
+
 void game_world_update(game_world *world, f32 dt)
 {
     player_update(&world->player, dt);
+    game_world_update_obstacles(world);
+    game_world_update_enemies(world);
+    pathfind_update(&world->world_navmesh);
 
     if (world->using_player_cam) {
         world->main_camera_view = player_get_view(&world->player);
@@ -259,12 +553,264 @@ void game_world_free(game_world *world)
         if (entity->has_trigger) {
             physics_trigger_free(&entity->trigger);
         }
+        if (entity->has_model) {
+            resource_cache_give_back(entity->model);
+        }
+        if (entity->type == EntityType_Prop) {
+            physics_body_free(&entity->physics_body);
+        }
+        if (entity->type == EntityType_Enemy) {
+            physics_character_free(&entity->character);
+        }
         delete entity;
     }
 
-    //navmesh_free(&world->world_navmesh);
+    navmesh_free(&world->world_navmesh);
     world->on_stay_callbacks.clear();
     world->entities.clear();
     player_free(&world->player);
+    /// @note(ame): the level may stay resident in the resource cache, its geometry mustn't stay in the physics world.
+    /// Unless the next world is the same level, which already holds its own reference.
+    game_world_preload_release(world->level);
+    if (world->level->ref_count == 1) {
+        gltf_model_set_collisions(&world->level->model, false);
+    }
     resource_cache_give_back(world->level);
 }
+
+/// @note(ame): PRELOADING
+
+void game_world_preload_cancel()
+{
+    if (preloader.current) {
+        log("[world] Cancelled preload of %s", preloader.current->path.c_str());
+        preloader.current->cancelled = true;
+        preloader.cancelled.push_back(preloader.current);
+        preloader.current = nullptr;
+    }
+}
+
+/// @note(ame): the preload job's JSON reads, false instead of throwing on anything malformed
+bool game_world_json_vec3(const nlohmann::json& object, const char *key, glm::vec3 *out)
+{
+    if (!object.is_object() || !object.contains(key)) {
+        return false;
+    }
+    const nlohmann::json& v = object[key];
+    if (!v.is_array() || v.size() < 3 || !v[0].is_number() || !v[1].is_number() || !v[2].is_number()) {
+        return false;
+    }
+    *out = glm::vec3(v[0].template get<f32>(), v[1].template get<f32>(), v[2].template get<f32>());
+    return true;
+}
+
+/// @note(ame): the level's navmesh with the props' obstacles carved, added in the order game_world_load_root adds them
+void game_world_preload_navmesh(game_world_preload *preload, const gltf_model *level)
+{
+    nlohmann::json& root = preload->root;
+
+    glm::vec3 min(0.0f);
+    glm::vec3 max(0.0f);
+    game_world_json_vec3(root, "bbox_min", &min);
+    game_world_json_vec3(root, "bbox_max", &max);
+    game_world_navmesh_init(&preload->world_navmesh, min, max, level);
+
+    if (root.contains("bodies") && root["bodies"].is_array()) {
+        for (auto& body : root["bodies"]) {
+            if (!body.is_object() || !body.contains("navmesh_obstacle") || !body["navmesh_obstacle"].is_boolean() || !body["navmesh_obstacle"].template get<bool>()) {
+                continue;
+            }
+            glm::vec3 position, size;
+            if (game_world_json_vec3(body, "position", &position) && game_world_json_vec3(body, "size", &size)) {
+                navmesh_obstacle_add(&preload->world_navmesh, position - size, position + size);
+            }
+        }
+    }
+    navmesh_flush(&preload->world_navmesh);
+}
+
+/// @note(ame): runs on a worker, so nothing in here may throw_error. Any failure is left for the main thread to report.
+bool game_world_preload_run(game_world_preload *preload)
+{
+    fs_mapped_file file;
+    if (!fs_map(&file, preload->path)) {
+        return false;
+    }
+    preload->root = nlohmann::json::parse(file.data, file.data + file.size, nullptr, false);
+    fs_unmap(&file);
+    if (preload->root.is_discarded() || !preload->root.contains("level_model") || !preload->root["level_model"].is_string()) {
+        return false;
+    }
+    if (preload->cancelled) {
+        return true;
+    }
+
+    preload->level_path = preload->root["level_model"];
+    const gltf_model *level = nullptr;
+    if (preload->resident_level && preload->level_path == preload->resident_level->path) {
+        preload->resident = true;
+        level = &preload->resident_level->model;
+    } else {
+        preload->imported = true;
+        if (!gltf_model_try_import(&preload->model, &preload->state, preload->level_path, true, &preload->cancelled)) {
+            return preload->cancelled;
+        }
+        level = &preload->model;
+    }
+    if (preload->cancelled) {
+        return true;
+    }
+
+    game_world_preload_navmesh(preload, level);
+    return true;
+}
+
+void game_world_preload_start(game_world *world, const std::string& path)
+{
+    game_world_preload_cancel();
+
+    game_world_preload *preload = new game_world_preload;
+    preload->path = path;
+    preload->resident_level = world->level;
+    preloader.current = preload;
+    preloader.started++;
+
+    job_push([preload]() {
+        preload->failed = !game_world_preload_run(preload);
+    }, &preload->counter);
+
+    log("[world] Preloading %s", path.c_str());
+}
+
+void game_world_preload_free(game_world_preload *preload)
+{
+    if (preload->imported) {
+        gltf_model_discard(&preload->model, &preload->state);
+    }
+    navmesh_free(&preload->world_navmesh);
+    preloader.discarded++;
+    delete preload;
+}
+
+/// @note(ame): distance from a point to the trigger box, 0 inside
+f32 game_world_trigger_distance(physics_trigger *trigger, glm::vec3 point)
+{
+    glm::vec3 local = glm::inverse(trigger->rotation) * (point - trigger->position);
+    glm::vec3 outside = glm::max(glm::abs(local) - trigger->size, glm::vec3(0.0f));
+    return glm::length(outside);
+}
+
+void game_world_preload_update(game_world *world)
+{
+    static console_var *radius = cvar_get("preload_radius");
+
+    /// @note(ame): reap cancelled preloads whose job is done
+    for (u64 i = 0; i < preloader.cancelled.size();) {
+        if (preloader.cancelled[i]->counter.pending == 0) {
+            game_world_preload_free(preloader.cancelled[i]);
+            preloader.cancelled.erase(preloader.cancelled.begin() + i);
+        } else {
+            i++;
+        }
+    }
+
+    glm::vec3 player_position = physics_character_get_position(&world->player.character);
+
+    entity *closest = nullptr;
+    f32 closest_distance = FLT_MAX;
+    f32 current_distance = FLT_MAX;
+    for (auto *e : world->entities) {
+        /// @note(ame): a trigger back into this very world has nothing to preload
+        if (!e->has_trigger || e->t_type != TriggerType_Transition || e->trigger_transition.empty() || e->trigger_transition == world->serialization_path) {
+            continue;
+        }
+
+        f32 distance = game_world_trigger_distance(&e->trigger, player_position);
+        if (distance < closest_distance) {
+            closest = e;
+            closest_distance = distance;
+        }
+        if (preloader.current && preloader.current->path == e->trigger_transition) {
+            current_distance = std::min(current_distance, distance);
+        }
+    }
+
+    /// @note(ame): cancel a bit further out than we start, so standing on the edge doesn't restart the load every frame
+    if (preloader.current && current_distance > radius->as.f * 1.5f) {
+        game_world_preload_cancel();
+    }
+    if (closest && closest_distance <= radius->as.f && !preloader.current) {
+        game_world_preload_start(world, closest->trigger_transition);
+    }
+}
+
+void game_world_load_preloaded(game_world *world, const std::string& path)
+{
+    timer t;
+    timer_init(&t);
+
+    game_world_preload *preload = preloader.current;
+    if (!preload || preload->path != path) {
+        preloader.missed++;
+        game_world_load(world, path);
+        log("[world] No preload for %s, loaded in %.2f ms", path.c_str(), timer_elasped(&t));
+        return;
+    }
+
+    preloader.current = nullptr;
+    preloader.used++;
+
+    /// @note(ame): pressed Interact before the job was done, help it finish
+    bool in_flight = preload->counter.pending > 0;
+    job_wait(&preload->counter);
+
+    if (preload->failed) {
+        log("[world] Preload of %s failed, loading it from scratch", path.c_str());
+        game_world_preload_free(preload);
+        game_world_load(world, path);
+        return;
+    }
+
+    resource *level = nullptr;
+    if (preload->resident) {
+        level = resource_cache_request(preload->level_path, ResourceType_GLTF, true);
+        resource_cache_wait_all({ level });
+    } else {
+        level = resource_cache_get_imported(preload->level_path, &preload->model, &preload->state);
+    }
+    game_world_load_root(world, path, preload->root, level, &preload->world_navmesh);
+    delete preload;
+
+    log("[world] Swapped to preloaded %s in %.2f ms%s", path.c_str(), timer_elasped(&t), in_flight ? " (waited on the import)" : "");
+}
+
+void game_world_preload_release(resource *level)
+{
+    if (preloader.current && preloader.current->resident_level == level) {
+        job_wait(&preloader.current->counter);
+        preloader.current->resident_level = nullptr;
+    }
+    for (auto *preload : preloader.cancelled) {
+        if (preload->resident_level == level) {
+            job_wait(&preload->counter);
+            preload->resident_level = nullptr;
+        }
+    }
+}
+
+void game_world_preload_init()
+{
+    cvar_register_float("preload_radius", 6.0f);
+}
+
+void game_world_preload_exit()
+{
+    game_world_preload_cancel();
+    for (auto *preload : preloader.cancelled) {
+        job_wait(&preload->counter);
+        game_world_preload_free(preload);
+    }
+    preloader.cancelled.clear();
+
+    log("[world] Preloads: %u started, %u used, %u missed, %u discarded", preloader.started, preloader.used, preloader.missed, preloader.discarded);
+}